@@ -0,0 +1,519 @@
+/*
+ * bench_replay - reissues the allocator calls of a recorded trace
+ *
+ * the calls of one process of a PROFILER_TRACE trace are made again, as
+ * fast as they go, by as many threads as the process had. each replay
+ * thread makes the calls of its recorded thread in their recorded order;
+ * between threads only what the program itself ordered is kept:
+ *
+ *   - a block is freed or reallocated once the call that made it is done,
+ *     whichever thread that was
+ *   - a thread whose first call came after another's last waits for that
+ *     one to finish, so threads that took turns do not overlap
+ *
+ * recorded threads that took turns share a replay thread; past max
+ * threads the ones that ran at once share too. blocks are named by a
+ * dense id rather than their recorded address: every allocation makes a
+ * new id, a free or realloc() consumes one, and the replayed pointers live
+ * in a table indexed by id. every page of a new block is written once so
+ * the resident size is the program's. operator new and new[] are replayed
+ * with malloc(); frees of blocks allocated before the trace started are
+ * skipped.
+ *
+ * prints one line and appends one JSON object to the results file:
+ *
+ *   {"mode":"preload","trace":"bench_replay.trace","pid":4242,"threads":4,
+ *    "ops":1200000,"seconds":0.412,"ops_per_sec":2912621.4,
+ *    "peak_rss_kb":81234,"waits":1520,"overhead":0.31,"rss_overhead_kb":6120}
+ *
+ * peak_rss_kb is the high-water mark while replaying, over the resident
+ * size when it began, so the ops read from the trace are not counted.
+ * overhead is the time over that of the "baseline" run of the same trace
+ * in the file (0 for the baseline itself), rss_overhead_kb the same for
+ * the peak. `make bench-replay` runs it without the profiler, under each
+ * profiler mode and linked in.
+ *
+ * usage: bench_replay <mode> <results.jsonl> <trace> [pid] [max_threads]
+ */
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../tools/trace/trace.h"
+
+#define DEFAULT_MAX_THREADS 256
+#define PAGE_SIZE 4096
+
+// where a block id is: not made yet, made, freed or reallocated
+enum { BLOCK_PENDING, BLOCK_READY, BLOCK_CONSUMED };
+
+// an op is the first or the last of its recorded thread
+#define OP_FIRST 1
+#define OP_LAST 2
+
+typedef struct {
+    uint8_t op;                 // trace_op_t
+    uint8_t flags;              // OP_FIRST, OP_LAST
+    uint32_t thread;            // recorded thread, by first appearance
+    uint32_t id;                // block made, 0 for a free
+    uint32_t old_id;            // block consumed, 0 for none
+    uint64_t size;
+    uint64_t alignment;
+    uint64_t time;
+    uint64_t addr;              // recorded, until ids are given
+    uint64_t old_addr;
+    size_t seq;                 // file order, to keep a thread's order on equal times
+} replay_op_t;
+
+typedef struct {
+    uint32_t tid;
+    size_t first, last;         // index of its first and last op, by time
+    uint32_t slot;              // replay thread
+    int done;                   // its last op is made
+} recorded_t;
+
+typedef struct {
+    replay_op_t **ops;          // in time order
+    size_t count;
+    size_t waits;
+    pthread_barrier_t *start;
+} slot_t;
+
+// recorded address (or tid) -> id
+typedef struct {
+    uint64_t *keys;             // 0 for a free slot
+    uint32_t *ids;              // 0 once taken
+    size_t capacity, used;
+} id_map_t;
+
+typedef struct {
+    uint32_t pid;
+    replay_op_t *ops;
+    size_t count, capacity;
+} collect_t;
+
+static void **g_blocks;
+static uint8_t *g_states;
+static recorded_t *g_recorded;
+static size_t g_recorded_count;
+
+static void *xrealloc(void *p, size_t size) {
+    p = realloc(p, size);
+    if (!p) {
+        fprintf(stderr, "Error: out of memory\n");
+        exit(1);
+    }
+    return p;
+}
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static size_t map_slot(const id_map_t *m, uint64_t key) {
+    size_t i = (size_t)((key * 0x9e3779b97f4a7c15ull) >> 20) & (m->capacity - 1);
+    while (m->keys[i] && m->keys[i] != key) i = (i + 1) & (m->capacity - 1);
+    return i;
+}
+
+static void map_put(id_map_t *m, uint64_t key, uint32_t id) {
+    if ((m->used + 1) * 2 > m->capacity) {
+        // taken slots are dropped on the way
+        id_map_t bigger = { .capacity = m->capacity ? m->capacity * 2 : 1024 };
+        bigger.keys = xrealloc(NULL, bigger.capacity * sizeof(uint64_t));
+        bigger.ids = xrealloc(NULL, bigger.capacity * sizeof(uint32_t));
+        memset(bigger.keys, 0, bigger.capacity * sizeof(uint64_t));
+        for (size_t i = 0; i < m->capacity; i++) {
+            if (!m->keys[i] || !m->ids[i]) continue;
+            size_t j = map_slot(&bigger, m->keys[i]);
+            bigger.keys[j] = m->keys[i];
+            bigger.ids[j] = m->ids[i];
+            bigger.used++;
+        }
+        free(m->keys);
+        free(m->ids);
+        *m = bigger;
+    }
+    size_t i = map_slot(m, key);
+    if (!m->keys[i]) m->used++;
+    m->keys[i] = key;
+    m->ids[i] = id;
+}
+
+static uint32_t map_get(const id_map_t *m, uint64_t key) {
+    if (!m->capacity || !key) return 0;
+    size_t i = map_slot(m, key);
+    return m->keys[i] ? m->ids[i] : 0;
+}
+
+// the id at key, which is no longer there; the slot stays for the probes
+static uint32_t map_take(id_map_t *m, uint64_t key) {
+    if (!m->capacity || !key) return 0;
+    size_t i = map_slot(m, key);
+    if (!m->keys[i]) return 0;
+    uint32_t id = m->ids[i];
+    m->ids[i] = 0;
+    return id;
+}
+
+static int collect_op(const trace_event_t *e, void *arg) {
+    collect_t *c = arg;
+    if (e->pid != c->pid) return 0;
+    if (c->count == c->capacity) {
+        c->capacity = c->capacity ? c->capacity * 2 : 4096;
+        c->ops = xrealloc(c->ops, c->capacity * sizeof(replay_op_t));
+    }
+    c->ops[c->count] = (replay_op_t){
+        .op = (uint8_t)e->op, .thread = e->tid, .size = e->size, .alignment = e->alignment,
+        .time = e->time, .addr = e->addr, .old_addr = e->old_addr, .seq = c->count,
+    };
+    c->count++;
+    return 0;
+}
+
+// the pid with the most events
+static int count_pid(const trace_event_t *e, void *arg) {
+    id_map_t *counts = arg;
+    uint64_t key = (uint64_t)e->pid + 1;
+    map_put(counts, key, map_get(counts, key) + 1);
+    return 0;
+}
+
+static uint32_t busiest_pid(const trace_file_t *t) {
+    id_map_t counts = { 0 };
+    trace_read(t, count_pid, &counts);
+    uint32_t pid = 0, most = 0;
+    for (size_t i = 0; i < counts.capacity; i++) {
+        if (counts.keys[i] && counts.ids[i] > most) {
+            most = counts.ids[i];
+            pid = (uint32_t)(counts.keys[i] - 1);
+        }
+    }
+    free(counts.keys);
+    free(counts.ids);
+    return pid;
+}
+
+static int compare_time(const void *a, const void *b) {
+    const replay_op_t *x = a, *y = b;
+    if (x->time != y->time) return x->time < y->time ? -1 : 1;
+    return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+/*
+ * give the ops, in time order, their block ids and recorded threads
+ * returns the ops kept; frees of unknown blocks are dropped, *blocks is
+ * one past the last id
+ */
+static size_t assign_ids(replay_op_t *ops, size_t count, uint32_t *blocks) {
+    id_map_t addrs = { 0 }, tids = { 0 };
+    uint32_t next_id = 1;
+    size_t kept = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        replay_op_t op = ops[i];
+        if (op.op == TRACE_FREE) {
+            op.old_id = map_take(&addrs, op.addr);
+            if (!op.old_id) continue;
+        } else {
+            if (op.op == TRACE_REALLOC) op.old_id = map_take(&addrs, op.old_addr);
+            op.id = next_id++;
+            // a block at an address still taken replaces it; the old one is left
+            if (op.addr) map_put(&addrs, op.addr, op.id);
+        }
+
+        uint64_t key = (uint64_t)op.thread + 1;
+        uint32_t thread = map_get(&tids, key);
+        if (!thread) {
+            g_recorded = xrealloc(g_recorded, (g_recorded_count + 1) * sizeof(recorded_t));
+            g_recorded[g_recorded_count] = (recorded_t){ .tid = op.thread, .first = kept };
+            thread = (uint32_t)++g_recorded_count;
+            map_put(&tids, key, thread);
+            op.flags |= OP_FIRST;
+        }
+        op.thread = thread - 1;
+        g_recorded[op.thread].last = kept;
+        ops[kept++] = op;
+    }
+    for (size_t i = 0; i < g_recorded_count; i++) {
+        ops[g_recorded[i].last].flags |= OP_LAST;
+    }
+
+    free(addrs.keys);
+    free(addrs.ids);
+    free(tids.keys);
+    free(tids.ids);
+    *blocks = next_id;
+    return kept;
+}
+
+/*
+ * a replay thread per set of recorded threads that took turns; past
+ * max_threads, the one free soonest takes the next
+ * returns the replay threads used
+ */
+static uint32_t assign_slots(uint32_t max_threads) {
+    size_t *free_at = xrealloc(NULL, max_threads * sizeof(size_t));
+    uint32_t slots = 0;
+    // recorded threads are numbered by their first op already
+    for (size_t i = 0; i < g_recorded_count; i++) {
+        recorded_t *r = &g_recorded[i];
+        uint32_t best = UINT32_MAX;
+        for (uint32_t s = 0; s < slots; s++) {
+            if (free_at[s] < r->first && (best == UINT32_MAX || free_at[s] > free_at[best])) best = s;
+        }
+        if (best == UINT32_MAX && slots < max_threads) {
+            best = slots++;
+            free_at[best] = 0;
+        }
+        if (best == UINT32_MAX) {
+            best = 0;
+            for (uint32_t s = 1; s < slots; s++) {
+                if (free_at[s] < free_at[best]) best = s;
+            }
+        }
+        r->slot = best;
+        if (r->last > free_at[best]) free_at[best] = r->last;
+    }
+    free(free_at);
+    return slots;
+}
+
+// the block to free or reallocate, once its thread has made it
+static void *consume(slot_t *s, uint32_t id) {
+    uint8_t state = __atomic_load_n(&g_states[id], __ATOMIC_ACQUIRE);
+    if (state == BLOCK_PENDING) {
+        s->waits++;
+        while ((state = __atomic_load_n(&g_states[id], __ATOMIC_ACQUIRE)) == BLOCK_PENDING) {
+            sched_yield();
+        }
+    }
+    uint8_t ready = BLOCK_READY;
+    if (!__atomic_compare_exchange_n(&g_states[id], &ready, BLOCK_CONSUMED, 0,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+    return g_blocks[id];
+}
+
+// before the first op of a thread: the threads that ended before it began
+static void wait_for_earlier(const recorded_t *r) {
+    for (size_t i = 0; i < g_recorded_count; i++) {
+        const recorded_t *other = &g_recorded[i];
+        if (other->last >= r->first) continue;
+        while (!__atomic_load_n(&other->done, __ATOMIC_ACQUIRE)) sched_yield();
+    }
+}
+
+static void *make_block(const replay_op_t *op, void *old) {
+    void *p = NULL;
+    switch (op->op) {
+    case TRACE_CALLOC:
+        return calloc(1, op->size);
+    case TRACE_REALLOC:
+        p = realloc(old, op->size);
+        break;
+    default:
+        if (op->alignment) {
+            size_t alignment = op->alignment < sizeof(void*) ? sizeof(void*) : op->alignment;
+            if (posix_memalign(&p, alignment, op->size) != 0) p = NULL;
+        } else {
+            p = malloc(op->size);
+        }
+        break;
+    }
+    // calloc() blocks are left as the program would find them, zeroed
+    if (p) {
+        for (size_t off = 0; off < op->size; off += PAGE_SIZE) ((volatile char*)p)[off] = 1;
+    }
+    return p;
+}
+
+static void *slot_main(void *arg) {
+    slot_t *s = arg;
+    pthread_barrier_wait(s->start);
+    for (size_t i = 0; i < s->count; i++) {
+        const replay_op_t *op = s->ops[i];
+        if (op->flags & OP_FIRST) wait_for_earlier(&g_recorded[op->thread]);
+
+        void *old = op->old_id ? consume(s, op->old_id) : NULL;
+        if (op->op == TRACE_FREE) {
+            free(old);
+        } else {
+            g_blocks[op->id] = make_block(op, old);
+            __atomic_store_n(&g_states[op->id], BLOCK_READY, __ATOMIC_RELEASE);
+        }
+        if (op->flags & OP_LAST) __atomic_store_n(&g_recorded[op->thread].done, 1, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+// a field of /proc/self/status, in KiB; 0 if it cannot be read
+static long status_kb(const char *field) {
+    FILE *f = fopen("/proc/self/status", "r");
+    if (!f) return 0;
+    char line[256];
+    long kb = 0;
+    size_t len = strlen(field);
+    while (fgets(line, sizeof(line), f)) {
+        if (strncmp(line, field, len) == 0 && line[len] == ':') {
+            kb = atol(line + len + 1);
+            break;
+        }
+    }
+    fclose(f);
+    return kb;
+}
+
+// the peak resident size starts again from the current one
+static void reset_peak_rss(void) {
+    FILE *f = fopen("/proc/self/clear_refs", "w");
+    if (!f) return;
+    fputs("5", f);
+    fclose(f);
+}
+
+/*
+ * the seconds and peak of the last baseline run of trace and pid in the
+ * results; returns 0 if there is none
+ */
+static int find_baseline(const char *path, const char *trace, uint32_t pid, double *seconds, long *peak) {
+    FILE *f = fopen(path, "r");
+    if (!f) return 0;
+    char line[1024], key[512];
+    snprintf(key, sizeof(key), "\"mode\":\"baseline\",\"trace\":\"%s\",\"pid\":%u,", trace, pid);
+    int found = 0;
+    while (fgets(line, sizeof(line), f)) {
+        if (strncmp(line + 1, key, strlen(key)) != 0) continue;
+        const char *s = strstr(line, "\"seconds\":");
+        const char *p = strstr(line, "\"peak_rss_kb\":");
+        if (!s || !p) continue;
+        *seconds = atof(s + strlen("\"seconds\":"));
+        *peak = atol(p + strlen("\"peak_rss_kb\":"));
+        found = 1;
+    }
+    fclose(f);
+    return found;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 4) {
+        fprintf(stderr, "usage: bench_replay <mode> <results.jsonl> <trace> [pid] [max_threads]\n");
+        return 1;
+    }
+    const char *mode = argv[1];
+    const char *results_path = argv[2];
+    const char *trace = argv[3];
+    uint32_t pid = argc > 4 ? (uint32_t)strtoul(argv[4], NULL, 10) : 0;
+    long max_threads = argc > 5 ? atol(argv[5]) : DEFAULT_MAX_THREADS;
+    if (max_threads <= 0) max_threads = DEFAULT_MAX_THREADS;
+    if (strpbrk(trace, "\"\\")) {
+        fprintf(stderr, "Error: the trace path cannot go into the results as is: %s\n", trace);
+        return 1;
+    }
+
+    trace_file_t t;
+    if (!trace_open(&t, trace)) return 1;
+    if (!pid) pid = busiest_pid(&t);
+    collect_t c = { .pid = pid };
+    trace_read(&t, collect_op, &c);
+    trace_close(&t);
+    if (!c.count) {
+        fprintf(stderr, "Error: %s has no events of pid %u\n", trace, pid);
+        return 1;
+    }
+
+    qsort(c.ops, c.count, sizeof(replay_op_t), compare_time);
+    uint32_t blocks;
+    size_t count = assign_ids(c.ops, c.count, &blocks);
+    uint32_t threads = assign_slots((uint32_t)max_threads);
+
+    g_blocks = xrealloc(NULL, blocks * sizeof(void*));
+    g_states = xrealloc(NULL, blocks);
+    memset(g_states, BLOCK_PENDING, blocks);
+
+    slot_t *slots = xrealloc(NULL, threads * sizeof(slot_t));
+    replay_op_t **lists = xrealloc(NULL, count * sizeof(replay_op_t*));
+    pthread_t *ids = xrealloc(NULL, threads * sizeof(pthread_t));
+    pthread_barrier_t start;
+    pthread_barrier_init(&start, NULL, threads + 1);
+
+    memset(slots, 0, threads * sizeof(slot_t));
+    for (size_t i = 0; i < count; i++) {
+        slots[g_recorded[c.ops[i].thread].slot].count++;
+    }
+    size_t at = 0;
+    for (uint32_t s = 0; s < threads; s++) {
+        slots[s].ops = lists + at;
+        slots[s].start = &start;
+        at += slots[s].count;
+        slots[s].count = 0;
+    }
+    for (size_t i = 0; i < count; i++) {
+        slot_t *s = &slots[g_recorded[c.ops[i].thread].slot];
+        s->ops[s->count++] = &c.ops[i];
+    }
+    for (uint32_t s = 0; s < threads; s++) {
+        pthread_create(&ids[s], NULL, slot_main, &slots[s]);
+    }
+
+    reset_peak_rss();
+    long resident = status_kb("VmRSS");
+    pthread_barrier_wait(&start);
+    double begin = now_sec();
+    for (uint32_t s = 0; s < threads; s++) {
+        pthread_join(ids[s], NULL);
+    }
+    double seconds = now_sec() - begin;
+    long peak = status_kb("VmHWM") - resident;
+    pthread_barrier_destroy(&start);
+
+    // what the program never freed, and what it left behind at an address reused
+    for (uint32_t id = 1; id < blocks; id++) {
+        if (g_states[id] == BLOCK_READY) free(g_blocks[id]);
+    }
+    size_t waits = 0;
+    for (uint32_t s = 0; s < threads; s++) {
+        waits += slots[s].waits;
+    }
+
+    double ops_per_sec = seconds > 0 ? (double)count / seconds : 0;
+    double base_seconds = 0, overhead = 0;
+    long base_peak = 0, rss_overhead = 0;
+    if (strcmp(mode, "baseline") != 0 &&
+        find_baseline(results_path, trace, pid, &base_seconds, &base_peak) && base_seconds > 0) {
+        overhead = seconds / base_seconds - 1;
+        rss_overhead = peak - base_peak;
+    }
+
+    FILE *results = fopen(results_path, "a");
+    if (!results) {
+        perror(results_path);
+        return 1;
+    }
+    printf("%-10s %8s %7s %10s %10s %14s %12s %10s %12s\n", "mode", "pid", "threads", "ops",
+           "seconds", "ops/sec", "peak RSS KB", "overhead", "+RSS KB");
+    printf("%-10s %8u %7u %10zu %10.3f %14.0f %12ld %9.1f%% %12ld\n\n", mode, pid, threads, count,
+           seconds, ops_per_sec, peak, overhead * 100, rss_overhead);
+    fprintf(results, "{\"mode\":\"%s\",\"trace\":\"%s\",\"pid\":%u,\"threads\":%u,\"ops\":%zu,"
+            "\"seconds\":%.6f,\"ops_per_sec\":%.1f,\"peak_rss_kb\":%ld,\"waits\":%zu,"
+            "\"overhead\":%.4f,\"rss_overhead_kb\":%ld}\n",
+            mode, trace, pid, threads, count, seconds, ops_per_sec, peak, waits, overhead, rss_overhead);
+    fclose(results);
+
+    free(ids);
+    free(lists);
+    free(slots);
+    free(g_states);
+    free(g_blocks);
+    free(g_recorded);
+    free(c.ops);
+    return 0;
+}
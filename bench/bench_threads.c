@@ -0,0 +1,366 @@
+/*
+ * bench_threads - allocation throughput and latency as threads are added
+ *
+ * runs each workload with 1, 2, 4, ... up to max threads:
+ *
+ *   producer_consumer  blocks allocated by one thread, freed by the next
+ *   request            bursts of mixed sizes, all freed when the request ends
+ *   cache              a large live set, entries replaced at random
+ *   strings            strings built by appending, grown with realloc()
+ *
+ * every allocator call is timed, less the cost of reading the clock. each
+ * (workload, threads) case prints one line and appends one JSON object to
+ * the results file:
+ *
+ *   {"mode":"preload","profile":"request","threads":4,"ops":400000,
+ *    "ops_per_sec":1523809.5,"speedup":1.9,"p50_ns":410.0,"p99_ns":3100.0,
+ *    "p999_ns":18000.0}
+ *
+ * ops_per_sec is over all threads, from start to the last one finishing;
+ * speedup is that over the 1-thread figure of the same workload. a lock
+ * every call goes through shows as a speedup that stays flat while p99
+ * climbs. `make bench-threads` runs it without the profiler, preloaded,
+ * and linked in with --wrap.
+ *
+ * usage: bench_threads <mode> <results.jsonl> [max_threads] [ops_per_thread]
+ */
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define DEFAULT_MAX_THREADS 8
+#define DEFAULT_OPS 50000
+
+// blocks in flight from one thread to the next, a power of two
+#define QUEUE_SIZE 1024
+
+// live entries per thread in the cache workload
+#define CACHE_ENTRIES 4096
+
+// blocks per request
+#define REQUEST_MIN 8
+#define REQUEST_MAX 64
+
+// a built string ends up between 1 and 32 KiB
+#define STRING_MAX 32768
+
+typedef enum { PROFILE_PRODUCER_CONSUMER, PROFILE_REQUEST, PROFILE_CACHE, PROFILE_STRINGS,
+               PROFILE_COUNT } profile_t;
+
+static const char *const PROFILE_NAMES[PROFILE_COUNT] = {
+    "producer_consumer", "request", "cache", "strings",
+};
+
+/*
+ * single producer, single consumer: thread i is the only one pushing to
+ * queue (i + 1) % threads, and the only one popping its own
+ */
+typedef struct {
+    _Atomic size_t head;        // next slot to pop
+    char pad[64 - sizeof(size_t)];
+    _Atomic size_t tail;        // next slot to push
+    void *slots[QUEUE_SIZE];
+} queue_t;
+
+typedef struct {
+    int index;
+    int threads;
+    profile_t profile;
+    size_t ops;                 // allocator calls to make
+    size_t done;                // allocator calls made
+    double *samples;            // one per call, up to ops
+    uint64_t rng;
+    queue_t *queues;
+    pthread_barrier_t *finished;    // the workers only, once they stop pushing
+} worker_t;
+
+static inline double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static inline uint64_t next_random(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+// a size from 16 B to 1 KiB, small ones more likely
+static size_t random_size(uint64_t *rng) {
+    uint64_t r = next_random(rng);
+    return (size_t)16 << (r % 7) >> ((r >> 8) % 3);
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return x < y ? -1 : x > y;
+}
+
+static double percentile(const double *sorted, size_t count, double q) {
+    size_t i = (size_t)(q * (double)(count - 1) + 0.5);
+    return sorted[i < count ? i : count - 1];
+}
+
+// median cost of reading the clock twice, taken off every sample
+static double g_timer = 0;
+
+static double timer_overhead(void) {
+    enum { ROUNDS = 10001 };
+    static double samples[ROUNDS];
+    for (int i = 0; i < ROUNDS; i++) {
+        double start = now_ns();
+        samples[i] = now_ns() - start;
+    }
+    qsort(samples, ROUNDS, sizeof(double), compare_double);
+    return samples[ROUNDS / 2];
+}
+
+/*
+ * the allocator calls, timed; a worker stops recording once it has made
+ * w->ops of them, the workloads check done_all() to stop
+ */
+static inline void record(worker_t *w, double start) {
+    if (w->done < w->ops) {
+        double sample = now_ns() - start;
+        w->samples[w->done] = sample > g_timer ? sample - g_timer : 0;
+    }
+    w->done++;
+}
+
+static inline int done_all(const worker_t *w) {
+    return w->done >= w->ops;
+}
+
+static void *timed_malloc(worker_t *w, size_t size) {
+    double start = now_ns();
+    char *p = malloc(size);
+    record(w, start);
+    *(volatile char*)p = 1;
+    return p;
+}
+
+static void timed_free(worker_t *w, void *p) {
+    double start = now_ns();
+    free(p);
+    record(w, start);
+}
+
+static void *timed_realloc(worker_t *w, void *p, size_t size) {
+    double start = now_ns();
+    char *q = realloc(p, size);
+    record(w, start);
+    return q;
+}
+
+static int queue_push(queue_t *q, void *p) {
+    size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    if (tail - atomic_load_explicit(&q->head, memory_order_acquire) == QUEUE_SIZE) return 0;
+    q->slots[tail & (QUEUE_SIZE - 1)] = p;
+    atomic_store_explicit(&q->tail, tail + 1, memory_order_release);
+    return 1;
+}
+
+static void *queue_pop(queue_t *q) {
+    size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    if (head == atomic_load_explicit(&q->tail, memory_order_acquire)) return NULL;
+    void *p = q->slots[head & (QUEUE_SIZE - 1)];
+    atomic_store_explicit(&q->head, head + 1, memory_order_release);
+    return p;
+}
+
+/*
+ * allocate for the next thread and free what the previous one sent; a
+ * block that finds the queue full is freed where it was allocated
+ */
+static void run_producer_consumer(worker_t *w) {
+    queue_t *own = &w->queues[w->index];
+    queue_t *next = &w->queues[(w->index + 1) % w->threads];
+
+    while (!done_all(w)) {
+        void *p = queue_pop(own);
+        if (p) timed_free(w, p);
+
+        p = timed_malloc(w, random_size(&w->rng));
+        if (!queue_push(next, p)) timed_free(w, p);
+    }
+
+    // nothing is pushed once everyone is past this
+    pthread_barrier_wait(w->finished);
+    for (void *p; (p = queue_pop(own)); ) free(p);
+}
+
+static void run_request(worker_t *w) {
+    void *blocks[REQUEST_MAX];
+    while (!done_all(w)) {
+        int count = REQUEST_MIN + (int)(next_random(&w->rng) % (REQUEST_MAX - REQUEST_MIN + 1));
+        for (int i = 0; i < count; i++) {
+            blocks[i] = timed_malloc(w, random_size(&w->rng));
+        }
+        for (int i = 0; i < count; i++) {
+            timed_free(w, blocks[i]);
+        }
+    }
+}
+
+static void run_cache(worker_t *w) {
+    void **entries = malloc(CACHE_ENTRIES * sizeof(void*));
+    for (int i = 0; i < CACHE_ENTRIES; i++) {
+        entries[i] = malloc(random_size(&w->rng));
+    }
+
+    while (!done_all(w)) {
+        size_t i = next_random(&w->rng) % CACHE_ENTRIES;
+        timed_free(w, entries[i]);
+        entries[i] = timed_malloc(w, random_size(&w->rng));
+    }
+
+    for (int i = 0; i < CACHE_ENTRIES; i++) {
+        free(entries[i]);
+    }
+    free(entries);
+}
+
+// appends of 8 to 71 bytes, the buffer grown by half when it is full
+static void run_strings(worker_t *w) {
+    while (!done_all(w)) {
+        size_t target = 1024 + next_random(&w->rng) % (STRING_MAX - 1024);
+        size_t capacity = 16, length = 0;
+        char *s = timed_malloc(w, capacity);
+
+        while (length < target) {
+            size_t chunk = 8 + next_random(&w->rng) % 64;
+            if (length + chunk + 1 > capacity) {
+                capacity += capacity / 2 > chunk ? capacity / 2 : chunk + 1;
+                s = timed_realloc(w, s, capacity);
+            }
+            memset(s + length, 'x', chunk);
+            length += chunk;
+            s[length] = '\0';
+        }
+        timed_free(w, s);
+    }
+}
+
+typedef struct {
+    worker_t *worker;
+    pthread_barrier_t *start;       // the workers and the main thread
+} start_t;
+
+static void *worker_main(void *arg) {
+    start_t *s = arg;
+    worker_t *w = s->worker;
+    pthread_barrier_wait(s->start);
+    switch (w->profile) {
+    case PROFILE_PRODUCER_CONSUMER: run_producer_consumer(w); break;
+    case PROFILE_REQUEST:           run_request(w); break;
+    case PROFILE_CACHE:             run_cache(w); break;
+    case PROFILE_STRINGS:           run_strings(w); break;
+    default: break;
+    }
+    return NULL;
+}
+
+/*
+ * one case: threads workers, started together
+ * returns the aggregate ops/sec, with the calls made in *total and the
+ * percentiles in p
+ */
+static double run_case(profile_t profile, int threads, size_t ops, double *samples,
+                       queue_t *queues, size_t *total, double p[3]) {
+    worker_t workers[threads];
+    start_t starts[threads];
+    pthread_t ids[threads];
+    pthread_barrier_t start_barrier, finished;
+
+    pthread_barrier_init(&start_barrier, NULL, (unsigned)threads + 1);
+    pthread_barrier_init(&finished, NULL, (unsigned)threads);
+    memset(queues, 0, (size_t)threads * sizeof(queue_t));
+
+    for (int i = 0; i < threads; i++) {
+        workers[i] = (worker_t){
+            .index = i, .threads = threads, .profile = profile, .ops = ops,
+            .samples = samples + (size_t)i * ops, .rng = 0x9e3779b97f4a7c15ull * (uint64_t)(i + 1),
+            .queues = queues, .finished = &finished,
+        };
+        starts[i] = (start_t){ &workers[i], &start_barrier };
+        pthread_create(&ids[i], NULL, worker_main, &starts[i]);
+    }
+
+    pthread_barrier_wait(&start_barrier);
+    double start = now_ns();
+    for (int i = 0; i < threads; i++) {
+        pthread_join(ids[i], NULL);
+    }
+    double elapsed = now_ns() - start;
+    pthread_barrier_destroy(&start_barrier);
+    pthread_barrier_destroy(&finished);
+
+    *total = 0;
+    for (int i = 0; i < threads; i++) {
+        *total += workers[i].done;
+    }
+
+    size_t count = (size_t)threads * ops;
+    qsort(samples, count, sizeof(double), compare_double);
+    p[0] = percentile(samples, count, 0.50);
+    p[1] = percentile(samples, count, 0.99);
+    p[2] = percentile(samples, count, 0.999);
+    return elapsed > 0 ? (double)*total * 1e9 / elapsed : 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        fprintf(stderr, "usage: bench_threads <mode> <results.jsonl> [max_threads] [ops_per_thread]\n");
+        return 1;
+    }
+    const char *mode = argv[1];
+    int max_threads = argc > 3 ? atoi(argv[3]) : DEFAULT_MAX_THREADS;
+    long ops = argc > 4 ? atol(argv[4]) : DEFAULT_OPS;
+    if (max_threads <= 0) max_threads = DEFAULT_MAX_THREADS;
+    if (ops <= 0) ops = DEFAULT_OPS;
+
+    FILE *results = fopen(argv[2], "a");
+    double *samples = malloc((size_t)max_threads * (size_t)ops * sizeof(double));
+    queue_t *queues = malloc((size_t)max_threads * sizeof(queue_t));
+    if (!results || !samples || !queues) {
+        perror(argv[2]);
+        return 1;
+    }
+
+    g_timer = timer_overhead();
+    printf("%-10s %-18s %7s %14s %8s %10s %10s %10s\n",
+           "mode", "profile", "threads", "ops/sec", "speedup", "p50 ns", "p99 ns", "p99.9 ns");
+    for (int profile = 0; profile < PROFILE_COUNT; profile++) {
+        double single = 0;
+        for (int threads = 1; threads <= max_threads; threads *= 2) {
+            size_t total;
+            double p[3];
+            double ops_per_sec = run_case((profile_t)profile, threads, (size_t)ops, samples, queues,
+                                          &total, p);
+            if (threads == 1) single = ops_per_sec;
+            double speedup = single > 0 ? ops_per_sec / single : 0;
+
+            printf("%-10s %-18s %7d %14.0f %8.2f %10.1f %10.1f %10.1f\n",
+                   mode, PROFILE_NAMES[profile], threads, ops_per_sec, speedup, p[0], p[1], p[2]);
+            fprintf(results, "{\"mode\":\"%s\",\"profile\":\"%s\",\"threads\":%d,\"ops\":%zu,"
+                    "\"ops_per_sec\":%.1f,\"speedup\":%.2f,\"p50_ns\":%.1f,\"p99_ns\":%.1f,"
+                    "\"p999_ns\":%.1f}\n",
+                    mode, PROFILE_NAMES[profile], threads, total, ops_per_sec, speedup, p[0], p[1], p[2]);
+            fflush(results);
+        }
+    }
+    printf("\n");
+
+    free(queues);
+    free(samples);
+    fclose(results);
+    return 0;
+}
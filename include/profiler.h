@@ -0,0 +1,43 @@
+/*
+ * memory profiler - runtime control API
+ *
+ * optional: programs never need to call these, the profiler works from
+ * LD_PRELOAD (or the link-time build) alone. they matter with
+ * PROFILER_DORMANT=1, where tracking starts switched off.
+ *
+ * a program that must also run without the profiler loaded should look
+ * the functions up with dlsym(RTLD_DEFAULT, "profiler_activate") instead
+ * of linking against them.
+ *
+ * all three are async-signal-safe.
+ */
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * start tracking. blocks allocated before this call are never reported,
+ * and freeing them is not an error.
+ * returns 0 on success or if already active, -1 if another thread is
+ * switching the state at the same moment.
+ */
+int profiler_activate(void);
+
+/*
+ * stop tracking and forward every call straight to libc.
+ * same return values as profiler_activate().
+ */
+int profiler_deactivate(void);
+
+// 1 while tracking, 0 while dormant
+int profiler_is_active(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // PROFILER_H
@@ -4,26 +4,81 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <time.h>
+#include <execinfo.h>
+#include "profiler_trace.h"
+
+/*
+ * uthash grows its bucket tables with malloc(), which is us. send it
+ * straight to libc: our own tables are not the program's allocations,
+ * and queueing them as re-entrant calls (deferred.c) would report them.
+ */
+#define uthash_malloc(sz) real_malloc_ptr(sz)
+#define uthash_free(ptr, sz) real_free_ptr(ptr)
 #include "uthash.h"  
 
+// maximum stack frames to capture
+#define MAX_STACK_FRAMES 16
+
+/*
+ * name of an interposed function
+ * 
+ * the preload build (libprofiler.so) defines malloc() itself. the link-time
+ * build (libprofiler.a, -DPROFILER_LINK_WRAP) defines __wrap_malloc() for use
+ * with -Wl,--wrap=malloc, and reaches libc through __real_malloc(), which
+ * the linker binds directly: no dlsym() and no PLT hop for static binaries.
+ */
+#ifdef PROFILER_LINK_WRAP
+#define PROFILER_INTERPOSE(name) __wrap_##name
+#else
+#define PROFILER_INTERPOSE(name) name
+#endif
+
+/*
+ * which API family produced an allocation
+ * 
+ * recorded so deallocation through the wrong family (malloc/delete,
+ * new/free, new[]/delete) can be reported.
+ */
+typedef enum alloc_kind {
+    ALLOC_MALLOC = 0,       // malloc, calloc, realloc, memalign family
+    ALLOC_NEW,              // operator new
+    ALLOC_NEW_ARRAY         // operator new[]
+} alloc_kind_t;
+
+// passed as the expected size when the caller does not know it
+#define SIZE_UNCHECKED ((size_t)-1)
+
+// passed as the expected alignment when the block must have none
+#define ALIGNMENT_NONE ((size_t)-2)
+
 /* 
  * allocation metadata stored for each malloc() call
  * 
  * we store the information needed to detect leaks:
  * - ptr: the address returned by malloc (used as hash key)
  * - size: number of bytes allocated
+ * - alignment: requested alignment (0 for plain malloc/calloc/realloc)
+ * - kind: allocating API family (malloc, new, new[])
  * - timestamp: when allocation occurred
  * - stack_trace: array of return addresses (from backtrace)
  * - stack_depth: number of frames captured
+ * - generation: active period it was made in, see activation.c
+ * - freed: a tombstone, freed this period, see hash_table.c
+ * - modules_epoch: module table version its frames belong to, see modules.c
  * - hh: uthash handle (required by uthash library)
  */
 typedef struct allocation_info {
     void *ptr;              // the allocated address (hash key)
     size_t size;            // bytes allocated
+    size_t alignment;       // memalign family alignment, 0 if none
     time_t timestamp;       // when it was allocated
     void **stack_trace;     // array of return addresses
     int stack_depth;        // number of frames in stack_trace
     int is_suspicious;      // 1 if likely libc false positive, 0 if real leak
+    alloc_kind_t kind;      // API family that allocated the block
+    unsigned int generation; // profiler_generation when allocated
+    int freed;              // tombstone, the block was freed
+    unsigned int modules_epoch; // modules_epoch when allocated
     UT_hash_handle hh;      // uthash handle 
 } allocation_info_t;
 
@@ -41,22 +96,432 @@ typedef struct profiler_state {
 
 // Function declarations for hash table (allocation tracking)
 void hash_table_init(void);
-void hash_table_add(void *ptr, size_t size, void **trace, int depth, int is_suspicious);
+void hash_table_add(void *ptr, size_t size, size_t alignment, alloc_kind_t kind,
+                    void **trace, int depth, int is_suspicious);
 void hash_table_remove(void *ptr);
 int hash_table_find(void *ptr);  
-void hash_table_report_leaks(void);
+int hash_table_take(void *ptr, size_t *size, size_t *alignment, alloc_kind_t *kind);
+void hash_table_report_leaks(size_t mmap_leaks, size_t mmap_bytes);
 void hash_table_cleanup(void);
+void hash_table_fork_prepare(void);
+void hash_table_fork_release(void);
+void hash_table_for_each_live(void (*fn)(const allocation_info_t *info, void *arg), void *arg);
 
 // Real libc function pointers (set by malloc_intercept.c)
 extern void* (*real_malloc_ptr)(size_t);
 extern void (*real_free_ptr)(void*);
 
+/*
+ * thread-local storage for the profiler's per-thread flags
+ * 
+ * initial-exec keeps every access a plain %fs-relative load: the default
+ * model for a shared library goes through __tls_get_addr, which may call
+ * malloc and re-enter us.
+ */
+#define PROFILER_TLS __thread __attribute__((tls_model("initial-exec")))
+
+// states of profiler_init_state, see profiler_init()
+enum {
+    PROFILER_UNINITIALIZED = 0,
+    PROFILER_INITIALIZING,
+    PROFILER_READY
+};
+
+// Interception state shared by the interposers (malloc_intercept.c)
+extern PROFILER_TLS int in_profiler;  // bootstrap/recursion guard
+
+/*
+ * in_profiler while the profiler runs foreign code that allocates for
+ * itself (the unwinder's one-time setup): nested calls are that code's
+ * own and go untracked, instead of being queued like a signal handler's
+ */
+#define PROFILER_OWN_CALLS 2
+extern int profiler_init_state;
+extern int profiler_shutting_down;    // skip validation during cleanup
+int profiler_init(void);
+int is_likely_libc_allocation(void **stack_trace, int depth);
+
+/*
+ * make sure the real functions are resolved before using them
+ * 
+ * one predictable branch once init is done. returns 0 only on the thread
+ * running profiler_init(), whose nested calls must use the bootstrap arena.
+ */
+static inline __attribute__((always_inline)) int profiler_enter(void) {
+    if (__builtin_expect(__atomic_load_n(&profiler_init_state, __ATOMIC_ACQUIRE) == PROFILER_READY, 1)) {
+        return 1;
+    }
+    return profiler_init();
+}
+
+/*
+ * Dormant mode and runtime activation (activation.c)
+ * 
+ * profiler_dormant is set only once init is complete, so interposers
+ * test it before anything else and forward straight to libc.
+ * profiler_generation is bumped on every activation; registry entries
+ * from older generations are retired.
+ */
+extern int profiler_dormant;
+extern unsigned int profiler_generation;
+void activation_init(void);
+void activation_start_watcher(void);
+int activation_predates(const void *ptr);
+int profiler_activate(void);
+int profiler_deactivate(void);
+int profiler_is_active(void);
+
+// periodic snapshots of the live allocations by site (sites.c)
+extern int sites_start_pending;
+void sites_init(void);
+void sites_start_deferred(void);
+void sites_stop(void);
+void sites_fork_child(void);
+
+/*
+ * allocation trace, PROFILER_TRACE=<path> (trace.c)
+ * the format is in profiler_trace.h
+ */
+extern int trace_enabled;
+void trace_init(void);
+void trace_alloc(trace_op_t op, void *ptr, void *old_ptr, size_t size, size_t alignment,
+                 void **trace, int depth);
+void trace_free(void *ptr);
+void trace_fork_child(void);
+void trace_finish(void);
+
+// the trace op of an allocation, for the calls that are not calloc or realloc
+static inline trace_op_t trace_op_of(alloc_kind_t kind, size_t alignment) {
+    if (kind == ALLOC_NEW) return TRACE_NEW;
+    if (kind == ALLOC_NEW_ARRAY) return TRACE_NEW_ARRAY;
+    return alignment ? TRACE_ALIGNED : TRACE_MALLOC;
+}
+
+// entry point for tools/profiler-attach, see attach.c
+int profiler_attach(void);
+
+// fork handlers and exec environment propagation (process.c)
+void process_init(void);
+
+/*
+ * Module table (modules.c)
+ * 
+ * every object ever loaded, kept across dlclose(). modules_epoch is the
+ * table version; stacks are resolved against the epoch they were
+ * captured in.
+ */
+extern unsigned int modules_epoch;
+void modules_init(void);
+void modules_fork_prepare(void);
+void modules_fork_release(int in_child);
+unsigned int modules_unloaded_owner(void **trace, int depth, unsigned int epoch);
+void modules_count_leak(unsigned int id, size_t size);
+void modules_report_unloaded(void);
+
+/*
+ * function names for the exit report (symbols.c, demangle.c)
+ * enabled by PROFILER_SYMBOLIZE=1; no malloc
+ */
+extern int symbolize_frames;
+const char *symbols_lookup(unsigned int id, const char *path, uintptr_t offset, uintptr_t *delta);
+int demangle_symbol(const char *mangled, char *out, size_t size);
+
+static inline unsigned int modules_current_epoch(void) {
+    return __atomic_load_n(&modules_epoch, __ATOMIC_ACQUIRE);
+}
+
+// Bootstrap arena for allocations made during init (bootstrap_arena.c)
+void *bootstrap_alloc(size_t size, size_t alignment);
+int bootstrap_owns(const void *ptr);
+size_t bootstrap_size(const void *ptr);
+
 // Configuration (set by malloc_intercept.c)
 extern int show_stack_traces;  // 1 = enabled, 0 = disabled
 
-// JSON output helpers
+// JSON output helpers, to stderr or PROFILER_OUTPUT (profiler.c)
+void output_init(void);
+void output_after_fork(void);
+int output_expand_path(const char *pattern, char *path, size_t len);
 void write_str(const char *str);
 void write_hex(unsigned long val);
 void write_dec(size_t val);
 
+/*
+ * line buffer for building one JSON event on the stack
+ *
+ * events are assembled here and emitted with a single write() instead of
+ * one syscall per field. if an event outgrows the buffer it is flushed
+ * early, so long lines still come out whole, just in more than one write.
+ */
+#define OUT_BUF_SIZE 2048
+
+// frames shown per event in the JSON output (top of the stack only)
+#define REPORT_FRAMES 7
+
+typedef struct out_buf {
+    char data[OUT_BUF_SIZE];
+    size_t len;
+} out_buf_t;
+
+void buf_str(out_buf_t *buf, const char *str);
+void buf_hex(out_buf_t *buf, unsigned long val);
+void buf_dec(out_buf_t *buf, size_t val);
+void buf_frames(out_buf_t *buf, void **trace, int depth, unsigned int epoch);
+void buf_flush(out_buf_t *buf);
+int modules_buf_frame(out_buf_t *buf, const void *addr, unsigned int epoch);
+
+/*
+ * memory accounting (profiler.c)
+ * 
+ * live and peak bytes per category, plus the combined peak. heap is what
+ * the malloc/new family handed out, mapped is anonymous mmap() memory
+ * minus pages given back with madvise(MADV_DONTNEED).
+ * lock-free (atomic counters), callable from any tracking path.
+ */
+typedef enum stat_category {
+    STAT_HEAP = 0,
+    STAT_MAPPED,
+    STAT_CATEGORIES
+} stat_category_t;
+
+void stats_account(stat_category_t category, long delta);
+size_t stats_live_bytes(stat_category_t category);
+size_t stats_peak_bytes(stat_category_t category);
+size_t stats_peak_total_bytes(void);
+void stats_reset(void);
+
+// Anonymous mapping registry (mmap_registry.c)
+void mmap_registry_add(void *addr, size_t len, void **trace, int depth, int is_suspicious);
+void mmap_registry_remove(void *addr, size_t len);
+int mmap_registry_move(void *old_addr, size_t old_len, void *new_addr, size_t new_len, int keep_old);
+void mmap_registry_dontneed(void *addr, size_t len);
+void mmap_registry_report_leaks(size_t *leaks, size_t *bytes);
+void mmap_registry_cleanup(void);
+void mmap_registry_fork_prepare(void);
+void mmap_registry_fork_release(void);
+
+// Corruption reporting (corruption.c)
+void corruption_init(void);
+void report_corruption_error(void *ptr, const char *error_type, void *caller);
+void corruption_report_summary(void);
+void corruption_flush_due(void);
+const char *corruption_mismatch_type(alloc_kind_t allocated, alloc_kind_t released);
+void corruption_fork_prepare(void);
+void corruption_fork_release(int in_child);
+
+/*
+ * Stack capture (stack_capture.c)
+ * 
+ * one of two variants, chosen once at load time by an IFUNC resolver:
+ * - full: the whole stack via backtrace()
+ * - caller only (PROFILER_STACK_TRACES=0): just frame 1, which is all
+ *   libc filtering and corruption dedup need; frame 0 is left NULL
+ * either way the variant's own frame is dropped, so frame 0 is the
+ * function capture_stack() was inlined into and frame 1 its caller.
+ *
+ * in the link-time build our code is part of the executable, where no
+ * tool can tell it from the program's, so every frame below the caller
+ * is dropped and frame 0 is the caller itself.
+ */
+int profiler_capture_stack(void **trace, void *caller) __attribute__((visibility("hidden")));
+#ifdef PROFILER_LINK_WRAP
+int profiler_drop_own_frames(void **trace, int depth, void *caller) __attribute__((visibility("hidden")));
+#endif
+
+/*
+ * capture the current stack into trace, returns the depth
+ * 
+ * in a static binary the unwinder relies on loader state (_dl_find_object)
+ * that libc sets up just before running constructors, and aborts when used
+ * earlier. the link-time build therefore records no frames until our
+ * constructor has run; everything allocated before that is libc startup.
+ */
+extern int profiler_stacks_ready;
+
+static inline __attribute__((always_inline)) int capture_stack_from(void **trace, void *caller) {
+#ifdef PROFILER_LINK_WRAP
+    if (__builtin_expect(!profiler_stacks_ready, 0)) return 0;
+    return profiler_drop_own_frames(trace, profiler_capture_stack(trace, caller), caller);
+#else
+    return profiler_capture_stack(trace, caller);
+#endif
+}
+
+static inline __attribute__((always_inline)) int capture_stack(void **trace) {
+    return capture_stack_from(trace, __builtin_return_address(0));
+}
+
+/*
+ * Deferred registry updates (deferred.c)
+ * 
+ * a call re-entering the profiler (from a signal handler, in_profiler
+ * already set on this thread) must not take a registry lock. it queues a
+ * deferred_op instead, and profiler_leave() applies the queue when the
+ * interrupted call is done.
+ */
+typedef enum deferred_type {
+    DEFER_ALLOC = 0,        // hash_table_add
+    DEFER_FREE,             // validate, untrack and release a block
+    DEFER_FORGET,           // hash_table_remove (realloc's old block)
+    DEFER_MAP,              // mmap_registry_add
+    DEFER_UNMAP,            // mmap_registry_remove
+    DEFER_MOVE,             // mmap_registry_move
+    DEFER_DONTNEED          // mmap_registry_dontneed
+} deferred_type_t;
+
+typedef struct deferred_op {
+    struct deferred_op *next;
+    int in_use;             // pool slot claimed
+    deferred_type_t type;
+    alloc_kind_t kind;
+    int keep_old;           // DEFER_MOVE: MREMAP_DONTUNMAP
+    void *ptr;
+    size_t size;
+    void *new_ptr;          // DEFER_MOVE destination
+    size_t new_size;
+    size_t alignment;
+    const char *size_error; // DEFER_FREE: report type for a size mismatch
+    void *caller;
+} deferred_op_t;
+
+extern PROFILER_TLS deferred_op_t *deferred_ops;
+int defer_op(const deferred_op_t *op);
+void deferred_drain(void);
+void deferred_fork_child(void);
+
+/*
+ * clear in_profiler on the way out of the profiler
+ * 
+ * one thread-local load when nothing was queued. the fence keeps the
+ * compiler from testing the queue before in_profiler is cleared: a
+ * signal in between would queue an operation nobody drains.
+ */
+static inline __attribute__((always_inline)) void profiler_leave(void) {
+    in_profiler = 0;
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    if (__builtin_expect(__atomic_load_n(&deferred_ops, __ATOMIC_RELAXED) != NULL, 0)) {
+        deferred_drain();
+    }
+}
+
+/*
+ * shared tracking path for every allocation entry point
+ * 
+ * always inlined into the interposer, so backtrace() frame 0 is the
+ * interposer itself and frame 1 is its caller - which is what
+ * is_likely_libc_allocation() inspects.
+ * 
+ * alignment is 0 for plain malloc-family allocations and the requested
+ * alignment for the memalign family and aligned operator new.
+ * op and old_ptr are only for the trace: calloc() and realloc() say
+ * what they are, see track_allocation() for the rest.
+ */
+static inline __attribute__((always_inline))
+void track_call(void *ptr, size_t size, size_t alignment, alloc_kind_t kind,
+                trace_op_t op, void *old_ptr) {
+    if (!ptr) return;
+    
+    // re-entered (signal handler): queue it, the registry lock may be ours
+    if (in_profiler) {
+        deferred_op_t op = { .type = DEFER_ALLOC, .kind = kind, .ptr = ptr, .size = size,
+                             .alignment = alignment, .caller = __builtin_return_address(0) };
+        defer_op(&op);
+        return;
+    }
+    in_profiler = 1;
+    
+    // capture stack trace - backtrace stores return addresses in the array
+    // eg: main -> helper -> helper2, both main and helper are in the array
+    void *trace[MAX_STACK_FRAMES];
+    int depth = capture_stack(trace);
+    
+    // check if this looks like libc infrastructure allocation
+    // no stack at all means libc startup, see capture_stack()
+    int is_suspicious = depth ? is_likely_libc_allocation(trace, depth) : 1;
+    
+    // track the allocation with stack trace and suspicion flag
+    hash_table_add(ptr, size, alignment, kind, trace, depth, is_suspicious);
+    if (__builtin_expect(trace_enabled, 0)) {
+        trace_alloc(op, ptr, old_ptr, size, alignment, trace, depth);
+    }
+    profiler_leave();
+    
+    // a forked child's reporter, see sites_fork_child()
+    if (__builtin_expect(sites_start_pending, 0)) {
+        sites_start_deferred();
+    }
+}
+
+static inline __attribute__((always_inline))
+void track_allocation(void *ptr, size_t size, size_t alignment, alloc_kind_t kind) {
+    track_call(ptr, size, alignment, kind, trace_op_of(kind, alignment), NULL);
+}
+
+/*
+ * removes the block from tracking with a single registry lookup and
+ * checks it against what the caller claims:
+ * - not tracked at all: double-free or invalid-free
+ * - allocated by another API family: alloc/dealloc mismatch
+ * - size or alignment differs from the record (sized deallocation only)
+ * 
+ * pass SIZE_UNCHECKED / 0 to skip the size / alignment check, and
+ * ALIGNMENT_NONE to require a block from the unaligned allocators.
+ * returns 1 if the block should be released, 0 if releasing it would
+ * crash or corrupt the heap. call with in_profiler set.
+ */
+static inline __attribute__((always_inline))
+int untrack_checked(void *ptr, alloc_kind_t kind, size_t size, size_t alignment,
+                    const char *size_error, void *caller) {
+    size_t recorded_size, recorded_alignment;
+    alloc_kind_t recorded_kind;
+    int taken = hash_table_take(ptr, &recorded_size, &recorded_alignment, &recorded_kind);
+    if (taken <= 0) {
+        // retired record, or allocated while we were dormant: release it untracked
+        if (taken < 0) {
+            return 1;
+        }
+        
+        // pointer not in table - either double-free or invalid-free
+        report_corruption_error(ptr, "Double-Free or Invalid-Free", caller);
+        return 0;
+    }
+    
+    // the block itself is valid, so it is still released after reporting
+    if (recorded_kind != kind) {
+        report_corruption_error(ptr, corruption_mismatch_type(recorded_kind, kind), caller);
+    } else if ((size != SIZE_UNCHECKED && size != recorded_size) ||
+               (alignment == ALIGNMENT_NONE && recorded_alignment != 0) ||
+               (alignment && alignment != ALIGNMENT_NONE && alignment != recorded_alignment)) {
+        report_corruption_error(ptr, size_error, caller);
+    }
+    return 1;
+}
+
+/*
+ * shared validation path for every deallocation entry point
+ * 
+ * returns 1 if the caller should release the block, 0 if it must not:
+ * because releasing it would crash, or because the free() was queued
+ * (signal handler) and the drain will release it once checked.
+ */
+static inline __attribute__((always_inline))
+int untrack_allocation(void *ptr, alloc_kind_t kind, size_t size, size_t alignment,
+                       const char *size_error) {
+    if (in_profiler) {
+        deferred_op_t op = { .type = DEFER_FREE, .kind = kind, .ptr = ptr, .size = size,
+                             .alignment = alignment, .size_error = size_error,
+                             .caller = __builtin_return_address(0) };
+        return !defer_op(&op);
+    }
+    in_profiler = 1;
+    
+    int release = untrack_checked(ptr, kind, size, alignment, size_error, __builtin_return_address(0));
+    if (release && __builtin_expect(trace_enabled, 0)) {
+        trace_free(ptr);
+    }
+    
+    profiler_leave();
+    return release;
+}
+
 #endif // PROFILER_INTERNAL_H
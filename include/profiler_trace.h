@@ -0,0 +1,109 @@
+/*
+ * allocation trace format, written with PROFILER_TRACE (src/trace.c)
+ * and read by tools/profiler-trace
+ *
+ * a trace file is the 8-byte magic followed by records. a record is one
+ * type byte and its fields; numbers are unsigned LEB128 varints, signed
+ * ones zigzag-encoded first.
+ *
+ *   'C' chunk    pid, tid, base time (ns), length, then length bytes of
+ *                events of one thread
+ *   'M' maps     pid, length, then length bytes of /proc/<pid>/maps text;
+ *                a process writes one or more at exit, in order
+ *
+ * a chunk is what one thread buffered between two flushes. chunks of the
+ * threads of a process, and of processes sharing a file, interleave in
+ * the file in the order they were flushed.
+ *
+ * an event is one op byte, with TRACE_FLAG_ALIGNED set when an alignment
+ * follows the size, then:
+ *
+ *   alloc ops    time delta, size, [alignment,] address delta, stack id
+ *   TRACE_REALLOC time delta, size, address delta, old address - address,
+ *                stack id
+ *   TRACE_FREE   time delta, address delta
+ *   TRACE_STACK  stack id, depth, frames (each a delta from the last)
+ *
+ * time deltas are from the previous event of the chunk, the first from
+ * the chunk's base time; address deltas (signed) from the previous
+ * address of the chunk, starting at 0. both restart with every chunk, so
+ * a chunk can be read on its own.
+ *
+ * a stack is defined once per process by a TRACE_STACK event, in the
+ * chunk of the thread that saw it first. other threads may use its id in
+ * chunks flushed before that one, so a reader resolves stacks after
+ * reading the whole file. stack id 0 means no stack.
+ *
+ * realloc(NULL, n) is a TRACE_REALLOC with old address 0. the old block
+ * of a successful realloc() gets no TRACE_FREE of its own.
+ */
+
+#ifndef PROFILER_TRACE_H
+#define PROFILER_TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TRACE_MAGIC "PRFTRC01"
+#define TRACE_MAGIC_SIZE 8
+
+#define TRACE_RECORD_CHUNK 'C'
+#define TRACE_RECORD_MAPS 'M'
+
+typedef enum trace_op {
+    TRACE_MALLOC = 1,
+    TRACE_CALLOC,
+    TRACE_REALLOC,
+    TRACE_FREE,
+    TRACE_ALIGNED,          // posix_memalign, aligned_alloc, memalign, valloc, pvalloc
+    TRACE_NEW,              // operator new
+    TRACE_NEW_ARRAY,        // operator new[]
+    TRACE_STACK,
+    TRACE_OPS
+} trace_op_t;
+
+#define TRACE_OP_MASK 0x0f
+#define TRACE_FLAG_ALIGNED 0x80
+
+// longest encoded varint
+#define TRACE_VARINT_MAX 10
+
+static inline size_t trace_put_varint(unsigned char *out, uint64_t value) {
+    size_t n = 0;
+    while (value >= 0x80) {
+        out[n++] = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    out[n++] = (unsigned char)value;
+    return n;
+}
+
+static inline uint64_t trace_zigzag(int64_t value) {
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static inline int64_t trace_unzigzag(uint64_t value) {
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+/*
+ * read a varint at *p, not past end
+ * returns 0 and leaves *p alone if it is cut short
+ */
+static inline int trace_get_varint(const unsigned char **p, const unsigned char *end,
+                                   uint64_t *value) {
+    uint64_t v = 0;
+    const unsigned char *q = *p;
+    for (int shift = 0; q < end && shift < 64; shift += 7) {
+        unsigned char b = *q++;
+        v |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) {
+            *p = q;
+            *value = v;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+#endif // PROFILER_TRACE_H
@@ -0,0 +1,85 @@
+#ifndef REAL_ALLOC_H
+#define REAL_ALLOC_H
+
+/*
+ * the real allocator behind the interposers
+ *
+ * shared by malloc_intercept.c and new_intercept.c, so operator new and
+ * delete reach libc the same way malloc and free do. malloc, free and
+ * memalign are declared for every build; on glibc the whole __libc_*
+ * family is, as it shares one switch. malloc_intercept.c binds the rest
+ * of the family, and owns the state declared below.
+ */
+
+#include <stddef.h>
+
+#ifdef PROFILER_LINK_WRAP
+/*
+ * link-time build: the linker resolves __real_X to libc's X, so these
+ * are plain direct calls and the code is the same for both builds.
+ */
+void* __real_malloc(size_t);
+void __real_free(void*);
+void* __real_memalign(size_t, size_t);
+
+#define real_malloc __real_malloc
+#define real_free __real_free
+#define real_memalign __real_memalign
+#elif defined(__GLIBC__) && !defined(PROFILER_NO_LIBC_BIND)
+/*
+ * preload build on glibc: call the allocator's __libc_* entry points
+ * directly instead of loading dlsym()ed pointers on every call. they are
+ * the same functions RTLD_NEXT finds unless another malloc (jemalloc,
+ * tcmalloc, ...) is loaded behind us; profiler_init() checks, and then
+ * switches to the dlsym()ed ones with a warning. the rest of the family
+ * has no __libc_* name and always uses dlsym().
+ */
+#define PROFILER_LIBC_BIND
+void* __libc_malloc(size_t);
+void __libc_free(void*);
+void* __libc_calloc(size_t, size_t);
+void* __libc_realloc(void*, size_t);
+void* __libc_memalign(size_t, size_t);
+void* __libc_valloc(size_t);
+void* __libc_pvalloc(size_t);
+
+extern int libc_bound __attribute__((visibility("hidden")));
+extern void* (*next_malloc)(size_t) __attribute__((visibility("hidden")));
+extern void (*next_free)(void*) __attribute__((visibility("hidden")));
+extern void* (*next_calloc)(size_t, size_t) __attribute__((visibility("hidden")));
+extern void* (*next_realloc)(void*, size_t) __attribute__((visibility("hidden")));
+extern void* (*next_memalign)(size_t, size_t) __attribute__((visibility("hidden")));
+extern void* (*next_valloc)(size_t) __attribute__((visibility("hidden")));
+extern void* (*next_pvalloc)(size_t) __attribute__((visibility("hidden")));
+
+static inline void* real_malloc(size_t size) {
+    return __builtin_expect(libc_bound, 1) ? __libc_malloc(size) : next_malloc(size);
+}
+static inline void real_free(void *ptr) {
+    if (__builtin_expect(libc_bound, 1)) __libc_free(ptr);
+    else next_free(ptr);
+}
+static inline void* real_calloc(size_t nmemb, size_t size) {
+    return __builtin_expect(libc_bound, 1) ? __libc_calloc(nmemb, size) : next_calloc(nmemb, size);
+}
+static inline void* real_realloc(void *ptr, size_t size) {
+    return __builtin_expect(libc_bound, 1) ? __libc_realloc(ptr, size) : next_realloc(ptr, size);
+}
+static inline void* real_memalign(size_t alignment, size_t size) {
+    return __builtin_expect(libc_bound, 1) ? __libc_memalign(alignment, size)
+                                           : next_memalign(alignment, size);
+}
+static inline void* real_valloc(size_t size) {
+    return __builtin_expect(libc_bound, 1) ? __libc_valloc(size) : next_valloc(size);
+}
+static inline void* real_pvalloc(size_t size) {
+    return __builtin_expect(libc_bound, 1) ? __libc_pvalloc(size) : next_pvalloc(size);
+}
+#else
+// dlsym()ed by profiler_init()
+extern void* (*real_malloc)(size_t) __attribute__((visibility("hidden")));
+extern void (*real_free)(void*) __attribute__((visibility("hidden")));
+extern void* (*real_memalign)(size_t, size_t) __attribute__((visibility("hidden")));
+#endif
+
+#endif // REAL_ALLOC_H
@@ -0,0 +1,333 @@
+/*
+ * dormant mode and runtime activation
+ *
+ * with PROFILER_DORMANT=1 the library can be preloaded into every process
+ * and cost next to nothing: each interposer tests profiler_dormant once
+ * and forwards straight to libc. tracking starts when asked to by
+ *   - a signal:        PROFILER_SIGNAL=SIGUSR2 (or a number), toggles
+ *   - a control file:  PROFILER_CONTROL_FILE=/path, polled every second,
+ *                      "1" activates, "0" goes dormant again
+ *   - the API:         profiler_activate() / profiler_deactivate(),
+ *                      see include/profiler.h
+ *
+ * "known to the profiler":
+ * blocks allocated while dormant are not in the registry, and their frees
+ * must not look like invalid frees. on activation we snapshot the address
+ * ranges that could hold such blocks (the brk heap and anonymous
+ * mappings, from /proc/self/maps). an untracked free inside the snapshot
+ * predates activation and is forwarded silently; anything else is still
+ * reported. blocks tracked in an earlier active period are retired by
+ * bumping profiler_generation, without walking the registry.
+ *
+ * a free inside the snapshot leaves a tombstone in the registry (see
+ * hash_table.c), so the same address freed again before it is reused is
+ * still a double free, whether the block predates activation or not. a
+ * tracked block's entry is flagged in place, which costs the free path
+ * nothing; blocks from the dormant period take a preallocated entry.
+ * limitation: inside the snapshot, invalid frees of addresses that were
+ * never a block are left to libc's own checks, and so are double frees of
+ * dormant-period blocks once the tombstone pool is used up.
+ *
+ * activation and deactivation are async-signal-safe: no locks, no
+ * malloc, only open/read/close/write.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include "../include/profiler_internal.h"
+
+// read-mostly state tested by every interposer
+int profiler_dormant = 0;
+unsigned int profiler_generation = 0;
+
+// anonymous mappings are usually far fewer; extra ones are merged
+#define MAX_SNAPSHOT_RANGES 1024
+
+typedef struct addr_range {
+    uintptr_t start;
+    uintptr_t end;
+} addr_range_t;
+
+/*
+ * double buffered, so a reactivation never rewrites the snapshot a
+ * concurrent free() is searching. -1 = no snapshot (started active).
+ */
+static addr_range_t g_ranges[2][MAX_SNAPSHOT_RANGES];
+static size_t g_range_count[2];
+static int g_current_ranges = -1;
+
+// one transition at a time, from any thread or signal handler
+static int g_transition_busy = 0;
+
+static const char *g_control_file = NULL;
+
+/*
+ * minimal /proc/self/maps line parser, async-signal-safe
+ * "start-end perms offset dev inode path"
+ */
+static const char *parse_hex(const char *p, uintptr_t *value) {
+    uintptr_t v = 0;
+    for (;;) {
+        char c = *p;
+        if (c >= '0' && c <= '9') v = (v << 4) | (uintptr_t)(c - '0');
+        else if (c >= 'a' && c <= 'f') v = (v << 4) | (uintptr_t)(c - 'a' + 10);
+        else break;
+        p++;
+    }
+    *value = v;
+    return p;
+}
+
+static const char *skip_field(const char *p) {
+    while (*p && *p != ' ') p++;
+    while (*p == ' ') p++;
+    return p;
+}
+
+/*
+ * could this mapping hold heap blocks?
+ * the brk heap, and anonymous mappings (malloc arenas, large chunks)
+ */
+static int line_is_heap_candidate(const char *line, uintptr_t *start, uintptr_t *end) {
+    const char *p = parse_hex(line, start);
+    if (*p != '-') return 0;
+    p = parse_hex(p + 1, end);
+    while (*p == ' ') p++;
+    p = skip_field(p);              // perms
+    p = skip_field(p);              // offset
+    p = skip_field(p);              // dev
+    uintptr_t inode;
+    const char *after_inode = parse_hex(p, &inode);
+    p = after_inode;
+    while (*p == ' ') p++;
+
+    if (strncmp(p, "[heap]", 6) == 0) return 1;
+    return inode == 0 && (*p == '\0' || *p == '\n');
+}
+
+static void add_range(int buffer, uintptr_t start, uintptr_t end) {
+    addr_range_t *ranges = g_ranges[buffer];
+    size_t count = g_range_count[buffer];
+
+    // adjacent mappings merge, and so does everything past the limit
+    if (count > 0 && (ranges[count - 1].end == start || count == MAX_SNAPSHOT_RANGES)) {
+        ranges[count - 1].end = end;
+        return;
+    }
+    ranges[count].start = start;
+    ranges[count].end = end;
+    g_range_count[buffer] = count + 1;
+}
+
+/*
+ * fill the spare buffer from /proc/self/maps and publish it
+ */
+static void snapshot_ranges(void) {
+    int buffer = (g_current_ranges == 0) ? 1 : 0;
+    g_range_count[buffer] = 0;
+
+    int fd = open("/proc/self/maps", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return;     // no snapshot: every untracked free is reported
+
+    char chunk[4096];
+    char line[512];
+    size_t line_len = 0;
+    ssize_t n;
+
+    while ((n = read(fd, chunk, sizeof(chunk))) > 0) {
+        for (ssize_t i = 0; i < n; i++) {
+            if (chunk[i] != '\n') {
+                // overlong lines are only ever long paths, never anonymous
+                if (line_len < sizeof(line) - 1) line[line_len++] = chunk[i];
+                continue;
+            }
+            line[line_len] = '\0';
+            line_len = 0;
+
+            uintptr_t start, end;
+            if (line_is_heap_candidate(line, &start, &end)) {
+                add_range(buffer, start, end);
+            }
+        }
+    }
+    close(fd);
+
+    __atomic_store_n(&g_current_ranges, buffer, __ATOMIC_RELEASE);
+}
+
+/*
+ * was ptr possibly allocated before the last activation?
+ */
+int activation_predates(const void *ptr) {
+    int buffer = __atomic_load_n(&g_current_ranges, __ATOMIC_ACQUIRE);
+    if (buffer < 0) return 0;
+
+    const addr_range_t *ranges = g_ranges[buffer];
+    uintptr_t addr = (uintptr_t)ptr;
+    size_t lo = 0, hi = g_range_count[buffer];
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (ranges[mid].end <= addr) {
+            lo = mid + 1;
+        } else if (ranges[mid].start > addr) {
+            hi = mid;
+        } else {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void log_state(const char *state) {
+    out_buf_t buf;
+    buf.len = 0;
+    buf_str(&buf, "{\"type\":\"profiler_state\",\"state\":\"");
+    buf_str(&buf, state);
+    buf_str(&buf, "\",\"generation\":");
+    buf_dec(&buf, __atomic_load_n(&profiler_generation, __ATOMIC_RELAXED));
+    buf_str(&buf, "}\n");
+    buf_flush(&buf);
+}
+
+/*
+ * start tracking
+ * returns 0 on success (or if already active), -1 if another transition
+ * is in progress
+ */
+int profiler_activate(void) {
+    if (!__atomic_load_n(&profiler_dormant, __ATOMIC_ACQUIRE)) return 0;
+    if (__atomic_exchange_n(&g_transition_busy, 1, __ATOMIC_ACQUIRE)) return -1;
+
+    // order matters: snapshot, retire old blocks, then go live
+    snapshot_ranges();
+    __atomic_add_fetch(&profiler_generation, 1, __ATOMIC_RELEASE);
+    stats_reset();
+    __atomic_store_n(&profiler_dormant, 0, __ATOMIC_RELEASE);
+    log_state("active");
+
+    __atomic_store_n(&g_transition_busy, 0, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/*
+ * stop tracking, forward everything to libc again
+ * the registry is left alone; its entries are retired on reactivation
+ */
+int profiler_deactivate(void) {
+    if (__atomic_load_n(&profiler_dormant, __ATOMIC_ACQUIRE)) return 0;
+    if (__atomic_exchange_n(&g_transition_busy, 1, __ATOMIC_ACQUIRE)) return -1;
+
+    __atomic_store_n(&profiler_dormant, 1, __ATOMIC_RELEASE);
+    log_state("dormant");
+
+    __atomic_store_n(&g_transition_busy, 0, __ATOMIC_RELEASE);
+    return 0;
+}
+
+int profiler_is_active(void) {
+    return !__atomic_load_n(&profiler_dormant, __ATOMIC_ACQUIRE);
+}
+
+static void activation_signal_handler(int sig) {
+    (void)sig;
+    int saved_errno = errno;
+    if (profiler_is_active()) {
+        profiler_deactivate();
+    } else {
+        profiler_activate();
+    }
+    errno = saved_errno;
+}
+
+/*
+ * accept "SIGUSR2", "USR2" or "12"
+ */
+static int parse_signal(const char *name) {
+    if (strncmp(name, "SIG", 3) == 0) name += 3;
+    if (strcmp(name, "USR1") == 0) return SIGUSR1;
+    if (strcmp(name, "USR2") == 0) return SIGUSR2;
+
+    char *end;
+    long number = strtol(name, &end, 10);
+    if (*end != '\0' || number <= 0 || number >= NSIG) return -1;
+    return (int)number;
+}
+
+/*
+ * read configuration, called from profiler_init()
+ *
+ * the dormant flag is set before init publishes the ready state, so no
+ * interposer ever tracks a block in a process that starts dormant
+ */
+void activation_init(void) {
+    const char *dormant = getenv("PROFILER_DORMANT");
+    if (dormant && strcmp(dormant, "1") == 0) {
+        profiler_dormant = 1;
+    }
+
+    const char *signal_name = getenv("PROFILER_SIGNAL");
+    if (signal_name && *signal_name) {
+        int sig = parse_signal(signal_name);
+        if (sig > 0) {
+            struct sigaction sa;
+            memset(&sa, 0, sizeof(sa));
+            sa.sa_handler = activation_signal_handler;
+            sa.sa_flags = SA_RESTART;
+            sigemptyset(&sa.sa_mask);
+            sigaction(sig, &sa, NULL);
+        } else {
+            write_str("[PROFILER ERROR] unknown PROFILER_SIGNAL\n");
+        }
+    }
+
+    const char *control_file = getenv("PROFILER_CONTROL_FILE");
+    if (control_file && *control_file) {
+        g_control_file = control_file;
+    }
+}
+
+/*
+ * control file watcher: apply the file's first byte once per second
+ */
+static void *control_file_watcher(void *arg) {
+    (void)arg;
+    struct timespec interval = { 1, 0 };
+
+    for (;;) {
+        int fd = open(g_control_file, O_RDONLY | O_CLOEXEC);
+        if (fd >= 0) {
+            char state;
+            if (read(fd, &state, 1) == 1) {
+                if (state == '1') profiler_activate();
+                else if (state == '0') profiler_deactivate();
+            }
+            close(fd);
+        }
+        nanosleep(&interval, NULL);
+    }
+    return NULL;
+}
+
+/*
+ * start the watcher thread, called from the library constructor
+ * (not from profiler_init(), which may run inside a malloc call)
+ */
+void activation_start_watcher(void) {
+    if (!g_control_file) return;
+
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&thread, &attr, control_file_watcher, NULL) != 0) {
+        write_str("[PROFILER ERROR] failed to start control file watcher\n");
+    }
+    pthread_attr_destroy(&attr);
+}
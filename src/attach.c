@@ -0,0 +1,179 @@
+/*
+ * attach to a running process - the in-process half
+ *
+ * tools/profiler-attach uses ptrace to make the target call
+ * dlopen("libprofiler.so") and then profiler_attach(). loaded that late,
+ * the library is last in the symbol lookup order and every object
+ * already resolved malloc() to libc, so LD_PRELOAD-style interposition
+ * never happens on its own.
+ *
+ * instead we rewrite the GOT: every loaded object's JUMP_SLOT and
+ * GLOB_DAT relocations for an interposed symbol are pointed at our
+ * definition. this reaches the same call sites a preload would - the
+ * program, its libraries, and libc's own PLT calls - and then tracking
+ * starts exactly like a dormant process being activated: blocks that
+ * existed before attach are never reported, freeing them is no error.
+ *
+ * not patched:
+ * - the dynamic loader, which keeps its own allocator pointers
+ * - objects dlopen()ed after attach
+ * - RTLD_DEEPBIND objects with private copies of the symbols
+ *
+ * the link-time build has no GOT to patch, so this is preload only.
+ */
+
+#define _GNU_SOURCE
+#include <link.h>
+#include <dlfcn.h>
+#include <string.h>
+#include <unistd.h>
+#include <elf.h>
+#include <sys/mman.h>
+#include "../include/profiler_internal.h"
+
+#ifndef PROFILER_LINK_WRAP
+
+// every symbol we define: PROFILER_WRAP_SYMBOLS in the Makefile, plus the
+// preload-only dlopen/dlclose
+static const char *const g_interposed_names[] = {
+    "malloc", "free", "calloc", "realloc", "reallocarray", "posix_memalign",
+    "aligned_alloc", "memalign", "valloc", "pvalloc", "malloc_usable_size",
+    "free_sized", "free_aligned_sized",
+    "mmap", "mmap64", "munmap", "mremap", "madvise", "dlopen", "dlclose",
+    "_Znwm", "_Znam", "_ZnwmRKSt9nothrow_t", "_ZnamRKSt9nothrow_t",
+    "_ZnwmSt11align_val_t", "_ZnamSt11align_val_t",
+    "_ZnwmSt11align_val_tRKSt9nothrow_t", "_ZnamSt11align_val_tRKSt9nothrow_t",
+    "_ZdlPv", "_ZdaPv", "_ZdlPvm", "_ZdaPvm", "_ZdlPvRKSt9nothrow_t", "_ZdaPvRKSt9nothrow_t",
+    "_ZdlPvSt11align_val_t", "_ZdaPvSt11align_val_t",
+    "_ZdlPvmSt11align_val_t", "_ZdaPvmSt11align_val_t",
+    "_ZdlPvSt11align_val_tRKSt9nothrow_t", "_ZdaPvSt11align_val_tRKSt9nothrow_t",
+};
+
+#define INTERPOSED_COUNT (sizeof(g_interposed_names) / sizeof(g_interposed_names[0]))
+
+// our definitions, looked up once in profiler_attach()
+static void *g_interposers[INTERPOSED_COUNT];
+
+static size_t g_page_size = 4096;
+static size_t g_patched = 0;
+
+static void *interposer_for(const char *name) {
+    for (size_t i = 0; i < INTERPOSED_COUNT; i++) {
+        if (strcmp(g_interposed_names[i], name) == 0) return g_interposers[i];
+    }
+    return NULL;
+}
+
+/*
+ * store value in a GOT slot, which full RELRO has made read-only
+ */
+static void patch_slot(void **slot, void *value, uintptr_t relro_start, uintptr_t relro_end) {
+    uintptr_t addr = (uintptr_t)slot;
+    int in_relro = addr >= relro_start && addr < relro_end;
+    uintptr_t page = addr & ~(uintptr_t)(g_page_size - 1);
+
+    if (in_relro && mprotect((void*)page, g_page_size, PROT_READ | PROT_WRITE) != 0) {
+        return;
+    }
+    __atomic_store_n(slot, value, __ATOMIC_RELEASE);
+    if (in_relro) {
+        mprotect((void*)page, g_page_size, PROT_READ);
+    }
+    g_patched++;
+}
+
+/*
+ * dynamic section pointers are relocated in place by glibc, except in
+ * objects it did not load itself (the vdso); accept both forms
+ */
+static uintptr_t dyn_ptr(const struct dl_phdr_info *info, ElfW(Addr) value) {
+    return (value < info->dlpi_addr) ? info->dlpi_addr + value : value;
+}
+
+static void patch_relocations(const struct dl_phdr_info *info, const ElfW(Rela) *rela, size_t size,
+                              const ElfW(Sym) *symtab, const char *strtab,
+                              uintptr_t relro_start, uintptr_t relro_end) {
+    for (size_t i = 0; i < size / sizeof(ElfW(Rela)); i++) {
+        unsigned long type = ELF64_R_TYPE(rela[i].r_info);
+        if (type != R_X86_64_JUMP_SLOT && type != R_X86_64_GLOB_DAT) continue;
+
+        const ElfW(Sym) *sym = &symtab[ELF64_R_SYM(rela[i].r_info)];
+        void *interposer = interposer_for(strtab + sym->st_name);
+        if (!interposer) continue;
+
+        void **slot = (void**)(info->dlpi_addr + rela[i].r_offset);
+        patch_slot(slot, interposer, relro_start, relro_end);
+    }
+}
+
+static int patch_object(struct dl_phdr_info *info, size_t size, void *data) {
+    (void)size;
+    (void)data;
+
+    // the loader and the vdso keep their own bindings
+    const char *name = info->dlpi_name;
+    if (strstr(name, "ld-linux") || strstr(name, "linux-vdso")) return 0;
+
+    const ElfW(Dyn) *dyn = NULL;
+    uintptr_t relro_start = 0, relro_end = 0;
+    for (int i = 0; i < info->dlpi_phnum; i++) {
+        const ElfW(Phdr) *phdr = &info->dlpi_phdr[i];
+        if (phdr->p_type == PT_DYNAMIC) {
+            dyn = (const ElfW(Dyn)*)(info->dlpi_addr + phdr->p_vaddr);
+        } else if (phdr->p_type == PT_GNU_RELRO) {
+            relro_start = info->dlpi_addr + phdr->p_vaddr;
+            relro_end = relro_start + phdr->p_memsz;
+        }
+    }
+    if (!dyn) return 0;
+
+    const ElfW(Sym) *symtab = NULL;
+    const char *strtab = NULL;
+    const ElfW(Rela) *jmprel = NULL, *rela = NULL;
+    size_t jmprel_size = 0, rela_size = 0;
+
+    for (; dyn->d_tag != DT_NULL; dyn++) {
+        switch (dyn->d_tag) {
+        case DT_SYMTAB:   symtab = (const ElfW(Sym)*)dyn_ptr(info, dyn->d_un.d_ptr); break;
+        case DT_STRTAB:   strtab = (const char*)dyn_ptr(info, dyn->d_un.d_ptr); break;
+        case DT_JMPREL:   jmprel = (const ElfW(Rela)*)dyn_ptr(info, dyn->d_un.d_ptr); break;
+        case DT_PLTRELSZ: jmprel_size = dyn->d_un.d_val; break;
+        case DT_RELA:     rela = (const ElfW(Rela)*)dyn_ptr(info, dyn->d_un.d_ptr); break;
+        case DT_RELASZ:   rela_size = dyn->d_un.d_val; break;
+        }
+    }
+    if (!symtab || !strtab) return 0;
+
+    if (jmprel) patch_relocations(info, jmprel, jmprel_size, symtab, strtab, relro_start, relro_end);
+    if (rela) patch_relocations(info, rela, rela_size, symtab, strtab, relro_start, relro_end);
+    return 0;
+}
+
+/*
+ * entry point called by profiler-attach, in the target, after dlopen()
+ * returns 0 on success, -1 if nothing could be patched
+ */
+int profiler_attach(void) {
+    // resolve our own definitions; a plain reference would bind to libc
+    Dl_info self;
+    if (!dladdr((void*)profiler_attach, &self)) return -1;
+    void *handle = dlopen(self.dli_fname, RTLD_NOW | RTLD_NOLOAD);
+    if (!handle) return -1;
+    for (size_t i = 0; i < INTERPOSED_COUNT; i++) {
+        g_interposers[i] = dlsym(handle, g_interposed_names[i]);
+    }
+    dlclose(handle);
+
+    long page = sysconf(_SC_PAGESIZE);
+    if (page > 0) g_page_size = (size_t)page;
+
+    // forward everything while the GOTs are half patched, then go live
+    __atomic_store_n(&profiler_dormant, 1, __ATOMIC_RELEASE);
+    dl_iterate_phdr(patch_object, NULL);
+    if (g_patched == 0) return -1;
+
+    profiler_activate();
+    return 0;
+}
+
+#endif
@@ -0,0 +1,84 @@
+/*
+ * bootstrap arena - allocations made before the real allocator is known
+ *
+ * profiler_init() resolves the real malloc with dlsym(), and on some
+ * glibc versions dlsym() itself calls calloc/malloc. those calls land in
+ * our interposers while the real function pointers are still NULL.
+ *
+ * they are served from this small static bump arena instead:
+ * - lock-free: a single atomic offset, safe from any thread or handler
+ * - never reused: memory is zero (bss) and stays valid forever, so
+ *   calloc needs no memset and free() of an arena block is a no-op
+ * - recognised by address range, which is two compares on the free path
+ *
+ * every block is preceded by a header holding its size, so realloc and
+ * malloc_usable_size work on arena blocks too.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include "../include/profiler_internal.h"
+
+// plenty for dlsym/dlerror bookkeeping, costs nothing until touched
+#define BOOTSTRAP_ARENA_SIZE (128 * 1024)
+
+// minimum alignment, same guarantee as malloc on x86_64
+#define BOOTSTRAP_MIN_ALIGN 16
+
+typedef struct arena_header {
+    size_t size;        // bytes requested by the caller
+    size_t reserved;    // keeps the header 16 bytes wide
+} arena_header_t;
+
+static char g_arena[BOOTSTRAP_ARENA_SIZE] __attribute__((aligned(4096)));
+static size_t g_arena_offset = 0;
+static int g_exhausted_logged = 0;
+
+/*
+ * carve a block out of the arena
+ *
+ * alignment must be a power of two (0 = default). returns NULL with
+ * errno = ENOMEM once the arena is exhausted.
+ */
+void *bootstrap_alloc(size_t size, size_t alignment) {
+    if (alignment < BOOTSTRAP_MIN_ALIGN) alignment = BOOTSTRAP_MIN_ALIGN;
+
+    size_t offset = __atomic_load_n(&g_arena_offset, __ATOMIC_RELAXED);
+    for (;;) {
+        // the block starts after its header, rounded up to the alignment
+        size_t start = (offset + sizeof(arena_header_t) + alignment - 1) & ~(alignment - 1);
+        size_t end = start + size;
+        if (end < start || end > BOOTSTRAP_ARENA_SIZE) {
+            if (!__atomic_exchange_n(&g_exhausted_logged, 1, __ATOMIC_RELAXED)) {
+                write_str("[PROFILER ERROR] bootstrap arena exhausted\n");
+            }
+            errno = ENOMEM;
+            return NULL;
+        }
+
+        if (__atomic_compare_exchange_n(&g_arena_offset, &offset, end, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            arena_header_t *header = (arena_header_t*)(g_arena + start) - 1;
+            header->size = size;
+            return g_arena + start;
+        }
+        // offset was refreshed by the failed exchange, retry
+    }
+}
+
+/*
+ * does ptr point into the arena?
+ */
+int bootstrap_owns(const void *ptr) {
+    return (const char*)ptr >= g_arena && (const char*)ptr < g_arena + BOOTSTRAP_ARENA_SIZE;
+}
+
+/*
+ * size requested for an arena block
+ */
+size_t bootstrap_size(const void *ptr) {
+    const arena_header_t *header = (const arena_header_t*)ptr - 1;
+    return header->size;
+}
@@ -0,0 +1,384 @@
+/*
+ * corruption reporting - deduplicated and rate limited
+ *
+ * a buggy loop can hit the same double-free millions of times. printing
+ * every occurrence costs a backtrace, a dladdr() per frame and a write()
+ * per event, and the process slows to a crawl.
+ *
+ * instead, each event is keyed by (error type, stack hash):
+ * - the first occurrence of a site is printed in full, if the global
+ *   token bucket has a token left
+ * - repeats only bump the per-site counter
+ * - sites with new occurrences are summarized periodically and at exit
+ *   as {"type":"corruption_summary",...} lines
+ *
+ * configuration:
+ *   PROFILER_CORRUPTION_RATE     - full reports per second (default 10)
+ *   PROFILER_CORRUPTION_BURST    - token bucket depth (default 20)
+ *   PROFILER_CORRUPTION_INTERVAL - seconds between summaries (default 10,
+ *                                  0 = summarize only at exit)
+ *
+ * a summary is written when it is due and either a new event arrives or
+ * the site reporter (PROFILER_REPORT_INTERVAL, see sites.c) wakes up.
+ * without the reporter, repeats of a site that then stops firing are
+ * only summarized at exit.
+ *
+ * thread safety: the site table and the bucket are protected by
+ * corruption_mutex.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <execinfo.h>
+#include <pthread.h>
+#include "../include/profiler_internal.h"
+
+// distinct corruption sites we remember, must be a power of two
+#define MAX_CORRUPTION_SITES 256
+
+/*
+ * one deduplicated corruption site
+ *
+ * frames are kept so the summary can still point at the code, even when
+ * the site was never printed in full because the bucket was empty.
+ */
+typedef struct corruption_site {
+    uint64_t key;                   // hash of (type, stack), 0 = empty slot
+    const char *error_type;         // string literal from the caller
+    void *first_addr;               // pointer passed on the first occurrence
+    uint64_t count;                 // total occurrences
+    uint64_t reported;              // occurrences printed in full (0 or 1)
+    uint64_t summarized;            // occurrences already printed or summarized
+    void *frames[REPORT_FRAMES];    // top of the first occurrence's stack
+    int depth;
+    unsigned int modules_epoch;     // when the first occurrence happened
+} corruption_site_t;
+
+static corruption_site_t g_sites[MAX_CORRUPTION_SITES];
+
+// occurrences that did not fit in the site table
+static uint64_t g_overflow_count = 0;
+static uint64_t g_overflow_summarized = 0;
+
+// token bucket state
+static double g_rate = 10.0;
+static double g_burst = 20.0;
+static double g_tokens = 20.0;
+static double g_last_refill = 0.0;
+
+// periodic summary state
+static double g_summary_interval = 10.0;
+static double g_last_summary = 0.0;
+
+static pthread_mutex_t corruption_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double env_double(const char *name, double fallback) {
+    const char *value = getenv(name);
+    if (!value || !*value) return fallback;
+
+    char *end;
+    double parsed = strtod(value, &end);
+    if (*end != '\0' || parsed < 0) return fallback;
+    return parsed;
+}
+
+/*
+ * read rate limiting configuration
+ *
+ * called from profiler_init(), before any corruption can be reported.
+ */
+void corruption_init(void) {
+    g_rate = env_double("PROFILER_CORRUPTION_RATE", 10.0);
+    g_burst = env_double("PROFILER_CORRUPTION_BURST", 20.0);
+    g_summary_interval = env_double("PROFILER_CORRUPTION_INTERVAL", 10.0);
+
+    g_tokens = g_burst;
+    g_last_refill = now_seconds();
+    g_last_summary = g_last_refill;
+}
+
+/*
+ * fork() support, see process.c
+ * a child starts with an empty site table and a full bucket: the
+ * parent's errors are the parent's to report.
+ */
+void corruption_fork_prepare(void) {
+    pthread_mutex_lock(&corruption_mutex);
+}
+
+void corruption_fork_release(int in_child) {
+    if (in_child) {
+        memset(g_sites, 0, sizeof(g_sites));
+        g_overflow_count = 0;
+        g_overflow_summarized = 0;
+        g_tokens = g_burst;
+        g_last_refill = now_seconds();
+        g_last_summary = g_last_refill;
+    }
+    pthread_mutex_unlock(&corruption_mutex);
+}
+
+/*
+ * FNV-1a over the error type and the raw return addresses
+ *
+ * frame addresses are stable for a given call site, so two occurrences
+ * from the same loop hash to the same key.
+ */
+static uint64_t site_hash(const char *error_type, void **trace, int depth) {
+    uint64_t hash = 14695981039346656037ULL;
+
+    for (const char *c = error_type; *c; c++) {
+        hash = (hash ^ (unsigned char)*c) * 1099511628211ULL;
+    }
+    for (int i = 0; i < depth; i++) {
+        uintptr_t frame = (uintptr_t)trace[i];
+        for (size_t b = 0; b < sizeof(frame); b++) {
+            hash = (hash ^ (frame & 0xff)) * 1099511628211ULL;
+            frame >>= 8;
+        }
+    }
+
+    // 0 marks an empty slot
+    return hash ? hash : 1;
+}
+
+/*
+ * find or claim the slot for a key (open addressing, linear probing)
+ * returns NULL if the table is full.
+ *
+ * caller must hold corruption_mutex
+ */
+static corruption_site_t *site_lookup(uint64_t key, int *is_new) {
+    size_t mask = MAX_CORRUPTION_SITES - 1;
+    size_t slot = key & mask;
+
+    for (size_t probe = 0; probe < MAX_CORRUPTION_SITES; probe++) {
+        corruption_site_t *site = &g_sites[(slot + probe) & mask];
+        if (site->key == key) {
+            *is_new = 0;
+            return site;
+        }
+        if (site->key == 0) {
+            site->key = key;
+            *is_new = 1;
+            return site;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * take one token from the bucket if available
+ *
+ * caller must hold corruption_mutex
+ */
+static int take_token(double now) {
+    g_tokens += (now - g_last_refill) * g_rate;
+    if (g_tokens > g_burst) g_tokens = g_burst;
+    g_last_refill = now;
+
+    if (g_tokens >= 1.0) {
+        g_tokens -= 1.0;
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * output one corruption event in JSON format
+ *
+ * Format: {"type":"Double-Free or Invalid-Free","addr":"0x...","frames":[...]}
+ * stack trace can be disabled with PROFILER_STACK_TRACES=0
+ */
+static void output_corruption_json(void *ptr, const char *error_type,
+                                   void **trace, int depth) {
+    out_buf_t buf;
+    buf.len = 0;
+
+    buf_str(&buf, "{\"type\":\"");
+    buf_str(&buf, error_type);
+    buf_str(&buf, "\",\"addr\":\"");
+    buf_hex(&buf, (unsigned long)ptr);
+    buf_str(&buf, "\",\"frames\":[");
+    if (show_stack_traces) {
+        buf_frames(&buf, trace, depth, modules_current_epoch());
+    }
+    buf_str(&buf, "]}\n");
+    buf_flush(&buf);
+}
+
+/*
+ * output one summary line for a site with unreported occurrences
+ *
+ * Format: {"type":"corruption_summary","error":"...","addr":"0x...",
+ *          "count":1000000,"new":999,"suppressed":999999,"frames":[...]}
+ * count is the running total, new is the number of occurrences not yet
+ * printed or summarized
+ *
+ * caller must hold corruption_mutex
+ */
+static void output_site_summary(corruption_site_t *site) {
+    out_buf_t buf;
+    buf.len = 0;
+
+    buf_str(&buf, "{\"type\":\"corruption_summary\",\"error\":\"");
+    buf_str(&buf, site->error_type);
+    buf_str(&buf, "\",\"addr\":\"");
+    buf_hex(&buf, (unsigned long)site->first_addr);
+    buf_str(&buf, "\",\"count\":");
+    buf_dec(&buf, site->count);
+    buf_str(&buf, ",\"new\":");
+    buf_dec(&buf, site->count - site->summarized);
+    buf_str(&buf, ",\"suppressed\":");
+    buf_dec(&buf, site->count - site->reported);
+    buf_str(&buf, ",\"frames\":[");
+    if (show_stack_traces) {
+        buf_frames(&buf, site->frames, site->depth, site->modules_epoch);
+    }
+    buf_str(&buf, "]}\n");
+    buf_flush(&buf);
+
+    site->summarized = site->count;
+}
+
+/*
+ * emit summaries for every site that changed since the last summary
+ *
+ * caller must hold corruption_mutex
+ */
+static void summarize_locked(void) {
+    for (size_t i = 0; i < MAX_CORRUPTION_SITES; i++) {
+        corruption_site_t *site = &g_sites[i];
+        if (site->key == 0 || site->count == site->summarized) continue;
+        output_site_summary(site);
+    }
+
+    if (g_overflow_count != g_overflow_summarized) {
+        out_buf_t buf;
+        buf.len = 0;
+        buf_str(&buf, "{\"type\":\"corruption_summary\",\"error\":\"overflow\",\"count\":");
+        buf_dec(&buf, g_overflow_count);
+        buf_str(&buf, ",\"new\":");
+        buf_dec(&buf, g_overflow_count - g_overflow_summarized);
+        buf_str(&buf, ",\"suppressed\":");
+        buf_dec(&buf, g_overflow_count);
+        buf_str(&buf, ",\"frames\":[]}\n");
+        buf_flush(&buf);
+        g_overflow_summarized = g_overflow_count;
+    }
+}
+
+/*
+ * summarize if the interval has elapsed
+ *
+ * caller must hold corruption_mutex
+ */
+static void summarize_if_due_locked(double now) {
+    if (g_summary_interval > 0 && now - g_last_summary >= g_summary_interval) {
+        g_last_summary = now;
+        summarize_locked();
+    }
+}
+
+/*
+ * write due summaries without waiting for the next event
+ * called from the site reporter thread
+ */
+void corruption_flush_due(void) {
+    pthread_mutex_lock(&corruption_mutex);
+    summarize_if_due_locked(now_seconds());
+    pthread_mutex_unlock(&corruption_mutex);
+}
+
+/*
+ * report memory corruption error
+ *
+ * called when we detect double-free or invalid-free.
+ * caller is the return address of the free/delete call, the dedup key
+ * when stack traces are disabled.
+ * the first occurrence of a site is reported immediately (rate permitting),
+ * repeats are counted and folded into the periodic summary.
+ */
+void report_corruption_error(void *ptr, const char *error_type, void *caller) {
+    // the stack is needed for the dedup key even when output omits it
+    void *trace[MAX_STACK_FRAMES];
+    int depth = capture_stack_from(trace, caller);
+    uint64_t key = site_hash(error_type, trace, depth);
+    double now = now_seconds();
+    int print_full = 0;
+
+    pthread_mutex_lock(&corruption_mutex);
+
+    int is_new = 0;
+    corruption_site_t *site = site_lookup(key, &is_new);
+    if (!site) {
+        g_overflow_count++;
+    } else {
+        if (is_new) {
+            site->error_type = error_type;
+            site->first_addr = ptr;
+            site->depth = (depth < REPORT_FRAMES) ? depth : REPORT_FRAMES;
+            memcpy(site->frames, trace, site->depth * sizeof(void*));
+            site->modules_epoch = modules_current_epoch();
+
+            // only new sites are worth a full report
+            // a full report already accounts for its occurrence
+            if (take_token(now)) {
+                site->reported = 1;
+                site->summarized = 1;
+                print_full = 1;
+            }
+        }
+        site->count++;
+    }
+
+    if (print_full) {
+        output_corruption_json(ptr, error_type, trace, depth);
+    }
+
+    summarize_if_due_locked(now);
+
+    pthread_mutex_unlock(&corruption_mutex);
+}
+
+/*
+ * error type for a block released through the wrong API family
+ * 
+ * indexed [allocated][released]. the diagonal is never reported.
+ */
+static const char *const g_mismatch_types[3][3] = {
+    [ALLOC_MALLOC] = {
+        [ALLOC_NEW]       = "Alloc-Dealloc-Mismatch (malloc / operator delete)",
+        [ALLOC_NEW_ARRAY] = "Alloc-Dealloc-Mismatch (malloc / operator delete[])",
+    },
+    [ALLOC_NEW] = {
+        [ALLOC_MALLOC]    = "Alloc-Dealloc-Mismatch (operator new / free)",
+        [ALLOC_NEW_ARRAY] = "Alloc-Dealloc-Mismatch (operator new / operator delete[])",
+    },
+    [ALLOC_NEW_ARRAY] = {
+        [ALLOC_MALLOC]    = "Alloc-Dealloc-Mismatch (operator new[] / free)",
+        [ALLOC_NEW]       = "Alloc-Dealloc-Mismatch (operator new[] / operator delete)",
+    },
+};
+
+const char *corruption_mismatch_type(alloc_kind_t allocated, alloc_kind_t released) {
+    const char *type = g_mismatch_types[allocated][released];
+    return type ? type : "Alloc-Dealloc-Mismatch";
+}
+
+/*
+ * final summary, called from profiler_cleanup() at exit
+ */
+void corruption_report_summary(void) {
+    pthread_mutex_lock(&corruption_mutex);
+    summarize_locked();
+    pthread_mutex_unlock(&corruption_mutex);
+}
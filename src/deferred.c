@@ -0,0 +1,196 @@
+/*
+ * deferred registry updates - tracking from signal handlers
+ *
+ * every registry is protected by a mutex. a signal handler that calls
+ * malloc() while its thread is inside the profiler (holding, or about to
+ * take, one of those mutexes) must not touch the registry: the lock is
+ * owned by the code the signal interrupted, which cannot run until the
+ * handler returns. in_profiler marks that window, so re-entry is always
+ * detected; before this file the nested call was simply not tracked, and
+ * a block malloc()ed in a handler later showed up as an invalid free.
+ *
+ * instead the nested call records what happened in a deferred_op and
+ * pushes it on a per-thread list, with nothing but atomics:
+ * - records come from a static pool, a slot is claimed with one exchange
+ * - the list head is thread-local and only changed with compare-exchange,
+ *   so a second signal nesting inside the push is safe too
+ * profiler_leave(), on the way out of the interrupted call, sees the list
+ * and applies it in order, outside any lock and outside signal context.
+ *
+ * what a deferred operation can not do:
+ * - unwind: the unwinder is not async-signal-safe, so only the immediate
+ *   caller is recorded
+ * - validate a free() on the spot: the block is held back and released
+ *   by the drain once it has been checked, like any other free()
+ * if the pool runs out, calls fall back to the old behaviour: allocations
+ * go untracked and frees are released unchecked.
+ *
+ * libc's own malloc is still not async-signal-safe; the profiler just no
+ * longer adds a lock of its own to the ones a handler could deadlock on.
+ */
+
+#define _GNU_SOURCE
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+#include "../include/profiler_internal.h"
+
+// records in flight across all threads; a handful per signal is plenty
+#define DEFERRED_SLOTS 128
+
+static deferred_op_t g_slots[DEFERRED_SLOTS];
+
+// rotating start of the free slot search
+static unsigned int g_next_slot = 0;
+
+// this thread's pending operations, newest first
+PROFILER_TLS deferred_op_t *deferred_ops = NULL;
+
+static deferred_op_t *claim_slot(void) {
+    unsigned int start = __atomic_fetch_add(&g_next_slot, 1, __ATOMIC_RELAXED);
+    for (unsigned int i = 0; i < DEFERRED_SLOTS; i++) {
+        deferred_op_t *slot = &g_slots[(start + i) % DEFERRED_SLOTS];
+        if (!__atomic_exchange_n(&slot->in_use, 1, __ATOMIC_ACQUIRE)) return slot;
+    }
+    return NULL;
+}
+
+static void release_slot(deferred_op_t *slot) {
+    __atomic_store_n(&slot->in_use, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * queue op for the current thread
+ * async-signal-safe. returns 1 if queued, 0 if the pool is exhausted or
+ * the call is the profiler's own (PROFILER_OWN_CALLS).
+ */
+int defer_op(const deferred_op_t *op) {
+    if (in_profiler == PROFILER_OWN_CALLS) return 0;
+
+    deferred_op_t *slot = claim_slot();
+    if (!slot) return 0;
+
+    slot->type = op->type;
+    slot->kind = op->kind;
+    slot->keep_old = op->keep_old;
+    slot->ptr = op->ptr;
+    slot->size = op->size;
+    slot->new_ptr = op->new_ptr;
+    slot->new_size = op->new_size;
+    slot->alignment = op->alignment;
+    slot->size_error = op->size_error;
+    slot->caller = op->caller;
+
+    deferred_op_t *head = __atomic_load_n(&deferred_ops, __ATOMIC_RELAXED);
+    do {
+        slot->next = head;
+    } while (!__atomic_compare_exchange_n(&deferred_ops, &head, slot, 0,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    return 1;
+}
+
+/*
+ * the stack of a deferred operation: the caller alone
+ * frame 0 stands in for the interposer, so reports and the libc filter
+ * read frame 1 exactly as they do for a captured stack
+ */
+static int deferred_trace(const deferred_op_t *op, void **trace) {
+    trace[0] = (void*)defer_op;
+    trace[1] = op->caller;
+    return 2;
+}
+
+static void apply(const deferred_op_t *op) {
+    void *trace[2];
+    int depth;
+
+    switch (op->type) {
+    case DEFER_ALLOC:
+        depth = deferred_trace(op, trace);
+        hash_table_add(op->ptr, op->size, op->alignment, op->kind, trace, depth,
+                       is_likely_libc_allocation(trace, depth));
+        if (trace_enabled) {
+            trace_alloc(trace_op_of(op->kind, op->alignment), op->ptr, NULL, op->size,
+                        op->alignment, trace, depth);
+        }
+        break;
+    case DEFER_FREE:
+        if (untrack_checked(op->ptr, op->kind, op->size, op->alignment, op->size_error, op->caller)) {
+            if (trace_enabled) trace_free(op->ptr);
+            real_free_ptr(op->ptr);
+        }
+        break;
+    case DEFER_FORGET:
+        // the trace sees a realloc() from a handler as a free and a malloc
+        hash_table_remove(op->ptr);
+        if (trace_enabled) trace_free(op->ptr);
+        break;
+    case DEFER_MAP:
+        depth = deferred_trace(op, trace);
+        mmap_registry_add(op->ptr, op->size, trace, depth, is_likely_libc_allocation(trace, depth));
+        break;
+    case DEFER_UNMAP:
+        mmap_registry_remove(op->ptr, op->size);
+        break;
+    case DEFER_MOVE:
+        mmap_registry_move(op->ptr, op->size, op->new_ptr, op->new_size, op->keep_old);
+        break;
+    case DEFER_DONTNEED:
+        mmap_registry_dontneed(op->ptr, op->size);
+        break;
+    }
+}
+
+/*
+ * apply this thread's pending operations, oldest first
+ * called by profiler_leave() with in_profiler clear; operations queued by
+ * signals arriving meanwhile are picked up before returning.
+ * signals are blocked while the queue is applied: it calls libc's malloc
+ * for the records, and a handler's malloc must not land in the middle.
+ */
+void deferred_drain(void) {
+    sigset_t all, saved;
+    sigfillset(&all);
+
+    do {
+        in_profiler = 1;
+        pthread_sigmask(SIG_SETMASK, &all, &saved);
+
+        deferred_op_t *list;
+        while ((list = __atomic_exchange_n(&deferred_ops, NULL, __ATOMIC_ACQUIRE)) != NULL) {
+            // the list is newest first
+            deferred_op_t *oldest = NULL;
+            while (list) {
+                deferred_op_t *next = list->next;
+                list->next = oldest;
+                oldest = list;
+                list = next;
+            }
+
+            while (oldest) {
+                deferred_op_t *next = oldest->next;
+                apply(oldest);
+                release_slot(oldest);
+                oldest = next;
+            }
+        }
+
+        // pending signals are delivered here and queue with in_profiler set
+        pthread_sigmask(SIG_SETMASK, &saved, NULL);
+        in_profiler = 0;
+        __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    } while (__atomic_load_n(&deferred_ops, __ATOMIC_ACQUIRE));
+}
+
+/*
+ * fork() support, see process.c
+ * slots held by threads that did not survive fork() are reclaimed
+ */
+void deferred_fork_child(void) {
+    for (int i = 0; i < DEFERRED_SLOTS; i++) {
+        g_slots[i].in_use = 0;
+    }
+    for (deferred_op_t *op = deferred_ops; op; op = op->next) {
+        op->in_use = 1;
+    }
+}
@@ -0,0 +1,1176 @@
+/*
+ * demangle - C++ function names for the in-process report, without malloc
+ *
+ * __cxa_demangle() allocates its result and every node it builds on the
+ * way, which is no way to spend the exit report of a malloc profiler.
+ * this is a small recursive-descent reader of the Itanium C++ ABI
+ * mangling that writes straight into the caller's buffer. substitutions
+ * and template parameters are kept as spans of the text already written,
+ * so the only thing built is the output itself.
+ *
+ * it covers what turns up in stacks: nested and local names, templates
+ * and packs, operators, constructors and destructors, the std::
+ * abbreviations, lambdas, ABI tags, function pointers, thunks and clone
+ * suffixes (".cold", ".isra.0"). the rest (member pointers, expressions
+ * in template arguments, decltype, vendor qualifiers) fails, and the
+ * caller keeps the mangled name. for the names it takes the output is
+ * that of c++filt.
+ */
+
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <string.h>
+#include "../include/profiler_internal.h"
+
+// substitution candidates and template parameters we keep track of
+#define DM_MAX_SUBS 128
+#define DM_MAX_ARGS 32
+
+// nesting of types and encodings
+#define DM_MAX_DEPTH 48
+
+// what qualifiers put on a type later need to know about it
+typedef struct {
+    uint8_t cv;                 // CV_* it already has
+    uint8_t ref;                // 1 for &, 2 for &&
+    uint8_t compound;           // a function or an array: qualifiers would go inside
+} type_info_t;
+
+// text already written, with what it is
+typedef struct {
+    uint32_t start, len;
+    type_info_t type;
+    uint8_t is_pack;            // a template argument pack: its elements are
+    uint8_t pack_first;         // elems[pack_first], ...
+    uint8_t pack_count;
+    // a substitution with template parameters in it: its mangling, which
+    // is read again where it is used (see parse_substitution)
+    uint32_t source, source_len;
+} span_t;
+
+typedef struct {
+    const char *mangled;
+    const char *p;              // next character of the mangled name
+    char *out;
+    size_t size, len;
+    size_t hidden;              // text parsed but not printed lives in [hidden, size)
+    char last;                  // last character written, kept when text is taken back
+    int error;
+    int depth;
+    span_t subs[DM_MAX_SUBS];   // S_, S0_, ...
+    int sub_count;
+    span_t args[DM_MAX_ARGS];   // T_, T0_, ...: the function's template arguments
+    int arg_count;
+    span_t elems[DM_MAX_ARGS];  // the elements of packs among them
+    int elem_count;
+    span_t last_name;           // the name constructors and destructors repeat
+    type_info_t type;           // of the type parsed last
+    int pack_index;             // in a pack expansion, the element printed; else -1
+    int pack_arg;               // the pack being expanded, -1 until its T_ is seen
+    int in_lambda;              // in the parameters of a lambda
+    int param_count;            // template parameters read so far
+} dm_t;
+
+// what parsing a <name> found out about it
+typedef struct {
+    int record_args;            // its template arguments are the T_ of the encoding
+    int is_template;            // ends with template arguments
+    int is_cdtor_or_conv;       // constructor, destructor or conversion operator
+    int cv;                     // member function qualifiers, CV_*
+    int ref;                    // 1 for &, 2 for &&
+} name_info_t;
+
+#define CV_RESTRICT 1
+#define CV_VOLATILE 2
+#define CV_CONST    4
+
+static void parse_type(dm_t *d);
+static void parse_pack_expansion(dm_t *d, size_t start, int params);
+static void parse_encoding(dm_t *d, int top);
+static void parse_name(dm_t *d, name_info_t *info);
+
+/*
+ * output
+ */
+static void put_n(dm_t *d, const char *s, size_t n) {
+    if (d->error) return;
+    if (d->len + n >= d->hidden) {
+        d->error = 1;
+        return;
+    }
+    memcpy(d->out + d->len, s, n);
+    d->len += n;
+    if (n) d->last = s[n - 1];
+}
+
+static void put(dm_t *d, const char *s) {
+    put_n(d, s, strlen(s));
+}
+
+// text written earlier, again
+static void put_span(dm_t *d, span_t s) {
+    if (d->error) return;
+    if (d->len + s.len >= d->hidden) {
+        d->error = 1;
+        return;
+    }
+    memmove(d->out + d->len, d->out + s.start, s.len);
+    d->len += s.len;
+    if (s.len) d->last = d->out[d->len - 1];
+}
+
+/*
+ * the character written last, for the space in "> >"
+ * an empty pack takes its ", " back but, as in libiberty, not the last
+ * character: "A<B<int>>" there
+ */
+static char last_char(const dm_t *d) {
+    return d->last;
+}
+
+static span_t make_span(const dm_t *d, size_t start) {
+    span_t s;
+    memset(&s, 0, sizeof(s));
+    s.start = (uint32_t)start;
+    s.len = (uint32_t)(d->len - start);
+    s.type = d->type;
+    return s;
+}
+
+// a substitution candidate, the text from start on, of the type d->type
+static void add_sub(dm_t *d, size_t start) {
+    if (d->error) return;
+    if (d->sub_count == DM_MAX_SUBS) {
+        d->error = 1;
+        return;
+    }
+    d->subs[d->sub_count++] = make_span(d, start);
+}
+
+/*
+ * a type as a candidate: the text from start on, mangled from from on
+ * params is d->param_count when its parsing started
+ */
+static void add_type_sub(dm_t *d, size_t start, const char *from, int params) {
+    add_sub(d, start);
+    if (d->error || d->param_count == params) return;
+    span_t *s = &d->subs[d->sub_count - 1];
+    s->source = (uint32_t)(from - d->mangled);
+    s->source_len = (uint32_t)(d->p - from);
+}
+
+static void clear_type(dm_t *d) {
+    memset(&d->type, 0, sizeof(d->type));
+}
+
+static void reverse(char *s, size_t n) {
+    for (size_t i = 0; i < n / 2; i++) {
+        char c = s[i];
+        s[i] = s[n - 1 - i];
+        s[n - 1 - i] = c;
+    }
+}
+
+static void move_span(span_t *s, size_t a, size_t b, size_t c) {
+    if (s->start >= a && s->start < b) s->start += (uint32_t)(c - b);
+    else if (s->start >= b && s->start < c) s->start -= (uint32_t)(b - a);
+}
+
+// the text [a,b) moved to the end of [a,c), and [b,c) to its start
+static void move_spans(dm_t *d, size_t a, size_t b, size_t c) {
+    for (int i = 0; i < d->sub_count; i++) move_span(&d->subs[i], a, b, c);
+    for (int i = 0; i < d->arg_count; i++) move_span(&d->args[i], a, b, c);
+    for (int i = 0; i < d->elem_count; i++) move_span(&d->elems[i], a, b, c);
+    move_span(&d->last_name, a, b, c);
+}
+
+/*
+ * swap the text [a,b) and [b,c), spans included
+ * the return type of a template function comes after its name in the
+ * mangling, and before it in the output
+ */
+static void rotate(dm_t *d, size_t a, size_t b, size_t c) {
+    reverse(d->out + a, b - a);
+    reverse(d->out + b, c - b);
+    reverse(d->out + a, c - a);
+    move_spans(d, a, b, c);
+}
+
+/*
+ * take the text from start on out of the output
+ * it moves to the end of the buffer, where substitutions can still
+ * refer to it: a local name's function is printed without its return
+ * type, and the return type may be substituted later on
+ */
+static void hide(dm_t *d, size_t start) {
+    size_t n = d->len - start;
+    size_t to = d->hidden - n;
+    memmove(d->out + to, d->out + start, n);
+    // nothing refers to the gap between the output and the hidden text
+    move_spans(d, start, d->len, d->hidden);
+    d->hidden = to;
+    d->len = start;
+}
+
+/*
+ * numbers
+ */
+static int is_digit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+static int is_lower(char c) {
+    return c >= 'a' && c <= 'z';
+}
+
+static int parse_number(dm_t *d, size_t *n) {
+    if (!is_digit(*d->p)) {
+        d->error = 1;
+        return 0;
+    }
+    size_t v = 0;
+    while (is_digit(*d->p)) {
+        v = v * 10 + (size_t)(*d->p++ - '0');
+        if (v > 1 << 20) {
+            d->error = 1;
+            return 0;
+        }
+    }
+    *n = v;
+    return 1;
+}
+
+// [<number>] _ as in S_, S0_ and T_, T0_: 0 for none, else the number + 1
+static int parse_seq_id(dm_t *d, size_t *id, int base36) {
+    size_t v = 0;
+    int digits = 0;
+    for (;; digits++) {
+        char c = *d->p;
+        if (is_digit(c)) v = v * (base36 ? 36 : 10) + (size_t)(c - '0');
+        else if (base36 && c >= 'A' && c <= 'Z') v = v * 36 + (size_t)(c - 'A' + 10);
+        else break;
+        d->p++;
+        if (v > 1 << 20) break;
+    }
+    if (*d->p != '_') {
+        d->error = 1;
+        return 0;
+    }
+    d->p++;
+    *id = digits ? v + 1 : 0;
+    return 1;
+}
+
+static void put_number(dm_t *d, size_t n) {
+    char digits[24];
+    size_t i = sizeof(digits);
+    do {
+        digits[--i] = (char)('0' + n % 10);
+        n /= 10;
+    } while (n);
+    put_n(d, digits + i, sizeof(digits) - i);
+}
+
+// _ <digit> or __ <number> _ after a local name, not printed
+static void skip_discriminator(dm_t *d) {
+    if (d->p[0] != '_') return;
+    if (is_digit(d->p[1])) {
+        d->p += 2;
+    } else if (d->p[1] == '_' && is_digit(d->p[2])) {
+        d->p += 2;
+        while (is_digit(*d->p)) d->p++;
+        if (*d->p == '_') d->p++;
+    }
+}
+
+/*
+ * names
+ */
+static void parse_source_name(dm_t *d) {
+    size_t n;
+    if (!parse_number(d, &n)) return;
+    if (strnlen(d->p, n) < n) {
+        d->error = 1;
+        return;
+    }
+
+    size_t start = d->len;
+    if (n >= 10 && strncmp(d->p, "_GLOBAL_", 8) == 0 &&
+        (d->p[8] == '.' || d->p[8] == '_' || d->p[8] == '$') && d->p[9] == 'N') {
+        put(d, "(anonymous namespace)");
+    } else {
+        put_n(d, d->p, n);
+    }
+    d->p += n;
+    d->last_name.start = start;
+    d->last_name.len = d->len - start;
+}
+
+static const struct {
+    char code[3];
+    const char *name;
+} operators[] = {
+    { "nw", "new" }, { "na", "new[]" }, { "dl", "delete" }, { "da", "delete[]" },
+    { "ps", "+" }, { "ng", "-" }, { "ad", "&" }, { "de", "*" }, { "co", "~" },
+    { "pl", "+" }, { "mi", "-" }, { "ml", "*" }, { "dv", "/" }, { "rm", "%" },
+    { "an", "&" }, { "or", "|" }, { "eo", "^" }, { "aS", "=" },
+    { "pL", "+=" }, { "mI", "-=" }, { "mL", "*=" }, { "dV", "/=" }, { "rM", "%=" },
+    { "aN", "&=" }, { "oR", "|=" }, { "eO", "^=" },
+    { "ls", "<<" }, { "rs", ">>" }, { "lS", "<<=" }, { "rS", ">>=" },
+    { "eq", "==" }, { "ne", "!=" }, { "lt", "<" }, { "gt", ">" }, { "le", "<=" },
+    { "ge", ">=" }, { "ss", "<=>" }, { "nt", "!" }, { "aa", "&&" }, { "oo", "||" },
+    { "pp", "++" }, { "mm", "--" }, { "cm", "," }, { "pm", "->*" }, { "pt", "->" },
+    { "cl", "()" }, { "ix", "[]" }, { "qu", "?" }, { "aw", "co_await" },
+};
+
+static void parse_operator_name(dm_t *d, name_info_t *info) {
+    if (d->p[0] == 'c' && d->p[1] == 'v') {
+        d->p += 2;
+        put(d, "operator ");
+        parse_type(d);
+        info->is_cdtor_or_conv = 1;
+        return;
+    }
+    if (d->p[0] == 'l' && d->p[1] == 'i') {
+        d->p += 2;
+        put(d, "operator\"\" ");
+        parse_source_name(d);
+        return;
+    }
+    for (size_t i = 0; i < sizeof(operators) / sizeof(operators[0]); i++) {
+        if (d->p[0] == operators[i].code[0] && d->p[1] == operators[i].code[1]) {
+            d->p += 2;
+            put(d, is_lower(operators[i].name[0]) ? "operator " : "operator");
+            put(d, operators[i].name);
+            return;
+        }
+    }
+    d->error = 1;
+}
+
+// Ut [<number>] _ and Ul <parameters> E [<number>] _
+static void parse_unnamed_type(dm_t *d) {
+    size_t id;
+    if (d->p[1] == 't') {
+        d->p += 2;
+        if (!parse_seq_id(d, &id, 0)) return;
+        put(d, "{unnamed type#");
+        put_number(d, id + 1);
+        put(d, "}");
+    } else if (d->p[1] == 'l') {
+        d->p += 2;
+        put(d, "{lambda(");
+        if (d->p[0] == 'v' && d->p[1] == 'E') {
+            d->p++;
+        } else {
+            d->in_lambda++;
+            for (int first = 1; *d->p != 'E' && !d->error; first = 0) {
+                if (!*d->p) d->error = 1;
+                if (!first) put(d, ", ");
+                parse_type(d);
+            }
+            d->in_lambda--;
+        }
+        d->p++;
+        put(d, ")#");
+        if (!parse_seq_id(d, &id, 0)) return;
+        put_number(d, id + 1);
+        put(d, "}");
+    } else {
+        d->error = 1;
+    }
+}
+
+static void parse_unqualified_name(dm_t *d, name_info_t *info) {
+    char c = d->p[0], next = d->p[1];
+    info->is_template = 0;
+    info->is_cdtor_or_conv = 0;
+
+    if (is_digit(c)) {
+        parse_source_name(d);
+    } else if (c == 'L' && is_digit(next)) {
+        // internal linkage, GCC before 5
+        d->p++;
+        parse_source_name(d);
+        skip_discriminator(d);
+    } else if (c == 'C' && next >= '1' && next <= '5') {
+        d->p += 2;
+        put_span(d, d->last_name);
+        info->is_cdtor_or_conv = 1;
+    } else if (c == 'D' && next >= '0' && next <= '5') {
+        d->p += 2;
+        put(d, "~");
+        put_span(d, d->last_name);
+        info->is_cdtor_or_conv = 1;
+    } else if (c == 'U') {
+        parse_unnamed_type(d);
+    } else if (is_lower(c)) {
+        parse_operator_name(d, info);
+    } else {
+        d->error = 1;
+    }
+
+    // B <source-name>: [abi:cxx11]
+    while (*d->p == 'B' && !d->error) {
+        span_t name = d->last_name;
+        d->p++;
+        put(d, "[abi:");
+        parse_source_name(d);
+        put(d, "]");
+        d->last_name = name;
+    }
+}
+
+/*
+ * S_, S0_, ... or one of the std:: abbreviations
+ * the prefix of a constructor or destructor spells out the abbreviated
+ * class: std::basic_iostream<char, std::char_traits<char> >::basic_iostream()
+ */
+static void parse_substitution(dm_t *d, int prefix) {
+    static const struct {
+        char code;
+        const char *name, *full;
+    } abbreviations[] = {
+        { 't', "std", "std" },
+        { 'a', "std::allocator", "std::allocator" },
+        { 'b', "std::basic_string", "std::basic_string" },
+        { 's', "std::string", "std::basic_string<char, std::char_traits<char>, std::allocator<char> >" },
+        { 'i', "std::istream", "std::basic_istream<char, std::char_traits<char> >" },
+        { 'o', "std::ostream", "std::basic_ostream<char, std::char_traits<char> >" },
+        { 'd', "std::iostream", "std::basic_iostream<char, std::char_traits<char> >" },
+    };
+
+    d->p++;
+    clear_type(d);
+    for (size_t i = 0; i < sizeof(abbreviations) / sizeof(abbreviations[0]); i++) {
+        if (*d->p != abbreviations[i].code) continue;
+        d->p++;
+        int full = prefix && (*d->p == 'C' || *d->p == 'D');
+        const char *name = full ? abbreviations[i].full : abbreviations[i].name;
+        size_t start = d->len;
+        put(d, name);
+        // the class name, for its constructors: after "std::", before any '<'
+        if (d->len - start > 5) {
+            const char *args = strchr(name, '<');
+            d->last_name.start = (uint32_t)(start + 5);
+            d->last_name.len = (uint32_t)((args ? (size_t)(args - name) : strlen(name)) - 5);
+        }
+        return;
+    }
+
+    size_t id;
+    if (!parse_seq_id(d, &id, 1)) return;
+    if (id >= (size_t)d->sub_count) {
+        d->error = 1;
+        return;
+    }
+
+    // like libiberty, a template parameter is what it stands for where
+    // it is substituted: the T_ of a function named in a template argument,
+    // substituted in the outer function's signature, is the outer one's.
+    // such substitutions are read again, and add no candidates this time.
+    const span_t *sub = &d->subs[id];
+    if (sub->source_len) {
+        const char *p = d->p;
+        int sub_count = d->sub_count;
+        d->p = d->mangled + sub->source;
+        parse_type(d);
+        if (d->p != d->mangled + sub->source + sub->source_len) d->error = 1;
+        d->p = p;
+        d->sub_count = sub_count;
+        return;
+    }
+    put_span(d, *sub);
+    d->type = sub->type;
+}
+
+/*
+ * T_, T0_, ...
+ * in a pack expansion, a pack prints the element being expanded; in the
+ * parameters of a generic lambda, they are its auto parameters
+ */
+static void parse_template_param(dm_t *d) {
+    size_t id;
+    d->p++;
+    if (!parse_seq_id(d, &id, 0)) return;
+    d->param_count++;
+    clear_type(d);
+    if (d->in_lambda) {
+        put(d, "auto:");
+        put_number(d, id + 1);
+        return;
+    }
+    if (id >= (size_t)d->arg_count) {
+        d->error = 1;
+        return;
+    }
+
+    const span_t *arg = &d->args[id];
+    if (arg->is_pack && d->pack_index >= 0 && (d->pack_arg < 0 || d->pack_arg == (int)id)) {
+        d->pack_arg = (int)id;
+        if (d->pack_index < arg->pack_count) {
+            const span_t *elem = &d->elems[arg->pack_first + d->pack_index];
+            put_span(d, *elem);
+            d->type = elem->type;
+        }
+        return;
+    }
+    put_span(d, *arg);
+    d->type = arg->type;
+}
+
+// L <type> <value> E, or L _Z <encoding> E
+static void parse_literal(dm_t *d) {
+    d->p++;
+    if (d->p[0] == '_' && d->p[1] == 'Z') {
+        d->p += 2;
+        parse_encoding(d, 0);
+    } else if (d->p[0] == 'b' && (d->p[1] == '0' || d->p[1] == '1') && d->p[2] == 'E') {
+        put(d, d->p[1] == '1' ? "true" : "false");
+        d->p += 2;
+    } else {
+        static const char integers[] = "ijlmxy";
+        static const char *const suffixes[] = { "", "u", "l", "ul", "ll", "ull" };
+        const char *integer = *d->p ? strchr(integers, *d->p) : NULL;
+        if (integer) {
+            d->p++;
+        } else {
+            put(d, "(");
+            parse_type(d);
+            put(d, ")");
+        }
+        if (*d->p == 'n') {
+            d->p++;
+            put(d, "-");
+        }
+        const char *value = d->p;
+        while (is_digit(*d->p)) d->p++;
+        if (d->p == value) d->error = 1;
+        put_n(d, value, (size_t)(d->p - value));
+        if (integer) put(d, suffixes[integer - integers]);
+    }
+    if (*d->p != 'E') {
+        d->error = 1;
+        return;
+    }
+    d->p++;
+}
+
+// a type or a literal; sets d->type
+static void parse_template_arg(dm_t *d) {
+    if (*d->p == 'L') {
+        parse_literal(d);
+        clear_type(d);
+    } else if (*d->p == 'X') {
+        // expressions
+        d->error = 1;
+    } else {
+        parse_type(d);
+    }
+}
+
+/*
+ * I <template-arg>* E
+ * with record, they become the T_ of what follows. a pack (J ... E)
+ * prints inline, its elements kept for expansions; an empty one takes
+ * the separator before it back
+ */
+static void parse_template_args(dm_t *d, int record) {
+    span_t args[DM_MAX_ARGS], elems[DM_MAX_ARGS];
+    int count = 0, elem_count = 0;
+    span_t name = d->last_name;
+
+    d->p++;
+    if (last_char(d) == '<') put(d, " ");
+    put(d, "<");
+    while (*d->p != 'E' && !d->error) {
+        if (!*d->p || count == DM_MAX_ARGS) {
+            d->error = 1;
+            break;
+        }
+        size_t separator = d->len;
+        if (count) put(d, ", ");
+        size_t start = d->len;
+        span_t arg;
+
+        if (*d->p == 'J') {
+            d->p++;
+            int first = elem_count;
+            while (*d->p != 'E' && !d->error) {
+                if (!*d->p || elem_count == DM_MAX_ARGS) {
+                    d->error = 1;
+                    break;
+                }
+                if (elem_count > first) put(d, ", ");
+                size_t elem_start = d->len;
+                parse_template_arg(d);
+                elems[elem_count++] = make_span(d, elem_start);
+            }
+            d->p++;
+            clear_type(d);
+            if (count && d->len == start) d->len = start = separator;
+            arg = make_span(d, start);
+            arg.is_pack = 1;
+            arg.pack_first = (uint8_t)first;
+            arg.pack_count = (uint8_t)(elem_count - first);
+        } else {
+            parse_template_arg(d);
+            arg = make_span(d, start);
+        }
+        args[count++] = arg;
+    }
+    d->p++;
+    if (last_char(d) == '>') put(d, " ");
+    put(d, ">");
+    d->last_name = name;
+    clear_type(d);
+
+    if (record && !d->error) {
+        memcpy(d->args, args, count * sizeof(span_t));
+        d->arg_count = count;
+        memcpy(d->elems, elems, elem_count * sizeof(span_t));
+        d->elem_count = elem_count;
+    }
+}
+
+static int parse_cv(dm_t *d) {
+    int cv = 0;
+    if (*d->p == 'r') {
+        cv |= CV_RESTRICT;
+        d->p++;
+    }
+    if (*d->p == 'V') {
+        cv |= CV_VOLATILE;
+        d->p++;
+    }
+    if (*d->p == 'K') {
+        cv |= CV_CONST;
+        d->p++;
+    }
+    return cv;
+}
+
+static void put_cv(dm_t *d, int cv) {
+    if (cv & CV_CONST) put(d, " const");
+    if (cv & CV_VOLATILE) put(d, " volatile");
+    if (cv & CV_RESTRICT) put(d, " restrict");
+}
+
+// N [<CV-qualifiers>] [<ref-qualifier>] <prefix> <unqualified-name> E
+static void parse_nested_name(dm_t *d, name_info_t *info) {
+    d->p++;
+    info->cv = parse_cv(d);
+    if (*d->p == 'R' || *d->p == 'O') info->ref = *d->p++ == 'R' ? 1 : 2;
+
+    size_t start = d->len;
+    int components = 0;
+    while (*d->p != 'E' && !d->error) {
+        char c = *d->p;
+        if (!c) {
+            d->error = 1;
+            break;
+        }
+
+        if (c == 'I') {
+            if (!components) d->error = 1;
+            parse_template_args(d, info->record_args);
+            info->is_template = 1;
+        } else {
+            if (components) put(d, "::");
+            if (c == 'S') {
+                parse_substitution(d, 1);
+            } else if (c == 'T') {
+                parse_template_param(d);
+            } else {
+                parse_unqualified_name(d, info);
+            }
+        }
+        components++;
+
+        // every prefix is a candidate, except those that were substitutions
+        clear_type(d);
+        if (c != 'S' && *d->p != 'E') add_sub(d, start);
+    }
+    d->p++;
+}
+
+// Z <function encoding> E <entity name> [<discriminator>]
+static void parse_local_name(dm_t *d, name_info_t *info) {
+    d->p++;
+    parse_encoding(d, 0);
+    if (*d->p != 'E') {
+        d->error = 1;
+        return;
+    }
+    d->p++;
+    put(d, "::");
+    if (*d->p == 's') {
+        d->p++;
+        put(d, "string literal");
+    } else {
+        parse_name(d, info);
+    }
+    skip_discriminator(d);
+}
+
+static void parse_name(dm_t *d, name_info_t *info) {
+    char c = *d->p;
+    if (c == 'N') {
+        parse_nested_name(d, info);
+        return;
+    }
+    if (c == 'Z') {
+        parse_local_name(d, info);
+        return;
+    }
+
+    size_t start = d->len;
+    int substitution = 0;
+    if (c == 'S' && d->p[1] == 't') {
+        d->p += 2;
+        put(d, "std::");
+        parse_unqualified_name(d, info);
+    } else if (c == 'S') {
+        parse_substitution(d, 0);
+        substitution = 1;
+    } else {
+        parse_unqualified_name(d, info);
+    }
+
+    clear_type(d);
+    if (*d->p == 'I') {
+        // <unscoped-template-name> <template-args>
+        if (!substitution) add_sub(d, start);
+        parse_template_args(d, info->record_args);
+        info->is_template = 1;
+    } else if (substitution) {
+        d->error = 1;
+    }
+}
+
+/*
+ * types
+ */
+static const char *builtin_type(dm_t *d) {
+    static const char *const single[26] = {
+        ['v' - 'a'] = "void", ['w' - 'a'] = "wchar_t", ['b' - 'a'] = "bool",
+        ['c' - 'a'] = "char", ['a' - 'a'] = "signed char", ['h' - 'a'] = "unsigned char",
+        ['s' - 'a'] = "short", ['t' - 'a'] = "unsigned short", ['i' - 'a'] = "int",
+        ['j' - 'a'] = "unsigned int", ['l' - 'a'] = "long", ['m' - 'a'] = "unsigned long",
+        ['x' - 'a'] = "long long", ['y' - 'a'] = "unsigned long long", ['n' - 'a'] = "__int128",
+        ['o' - 'a'] = "unsigned __int128", ['f' - 'a'] = "float", ['d' - 'a'] = "double",
+        ['e' - 'a'] = "long double", ['g' - 'a'] = "__float128", ['z' - 'a'] = "...",
+    };
+    static const char *const extended[26] = {
+        ['d' - 'a'] = "decimal64", ['e' - 'a'] = "decimal128", ['f' - 'a'] = "decimal32",
+        ['h' - 'a'] = "half", ['i' - 'a'] = "char32_t", ['s' - 'a'] = "char16_t",
+        ['u' - 'a'] = "char8_t", ['a' - 'a'] = "auto", ['c' - 'a'] = "decltype(auto)",
+        ['n' - 'a'] = "decltype(nullptr)",
+    };
+
+    char c = d->p[0];
+    if (is_lower(c) && single[c - 'a']) {
+        d->p++;
+        return single[c - 'a'];
+    }
+    if (c == 'D' && is_lower(d->p[1]) && extended[d->p[1] - 'a']) {
+        d->p += 2;
+        return extended[d->p[-1] - 'a'];
+    }
+    return NULL;
+}
+
+// parameters of a function, up to the E or the ref-qualifier before it
+static void parse_parameters(dm_t *d) {
+    put(d, "(");
+    if (d->p[0] == 'v' && (d->p[1] == '\0' || d->p[1] == 'E' || d->p[1] == '.')) {
+        d->p++;
+    } else {
+        for (int first = 1; !d->error; first = 0) {
+            char c = d->p[0];
+            if (c == '\0' || c == 'E' || c == '.' || ((c == 'R' || c == 'O') && d->p[1] == 'E')) break;
+            // an empty pack expansion takes its separator back
+            size_t separator = d->len;
+            if (!first) put(d, ", ");
+            size_t start = d->len;
+            parse_type(d);
+            if (d->len == start) d->len = separator;
+        }
+    }
+    put(d, ")");
+}
+
+/*
+ * F [Y] <return type> <parameters> [<ref-qualifier>] E
+ * marker is what the function is reached through: "*" gives void (*)(int)
+ */
+static void parse_function_type(dm_t *d, const char *marker) {
+    d->p++;
+    if (*d->p == 'Y') d->p++;
+    parse_type(d);
+    // returning a function pointer: void (*(*)(int))(char)
+    if (d->type.compound) d->error = 1;
+    put(d, " ");
+    if (marker) {
+        put(d, "(");
+        put(d, marker);
+        put(d, ")");
+    }
+    parse_parameters(d);
+    if (d->p[0] == 'R' || d->p[0] == 'O') put(d, *d->p++ == 'R' ? " &" : " &&");
+    if (*d->p != 'E') {
+        d->error = 1;
+        return;
+    }
+    d->p++;
+    clear_type(d);
+    d->type.compound = 1;
+}
+
+// A <number> _ <element type>, one dimension only
+static void parse_array_type(dm_t *d, const char *marker) {
+    d->p++;
+    const char *dimension = d->p;
+    while (is_digit(*d->p)) d->p++;
+    size_t digits = (size_t)(d->p - dimension);
+    if (*d->p != '_' || d->p[1] == 'A') {
+        d->error = 1;
+        return;
+    }
+    d->p++;
+    parse_type(d);
+    if (d->type.compound) d->error = 1;
+    put(d, " ");
+    if (marker) {
+        put(d, "(");
+        put(d, marker);
+        put(d, ") ");
+    }
+    put(d, "[");
+    put_n(d, dimension, digits);
+    put(d, "]");
+    clear_type(d);
+    d->type.compound = 1;
+}
+
+/*
+ * pointers and references, P/R/O chains
+ * suffixes go on innermost first, "RPi" is int*&; a function or array
+ * takes them inside: "PFviE" is void (*)(int). a reference to a
+ * reference collapses, as in C++: "OT_" with T_ = int& is int&
+ */
+static void parse_pointer_type(dm_t *d, size_t start, int params) {
+    const char *from = d->p;
+    char ops[8];
+    int count = 0;
+    while ((*d->p == 'P' || *d->p == 'R' || *d->p == 'O') && count < (int)sizeof(ops)) {
+        ops[count++] = *d->p++;
+    }
+
+    char marker[24];
+    size_t len = 0;
+    for (int i = count - 1; i >= 0; i--) {
+        const char *op = ops[i] == 'P' ? "*" : ops[i] == 'R' ? "&" : "&&";
+        size_t n = strlen(op);
+        memcpy(marker + len, op, n);
+        len += n;
+    }
+    marker[len] = '\0';
+
+    if (*d->p == 'F' || *d->p == 'A') {
+        if (*d->p == 'F') parse_function_type(d, marker);
+        else parse_array_type(d, marker);
+        // the inner type and each level are candidates; they are not
+        // contiguous text, so all of them stand for the whole
+        for (int i = count; i >= 0; i--) add_type_sub(d, start, from + i, params);
+        return;
+    }
+
+    parse_type(d);
+    for (int i = count - 1; i >= 0 && !d->error; i--) {
+        type_info_t inner = d->type;
+        // a substituted function or array would need the marker inside
+        if (inner.compound) d->error = 1;
+        clear_type(d);
+        if (ops[i] == 'P') {
+            put(d, "*");
+        } else {
+            int ref = ops[i] == 'R' ? 1 : 2;
+            if (!inner.ref) put(d, ref == 1 ? "&" : "&&");
+            else if (inner.ref == 2 && ref == 1) d->error = 1;  // T&& as T&
+            else ref = inner.ref;
+            d->type.ref = (uint8_t)ref;
+        }
+        add_type_sub(d, start, from + i, params);
+    }
+}
+
+/*
+ * Dp <pattern>: the pattern once per element of the pack in it
+ * "DpRKT_" with T_ = <int, char*> is "int const&, char* const&". the
+ * first pass finds the pack; the others print the pattern again and
+ * forget the substitutions they add, which are the first pass's.
+ */
+static void parse_pack_expansion(dm_t *d, size_t start, int params) {
+    int saved_index = d->pack_index, saved_arg = d->pack_arg;
+    const char *from = d->p;
+    d->p += 2;
+    const char *pattern = d->p;
+
+    d->pack_index = 0;
+    d->pack_arg = -1;
+    parse_type(d);
+    int arg = d->pack_arg;
+    if (arg >= 0 && !d->error) {
+        int count = d->args[arg].pack_count;
+        const char *end = d->p;
+        int sub_count = d->sub_count;
+        if (!count) hide(d, start);
+        for (int i = 1; i < count && !d->error; i++) {
+            put(d, ", ");
+            d->p = pattern;
+            d->pack_index = i;
+            parse_type(d);
+            d->sub_count = sub_count;
+        }
+        d->p = end;
+    }
+
+    d->pack_index = saved_index;
+    d->pack_arg = saved_arg;
+    clear_type(d);
+    add_type_sub(d, start, from, params);
+}
+
+static void parse_type(dm_t *d) {
+    if (++d->depth > DM_MAX_DEPTH) {
+        d->error = 1;
+        return;
+    }
+
+    size_t start = d->len;
+    const char *from = d->p;
+    int params = d->param_count;
+    clear_type(d);
+    const char *builtin = builtin_type(d);
+    if (builtin) {
+        put(d, builtin);
+        d->depth--;
+        return;
+    }
+
+    char c = d->p[0];
+    name_info_t info;
+    memset(&info, 0, sizeof(info));
+
+    switch (c) {
+    case 'r':
+    case 'V':
+    case 'K': {
+        // a reference takes no qualifiers, and a type no second const
+        int cv = parse_cv(d);
+        parse_type(d);
+        if (d->type.compound) d->error = 1;
+        if (!d->type.ref) {
+            put_cv(d, cv & ~d->type.cv);
+            d->type.cv |= (uint8_t)cv;
+        }
+        add_type_sub(d, start, from, params);
+        break;
+    }
+    case 'P':
+    case 'R':
+    case 'O':
+        parse_pointer_type(d, start, params);
+        break;
+    case 'F':
+        parse_function_type(d, NULL);
+        add_type_sub(d, start, from, params);
+        break;
+    case 'A':
+        parse_array_type(d, NULL);
+        add_type_sub(d, start, from, params);
+        break;
+    case 'T':
+        parse_template_param(d);
+        add_type_sub(d, start, from, params);
+        if (*d->p == 'I') {
+            parse_template_args(d, 0);
+            add_type_sub(d, start, from, params);
+        }
+        break;
+    case 'S':
+        if (d->p[1] == 't') {
+            parse_name(d, &info);
+            add_type_sub(d, start, from, params);
+        } else {
+            parse_substitution(d, 0);
+            if (*d->p == 'I') {
+                parse_template_args(d, 0);
+                add_type_sub(d, start, from, params);
+            }
+        }
+        break;
+    case 'D':
+        if (d->p[1] == 'p') {
+            parse_pack_expansion(d, start, params);
+        } else {
+            d->error = 1;
+        }
+        break;
+    case 'u':
+        d->p++;
+        parse_source_name(d);
+        add_type_sub(d, start, from, params);
+        break;
+    case 'N':
+    case 'Z':
+    case '0' ... '9':
+        parse_name(d, &info);
+        add_type_sub(d, start, from, params);
+        break;
+    default:
+        // member pointers, decltype, vendor qualifiers, vector types
+        d->error = 1;
+        break;
+    }
+    d->depth--;
+}
+
+/*
+ * encodings
+ */
+static void parse_special_name(dm_t *d) {
+    char c = d->p[0], kind = d->p[1];
+    d->p += 2;
+    if (c == 'T') {
+        switch (kind) {
+        case 'V': put(d, "vtable for "); parse_type(d); return;
+        case 'T': put(d, "VTT for "); parse_type(d); return;
+        case 'I': put(d, "typeinfo for "); parse_type(d); return;
+        case 'S': put(d, "typeinfo name for "); parse_type(d); return;
+        case 'H': put(d, "TLS init function for "); break;
+        case 'W': put(d, "TLS wrapper function for "); break;
+        case 'h':
+        case 'v': {
+            // call offsets: h <number> _ or v <number> _ <number> _
+            for (int i = 0; i < (kind == 'h' ? 1 : 2); i++) {
+                if (*d->p == 'n') d->p++;
+                while (is_digit(*d->p)) d->p++;
+                if (*d->p++ != '_') {
+                    d->error = 1;
+                    return;
+                }
+            }
+            put(d, kind == 'h' ? "non-virtual thunk to " : "virtual thunk to ");
+            parse_encoding(d, 1);
+            return;
+        }
+        default:
+            d->error = 1;
+            return;
+        }
+    } else if (kind == 'V') {
+        put(d, "guard variable for ");
+    } else {
+        d->error = 1;
+        return;
+    }
+
+    name_info_t info;
+    memset(&info, 0, sizeof(info));
+    parse_name(d, &info);
+}
+
+// top is 0 for the functions of local names, printed without return type
+static void parse_encoding(dm_t *d, int top) {
+    if (++d->depth > DM_MAX_DEPTH) {
+        d->error = 1;
+        return;
+    }
+    if (d->p[0] == 'T' || (d->p[0] == 'G' && d->p[1] == 'V')) {
+        parse_special_name(d);
+        d->depth--;
+        return;
+    }
+
+    name_info_t info;
+    memset(&info, 0, sizeof(info));
+    info.record_args = 1;
+    size_t name_start = d->len;
+    parse_name(d, &info);
+
+    // a variable, or the end of a local name's function
+    char c = *d->p;
+    if (d->error || c == '\0' || c == 'E' || c == '.') {
+        d->depth--;
+        return;
+    }
+
+    if (info.is_template && !info.is_cdtor_or_conv) {
+        size_t type_start = d->len;
+        parse_type(d);
+        // void (*f<int>())(char)
+        if (d->type.compound) d->error = 1;
+        if (!top) {
+            if (!d->error) hide(d, type_start);
+        } else {
+            put(d, " ");
+            if (!d->error) rotate(d, name_start, type_start, d->len);
+        }
+    }
+    parse_parameters(d);
+    put_cv(d, info.cv);
+    if (info.ref) put(d, info.ref == 1 ? " &" : " &&");
+    d->depth--;
+}
+
+/*
+ * demangle mangled into out (size bytes, NUL included)
+ * returns 1 if out holds the demangled name, 0 if mangled is not a C++
+ * name, uses something this reader does not handle, or does not fit
+ */
+int demangle_symbol(const char *mangled, char *out, size_t size) {
+    if (strncmp(mangled, "_Z", 2) != 0 || size == 0) return 0;
+
+    dm_t d;
+    d.mangled = mangled;
+    d.p = mangled + 2;
+    d.out = out;
+    d.size = size;
+    d.hidden = size;
+    d.len = 0;
+    d.last = '\0';
+    d.error = 0;
+    d.depth = 0;
+    d.sub_count = 0;
+    d.arg_count = 0;
+    d.elem_count = 0;
+    memset(&d.last_name, 0, sizeof(d.last_name));
+    memset(&d.type, 0, sizeof(d.type));
+    d.pack_index = -1;
+    d.pack_arg = -1;
+    d.in_lambda = 0;
+    d.param_count = 0;
+
+    parse_encoding(&d, 1);
+
+    // clone suffixes: foo.cold is "foo() [clone .cold]"
+    while (!d.error && d.p[0] == '.' &&
+           (is_lower(d.p[1]) || is_digit(d.p[1]) || d.p[1] == '_')) {
+        const char *end = d.p + 2;
+        while (is_lower(*end) || is_digit(*end) || *end == '_') end++;
+        while (end[0] == '.' && is_digit(end[1])) {
+            end += 2;
+            while (is_digit(*end)) end++;
+        }
+        put(&d, " [clone ");
+        put_n(&d, d.p, (size_t)(end - d.p));
+        put(&d, "]");
+        d.p = end;
+    }
+
+    if (d.error || *d.p) return 0;
+    out[d.len] = '\0';
+    return 1;
+}
@@ -15,6 +15,8 @@
 #include <unistd.h>
 #include <pthread.h>
 #include <dlfcn.h>       
+#include <sys/mman.h>
+#include <sys/syscall.h>
 #include "../include/profiler_internal.h"
 #include "../include/uthash.h"
 
@@ -25,6 +27,18 @@ static allocation_info_t *g_allocations = NULL;
 // static initialization, safe before any threads exist
 static pthread_mutex_t hash_table_mutex = PTHREAD_MUTEX_INITIALIZER;
 
+/*
+ * tombstone pool, see take_entry()
+ * mapped from the kernel on first use; free entries are chained through
+ * their ptr field. once it is exhausted no more tombstones are made.
+ */
+#define TOMBSTONE_POOL 4096
+
+static allocation_info_t *g_tombstones = NULL;
+static allocation_info_t *g_free_tombstones = NULL;
+static size_t g_tombstones_used = 0;
+static pthread_mutex_t tombstone_mutex = PTHREAD_MUTEX_INITIALIZER;
+
 /*
  * initialize the tracker
  * 
@@ -34,13 +48,63 @@ void hash_table_init(void) {
     g_allocations = NULL;
 }
 
+/*
+ * fork() support, see process.c
+ * prepare holds the lock across fork() so the child never inherits it
+ * taken by a thread that no longer exists. the child's copy of the
+ * table is retired by a generation bump, not walked.
+ */
+void hash_table_fork_prepare(void) {
+    pthread_mutex_lock(&hash_table_mutex);
+    pthread_mutex_lock(&tombstone_mutex);
+}
+
+void hash_table_fork_release(void) {
+    pthread_mutex_unlock(&tombstone_mutex);
+    pthread_mutex_unlock(&hash_table_mutex);
+}
+
+/*
+ * was the entry made in the current active period?
+ * entries from before the last activation are retired (see activation.c):
+ * they are not leaks, and their pointers count as unknown.
+ */
+static int is_current(const allocation_info_t *info) {
+    return info->generation == __atomic_load_n(&profiler_generation, __ATOMIC_RELAXED);
+}
+
+// a block of this active period that has not been freed
+static int is_live(const allocation_info_t *info) {
+    return is_current(info) && !info->freed;
+}
+
+static int is_pool_tombstone(const allocation_info_t *info) {
+    return g_tombstones && info >= g_tombstones && info < g_tombstones + TOMBSTONE_POOL;
+}
+
+// release an entry's memory
+static void free_info(allocation_info_t *info) {
+    if (is_pool_tombstone(info)) {
+        pthread_mutex_lock(&tombstone_mutex);
+        info->ptr = g_free_tombstones;
+        g_free_tombstones = info;
+        pthread_mutex_unlock(&tombstone_mutex);
+        return;
+    }
+    if (info->stack_trace) {
+        real_free_ptr(info->stack_trace);
+    }
+    real_free_ptr(info);
+}
+
 /*
  * add an allocation to our tracking table
  * 
  * called immediately after malloc() succeeds.
  * we use real_malloc_ptr to allocate metadata (avoids recursion).
  */
-void hash_table_add(void *ptr, size_t size ,void **trace, int depth, int is_suspicious) {
+void hash_table_add(void *ptr, size_t size, size_t alignment, alloc_kind_t kind,
+                    void **trace, int depth, int is_suspicious) {
     if (!ptr) return;
     
     // don't track if real_malloc_ptr isn't set yet (during early init)
@@ -56,8 +120,13 @@ void hash_table_add(void *ptr, size_t size ,void **trace, int depth, int is_susp
     // initialize metadata fields
     info->ptr = ptr;
     info->size = size;
+    info->alignment = alignment;
+    info->kind = kind;
     info->timestamp = time(NULL);
     info->is_suspicious = is_suspicious;
+    info->freed = 0;
+    info->generation = __atomic_load_n(&profiler_generation, __ATOMIC_RELAXED);
+    info->modules_epoch = __atomic_load_n(&modules_epoch, __ATOMIC_RELAXED);
     
     // allocate and copy stack trace
     info->stack_trace = real_malloc_ptr(depth * sizeof(void*));
@@ -71,53 +140,163 @@ void hash_table_add(void *ptr, size_t size ,void **trace, int depth, int is_susp
     // lock before modifying shared hash table
     pthread_mutex_lock(&hash_table_mutex);
     
-    // add to hash table
-    // for me : HASH_ADD_PTR(head, keyfield, item)
-    HASH_ADD_PTR(g_allocations, ptr, info);
+    // add to hash table, replacing a retired entry for the same address
+    // (freed while dormant, so we never saw it go)
+    // for me : HASH_REPLACE_PTR(head, keyfield, item, replaced)
+    allocation_info_t *replaced = NULL;
+    HASH_REPLACE_PTR(g_allocations, ptr, info, replaced);
     
     // unlock after modification complete
     pthread_mutex_unlock(&hash_table_mutex);
+    
+    stats_account(STAT_HEAP, (long)size);
+    if (replaced) {
+        if (is_live(replaced)) {
+            stats_account(STAT_HEAP, -(long)replaced->size);
+        }
+        free_info(replaced);
+    }
 }
 
 /*
- * remove an allocation from tracking
- * 
- * called when free() is called.
- * 
- * thread safety: protected by hash_table_mutex
+ * a pool entry for a tombstone, NULL once the pool is used up
+ * caller must hold hash_table_mutex
  */
-void hash_table_remove(void *ptr) {
-    if (!ptr) return;
-    
-    // find the allocation metadata
+static allocation_info_t *tombstone_get(void) {
+    allocation_info_t *info = NULL;
+
+    pthread_mutex_lock(&tombstone_mutex);
+    if (g_free_tombstones) {
+        info = g_free_tombstones;
+        g_free_tombstones = info->ptr;
+    } else {
+        if (!g_tombstones) {
+            void *mem = (void*)syscall(SYS_mmap, NULL, TOMBSTONE_POOL * sizeof(allocation_info_t),
+                                       PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (mem != MAP_FAILED) g_tombstones = mem;
+        }
+        if (g_tombstones && g_tombstones_used < TOMBSTONE_POOL) {
+            info = &g_tombstones[g_tombstones_used++];
+        }
+    }
+    pthread_mutex_unlock(&tombstone_mutex);
+    return info;
+}
+
+/*
+ * tombstones, after a dormant start (see activation.c):
+ * a free inside the activation snapshot cannot tell a block allocated
+ * while dormant from one this period already freed. so such frees leave
+ * a freed entry behind, and a second free of the address finds it. the
+ * entry is replaced by the next block allocated there, and retired with
+ * the rest on reactivation.
+ *
+ * a tracked block keeps its own entry, flagged in place: no allocation
+ * and no second insert on the free path. only a block we never saw
+ * (allocated while dormant) takes an entry from the pool.
+ *
+ * caller must hold hash_table_mutex. returns the stack to release.
+ */
+static void **make_tombstone_locked(allocation_info_t *info) {
+    void **stack = info->stack_trace;
+    info->stack_trace = NULL;
+    info->stack_depth = 0;
+    info->freed = 1;
+    info->generation = __atomic_load_n(&profiler_generation, __ATOMIC_RELAXED);
+    return stack;
+}
+
+/*
+ * unregister ptr, leaving a tombstone if it is inside the activation
+ * snapshot. size, alignment and kind are filled in if the entry was live.
+ * returns 1 if it was live, 0 if ptr is unknown or already freed, -1 if
+ * the entry was retired or the block predates activation.
+ */
+static int take_entry(void *ptr, size_t *size, size_t *alignment, alloc_kind_t *kind) {
     allocation_info_t *found;
-    
-    // lock before accessing shared hash table
+
     pthread_mutex_lock(&hash_table_mutex);
-    
-    // find the entry in hash table
-    // for me : HASH_FIND_PTR(head, key_ptr, output)
     HASH_FIND_PTR(g_allocations, &ptr, found);
-    
-    if (found) {
-        // remove from hash table
+
+    if (!found) {
+        // unknown, but allocated while dormant if it is in the snapshot
+        int status = 0;
+        if (activation_predates(ptr)) {
+            allocation_info_t *tombstone = tombstone_get();
+            if (tombstone) {
+                memset(tombstone, 0, sizeof(*tombstone));
+                tombstone->ptr = ptr;
+                make_tombstone_locked(tombstone);
+                HASH_ADD_PTR(g_allocations, ptr, tombstone);
+            }
+            status = -1;
+        }
+        pthread_mutex_unlock(&hash_table_mutex);
+        return status;
+    }
+
+    int live = is_current(found);
+    if (live && found->freed) {
+        // freed twice this period: the tombstone stays for the next one
+        pthread_mutex_unlock(&hash_table_mutex);
+        return 0;
+    }
+    if (live) {
+        *size = found->size;
+        *alignment = found->alignment;
+        *kind = found->kind;
+    }
+
+    void **stack = NULL;
+    if (activation_predates(ptr)) {
+        stack = make_tombstone_locked(found);
+        found = NULL;
+    } else {
         HASH_DEL(g_allocations, found);
     }
-    
-    // unlock before freeing memory 
     pthread_mutex_unlock(&hash_table_mutex);
+
+    // free outside the critical section
+    if (stack) real_free_ptr(stack);
+    if (found) free_info(found);
+    if (!live) return -1;
+
+    stats_account(STAT_HEAP, -(long)*size);
+    return 1;
+}
+
+/*
+ * remove an allocation from tracking
+ * 
+ * called for realloc()'s old block once it has moved.
+ * 
+ * thread safety: protected by hash_table_mutex
+ */
+void hash_table_remove(void *ptr) {
+    if (!ptr) return;
     
-    // free outside the critical section 
-    if (found) {
-        // free the stack trace array first, then the struct
-        if (found->stack_trace) {
-            real_free_ptr(found->stack_trace);
-        }
-        real_free_ptr(found);
-    }
+    size_t size, alignment;
+    alloc_kind_t kind;
+    take_entry(ptr, &size, &alignment, &kind);
+}
+
+/*
+ * remove an allocation from tracking and return its metadata
+ * 
+ * the free()/delete fast path: a single lookup under a single lock
+ * both validates the pointer and unregisters it. size, alignment and
+ * kind are filled in when the pointer was found.
+ * returns 1 if found, 0 if not found or already freed (see the
+ * tombstones above), -1 if the entry was retired (made before the last
+ * activation, or by the parent before fork()) or the block was allocated
+ * while dormant; those blocks are valid to release.
+ * 
+ * thread safety: protected by hash_table_mutex
+ */
+int hash_table_take(void *ptr, size_t *size, size_t *alignment, alloc_kind_t *kind) {
+    if (!ptr) return 0;
     
-    // not found - could be double-free or invalid-free
-    // for now, just ignore. we'll add detection in phase 4
+    return take_entry(ptr, size, alignment, kind);
 }
 
 /*
@@ -142,7 +321,7 @@ int hash_table_find(void *ptr) {
     // unlock immediately after lookup
     pthread_mutex_unlock(&hash_table_mutex);
     
-    if (found){
+    if (found && is_live(found)){
          return 1;
     }
     return 0;
@@ -150,48 +329,61 @@ int hash_table_find(void *ptr) {
 
 /*
  * output a single leak in JSON format
- * uses only write() syscalls which are async-safe and do not use malloc internally (like printf)
+ * the line is built in a stack buffer and emitted with one write() syscall,
+ * which is async-safe and does not use malloc internally (like printf)
  * 
- * Format: {"type":"leak","addr":"0x...","size":1024,"frames":[
+ * Format: {"type":"leak","addr":"0x...","size":1024,"align":64,"frames":[
  *           {"addr":"0x123","bin":"libprofiler.so"},
  *           {"addr":"0x456","bin":"test_program"}
  *         ]}
+ * "align" is only present for memalign family allocations
+ * "kind" is only present for operator new ("new") and new[] ("new[]")
+ * "unloaded" is the id of the dlclose()d module that made it, see modules.c
  */
-static void output_leak_json(allocation_info_t *info) {
-    write_str("{\"type\":\"leak\",\"addr\":\"");
-    write_hex((unsigned long)info->ptr);
-    write_str("\",\"size\":");
-    write_dec(info->size);
-    write_str(",\"frames\":[");
+static void output_leak_json(allocation_info_t *info, unsigned int unloaded) {
+    out_buf_t buf;
+    buf.len = 0;
     
-    // output stack trace frames with binary names
+    buf_str(&buf, "{\"type\":\"leak\",\"addr\":\"");
+    buf_hex(&buf, (unsigned long)info->ptr);
+    buf_str(&buf, "\",\"size\":");
+    buf_dec(&buf, info->size);
+    if (info->alignment) {
+        buf_str(&buf, ",\"align\":");
+        buf_dec(&buf, info->alignment);
+    }
+    if (info->kind == ALLOC_NEW) {
+        buf_str(&buf, ",\"kind\":\"new\"");
+    } else if (info->kind == ALLOC_NEW_ARRAY) {
+        buf_str(&buf, ",\"kind\":\"new[]\"");
+    }
+    if (unloaded) {
+        buf_str(&buf, ",\"unloaded\":");
+        buf_dec(&buf, unloaded);
+    }
+    buf_str(&buf, ",\"frames\":[");
+    
+    // output stack trace frames with binary names (top frames only)
     if (show_stack_traces && info->stack_trace && info->stack_depth > 0) {
-        // limit to top 7 frames
-        int frames_to_show = (info->stack_depth < 7) ? info->stack_depth : 7;
-        // output each frame
-        for (int i = 0; i < frames_to_show; i++) {
-            if (i > 0) write_str(",");
-            
-            // Get binary name using dladdr()
-            Dl_info dl_info;
-            // default is unkown
-            const char *binary_name = "unknown";
-            if (dladdr(info->stack_trace[i], &dl_info) && dl_info.dli_fname) {
-                // Extract just the filename from the full path
-                const char *slash = strrchr(dl_info.dli_fname, '/');
-                binary_name = slash ? (slash + 1) : dl_info.dli_fname;
-            }
-            
-            // Output: {"addr":"0x123","bin":"libprofiler.so"}
-            write_str("{\"addr\":\"");
-            write_hex((unsigned long)info->stack_trace[i]);
-            write_str("\",\"bin\":\"");
-            write_str(binary_name);
-            write_str("\"}");
-        }
+        buf_frames(&buf, info->stack_trace, info->stack_depth, info->modules_epoch);
     }
     
-    write_str("]}\n");
+    buf_str(&buf, "]}\n");
+    buf_flush(&buf);
+}
+
+/*
+ * call fn on every live allocation the exit report would list, with the
+ * registry locked (see sites.c). fn must not allocate; call with
+ * in_profiler set.
+ */
+void hash_table_for_each_live(void (*fn)(const allocation_info_t *info, void *arg), void *arg) {
+    allocation_info_t *current, *tmp;
+    pthread_mutex_lock(&hash_table_mutex);
+    HASH_ITER(hh, g_allocations, current, tmp) {
+        if (is_live(current) && !current->is_suspicious) fn(current, arg);
+    }
+    pthread_mutex_unlock(&hash_table_mutex);
 }
 
 /*
@@ -201,22 +393,45 @@ static void output_leak_json(allocation_info_t *info) {
  * outputs structured JSON data (one object per line):
  * - header: leak count and total bytes
  * - leak: individual leak with address, size, and raw stack frames
- * - summary: final statistics
+ * - summary: final statistics, including the unreleased mappings
+ *   counted by mmap_registry_report_leaks() and peak memory use
  * 
  * separates confirmed leaks vs suspicious leaks (likely libc).
+ * leaks made by a module that has since been dlclose()d are also
+ * counted per module, and listed first (unloaded_module events).
  */
-void hash_table_report_leaks(void) {
+void hash_table_report_leaks(size_t mmap_leaks, size_t mmap_bytes) {
     allocation_info_t *current, *tmp;
     int confirmed_count = 0;
     int suspicious_count = 0;
     size_t confirmed_bytes = 0;
     size_t suspicious_bytes = 0;
+    int aligned_count = 0;
+    size_t aligned_bytes = 0;
+    int unloaded_count = 0;
+    size_t unloaded_bytes = 0;
     
     // first pass: count leaks
     HASH_ITER(hh, g_allocations, current, tmp) {
+        if (!is_live(current)) continue;
+        
         if (!current->is_suspicious) {
             confirmed_count++;
             confirmed_bytes += current->size;
+            
+            // aligned allocations are broken out separately
+            if (current->alignment) {
+                aligned_count++;
+                aligned_bytes += current->size;
+            }
+            
+            unsigned int unloaded = modules_unloaded_owner(current->stack_trace, current->stack_depth,
+                                                           current->modules_epoch);
+            if (unloaded) {
+                unloaded_count++;
+                unloaded_bytes += current->size;
+                modules_count_leak(unloaded, current->size);
+            }
         } else {
             suspicious_count++;
             suspicious_bytes += current->size;
@@ -225,30 +440,59 @@ void hash_table_report_leaks(void) {
     
     // output header and leaks (only if there are leaks)
     if (confirmed_count > 0) {
-        write_str("{\"type\":\"header\",\"leaks_count\":");
-        write_dec(confirmed_count);
-        write_str(",\"total_bytes\":");
-        write_dec(confirmed_bytes);
-        write_str("}\n");
+        modules_report_unloaded();
+        
+        out_buf_t buf;
+        buf.len = 0;
+        buf_str(&buf, "{\"type\":\"header\",\"leaks_count\":");
+        buf_dec(&buf, confirmed_count);
+        buf_str(&buf, ",\"total_bytes\":");
+        buf_dec(&buf, confirmed_bytes);
+        buf_str(&buf, "}\n");
+        buf_flush(&buf);
         
         // output each leak
         HASH_ITER(hh, g_allocations, current, tmp) {
-            if (!current->is_suspicious) {
-                output_leak_json(current);
+            if (is_live(current) && !current->is_suspicious) {
+                output_leak_json(current, modules_unloaded_owner(current->stack_trace, current->stack_depth,
+                                                                 current->modules_epoch));
             }
         }
     }
     
-    // output summary
-    write_str("{\"type\":\"summary\",\"real_leaks\":");
-    write_dec(confirmed_count);
-    write_str(",\"real_bytes\":");
-    write_dec(confirmed_bytes);
-    write_str(",\"libc_leaks\":");
-    write_dec(suspicious_count);
-    write_str(",\"libc_bytes\":");
-    write_dec(suspicious_bytes);
-    write_str("}\n");
+    // output summary, one write() so processes sharing stderr never interleave it
+    out_buf_t buf;
+    buf.len = 0;
+    buf_str(&buf, "{\"type\":\"summary\",\"pid\":");
+    buf_dec(&buf, (size_t)getpid());
+    buf_str(&buf, ",\"real_leaks\":");
+    buf_dec(&buf, confirmed_count);
+    buf_str(&buf, ",\"real_bytes\":");
+    buf_dec(&buf, confirmed_bytes);
+    buf_str(&buf, ",\"libc_leaks\":");
+    buf_dec(&buf, suspicious_count);
+    buf_str(&buf, ",\"libc_bytes\":");
+    buf_dec(&buf, suspicious_bytes);
+    buf_str(&buf, ",\"aligned_leaks\":");
+    buf_dec(&buf, aligned_count);
+    buf_str(&buf, ",\"aligned_bytes\":");
+    buf_dec(&buf, aligned_bytes);
+    buf_str(&buf, ",\"unloaded_leaks\":");
+    buf_dec(&buf, unloaded_count);
+    buf_str(&buf, ",\"unloaded_bytes\":");
+    buf_dec(&buf, unloaded_bytes);
+    buf_str(&buf, ",\"mmap_leaks\":");
+    buf_dec(&buf, mmap_leaks);
+    buf_str(&buf, ",\"mmap_bytes\":");
+    buf_dec(&buf, mmap_bytes);
+    buf_str(&buf, ",\"peak_heap_bytes\":");
+    buf_dec(&buf, stats_peak_bytes(STAT_HEAP));
+    buf_str(&buf, ",\"peak_mapped_bytes\":");
+    buf_dec(&buf, stats_peak_bytes(STAT_MAPPED));
+    buf_str(&buf, ",\"peak_total_bytes\":");
+    buf_dec(&buf, stats_peak_total_bytes());
+    buf_str(&buf, "}\n");
+    buf_flush(&buf);
 }
 
 /*
@@ -257,22 +501,21 @@ void hash_table_report_leaks(void) {
  * free all tracking metadata. called at exit.
  * uses HASH_ITER to safely delete all entries.
  * 
- * thread safety: at exit, program is single-threaded, so no need to lock
+ * thread safety: the program's other threads may still run at exit (their
+ * frees are no longer tracked, but lookups still take the lock), so the
+ * registry is locked. the site reporter is already stopped by then.
  */
 void hash_table_cleanup(void) {
     allocation_info_t *current, *tmp;
     
+    pthread_mutex_lock(&hash_table_mutex);
+    
     // iterate through the remain data in the hash and delete them
-    // at program exit, we're single-threaded, so no lock needed
     HASH_ITER(hh, g_allocations, current, tmp) {
         HASH_DEL(g_allocations, current);  // remove from hash table
-        
-        // free stack trace array first, then the struct
-        if (current->stack_trace) {
-            real_free_ptr(current->stack_trace);
-        }
-        real_free_ptr(current);
+        free_info(current);
     }
     
     g_allocations = NULL;
+    pthread_mutex_unlock(&hash_table_mutex);
 }
@@ -2,6 +2,9 @@
  * memory profiler - main interception layer
  * 
  * implements the LD_PRELOAD magic that intercepts malloc/free.
+ * covers the whole malloc family: malloc, calloc, realloc, reallocarray,
+ * free, free_sized, free_aligned_sized, posix_memalign, aligned_alloc,
+ * memalign, valloc, pvalloc and malloc_usable_size.
  * 
  * how it works:
  * 1. we define malloc() and free() functions here
@@ -9,6 +12,10 @@
  *    loads our functions before libc's
  * 3. our functions intercept the call, track it, then call the real malloc/free
  * 
+ * for static binaries the same code is built into libprofiler.a as
+ * __wrap_malloc() etc. (see PROFILER_INTERPOSE), and the linker's --wrap
+ * option routes the program's calls to it.
+ * 
  * the bootstrap problem:
  * our tracking code needs to allocate memory for metadata. if we track
  * that allocation, we get infinite recursion:
@@ -17,6 +24,25 @@
  * solution:
  * use the 'in_profiler' flag. when inside profiler code, we don't track.
  * this prevents recursion when our own code (like hash_table_add) calls malloc.
+ * the flag is thread-local, so one thread inside the profiler doesn't
+ * hide the allocations of every other thread.
+ * 
+ * the init problem:
+ * profiler_init() resolves the real functions with dlsym(), which may
+ * itself call malloc/calloc before they are known. init is a small state
+ * machine (uninitialized -> initializing -> ready) driven by an atomic:
+ * - the thread that wins the transition runs init; its re-entrant calls
+ *   are served from the static bootstrap arena (bootstrap_arena.c)
+ * - other threads wait for the ready state
+ * - free() recognises arena blocks by address and ignores them
+ * init runs eagerly from the library constructor, so usually no
+ * interposer ever sees anything but the ready state.
+ * 
+ * dormant mode:
+ * with PROFILER_DORMANT=1 every interposer starts with one test of
+ * profiler_dormant and forwards straight to libc until tracking is
+ * activated (activation.c). the flag is only set by init, after the real
+ * functions are known.
  * 
  * we must avoid any libc functions that might call malloc.
  * write() is a direct syscall with zero dependency on libc buffering.
@@ -26,20 +52,71 @@
 #define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
+#include <errno.h>
+#include <malloc.h>
 #include <dlfcn.h>
 #include <string.h>
 #include <unistd.h>     
 #include <execinfo.h>  
+#include <sched.h>
 #include "../include/profiler_internal.h"
+#include "../include/real_alloc.h"
 
-// maximum stack frames to capture
-#define MAX_STACK_FRAMES 16
+#ifdef PROFILER_LINK_WRAP
+// the rest of the family, see real_alloc.h
+void* __real_calloc(size_t, size_t);
+void* __real_realloc(void*, size_t);
+int __real_posix_memalign(void**, size_t, size_t);
+void* __real_aligned_alloc(size_t, size_t);
+void* __real_valloc(size_t);
+void* __real_pvalloc(size_t);
+size_t __real_malloc_usable_size(void*);
+void __real_free_sized(void*, size_t) __attribute__((weak));
+void __real_free_aligned_sized(void*, size_t, size_t) __attribute__((weak));
 
+#define real_calloc __real_calloc
+#define real_realloc __real_realloc
+#define real_posix_memalign __real_posix_memalign
+#define real_aligned_alloc __real_aligned_alloc
+#define real_valloc __real_valloc
+#define real_pvalloc __real_pvalloc
+#define real_malloc_usable_size __real_malloc_usable_size
+#define real_free_sized __real_free_sized
+#define real_free_aligned_sized __real_free_aligned_sized
+#elif defined(PROFILER_LIBC_BIND)
+// cleared by profiler_init(), before any call, if RTLD_NEXT is not libc
+int libc_bound = 1;
+void* (*next_malloc)(size_t) = NULL;
+void (*next_free)(void*) = NULL;
+void* (*next_calloc)(size_t, size_t) = NULL;
+void* (*next_realloc)(void*, size_t) = NULL;
+void* (*next_memalign)(size_t, size_t) = NULL;
+void* (*next_valloc)(size_t) = NULL;
+void* (*next_pvalloc)(size_t) = NULL;
+
+static int (*real_posix_memalign)(void**, size_t, size_t) = NULL;
+static void* (*real_aligned_alloc)(size_t, size_t) = NULL;
+static size_t (*real_malloc_usable_size)(void*) = NULL;
+static void (*real_free_sized)(void*, size_t) = NULL;
+static void (*real_free_aligned_sized)(void*, size_t, size_t) = NULL;
+#else
 // function pointers to the real libc malloc/free 
-static void* (*real_malloc)(size_t) = NULL;
-static void (*real_free)(void*) = NULL;
+void* (*real_malloc)(size_t) = NULL;
+void (*real_free)(void*) = NULL;
+void* (*real_memalign)(size_t, size_t) = NULL;
 static void* (*real_calloc)(size_t, size_t) = NULL;
 static void* (*real_realloc)(void*, size_t) = NULL;
+static int (*real_posix_memalign)(void**, size_t, size_t) = NULL;
+static void* (*real_aligned_alloc)(size_t, size_t) = NULL;
+static void* (*real_valloc)(size_t) = NULL;
+static void* (*real_pvalloc)(size_t) = NULL;
+static size_t (*real_malloc_usable_size)(void*) = NULL;
+static void (*real_free_sized)(void*, size_t) = NULL;
+static void (*real_free_aligned_sized)(void*, size_t, size_t) = NULL;
+#endif
+
+// system page size, alignment recorded for valloc/pvalloc
+static size_t page_size = 4096;
 
 // export these for hash_table.c to use
 void* (*real_malloc_ptr)(size_t) = NULL;
@@ -47,47 +124,126 @@ void (*real_free_ptr)(void*) = NULL;
 int show_stack_traces = 1;  // exported configuration
 
 // bootstrap protection - prevents tracking our own allocations
-static int in_profiler = 0;
+PROFILER_TLS int in_profiler = 0;
+
+// initialization state machine, see profiler_init()
+int profiler_init_state = PROFILER_UNINITIALIZED;
+int profiler_shutting_down = 0;  // skip validation during cleanup
 
-// initialization flags  
-static int profiler_initialized = 0;
-static int profiler_shutting_down = 0;  // skip validation during cleanup
+// set on the thread running profiler_init(), for re-entry detection
+static PROFILER_TLS int init_running_here = 0;
+
+// helpers defined at the bottom of this file
+static void profiler_log(const char *msg) __attribute__((unused));
 
 /*
  * initialize the profiler
  * 
- * called once on first malloc/free call.
- * uses dlsym() to get pointers to the real libc functions.
+ * called from the library constructor, or from the first interposer that
+ * runs before it. uses dlsym() to get pointers to the real libc functions.
+ * 
+ * returns 1 once the real functions are usable, 0 if the calling thread
+ * is the one running init (re-entered from dlsym) - the caller must then
+ * use the bootstrap arena.
  */
-static void profiler_init(void) {
-    if (profiler_initialized) return;
+int profiler_init(void) {
+    int expected = PROFILER_UNINITIALIZED;
+    if (!__atomic_compare_exchange_n(&profiler_init_state, &expected, PROFILER_INITIALIZING,
+                                     0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        if (expected == PROFILER_READY) return 1;
+        
+        // re-entered from our own dlsym() call
+        if (init_running_here) return 0;
+        
+        // another thread is initializing, wait for it
+        while (__atomic_load_n(&profiler_init_state, __ATOMIC_ACQUIRE) != PROFILER_READY) {
+            sched_yield();
+        }
+        return 1;
+    }
     
-    profiler_initialized = 1;
+    init_running_here = 1;
     
     // read configuration from environment variables
     const char *env_stack_traces = getenv("PROFILER_STACK_TRACES");
     if (env_stack_traces && strcmp(env_stack_traces, "0") == 0) {
         show_stack_traces = 0;  // disabled
     }
+    const char *env_symbolize = getenv("PROFILER_SYMBOLIZE");
+    if (env_symbolize && strcmp(env_symbolize, "1") == 0) {
+        symbolize_frames = 1;
+    }
     
+#ifndef PROFILER_LINK_WRAP
     // get real function pointers using dlsym
+    // a failed lookup makes dlsym allocate and free its error string
+    // through us; those calls are served by the bootstrap arena
+#ifndef PROFILER_LIBC_BIND
     real_malloc = dlsym(RTLD_NEXT, "malloc");
     real_free = dlsym(RTLD_NEXT, "free");
     real_calloc = dlsym(RTLD_NEXT, "calloc");
     real_realloc = dlsym(RTLD_NEXT, "realloc");
+    real_memalign = dlsym(RTLD_NEXT, "memalign");
+    real_valloc = dlsym(RTLD_NEXT, "valloc");
+    real_pvalloc = dlsym(RTLD_NEXT, "pvalloc");
+#endif
+    real_posix_memalign = dlsym(RTLD_NEXT, "posix_memalign");
+    real_aligned_alloc = dlsym(RTLD_NEXT, "aligned_alloc");
+    real_malloc_usable_size = dlsym(RTLD_NEXT, "malloc_usable_size");
+    
+    // C23 sized frees only exist in newer libcs, plain free() is equivalent
+    real_free_sized = dlsym(RTLD_NEXT, "free_sized");
+    real_free_aligned_sized = dlsym(RTLD_NEXT, "free_aligned_sized");
+#endif
+    
+    long sys_page_size = sysconf(_SC_PAGESIZE);
+    if (sys_page_size > 0) {
+        page_size = (size_t)sys_page_size;
+    }
     
+#if defined(PROFILER_LIBC_BIND)
+    // another malloc behind us: nothing has been allocated through
+    // __libc_* yet (init runs first), so go through it from here on
+    next_malloc = dlsym(RTLD_NEXT, "malloc");
+    if (next_malloc && next_malloc != __libc_malloc) {
+        next_free = dlsym(RTLD_NEXT, "free");
+        next_calloc = dlsym(RTLD_NEXT, "calloc");
+        next_realloc = dlsym(RTLD_NEXT, "realloc");
+        next_memalign = dlsym(RTLD_NEXT, "memalign");
+        next_valloc = dlsym(RTLD_NEXT, "valloc");
+        next_pvalloc = dlsym(RTLD_NEXT, "pvalloc");
+        if (next_free && next_calloc && next_realloc && next_memalign && next_valloc && next_pvalloc) {
+            libc_bound = 0;
+            profiler_log("[PROFILER WARNING] malloc is replaced by another library, "
+                         "calling it through dlsym()\n");
+        } else {
+            profiler_log("[PROFILER WARNING] malloc is replaced by another library "
+                         "without the whole family, staying on glibc's\n");
+        }
+    }
+#elif !defined(PROFILER_LINK_WRAP)
     // verify we found the real functions
     if (!real_malloc || !real_free) {
         profiler_log("[PROFILER ERROR] Failed to find real malloc/free\n");
         _exit(1);  
     }
+#endif
     
     // export for hash_table.c to use
     real_malloc_ptr = real_malloc;
     real_free_ptr = real_free;
     
     // initialize tracking system
+    output_init();
+    trace_init();
     hash_table_init();
+    corruption_init();
+    activation_init();
+    
+    // publish the real function pointers to every thread
+    init_running_here = 0;
+    __atomic_store_n(&profiler_init_state, PROFILER_READY, __ATOMIC_RELEASE);
+    return 1;
 }
 
 /*
@@ -98,9 +254,23 @@ static void profiler_init(void) {
  */
 __attribute__((destructor))
 static void profiler_cleanup(void) {
+    // the site reporter walks the registry, it must be gone before
+    // the report and the teardown below
+    sites_stop();
     profiler_shutting_down = 1;  // disable corruption detection during cleanup
-    hash_table_report_leaks();
+    trace_finish();
+    
+    // a process that never left dormant mode (or went back) has nothing to say
+    if (!profiler_dormant) {
+        corruption_report_summary();
+        
+        size_t mmap_leaks, mmap_bytes;
+        mmap_registry_report_leaks(&mmap_leaks, &mmap_bytes);
+        hash_table_report_leaks(mmap_leaks, mmap_bytes);
+    }
+    
     hash_table_cleanup();
+    mmap_registry_cleanup();
 }
 
 /*
@@ -109,33 +279,17 @@ static void profiler_cleanup(void) {
  * this gets called instead of libc's malloc.
  * we track the allocation then call the real malloc.
  */
-void* malloc(size_t size) {
-    // initialize on first call
-    if (!profiler_initialized) {
-        profiler_init();
+void* PROFILER_INTERPOSE(malloc)(size_t size) {
+    if (profiler_dormant) return real_malloc(size);
+    
+    // initialize on first call, or serve init's own allocations
+    if (!profiler_enter()) {
+        return bootstrap_alloc(size, 0);
     }
     
     // call the real malloc
     void *ptr = real_malloc(size);
-    
-    // track it only if we're not in the profiler code (prevents recursion) 
-    // for me: eg malloc -> track -> malloc -> track -> ...
-    if (!in_profiler && ptr) {
-        in_profiler = 1;
-        
-        // capture stack trace - backtrace stores return addresses in the array
-        // eg: main -> helper -> helper2, both main and helper are in the array
-        void *trace[MAX_STACK_FRAMES];
-        int depth = backtrace(trace, MAX_STACK_FRAMES);
-        
-        // check if this looks like libc infrastructure allocation
-        int is_suspicious = is_likely_libc_allocation(trace, depth);
-        
-        // track the allocation with stack trace and suspicion flag
-        hash_table_add(ptr, size, trace, depth, is_suspicious);
-        in_profiler = 0;
-    }
-    
+    track_allocation(ptr, size, 0, ALLOC_MALLOC);
     return ptr;
 }
 
@@ -147,15 +301,21 @@ void* malloc(size_t size) {
  * if corruption is detected, reports error immediately and skips the free
  * to prevent crashes or heap corruption.
  */
-void free(void *ptr) {
-    // initialize if needed (shouldn't happen, but be safe)
-    if (!profiler_initialized) {
-        profiler_init();
-    }
-    
+void PROFILER_INTERPOSE(free)(void *ptr) {
     // don't free NULL 
     if (!ptr) return;
     
+    // bootstrap arena blocks are never released
+    if (bootstrap_owns(ptr)) return;
+    
+    if (profiler_dormant) {
+        real_free(ptr);
+        return;
+    }
+    
+    // initialize if needed (shouldn't happen, but be safe)
+    if (!profiler_enter()) return;
+    
     // skip validation during profiler shutdown (cleanup frees internal metadata)
     if (profiler_shutting_down) {
         real_free(ptr);
@@ -163,81 +323,155 @@ void free(void *ptr) {
     }
     
     // validate and remove from tracking
-    if (!in_profiler) {
-        in_profiler = 1;
-        
-        // check if this pointer exists in our tracking table
-        int found = hash_table_find(ptr);
-        
-        if (!found) {
-            // pointer not in table - either double-free or invalid-free
-            // report the error immediately
-            report_corruption_error(ptr, "Double-Free or Invalid-Free");
-            in_profiler = 0;
-            
-            // don't call real_free() - would crash or corrupt heap!
-            return;
-        }
-        
-        // valid free - remove from tracking
-        hash_table_remove(ptr);
-        in_profiler = 0;
+    // on double-free or invalid-free, don't call real_free() - would crash or corrupt heap!
+    if (!untrack_allocation(ptr, ALLOC_MALLOC, SIZE_UNCHECKED, 0, NULL)) {
+        return;
     }
     
     // call real free
     real_free(ptr);
 }
 
+/*
+ * intercepted free_sized() (C23)
+ * 
+ * the caller promises size is exactly what it asked malloc/calloc/realloc
+ * for. the record is already fetched by the free path's single registry
+ * lookup, so checking the promise costs one compare. a broken promise,
+ * or a block from the memalign family (which needs free_aligned_sized),
+ * is reported as "Sized-Free-Mismatch" and the block is still released.
+ */
+void PROFILER_INTERPOSE(free_sized)(void *ptr, size_t size) {
+    if (!ptr) return;
+    if (bootstrap_owns(ptr)) return;
+    if (profiler_dormant) {
+        real_free(ptr);
+        return;
+    }
+    if (!profiler_enter()) return;
+    
+    if (profiler_shutting_down) {
+        real_free(ptr);
+        return;
+    }
+    
+    if (!untrack_allocation(ptr, ALLOC_MALLOC, size, ALIGNMENT_NONE, "Sized-Free-Mismatch")) {
+        return;
+    }
+    
+    if (real_free_sized) {
+        real_free_sized(ptr, size);
+    } else {
+        real_free(ptr);
+    }
+}
+
+/*
+ * intercepted free_aligned_sized() (C23)
+ * 
+ * same as free_sized(), for aligned_alloc() blocks: both the alignment
+ * and the size must match the record.
+ */
+void PROFILER_INTERPOSE(free_aligned_sized)(void *ptr, size_t alignment, size_t size) {
+    if (!ptr) return;
+    if (bootstrap_owns(ptr)) return;
+    if (profiler_dormant) {
+        real_free(ptr);
+        return;
+    }
+    if (!profiler_enter()) return;
+    
+    if (profiler_shutting_down) {
+        real_free(ptr);
+        return;
+    }
+    
+    // alignment 0 would mean "unchecked" to the helper, and is never valid here
+    size_t expected_alignment = alignment ? alignment : SIZE_UNCHECKED;
+    if (!untrack_allocation(ptr, ALLOC_MALLOC, size, expected_alignment, "Sized-Free-Mismatch")) {
+        return;
+    }
+    
+    if (real_free_aligned_sized) {
+        real_free_aligned_sized(ptr, alignment, size);
+    } else {
+        real_free(ptr);
+    }
+}
+
 /*
  * intercepted calloc()
  * 
  * calloc allocates and zeros memory. track it like malloc.
  */
-void* calloc(size_t nmemb, size_t size) {
-    if (!profiler_initialized) {
-        profiler_init();
+void* PROFILER_INTERPOSE(calloc)(size_t nmemb, size_t size) {
+    if (profiler_dormant) return real_calloc(nmemb, size);
+    
+    if (!profiler_enter()) {
+        // arena memory is never reused, so it is already zero
+        size_t total;
+        if (__builtin_mul_overflow(nmemb, size, &total)) {
+            errno = ENOMEM;
+            return NULL;
+        }
+        return bootstrap_alloc(total, 0);
     }
     
     // call real calloc and track it
     void *ptr = real_calloc(nmemb, size);
-    
-    if (!in_profiler && ptr) {
-        in_profiler = 1;
-        
-        // capture stack trace
-        void *trace[MAX_STACK_FRAMES];
-        int depth = backtrace(trace, MAX_STACK_FRAMES);
-        
-        // check if this looks like libc infrastructure allocation
-        int is_suspicious = is_likely_libc_allocation(trace, depth);
-        
-        hash_table_add(ptr, nmemb * size, trace, depth, is_suspicious);
-        in_profiler = 0;
-    }
-    
+    track_call(ptr, nmemb * size, 0, ALLOC_MALLOC, TRACE_CALLOC, NULL);
     return ptr;
 }
 
 /*
- * intercepted realloc()
+ * shared body of realloc() and reallocarray()
  * 
  * realloc can act like malloc (if ptr is NULL), free (if size is 0),
  * or move the allocation to a new address.
  * we remove old tracking and add new tracking.
  */
-void* realloc(void *ptr, size_t size) {
-    if (!profiler_initialized) {
-        profiler_init();
+static inline __attribute__((always_inline))
+void* realloc_tracked(void *ptr, size_t size) {
+    // arena blocks still need moving by hand, see below
+    if (profiler_dormant && !(ptr && bootstrap_owns(ptr))) {
+        return real_realloc(ptr, size);
+    }
+    
+    // during init everything comes from the arena
+    if (!profiler_enter()) {
+        void *new_ptr = bootstrap_alloc(size, 0);
+        if (new_ptr && ptr && bootstrap_owns(ptr)) {
+            size_t old_size = bootstrap_size(ptr);
+            memcpy(new_ptr, ptr, old_size < size ? old_size : size);
+        }
+        return new_ptr;
+    }
+    
+    // arena blocks can't grow in place: move them to the real heap
+    if (ptr && bootstrap_owns(ptr)) {
+        void *new_ptr = real_malloc(size);
+        if (new_ptr) {
+            size_t old_size = bootstrap_size(ptr);
+            memcpy(new_ptr, ptr, old_size < size ? old_size : size);
+            track_allocation(new_ptr, size, 0, ALLOC_MALLOC);
+        }
+        return new_ptr;
     }
     
     // if ptr is NULL, this is just malloc
     if (!ptr) {
-        return malloc(size);
+        void *new_ptr = real_malloc(size);
+        track_call(new_ptr, size, 0, ALLOC_MALLOC, TRACE_REALLOC, NULL);
+        return new_ptr;
     }
     
-    // if size is 0, this is just free
+    // if size is 0, this is just free, checked inline so reports name
+    // realloc's caller rather than our realloc
     if (size == 0) {
-        free(ptr);
+        if (profiler_shutting_down ||
+            untrack_allocation(ptr, ALLOC_MALLOC, SIZE_UNCHECKED, 0, NULL)) {
+            real_free(ptr);
+        }
         return NULL;
     }
     
@@ -245,30 +479,171 @@ void* realloc(void *ptr, size_t size) {
     void *new_ptr = real_realloc(ptr, size);
     
     // update tracking: remove old, add new
-    if (!in_profiler) {
+    // on failure the old block is still live, so keep tracking it
+    if (new_ptr && in_profiler) {
+        deferred_op_t op = { .type = DEFER_FORGET, .ptr = ptr };
+        defer_op(&op);
+    } else if (new_ptr) {
         in_profiler = 1;
         hash_table_remove(ptr);
-        if (new_ptr) {
-            // capture stack trace
-            void *trace[MAX_STACK_FRAMES];
-            int depth = backtrace(trace, MAX_STACK_FRAMES);
-            
-            // check if this looks like libc infrastructure allocation
-            int is_suspicious = is_likely_libc_allocation(trace, depth);
-            
-            hash_table_add(new_ptr, size, trace, depth, is_suspicious);
-        }
-        in_profiler = 0;
+        profiler_leave();
     }
+    track_call(new_ptr, size, 0, ALLOC_MALLOC, TRACE_REALLOC, ptr);
     
     return new_ptr;
 }
 
+/*
+ * intercepted realloc()
+ */
+void* PROFILER_INTERPOSE(realloc)(void *ptr, size_t size) {
+    return realloc_tracked(ptr, size);
+}
+
+/*
+ * intercepted reallocarray()
+ * 
+ * realloc with an overflow check on nmemb * size.
+ */
+void* PROFILER_INTERPOSE(reallocarray)(void *ptr, size_t nmemb, size_t size) {
+    size_t total;
+    if (__builtin_mul_overflow(nmemb, size, &total)) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    return realloc_tracked(ptr, total);
+}
+
+/*
+ * intercepted posix_memalign()
+ * 
+ * returns an error code instead of setting errno. *memptr is only
+ * written on success.
+ */
+int PROFILER_INTERPOSE(posix_memalign)(void **memptr, size_t alignment, size_t size) {
+    if (profiler_dormant) return real_posix_memalign(memptr, alignment, size);
+    
+    if (!profiler_enter()) {
+        void *ptr = bootstrap_alloc(size, alignment);
+        if (!ptr) return ENOMEM;
+        *memptr = ptr;
+        return 0;
+    }
+    
+    int ret = real_posix_memalign(memptr, alignment, size);
+    if (ret == 0) {
+        track_allocation(*memptr, size, alignment, ALLOC_MALLOC);
+    }
+    return ret;
+}
+
+/*
+ * intercepted aligned_alloc() (C11)
+ */
+void* PROFILER_INTERPOSE(aligned_alloc)(size_t alignment, size_t size) {
+    if (profiler_dormant) return real_aligned_alloc(alignment, size);
+    
+    if (!profiler_enter()) {
+        return bootstrap_alloc(size, alignment);
+    }
+    
+    void *ptr = real_aligned_alloc(alignment, size);
+    track_allocation(ptr, size, alignment, ALLOC_MALLOC);
+    return ptr;
+}
+
+/*
+ * intercepted memalign() (obsolete, still used by older code)
+ */
+void* PROFILER_INTERPOSE(memalign)(size_t alignment, size_t size) {
+    if (profiler_dormant) return real_memalign(alignment, size);
+    
+    if (!profiler_enter()) {
+        return bootstrap_alloc(size, alignment);
+    }
+    
+    void *ptr = real_memalign(alignment, size);
+    track_allocation(ptr, size, alignment, ALLOC_MALLOC);
+    return ptr;
+}
+
+/*
+ * intercepted valloc() - page aligned allocation
+ */
+void* PROFILER_INTERPOSE(valloc)(size_t size) {
+    if (profiler_dormant) return real_valloc(size);
+    
+    if (!profiler_enter()) {
+        return bootstrap_alloc(size, page_size);
+    }
+    
+    void *ptr = real_valloc(size);
+    track_allocation(ptr, size, page_size, ALLOC_MALLOC);
+    return ptr;
+}
+
+/*
+ * intercepted pvalloc() - page aligned, size rounded up to whole pages
+ * 
+ * we record the rounded size since that is what the caller owns.
+ */
+void* PROFILER_INTERPOSE(pvalloc)(size_t size) {
+    if (profiler_dormant) return real_pvalloc(size);
+    
+    if (!profiler_enter()) {
+        return bootstrap_alloc((size + page_size - 1) & ~(page_size - 1), page_size);
+    }
+    
+    void *ptr = real_pvalloc(size);
+    size_t rounded = (size + page_size - 1) & ~(page_size - 1);
+    if (rounded == 0) rounded = page_size;
+    track_allocation(ptr, rounded, page_size, ALLOC_MALLOC);
+    return ptr;
+}
+
+/*
+ * intercepted malloc_usable_size()
+ * 
+ * pure query, forwarded as is. interposed so every malloc entry point
+ * goes through the profiler and the real symbol is resolved in one place.
+ */
+size_t PROFILER_INTERPOSE(malloc_usable_size)(void *ptr) {
+    if (ptr && bootstrap_owns(ptr)) {
+        return bootstrap_size(ptr);
+    }
+    if (!profiler_enter()) return 0;
+    
+    return real_malloc_usable_size(ptr);
+}
+
 // safe output function - uses direct syscall, never calls malloc
 static void profiler_log(const char *msg) {
     write(STDERR_FILENO, msg, strlen(msg));
 }
 
+// shared objects that make up the C/C++ runtime and the loader
+static int is_runtime_object(const char *fname) {
+    return fname && (strstr(fname, "libstdc++.so") || strstr(fname, "libc.so") ||
+                     strstr(fname, "libgcc_s.so") || strstr(fname, "ld-linux"));
+}
+
+/*
+ * is every caller above frame 1 part of the runtime?
+ * true for libstdc++'s static initializers run by the loader. a truncated
+ * stack may hide a user frame, so it never qualifies.
+ */
+static int is_runtime_only_stack(void **stack_trace, int depth) {
+    if (depth >= MAX_STACK_FRAMES) return 0;
+
+    for (int i = 2; i < depth; i++) {
+        Dl_info info;
+        if (dladdr(stack_trace[i], &info) == 0 || !is_runtime_object(info.dli_fname)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
 /*
  * check if allocation likely came from libc infrastructure
  *
@@ -284,7 +659,7 @@ static void profiler_log(const char *msg) {
  * 
  * returns: 1 if suspicious (likely false positive), 0 if real leak
  */
-static int is_likely_libc_allocation(void **stack_trace, int depth) {
+int is_likely_libc_allocation(void **stack_trace, int depth) {
     if (!stack_trace || depth < 2) {
         return 0;  // can't determine, assume real
     }
@@ -300,54 +675,20 @@ static int is_likely_libc_allocation(void **stack_trace, int depth) {
         if (info.dli_fname && strstr(info.dli_fname, "libc.so")) {
             return 1;  // direct libc call, suspicious
         }
-    }
-    
-    return 0;  // not from libc, likely user code
-}
-
-/*
- * report memory corruption error
- * 
- * called when we detect double-free or invalid-free.
- * reports immediately, doesn't wait for program exit.
- * 
- * outputs JSON format: {"type":"Double-Free or Invalid-Free","addr":"0x...","frames":[...]}
- * stack trace can be disabled with PROFILER_STACK_TRACES=0
- */
-static void report_corruption_error(void *ptr, const char *error_type) {
-    // Output corruption event in JSON format 
-    write_str("{\"type\":\"");
-    write_str(error_type);
-    write_str("\",\"addr\":\"");
-    write_hex((unsigned long)ptr);
-    write_str("\",\"frames\":[");
-    
-    // Capture and output stack trace if enabled (top 7 frames only)
-    if (show_stack_traces) {
-        void *stack_trace[MAX_STACK_FRAMES];
-        int depth = backtrace(stack_trace, MAX_STACK_FRAMES);
-        int frames_to_show = (depth < 7) ? depth : 7;
         
-        for (int i = 0; i < frames_to_show; i++) {
-            if (i > 0) write_str(",");
-            
-            // Get binary name using dladdr()
-            Dl_info dl_info;
-            const char *binary_name = "unknown";
-            if (dladdr(stack_trace[i], &dl_info) && dl_info.dli_fname) {
-                // Extract just the filename from the full path
-                const char *slash = strrchr(dl_info.dli_fname, '/');
-                binary_name = slash ? (slash + 1) : dl_info.dli_fname;
-            }
-            
-            // Output: {"addr":"0x123","bin":"libprofiler.so"}
-            write_str("{\"addr\":\"");
-            write_hex((unsigned long)stack_trace[i]);
-            write_str("\",\"bin\":\"");
-            write_str(binary_name);
-            write_str("\"}");
+        // the C++ runtime calls operator new for user containers too
+        // (std::string, std::vector), so only its own startup allocations
+        // count: the eh emergency pool and locale setup, reached from
+        // static initializers with no user frame on the stack
+        if (info.dli_fname && strstr(info.dli_fname, "libstdc++.so")) {
+            return is_runtime_only_stack(stack_trace, depth);
+        }
+        
+        // and the dynamic loader (TLS blocks of new threads, dlopen)
+        if (info.dli_fname && strstr(info.dli_fname, "ld-linux")) {
+            return 1;
         }
     }
     
-    write_str("]}\n");
+    return 0;  // not from libc, likely user code
 }
@@ -0,0 +1,245 @@
+/*
+ * mmap interception layer
+ *
+ * large buffers often come straight from mmap(), and those are invisible
+ * to the malloc interposers. we wrap mmap/mmap64/munmap/mremap/madvise
+ * and feed anonymous mappings into the range index in mmap_registry.c,
+ * which reports the ones never unmapped at exit.
+ *
+ * file-backed mappings are not tracked, but they still punch holes in
+ * tracked ranges when mapped MAP_FIXED over them.
+ *
+ * glibc's own mmap() calls (large malloc chunks, thread stacks, the
+ * loader) use internal entry points and never reach us, so large
+ * mallocs are not counted twice.
+ */
+
+#define _GNU_SOURCE
+#include <stdarg.h>
+#include <dlfcn.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "../include/profiler_internal.h"
+
+#ifdef PROFILER_LINK_WRAP
+// link-time build: bound by the linker, see malloc_intercept.c
+void *__real_mmap(void*, size_t, int, int, int, off_t);
+int __real_munmap(void*, size_t);
+void *__real_mremap(void*, size_t, size_t, int, ...);
+int __real_madvise(void*, size_t, int);
+
+#define real_mmap __real_mmap
+#define real_munmap __real_munmap
+#define real_mremap __real_mremap
+#define real_madvise __real_madvise
+
+static inline void mmap_intercept_init(void) {}
+#else
+static void* (*real_mmap)(void*, size_t, int, int, int, off_t) = NULL;
+static int (*real_munmap)(void*, size_t) = NULL;
+static void* (*real_mremap)(void*, size_t, size_t, int, ...) = NULL;
+static int (*real_madvise)(void*, size_t, int) = NULL;
+
+// used until dlsym is usable (very early in startup)
+static void *sys_mmap(void *addr, size_t len, int prot, int flags, int fd, off_t offset) {
+    return (void*)syscall(SYS_mmap, addr, len, prot, flags, fd, offset);
+}
+
+static int sys_munmap(void *addr, size_t len) {
+    return (int)syscall(SYS_munmap, addr, len);
+}
+
+static void *sys_mremap(void *old_address, size_t old_size, size_t new_size, int flags, ...) {
+    void *new_address = NULL;
+    if (flags & MREMAP_FIXED) {
+        va_list ap;
+        va_start(ap, flags);
+        new_address = va_arg(ap, void*);
+        va_end(ap);
+    }
+    return (void*)syscall(SYS_mremap, old_address, old_size, new_size, flags, new_address);
+}
+
+static int sys_madvise(void *addr, size_t len, int advice) {
+    return (int)syscall(SYS_madvise, addr, len, advice);
+}
+
+/*
+ * resolve the real functions
+ *
+ * mmap can be called before profiler_init() runs, so this is separate
+ * and cheap to call from every interposer. real_mmap is the done flag:
+ * it is published last with release, so a thread that sees it set with
+ * acquire also sees the other three. two threads racing here store the
+ * same values.
+ */
+static void mmap_intercept_init(void) {
+    if (__atomic_load_n(&real_mmap, __ATOMIC_ACQUIRE)) return;
+
+    real_munmap = dlsym(RTLD_NEXT, "munmap");
+    real_mremap = dlsym(RTLD_NEXT, "mremap");
+    real_madvise = dlsym(RTLD_NEXT, "madvise");
+    void *(*resolved_mmap)(void*, size_t, int, int, int, off_t) = dlsym(RTLD_NEXT, "mmap");
+
+    if (!real_munmap) real_munmap = sys_munmap;
+    if (!real_mremap) real_mremap = sys_mremap;
+    if (!real_madvise) real_madvise = sys_madvise;
+    __atomic_store_n(&real_mmap, resolved_mmap ? resolved_mmap : sys_mmap, __ATOMIC_RELEASE);
+}
+#endif
+
+/*
+ * same idea as track_allocation(), for mappings
+ * always inlined so frame 1 is the caller of mmap()
+ */
+static inline __attribute__((always_inline))
+void track_mapping(void *addr, size_t len) {
+    if (addr == MAP_FAILED) return;
+
+    // re-entered (signal handler): queue it, see deferred.c
+    if (in_profiler) {
+        deferred_op_t op = { .type = DEFER_MAP, .ptr = addr, .size = len,
+                             .caller = __builtin_return_address(0) };
+        defer_op(&op);
+        return;
+    }
+    in_profiler = 1;
+
+    void *trace[MAX_STACK_FRAMES];
+    int depth = capture_stack(trace);
+    int is_suspicious = depth ? is_likely_libc_allocation(trace, depth) : 1;
+    mmap_registry_add(addr, len, trace, depth, is_suspicious);
+
+    profiler_leave();
+}
+
+/*
+ * registry updates that need no stack (unmap, move, dontneed)
+ *
+ * munmap() and mremap() give an address range back before the registry
+ * hears of it. the recursion guard is taken before the syscall, so a
+ * signal handler mapping that range again in between is queued behind
+ * our update instead of being overwritten by it.
+ * returns 1 if re-entered: updates must then be queued, see deferred.c
+ */
+static inline __attribute__((always_inline)) int mappings_enter(void) {
+    if (in_profiler) return 1;
+    in_profiler = 1;
+    return 0;
+}
+
+// apply op (if any) and leave, or queue it when re-entered
+static void mappings_leave(int nested, const deferred_op_t *op) {
+    if (nested) {
+        if (op) defer_op(op);
+        return;
+    }
+
+    if (op && op->type == DEFER_UNMAP) {
+        mmap_registry_remove(op->ptr, op->size);
+    } else if (op && op->type == DEFER_MOVE) {
+        mmap_registry_move(op->ptr, op->size, op->new_ptr, op->new_size, op->keep_old);
+    } else if (op && op->type == DEFER_DONTNEED) {
+        mmap_registry_dontneed(op->ptr, op->size);
+    }
+
+    profiler_leave();
+}
+
+static inline __attribute__((always_inline))
+void *mmap_tracked(void *addr, size_t len, int prot, int flags, int fd, off_t offset) {
+    mmap_intercept_init();
+
+    void *result = real_mmap(addr, len, prot, flags, fd, offset);
+    if (result == MAP_FAILED || profiler_shutting_down || profiler_dormant) return result;
+
+    if (flags & MAP_ANONYMOUS) {
+        track_mapping(result, len);
+    } else if (flags & MAP_FIXED) {
+        // a file mapping replaced whatever anonymous pages were there
+        deferred_op_t op = { .type = DEFER_UNMAP, .ptr = result, .size = len };
+        mappings_leave(mappings_enter(), &op);
+    }
+    return result;
+}
+
+/*
+ * intercepted mmap() / mmap64()
+ */
+void *PROFILER_INTERPOSE(mmap)(void *addr, size_t len, int prot, int flags, int fd, off_t offset) {
+    return mmap_tracked(addr, len, prot, flags, fd, offset);
+}
+
+void *PROFILER_INTERPOSE(mmap64)(void *addr, size_t len, int prot, int flags, int fd, off_t offset) {
+    return mmap_tracked(addr, len, prot, flags, fd, offset);
+}
+
+/*
+ * intercepted munmap()
+ *
+ * any sub-range may be unmapped, the registry trims or splits entries.
+ */
+int PROFILER_INTERPOSE(munmap)(void *addr, size_t len) {
+    mmap_intercept_init();
+
+    if (profiler_shutting_down || profiler_dormant) return real_munmap(addr, len);
+
+    int nested = mappings_enter();
+    int ret = real_munmap(addr, len);
+    deferred_op_t op = { .type = DEFER_UNMAP, .ptr = addr, .size = len };
+    mappings_leave(nested, ret == 0 ? &op : NULL);
+    return ret;
+}
+
+/*
+ * intercepted mremap()
+ *
+ * variadic: the fifth argument (new_address) is only passed with
+ * MREMAP_FIXED. the moved range keeps its original allocation stack.
+ */
+void *PROFILER_INTERPOSE(mremap)(void *old_address, size_t old_size, size_t new_size, int flags, ...) {
+    mmap_intercept_init();
+
+    void *new_address = NULL;
+    if (flags & MREMAP_FIXED) {
+        va_list ap;
+        va_start(ap, flags);
+        new_address = va_arg(ap, void*);
+        va_end(ap);
+    }
+
+    if (profiler_shutting_down || profiler_dormant) {
+        return real_mremap(old_address, old_size, new_size, flags, new_address);
+    }
+
+    int nested = mappings_enter();
+    void *result = real_mremap(old_address, old_size, new_size, flags, new_address);
+
+#ifdef MREMAP_DONTUNMAP
+    int keep_old = (flags & MREMAP_DONTUNMAP) != 0;
+#else
+    int keep_old = 0;
+#endif
+    deferred_op_t op = { .type = DEFER_MOVE, .ptr = old_address, .size = old_size,
+                         .new_ptr = result, .new_size = new_size, .keep_old = keep_old };
+    mappings_leave(nested, result != MAP_FAILED ? &op : NULL);
+    return result;
+}
+
+/*
+ * intercepted madvise()
+ *
+ * MADV_DONTNEED drops the pages of a private anonymous mapping, which
+ * lowers its resident estimate without unmapping it.
+ */
+int PROFILER_INTERPOSE(madvise)(void *addr, size_t len, int advice) {
+    mmap_intercept_init();
+
+    int ret = real_madvise(addr, len, advice);
+    if (ret == 0 && advice == MADV_DONTNEED && !profiler_shutting_down && !profiler_dormant) {
+        deferred_op_t op = { .type = DEFER_DONTNEED, .ptr = addr, .size = len };
+        mappings_leave(mappings_enter(), &op);
+    }
+    return ret;
+}
@@ -0,0 +1,555 @@
+/*
+ * mmap registry - anonymous mapping range index
+ *
+ * keeps every live anonymous mapping created through mmap()/mremap() in
+ * an array sorted by start address, so:
+ * - lookups by address are a binary search
+ * - munmap() of any sub-range trims or splits the covering entries
+ *   (unmapping the middle of a mapping leaves two entries behind)
+ * - mremap() moves an entry and keeps its allocation stack
+ * - madvise(MADV_DONTNEED) ranges are kept in a second sorted array, so
+ *   advising the same pages twice releases them once
+ *
+ * entries hold their stack inline, and the array itself lives in memory
+ * obtained straight from the kernel, so the registry never calls malloc.
+ * thread-safe with pthread mutex.
+ */
+
+#define _GNU_SOURCE
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "../include/profiler_internal.h"
+
+/*
+ * metadata for one anonymous mapping (or what is left of it)
+ *
+ * released counts the bytes of the entry covered by released ranges
+ * (madvise(MADV_DONTNEED)); they are excluded from the resident estimate
+ * until the range is unmapped. it is an estimate: pages touched again
+ * after the advice come back without us seeing it, and are never
+ * credited back.
+ *
+ * entries from an earlier active period (generation, see activation.c)
+ * are still trimmed and split, but no longer counted or reported.
+ */
+typedef struct mapping_info {
+    uintptr_t start;                    // first byte (page aligned)
+    uintptr_t end;                      // one past the last byte
+    size_t released;                    // MADV_DONTNEED bytes, <= end - start
+    int is_suspicious;                  // 1 if mapped directly by libc
+    unsigned int generation;            // profiler_generation when mapped
+    unsigned int modules_epoch;         // modules_epoch when mapped
+    int stack_depth;
+    void *stack_trace[MAX_STACK_FRAMES];
+} mapping_info_t;
+
+// sorted by start, non-overlapping
+static mapping_info_t *g_maps = NULL;
+static size_t g_count = 0;
+static size_t g_capacity = 0;
+
+// released ranges, sorted by start, non-overlapping and non-adjacent
+typedef struct released_range {
+    uintptr_t start;
+    uintptr_t end;
+} released_range_t;
+
+static released_range_t *g_released = NULL;
+static size_t g_released_count = 0;
+static size_t g_released_capacity = 0;
+
+static pthread_mutex_t mmap_registry_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * raw kernel mappings for our own storage
+ * syscall() goes around the interposed mmap(), so no recursion
+ */
+static void *raw_mmap(size_t len) {
+    void *mem = (void*)syscall(SYS_mmap, NULL, len, PROT_READ | PROT_WRITE,
+                               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return (mem == MAP_FAILED) ? NULL : mem;
+}
+
+static void raw_munmap(void *addr, size_t len) {
+    syscall(SYS_munmap, addr, len);
+}
+
+static size_t page_round_up(size_t len) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    return (len + page - 1) & ~(page - 1);
+}
+
+/*
+ * make room for at least one more entry
+ * returns 0 if the kernel refused more memory
+ *
+ * caller must hold mmap_registry_mutex
+ */
+static int reserve_one(void) {
+    if (g_count < g_capacity) return 1;
+
+    size_t new_capacity = g_capacity ? g_capacity * 2 : 256;
+    mapping_info_t *grown = raw_mmap(new_capacity * sizeof(mapping_info_t));
+    if (!grown) return 0;
+
+    if (g_maps) {
+        memcpy(grown, g_maps, g_count * sizeof(mapping_info_t));
+        raw_munmap(g_maps, g_capacity * sizeof(mapping_info_t));
+    }
+    g_maps = grown;
+    g_capacity = new_capacity;
+    return 1;
+}
+
+// reserve_one() for the released ranges
+static int reserve_released_one(void) {
+    if (g_released_count < g_released_capacity) return 1;
+
+    size_t new_capacity = g_released_capacity ? g_released_capacity * 2 : 256;
+    released_range_t *grown = raw_mmap(new_capacity * sizeof(released_range_t));
+    if (!grown) return 0;
+
+    if (g_released) {
+        memcpy(grown, g_released, g_released_count * sizeof(released_range_t));
+        raw_munmap(g_released, g_released_capacity * sizeof(released_range_t));
+    }
+    g_released = grown;
+    g_released_capacity = new_capacity;
+    return 1;
+}
+
+/*
+ * index of the first released range whose end is at or above addr
+ * (the first range that could overlap or touch [addr, ...))
+ *
+ * caller must hold mmap_registry_mutex
+ */
+static size_t first_released(uintptr_t addr) {
+    size_t lo = 0, hi = g_released_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (g_released[mid].end < addr) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// released bytes inside [start, end), caller must hold mmap_registry_mutex
+static size_t released_bytes_in(uintptr_t start, uintptr_t end) {
+    size_t total = 0;
+    for (size_t i = first_released(start); i < g_released_count && g_released[i].start < end; i++) {
+        uintptr_t lo = (start > g_released[i].start) ? start : g_released[i].start;
+        uintptr_t hi = (end < g_released[i].end) ? end : g_released[i].end;
+        if (hi > lo) total += hi - lo;
+    }
+    return total;
+}
+
+/*
+ * mark [start, end) released, merging with the ranges it overlaps or touches
+ * returns the number of bytes that were not released before
+ *
+ * caller must hold mmap_registry_mutex
+ */
+static size_t released_add(uintptr_t start, uintptr_t end) {
+    size_t first = first_released(start);
+    size_t last = first;
+    size_t already = 0;
+    uintptr_t merged_start = start, merged_end = end;
+
+    while (last < g_released_count && g_released[last].start <= end) {
+        released_range_t *range = &g_released[last];
+        uintptr_t lo = (start > range->start) ? start : range->start;
+        uintptr_t hi = (end < range->end) ? end : range->end;
+        if (hi > lo) already += hi - lo;
+        if (range->start < merged_start) merged_start = range->start;
+        if (range->end > merged_end) merged_end = range->end;
+        last++;
+    }
+
+    if (last == first) {
+        if (!reserve_released_one()) return 0;     // not recorded, not counted
+        memmove(&g_released[first + 1], &g_released[first],
+                (g_released_count - first) * sizeof(released_range_t));
+        g_released_count++;
+    } else if (last > first + 1) {
+        memmove(&g_released[first + 1], &g_released[last],
+                (g_released_count - last) * sizeof(released_range_t));
+        g_released_count -= last - first - 1;
+    }
+    g_released[first].start = merged_start;
+    g_released[first].end = merged_end;
+
+    return (end - start) - already;
+}
+
+/*
+ * forget released ranges inside [start, end), after the pages are
+ * unmapped or replaced. if a range can't be split the tail is dropped,
+ * which only makes the resident estimate larger.
+ *
+ * caller must hold mmap_registry_mutex
+ */
+static void released_remove(uintptr_t start, uintptr_t end) {
+    size_t i = first_released(start);
+
+    while (i < g_released_count && g_released[i].start < end) {
+        released_range_t *range = &g_released[i];
+
+        if (range->end <= start) {
+            i++;                        // only touches the range
+        } else if (start <= range->start && end >= range->end) {
+            memmove(&g_released[i], &g_released[i + 1],
+                    (g_released_count - i - 1) * sizeof(released_range_t));
+            g_released_count--;
+        } else if (start > range->start && end < range->end) {
+            released_range_t tail = { end, range->end };
+            range->end = start;
+            if (reserve_released_one()) {
+                memmove(&g_released[i + 2], &g_released[i + 1],
+                        (g_released_count - i - 1) * sizeof(released_range_t));
+                g_released[i + 1] = tail;
+                g_released_count++;
+            }
+            return;
+        } else {
+            if (start <= range->start) {
+                range->start = end;     // head removed
+            } else {
+                range->end = start;     // tail removed
+            }
+            i++;
+        }
+    }
+}
+
+/*
+ * index of the first entry whose end is above addr
+ * (the first entry that could overlap [addr, ...))
+ *
+ * caller must hold mmap_registry_mutex
+ */
+static size_t first_overlap(uintptr_t addr) {
+    size_t lo = 0, hi = g_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (g_maps[mid].end <= addr) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// caller must hold mmap_registry_mutex and have reserved room
+static void insert_at(size_t index, const mapping_info_t *entry) {
+    memmove(&g_maps[index + 1], &g_maps[index], (g_count - index) * sizeof(mapping_info_t));
+    g_maps[index] = *entry;
+    g_count++;
+}
+
+// caller must hold mmap_registry_mutex
+static void erase_at(size_t index) {
+    memmove(&g_maps[index], &g_maps[index + 1], (g_count - index - 1) * sizeof(mapping_info_t));
+    g_count--;
+}
+
+// resident bytes attributed to an entry
+static size_t resident_bytes(const mapping_info_t *entry) {
+    return (entry->end - entry->start) - entry->released;
+}
+
+// mapped in the current active period?
+static int is_current(const mapping_info_t *entry) {
+    return entry->generation == __atomic_load_n(&profiler_generation, __ATOMIC_ACQUIRE);
+}
+
+// stats_account() for current entries only
+static void account(const mapping_info_t *entry, long delta) {
+    if (is_current(entry)) stats_account(STAT_MAPPED, delta);
+}
+
+/*
+ * drop [start, end) from the index
+ *
+ * entries fully inside the range are removed, entries straddling an edge
+ * are trimmed, and an entry strictly containing the range is split in two.
+ * trimmed pieces keep the released bytes that fall inside them.
+ * if out is not NULL, the first overlapping entry is copied there.
+ * returns the number of entries that overlapped.
+ *
+ * caller must hold mmap_registry_mutex
+ */
+static int remove_range_locked(uintptr_t start, uintptr_t end, mapping_info_t *out) {
+    int overlapped = 0;
+    size_t i = first_overlap(start);
+
+    while (i < g_count && g_maps[i].start < end) {
+        mapping_info_t *entry = &g_maps[i];
+        if (out && overlapped == 0) {
+            *out = *entry;
+        }
+        overlapped++;
+
+        size_t before = resident_bytes(entry);
+        int current = is_current(entry);
+
+        if (start <= entry->start && end >= entry->end) {
+            // fully covered
+            account(entry, -(long)before);
+            erase_at(i);
+            continue;
+        }
+
+        size_t after;
+        if (start > entry->start && end < entry->end) {
+            // hole in the middle: split into [entry->start, start) and [end, entry->end)
+            if (!reserve_one()) {
+                // can't split, keep the head and forget the tail
+                entry->end = start;
+                entry->released = released_bytes_in(entry->start, entry->end);
+                account(entry, (long)resident_bytes(entry) - (long)before);
+                i++;
+                continue;
+            }
+            entry = &g_maps[i];  // storage may have moved
+
+            mapping_info_t tail = *entry;
+            tail.start = end;
+            entry->end = start;
+            entry->released = released_bytes_in(entry->start, entry->end);
+            tail.released = released_bytes_in(tail.start, tail.end);
+
+            insert_at(i + 1, &tail);
+            after = resident_bytes(&g_maps[i]) + resident_bytes(&g_maps[i + 1]);
+            i += 2;
+        } else {
+            if (start <= entry->start) {
+                entry->start = end;     // head unmapped
+            } else {
+                entry->end = start;     // tail unmapped
+            }
+            entry->released = released_bytes_in(entry->start, entry->end);
+            after = resident_bytes(entry);
+            i++;
+        }
+
+        if (current) stats_account(STAT_MAPPED, (long)after - (long)before);
+    }
+
+    released_remove(start, end);
+    return overlapped;
+}
+
+// caller must hold mmap_registry_mutex
+static void add_locked(const mapping_info_t *entry) {
+    // MAP_FIXED can land on top of tracked pages, which replaces them
+    remove_range_locked(entry->start, entry->end, NULL);
+
+    if (!reserve_one()) return;
+    insert_at(first_overlap(entry->start), entry);
+    account(entry, (long)(entry->end - entry->start));
+}
+
+/*
+ * fork() support, same as the heap registry
+ */
+void mmap_registry_fork_prepare(void) {
+    pthread_mutex_lock(&mmap_registry_mutex);
+}
+
+void mmap_registry_fork_release(void) {
+    pthread_mutex_unlock(&mmap_registry_mutex);
+}
+
+/*
+ * track a new anonymous mapping
+ *
+ * called right after mmap() succeeds.
+ */
+void mmap_registry_add(void *addr, size_t len, void **trace, int depth, int is_suspicious) {
+    if (!addr || len == 0) return;
+
+    mapping_info_t entry;
+    entry.start = (uintptr_t)addr;
+    entry.end = entry.start + page_round_up(len);
+    entry.released = 0;
+    entry.is_suspicious = is_suspicious;
+    entry.generation = __atomic_load_n(&profiler_generation, __ATOMIC_ACQUIRE);
+    entry.modules_epoch = modules_current_epoch();
+    entry.stack_depth = (depth < MAX_STACK_FRAMES) ? depth : MAX_STACK_FRAMES;
+    memcpy(entry.stack_trace, trace, entry.stack_depth * sizeof(void*));
+
+    pthread_mutex_lock(&mmap_registry_mutex);
+    add_locked(&entry);
+    pthread_mutex_unlock(&mmap_registry_mutex);
+}
+
+/*
+ * forget [addr, addr + len), called after munmap() succeeds
+ *
+ * also used when a non-anonymous mapping replaces tracked pages.
+ */
+void mmap_registry_remove(void *addr, size_t len) {
+    if (len == 0) return;
+
+    uintptr_t start = (uintptr_t)addr;
+    uintptr_t end = start + page_round_up(len);
+
+    pthread_mutex_lock(&mmap_registry_mutex);
+    remove_range_locked(start, end, NULL);
+    pthread_mutex_unlock(&mmap_registry_mutex);
+}
+
+/*
+ * follow an mremap() of [old_addr, old_addr + old_len)
+ *
+ * the new range inherits the stack of the mapping it came from.
+ * keep_old is set for MREMAP_DONTUNMAP, where the old range stays mapped.
+ * returns 1 if the old range was tracked (the mapping is anonymous).
+ */
+int mmap_registry_move(void *old_addr, size_t old_len, void *new_addr, size_t new_len, int keep_old) {
+    uintptr_t old_start = (uintptr_t)old_addr;
+    uintptr_t old_end = old_start + page_round_up(old_len);
+    mapping_info_t source;
+    int tracked;
+
+    pthread_mutex_lock(&mmap_registry_mutex);
+
+    if (keep_old) {
+        size_t i = first_overlap(old_start);
+        tracked = (i < g_count && g_maps[i].start < old_end);
+        if (tracked) source = g_maps[i];
+    } else {
+        tracked = remove_range_locked(old_start, old_end, &source) > 0;
+    }
+
+    if (tracked) {
+        source.start = (uintptr_t)new_addr;
+        source.end = source.start + page_round_up(new_len);
+        source.released = 0;
+        add_locked(&source);
+    }
+
+    pthread_mutex_unlock(&mmap_registry_mutex);
+    return tracked;
+}
+
+/*
+ * account madvise(MADV_DONTNEED) on tracked pages
+ *
+ * the mapping stays, but its pages are dropped until touched again.
+ * only pages not already released are counted, so repeating the advice
+ * on the same range changes nothing. pages touched again in between are
+ * not seen, and are not credited back.
+ */
+void mmap_registry_dontneed(void *addr, size_t len) {
+    uintptr_t start = (uintptr_t)addr;
+    uintptr_t end = start + page_round_up(len);
+
+    pthread_mutex_lock(&mmap_registry_mutex);
+
+    for (size_t i = first_overlap(start); i < g_count && g_maps[i].start < end; i++) {
+        mapping_info_t *entry = &g_maps[i];
+        uintptr_t lo = (start > entry->start) ? start : entry->start;
+        uintptr_t hi = (end < entry->end) ? end : entry->end;
+
+        size_t newly = released_add(lo, hi);
+        entry->released += newly;
+        account(entry, -(long)newly);
+    }
+
+    pthread_mutex_unlock(&mmap_registry_mutex);
+}
+
+/*
+ * output one unreleased mapping in JSON format
+ *
+ * Format: {"type":"mmap_leak","addr":"0x...","size":65536,"released":4096,"frames":[...]}
+ */
+static void output_mapping_json(const mapping_info_t *entry) {
+    out_buf_t buf;
+    buf.len = 0;
+
+    buf_str(&buf, "{\"type\":\"mmap_leak\",\"addr\":\"");
+    buf_hex(&buf, (unsigned long)entry->start);
+    buf_str(&buf, "\",\"size\":");
+    buf_dec(&buf, entry->end - entry->start);
+    buf_str(&buf, ",\"released\":");
+    buf_dec(&buf, entry->released);
+    buf_str(&buf, ",\"frames\":[");
+    if (show_stack_traces && entry->stack_depth > 0) {
+        buf_frames(&buf, (void**)entry->stack_trace, entry->stack_depth, entry->modules_epoch);
+    }
+    buf_str(&buf, "]}\n");
+    buf_flush(&buf);
+}
+
+/*
+ * report anonymous mappings still alive at exit
+ *
+ * outputs {"type":"mmap_header",...} followed by one mmap_leak line per
+ * mapping. mappings created directly by libc are counted but not listed,
+ * same as heap leaks. leaks/bytes receive the listed totals.
+ */
+void mmap_registry_report_leaks(size_t *leaks, size_t *bytes) {
+    size_t count = 0, total = 0;
+
+    pthread_mutex_lock(&mmap_registry_mutex);
+
+    for (size_t i = 0; i < g_count; i++) {
+        if (!g_maps[i].is_suspicious && is_current(&g_maps[i])) {
+            count++;
+            total += g_maps[i].end - g_maps[i].start;
+        }
+    }
+
+    if (count > 0) {
+        out_buf_t buf;
+        buf.len = 0;
+        buf_str(&buf, "{\"type\":\"mmap_header\",\"mappings_count\":");
+        buf_dec(&buf, count);
+        buf_str(&buf, ",\"total_bytes\":");
+        buf_dec(&buf, total);
+        buf_str(&buf, "}\n");
+        buf_flush(&buf);
+
+        for (size_t i = 0; i < g_count; i++) {
+            if (!g_maps[i].is_suspicious && is_current(&g_maps[i])) {
+                output_mapping_json(&g_maps[i]);
+            }
+        }
+    }
+
+    pthread_mutex_unlock(&mmap_registry_mutex);
+
+    *leaks = count;
+    *bytes = total;
+}
+
+/*
+ * release the index storage, called at exit
+ */
+void mmap_registry_cleanup(void) {
+    pthread_mutex_lock(&mmap_registry_mutex);
+    if (g_maps) {
+        raw_munmap(g_maps, g_capacity * sizeof(mapping_info_t));
+    }
+    g_maps = NULL;
+    g_count = 0;
+    g_capacity = 0;
+    if (g_released) {
+        raw_munmap(g_released, g_released_capacity * sizeof(released_range_t));
+    }
+    g_released = NULL;
+    g_released_count = 0;
+    g_released_capacity = 0;
+    pthread_mutex_unlock(&mmap_registry_mutex);
+}
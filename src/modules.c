@@ -0,0 +1,405 @@
+/*
+ * module table - which object was where, and when
+ *
+ * a leak is reported at exit, long after it was allocated. if the
+ * library that allocated it was dlclose()d in between, dladdr() knows
+ * nothing about its frames any more (they print as "unknown"), or worse,
+ * names whatever was loaded at that address since.
+ *
+ * so we keep our own table of every object ever loaded: path, load
+ * base, address range and GNU build-id. entries are never removed, an
+ * unload just closes them. the table is versioned: modules_epoch is
+ * bumped on every change, each entry knows the epochs it was live for,
+ * and every allocation records the epoch it was made in. a frame is
+ * looked up among the modules live at its allocation's epoch, so an
+ * address reused by a later dlopen() still resolves to the right one.
+ *
+ * dlopen() and dlclose() are interposed to refresh the table right after
+ * the loader is done (dl_iterate_phdr; this also catches dependencies a
+ * dlopen() pulled in, and a dlclose() that did not really unload).
+ * a module's range becomes valid from the epoch its dlopen() started in,
+ * which covers allocations made by its own constructors.
+ *
+ * leaks whose stack runs through a module that is gone are a class of
+ * their own: nothing can ever free them. they are listed per module at
+ * exit, before the leak list, with "unloaded_module" events.
+ *
+ * frames are written as (module id, offset in the module), not as bare
+ * runtime addresses: with PIE executables and shared libraries only the
+ * offset means anything to addr2line, and it is the same from one run to
+ * the next. the first event that refers to a module is preceded by a
+ * "module" event carrying its path, load base and build-id, so the
+ * output is self-describing and can be symbolized offline, or from a
+ * cache keyed by build-id.
+ *
+ * PROFILER_SYMBOLIZE=1 also names the function of each frame in the exit
+ * report, from the module's own symbol table (symbols.c).
+ *
+ * the link-time build (static binaries) has the table, but does not
+ * interpose dlopen()/dlclose().
+ */
+
+#define _GNU_SOURCE
+#include <link.h>
+#include <dlfcn.h>
+#include <elf.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "../include/profiler_internal.h"
+
+#define MAX_MODULES 512
+
+// every path ever seen, back to back
+#define NAMES_SIZE (64 * 1024)
+
+// longest build-id we keep (sha1 is 20 bytes)
+#define BUILD_ID_MAX 32
+
+typedef struct module {
+    unsigned int id;            // 1-based, never reused
+    const char *path;           // as the loader reports it
+    uintptr_t base;             // load bias (dlpi_addr)
+    uintptr_t start, end;       // range covered by PT_LOAD segments
+    unsigned int loaded_at;     // first epoch the module is live in
+    unsigned int unloaded_at;   // first epoch it is gone in, 0 while loaded
+    int seen;                   // found by the current refresh
+    int announced;              // "module" event written
+    size_t build_id_len;
+    unsigned char build_id[BUILD_ID_MAX];
+    size_t leaks;               // live allocations at exit, unloaded modules only
+    size_t leak_bytes;
+} module_t;
+
+static module_t g_modules[MAX_MODULES];
+static size_t g_module_count = 0;
+
+static char g_names[NAMES_SIZE];
+static size_t g_names_used = 0;
+
+unsigned int modules_epoch = 1;
+
+static pthread_mutex_t modules_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// the loader calls the program "", use the real path instead
+static char g_exe_path[PATH_MAX];
+
+static const char *store_name(const char *name) {
+    size_t len = strlen(name) + 1;
+    if (g_names_used + len > NAMES_SIZE) return "?";
+    char *copy = g_names + g_names_used;
+    memcpy(copy, name, len);
+    g_names_used += len;
+    return copy;
+}
+
+/*
+ * GNU build-id from the PT_NOTE segments, which are mapped
+ */
+static void read_build_id(module_t *m, const struct dl_phdr_info *info) {
+    for (int i = 0; i < info->dlpi_phnum; i++) {
+        const ElfW(Phdr) *phdr = &info->dlpi_phdr[i];
+        if (phdr->p_type != PT_NOTE) continue;
+
+        const char *p = (const char*)(info->dlpi_addr + phdr->p_vaddr);
+        const char *end = p + phdr->p_memsz;
+        while (p + sizeof(ElfW(Nhdr)) <= end) {
+            const ElfW(Nhdr) *note = (const ElfW(Nhdr)*)p;
+            const char *name = p + sizeof(ElfW(Nhdr));
+            const unsigned char *desc = (const unsigned char*)name + ((note->n_namesz + 3) & ~3u);
+
+            if (note->n_type == NT_GNU_BUILD_ID && note->n_namesz == 4 &&
+                memcmp(name, "GNU", 4) == 0) {
+                size_t len = note->n_descsz < BUILD_ID_MAX ? note->n_descsz : BUILD_ID_MAX;
+                memcpy(m->build_id, desc, len);
+                m->build_id_len = len;
+                return;
+            }
+            p = (const char*)desc + ((note->n_descsz + 3) & ~3u);
+        }
+    }
+}
+
+static const char *module_path(const struct dl_phdr_info *info) {
+    return info->dlpi_name[0] ? info->dlpi_name : g_exe_path;
+}
+
+static module_t *find_loaded(const struct dl_phdr_info *info) {
+    const char *path = module_path(info);
+    for (size_t i = 0; i < g_module_count; i++) {
+        module_t *m = &g_modules[i];
+        if (!m->unloaded_at && m->base == info->dlpi_addr &&
+            strcmp(m->path, path) == 0) {
+            return m;
+        }
+    }
+    return NULL;
+}
+
+// dl_iterate_phdr callback, data points at the epoch new modules start in
+static int refresh_object(struct dl_phdr_info *info, size_t size, void *data) {
+    (void)size;
+
+    module_t *m = find_loaded(info);
+    if (m) {
+        m->seen = 1;
+        return 0;
+    }
+    if (g_module_count == MAX_MODULES) return 0;
+
+    uintptr_t start = UINTPTR_MAX, end = 0;
+    for (int i = 0; i < info->dlpi_phnum; i++) {
+        const ElfW(Phdr) *phdr = &info->dlpi_phdr[i];
+        if (phdr->p_type != PT_LOAD) continue;
+        uintptr_t seg = info->dlpi_addr + phdr->p_vaddr;
+        if (seg < start) start = seg;
+        if (seg + phdr->p_memsz > end) end = seg + phdr->p_memsz;
+    }
+    if (start >= end) return 0;
+
+    m = &g_modules[g_module_count];
+    memset(m, 0, sizeof(*m));
+    m->id = (unsigned int)(g_module_count + 1);
+    m->path = store_name(module_path(info));
+    m->base = info->dlpi_addr;
+    m->start = start;
+    m->end = end;
+    m->loaded_at = *(unsigned int*)data;
+    m->seen = 1;
+    read_build_id(m, info);
+    g_module_count++;
+    return 0;
+}
+
+/*
+ * bring the table in line with the loader
+ * modules added since the last refresh are live from epoch `since`
+ */
+static void refresh(unsigned int since) {
+    pthread_mutex_lock(&modules_mutex);
+
+    for (size_t i = 0; i < g_module_count; i++) {
+        g_modules[i].seen = 0;
+    }
+    size_t before = g_module_count;
+    dl_iterate_phdr(refresh_object, &since);
+
+    int changed = g_module_count != before;
+    unsigned int next = __atomic_load_n(&modules_epoch, __ATOMIC_RELAXED) + 1;
+    for (size_t i = 0; i < before; i++) {
+        module_t *m = &g_modules[i];
+        if (!m->unloaded_at && !m->seen) {
+            m->unloaded_at = next;
+            changed = 1;
+        }
+    }
+    if (changed) {
+        __atomic_store_n(&modules_epoch, next, __ATOMIC_RELEASE);
+    }
+
+    pthread_mutex_unlock(&modules_mutex);
+}
+
+void modules_init(void) {
+    ssize_t len = readlink("/proc/self/exe", g_exe_path, sizeof(g_exe_path) - 1);
+    g_exe_path[len > 0 ? len : 0] = '\0';
+    refresh(modules_epoch);
+}
+
+/*
+ * fork() support, see process.c
+ */
+void modules_fork_prepare(void) {
+    pthread_mutex_lock(&modules_mutex);
+}
+
+/*
+ * a child writing to its own file (PROFILER_OUTPUT with %p) has to
+ * describe its modules again
+ */
+void modules_fork_release(int in_child) {
+    if (in_child) {
+        for (size_t i = 0; i < g_module_count; i++) {
+            g_modules[i].announced = 0;
+        }
+    }
+    pthread_mutex_unlock(&modules_mutex);
+}
+
+/*
+ * the module addr belonged to at epoch, or NULL
+ */
+static module_t *lookup(const void *addr, unsigned int epoch) {
+    uintptr_t a = (uintptr_t)addr;
+    for (size_t i = 0; i < g_module_count; i++) {
+        module_t *m = &g_modules[i];
+        if (a >= m->start && a < m->end && m->loaded_at <= epoch &&
+            (!m->unloaded_at || epoch < m->unloaded_at)) {
+            return m;
+        }
+    }
+    return NULL;
+}
+
+static void buf_build_id(out_buf_t *buf, const module_t *m) {
+    static const char hex[] = "0123456789abcdef";
+    for (size_t b = 0; b < m->build_id_len; b++) {
+        char byte[3] = { hex[m->build_id[b] >> 4], hex[m->build_id[b] & 0xf], '\0' };
+        buf_str(buf, byte);
+    }
+}
+
+/*
+ * describe m, once, before the first event that refers to it
+ *
+ * Format: {"type":"module","id":1,"path":"/usr/bin/server","base":"0x5581...",
+ *          "build_id":"5b1c...","unloaded":true}
+ * "unloaded" is only present if the module was gone by then.
+ * written straight away: the event being built is still in its buffer,
+ * so this line always comes first.
+ */
+static void announce(module_t *m) {
+    if (__atomic_exchange_n(&m->announced, 1, __ATOMIC_ACQ_REL)) return;
+
+    out_buf_t buf;
+    buf.len = 0;
+    buf_str(&buf, "{\"type\":\"module\",\"id\":");
+    buf_dec(&buf, m->id);
+    buf_str(&buf, ",\"path\":\"");
+    buf_str(&buf, m->path);
+    buf_str(&buf, "\",\"base\":\"");
+    buf_hex(&buf, (unsigned long)m->base);
+    buf_str(&buf, "\",\"build_id\":\"");
+    buf_build_id(&buf, m);
+    buf_str(&buf, "\"");
+    if (m->unloaded_at) {
+        buf_str(&buf, ",\"unloaded\":true");
+    }
+    buf_str(&buf, "}\n");
+    buf_flush(&buf);
+}
+
+/*
+ * append frame addr, recorded at epoch, to a JSON frames array
+ *
+ * Format: {"addr":"0x7f...","bin":"libfoo.so","mod":3,"off":"0x1139"}
+ * with PROFILER_SYMBOLIZE=1 the exit report adds "fn":"foo(int)+0x19"
+ * returns 0 if no module covers addr: the caller asks dladdr().
+ */
+int modules_buf_frame(out_buf_t *buf, const void *addr, unsigned int epoch) {
+    module_t *m = lookup(addr, epoch);
+    if (!m) return 0;
+    announce(m);
+
+    const char *slash = strrchr(m->path, '/');
+    buf_str(buf, "{\"addr\":\"");
+    buf_hex(buf, (unsigned long)addr);
+    buf_str(buf, "\",\"bin\":\"");
+    buf_str(buf, slash ? slash + 1 : m->path);
+    buf_str(buf, "\",\"mod\":");
+    buf_dec(buf, m->id);
+    buf_str(buf, ",\"off\":\"");
+    uintptr_t offset = (uintptr_t)addr - m->base;
+    buf_hex(buf, (unsigned long)offset);
+    buf_str(buf, "\"");
+
+    // function names only in the exit report, see symbols.c
+    uintptr_t delta;
+    const char *fn;
+    if (symbolize_frames && profiler_shutting_down &&
+        (fn = symbols_lookup(m->id, m->path, offset, &delta))) {
+        buf_str(buf, ",\"fn\":\"");
+        buf_str(buf, fn);
+        if (delta) {
+            buf_str(buf, "+");
+            buf_hex(buf, (unsigned long)delta);
+        }
+        buf_str(buf, "\"");
+    }
+    buf_str(buf, "}");
+    return 1;
+}
+
+/*
+ * id of the first unloaded module on a stack recorded at epoch, or 0
+ * frame 0 is the interposer and is skipped
+ */
+unsigned int modules_unloaded_owner(void **trace, int depth, unsigned int epoch) {
+    for (int i = 1; i < depth; i++) {
+        module_t *m = lookup(trace[i], epoch);
+        if (m && m->unloaded_at) return m->id;
+    }
+    return 0;
+}
+
+void modules_count_leak(unsigned int id, size_t size) {
+    if (id == 0 || id > g_module_count) return;
+    g_modules[id - 1].leaks++;
+    g_modules[id - 1].leak_bytes += size;
+}
+
+/*
+ * one event per unloaded module that still owns live allocations
+ *
+ * Format: {"type":"unloaded_module","id":3,"path":"/opt/plugins/libfoo.so",
+ *          "base":"0x7f...","build_id":"5b1c...","leaks":2,"bytes":96}
+ * called at exit, after modules_count_leak(), before the leak list
+ */
+void modules_report_unloaded(void) {
+    for (size_t i = 0; i < g_module_count; i++) {
+        module_t *m = &g_modules[i];
+        if (!m->leaks) continue;
+
+        out_buf_t buf;
+        buf.len = 0;
+        buf_str(&buf, "{\"type\":\"unloaded_module\",\"id\":");
+        buf_dec(&buf, m->id);
+        buf_str(&buf, ",\"path\":\"");
+        buf_str(&buf, m->path);
+        buf_str(&buf, "\",\"base\":\"");
+        buf_hex(&buf, (unsigned long)m->base);
+        buf_str(&buf, "\",\"build_id\":\"");
+        buf_build_id(&buf, m);
+        buf_str(&buf, "\",\"leaks\":");
+        buf_dec(&buf, m->leaks);
+        buf_str(&buf, ",\"bytes\":");
+        buf_dec(&buf, m->leak_bytes);
+        buf_str(&buf, "}\n");
+        buf_flush(&buf);
+    }
+}
+
+#ifndef PROFILER_LINK_WRAP
+static void *(*real_dlopen)(const char*, int) = NULL;
+static int (*real_dlclose)(void*) = NULL;
+
+static void resolve_dl(void) {
+    if (!real_dlopen) real_dlopen = dlsym(RTLD_NEXT, "dlopen");
+    if (!real_dlclose) real_dlclose = dlsym(RTLD_NEXT, "dlclose");
+}
+
+/*
+ * intercepted dlopen()
+ *
+ * the loader sees us as the caller, which matters only for "$ORIGIN" in
+ * the file name: it expands to our directory, not the program's
+ */
+void *dlopen(const char *file, int mode) {
+    resolve_dl();
+    unsigned int since = __atomic_load_n(&modules_epoch, __ATOMIC_ACQUIRE);
+    void *handle = real_dlopen(file, mode);
+    if (handle) refresh(since);
+    return handle;
+}
+
+/*
+ * intercepted dlclose()
+ */
+int dlclose(void *handle) {
+    resolve_dl();
+    int ret = real_dlclose(handle);
+    if (ret == 0) refresh(__atomic_load_n(&modules_epoch, __ATOMIC_ACQUIRE));
+    return ret;
+}
+#endif
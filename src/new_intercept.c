@@ -0,0 +1,273 @@
+/*
+ * C++ operator new/delete interception
+ *
+ * every replaceable global allocation function of C++17 is interposed:
+ * plain, nothrow, sized, std::align_val_t and their combinations, for
+ * both the scalar and the array forms.
+ *
+ * why C and not C++:
+ * the profiler is a plain C library and is preloaded into C programs too.
+ * defining the operators against their Itanium ABI mangled names keeps
+ * libstdc++ out of our dependencies; the few runtime hooks we need
+ * (new handler, std::bad_alloc) are looked up with dlsym() only on the
+ * out-of-memory path, and only exist when the program links libstdc++.
+ *
+ * every entry point goes through the same inline helpers as malloc/free
+ * (track_allocation / untrack_allocation), so a new+delete pair costs the
+ * same as a malloc+free pair. the kind recorded per block lets us report
+ * malloc/delete, new/free and new[]/delete mismatches. sized deletes are
+ * checked against the recorded size ("Sized-Delete-Mismatch"), aligned
+ * ones against the recorded alignment too ("Aligned-Delete-Mismatch").
+ *
+ * mangling cheat sheet (x86_64, size_t = unsigned long = 'm'):
+ *   _Znwm / _Znam       operator new / new[] (size_t)
+ *   _ZdlPv / _ZdaPv     operator delete / delete[] (void*)
+ *   RKSt9nothrow_t      const std::nothrow_t&
+ *   St11align_val_t     std::align_val_t
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <dlfcn.h>
+#include "../include/profiler_internal.h"
+#include "../include/real_alloc.h"
+
+/*
+ * out of memory handling, as required by [new.delete.single]
+ *
+ * call the installed new_handler and retry; with no handler, throwing
+ * forms raise std::bad_alloc and nothrow forms return NULL.
+ *
+ * note: the nothrow forms cannot catch a bad_alloc thrown by the handler
+ * from C, so it propagates. real handlers either free memory or abort.
+ */
+typedef void (*new_handler_t)(void);
+
+#ifdef PROFILER_LINK_WRAP
+// static binaries may have no dynamic symbol table, link the hooks weakly
+new_handler_t _ZSt15get_new_handlerv(void) __attribute__((weak));
+void _ZSt17__throw_bad_allocv(void) __attribute__((weak, noreturn));
+
+static int call_new_handler(void) {
+    new_handler_t handler = _ZSt15get_new_handlerv ? _ZSt15get_new_handlerv() : NULL;
+    if (!handler) return 0;
+
+    handler();
+    return 1;
+}
+
+__attribute__((noreturn))
+static void throw_bad_alloc(void) {
+    if (_ZSt17__throw_bad_allocv) {
+        _ZSt17__throw_bad_allocv();
+    }
+    abort();
+}
+#else
+static int call_new_handler(void) {
+    static new_handler_t (*get_new_handler)(void) = NULL;
+    if (!get_new_handler) {
+        get_new_handler = (new_handler_t (*)(void))dlsym(RTLD_DEFAULT, "_ZSt15get_new_handlerv");
+    }
+
+    new_handler_t handler = get_new_handler ? get_new_handler() : NULL;
+    if (!handler) return 0;
+
+    handler();
+    return 1;
+}
+
+__attribute__((noreturn))
+static void throw_bad_alloc(void) {
+    void (*throw_fn)(void) = (void (*)(void))dlsym(RTLD_DEFAULT, "_ZSt17__throw_bad_allocv");
+    if (throw_fn) {
+        throw_fn();
+    }
+    abort();
+}
+#endif
+
+static void *alloc_or_handle(size_t size, size_t alignment, int nothrow) {
+    for (;;) {
+        void *ptr = alignment ? real_memalign(alignment, size) : real_malloc(size);
+        if (ptr) return ptr;
+
+        if (!call_new_handler()) {
+            if (nothrow) return NULL;
+            throw_bad_alloc();
+        }
+    }
+}
+
+/*
+ * shared bodies, always inlined into the exported symbols so the
+ * backtrace sees the operator as frame 0 and its caller as frame 1
+ */
+static inline __attribute__((always_inline))
+void *new_tracked(size_t size, size_t alignment, alloc_kind_t kind, int nothrow) {
+    if (profiler_dormant) {
+        void *ptr = alignment ? real_memalign(alignment, size) : real_malloc(size);
+        return ptr ? ptr : alloc_or_handle(size, alignment, nothrow);
+    }
+    
+    // no C++ runtime runs during our init, but stay correct if one does
+    if (!profiler_enter()) {
+        void *ptr = bootstrap_alloc(size, alignment);
+        if (!ptr && !nothrow) throw_bad_alloc();
+        return ptr;
+    }
+
+    // fast path: real allocator succeeds on the first try
+    void *ptr = alignment ? real_memalign(alignment, size) : real_malloc(size);
+    if (__builtin_expect(!ptr, 0)) {
+        ptr = alloc_or_handle(size, alignment, nothrow);
+    }
+
+    track_allocation(ptr, size, alignment, kind);
+    return ptr;
+}
+
+static inline __attribute__((always_inline))
+void delete_tracked(void *ptr, alloc_kind_t kind, size_t size, size_t alignment) {
+    // deleting NULL is a no-op
+    if (!ptr) return;
+
+    // bootstrap arena blocks are never released
+    if (bootstrap_owns(ptr)) return;
+    if (profiler_dormant) {
+        real_free(ptr);
+        return;
+    }
+    if (!profiler_enter()) return;
+
+    // skip validation during profiler shutdown (cleanup frees internal metadata)
+    if (profiler_shutting_down) {
+        real_free(ptr);
+        return;
+    }
+
+    // aligned forms may get the alignment wrong, sized ones only the size
+    const char *size_error = alignment ? "Aligned-Delete-Mismatch" : "Sized-Delete-Mismatch";
+    if (!untrack_allocation(ptr, kind, size, alignment, size_error)) {
+        return;
+    }
+    real_free(ptr);
+}
+
+/*
+ * operator new / new[]
+ */
+
+// operator new(size_t)
+void *PROFILER_INTERPOSE(_Znwm)(size_t size) {
+    return new_tracked(size, 0, ALLOC_NEW, 0);
+}
+
+// operator new[](size_t)
+void *PROFILER_INTERPOSE(_Znam)(size_t size) {
+    return new_tracked(size, 0, ALLOC_NEW_ARRAY, 0);
+}
+
+// operator new(size_t, const std::nothrow_t&)
+void *PROFILER_INTERPOSE(_ZnwmRKSt9nothrow_t)(size_t size, const void *nothrow_tag) {
+    (void)nothrow_tag;
+    return new_tracked(size, 0, ALLOC_NEW, 1);
+}
+
+// operator new[](size_t, const std::nothrow_t&)
+void *PROFILER_INTERPOSE(_ZnamRKSt9nothrow_t)(size_t size, const void *nothrow_tag) {
+    (void)nothrow_tag;
+    return new_tracked(size, 0, ALLOC_NEW_ARRAY, 1);
+}
+
+// operator new(size_t, std::align_val_t)
+void *PROFILER_INTERPOSE(_ZnwmSt11align_val_t)(size_t size, size_t alignment) {
+    return new_tracked(size, alignment, ALLOC_NEW, 0);
+}
+
+// operator new[](size_t, std::align_val_t)
+void *PROFILER_INTERPOSE(_ZnamSt11align_val_t)(size_t size, size_t alignment) {
+    return new_tracked(size, alignment, ALLOC_NEW_ARRAY, 0);
+}
+
+// operator new(size_t, std::align_val_t, const std::nothrow_t&)
+void *PROFILER_INTERPOSE(_ZnwmSt11align_val_tRKSt9nothrow_t)(size_t size, size_t alignment, const void *nothrow_tag) {
+    (void)nothrow_tag;
+    return new_tracked(size, alignment, ALLOC_NEW, 1);
+}
+
+// operator new[](size_t, std::align_val_t, const std::nothrow_t&)
+void *PROFILER_INTERPOSE(_ZnamSt11align_val_tRKSt9nothrow_t)(size_t size, size_t alignment, const void *nothrow_tag) {
+    (void)nothrow_tag;
+    return new_tracked(size, alignment, ALLOC_NEW_ARRAY, 1);
+}
+
+/*
+ * operator delete / delete[]
+ *
+ * sized forms pass the size for validation, aligned forms the alignment.
+ */
+
+// operator delete(void*)
+void PROFILER_INTERPOSE(_ZdlPv)(void *ptr) {
+    delete_tracked(ptr, ALLOC_NEW, SIZE_UNCHECKED, 0);
+}
+
+// operator delete[](void*)
+void PROFILER_INTERPOSE(_ZdaPv)(void *ptr) {
+    delete_tracked(ptr, ALLOC_NEW_ARRAY, SIZE_UNCHECKED, 0);
+}
+
+// operator delete(void*, size_t)
+void PROFILER_INTERPOSE(_ZdlPvm)(void *ptr, size_t size) {
+    delete_tracked(ptr, ALLOC_NEW, size, 0);
+}
+
+// operator delete[](void*, size_t)
+void PROFILER_INTERPOSE(_ZdaPvm)(void *ptr, size_t size) {
+    delete_tracked(ptr, ALLOC_NEW_ARRAY, size, 0);
+}
+
+// operator delete(void*, const std::nothrow_t&)
+void PROFILER_INTERPOSE(_ZdlPvRKSt9nothrow_t)(void *ptr, const void *nothrow_tag) {
+    (void)nothrow_tag;
+    delete_tracked(ptr, ALLOC_NEW, SIZE_UNCHECKED, 0);
+}
+
+// operator delete[](void*, const std::nothrow_t&)
+void PROFILER_INTERPOSE(_ZdaPvRKSt9nothrow_t)(void *ptr, const void *nothrow_tag) {
+    (void)nothrow_tag;
+    delete_tracked(ptr, ALLOC_NEW_ARRAY, SIZE_UNCHECKED, 0);
+}
+
+// operator delete(void*, std::align_val_t)
+void PROFILER_INTERPOSE(_ZdlPvSt11align_val_t)(void *ptr, size_t alignment) {
+    delete_tracked(ptr, ALLOC_NEW, SIZE_UNCHECKED, alignment);
+}
+
+// operator delete[](void*, std::align_val_t)
+void PROFILER_INTERPOSE(_ZdaPvSt11align_val_t)(void *ptr, size_t alignment) {
+    delete_tracked(ptr, ALLOC_NEW_ARRAY, SIZE_UNCHECKED, alignment);
+}
+
+// operator delete(void*, size_t, std::align_val_t)
+void PROFILER_INTERPOSE(_ZdlPvmSt11align_val_t)(void *ptr, size_t size, size_t alignment) {
+    delete_tracked(ptr, ALLOC_NEW, size, alignment);
+}
+
+// operator delete[](void*, size_t, std::align_val_t)
+void PROFILER_INTERPOSE(_ZdaPvmSt11align_val_t)(void *ptr, size_t size, size_t alignment) {
+    delete_tracked(ptr, ALLOC_NEW_ARRAY, size, alignment);
+}
+
+// operator delete(void*, std::align_val_t, const std::nothrow_t&)
+void PROFILER_INTERPOSE(_ZdlPvSt11align_val_tRKSt9nothrow_t)(void *ptr, size_t alignment, const void *nothrow_tag) {
+    (void)nothrow_tag;
+    delete_tracked(ptr, ALLOC_NEW, SIZE_UNCHECKED, alignment);
+}
+
+// operator delete[](void*, std::align_val_t, const std::nothrow_t&)
+void PROFILER_INTERPOSE(_ZdaPvSt11align_val_tRKSt9nothrow_t)(void *ptr, size_t alignment, const void *nothrow_tag) {
+    (void)nothrow_tag;
+    delete_tracked(ptr, ALLOC_NEW_ARRAY, SIZE_UNCHECKED, alignment);
+}
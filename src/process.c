@@ -0,0 +1,268 @@
+/*
+ * process lifecycle - fork() and exec()
+ *
+ * fork():
+ * a thread holding one of our mutexes when another thread forks leaves
+ * the child with a lock nobody will ever release, and its first malloc
+ * hangs. pthread_atfork handlers take every profiler lock before fork()
+ * and release them on both sides, always in the same order:
+ *   hash_table_mutex -> mmap_registry_mutex -> corruption_mutex -> modules_mutex
+ *
+ * the child also inherits the parent's registry. those blocks are the
+ * parent's to report, so the child bumps profiler_generation: the
+ * inherited records are retired in O(1) (see activation.c), freeing one
+ * in the child is valid, and the child's report only lists what the
+ * child allocated. a pre-fork server gets one report per worker.
+ *
+ * exec():
+ * programs that exec with their own environment (execve, execle,
+ * posix_spawn with envp) often drop LD_PRELOAD, and the new image runs
+ * unprofiled. the env-taking exec functions are interposed to put
+ * LD_PRELOAD (with this library first) and the PROFILER_* settings back
+ * into the child's environment. the rest of the exec family passes
+ * environ unchanged and needs nothing.
+ *
+ * exec does not run destructors, so the old image writes no report.
+ */
+
+#define _GNU_SOURCE
+#include <stdarg.h>
+#include <string.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <dlfcn.h>
+#include <spawn.h>
+#include <sys/syscall.h>
+#include "../include/profiler_internal.h"
+
+static void fork_prepare(void) {
+    hash_table_fork_prepare();
+    mmap_registry_fork_prepare();
+    corruption_fork_prepare();
+    modules_fork_prepare();
+}
+
+static void fork_parent(void) {
+    modules_fork_release(0);
+    corruption_fork_release(0);
+    mmap_registry_fork_release();
+    hash_table_fork_release();
+}
+
+static void fork_child(void) {
+    // retire the parent's records, start counting from zero
+    __atomic_add_fetch(&profiler_generation, 1, __ATOMIC_RELEASE);
+    stats_reset();
+
+    modules_fork_release(1);
+    corruption_fork_release(1);
+    mmap_registry_fork_release();
+    hash_table_fork_release();
+    deferred_fork_child();
+
+    output_after_fork();
+    trace_fork_child();
+    sites_fork_child();
+}
+
+#ifndef PROFILER_LINK_WRAP
+// absolute path of this library, for the child's LD_PRELOAD
+static char g_self_path[PATH_MAX];
+
+static int (*real_execve)(const char*, char *const[], char *const[]) = NULL;
+static int (*real_execvpe)(const char*, char *const[], char *const[]) = NULL;
+static int (*real_fexecve)(int, char *const[], char *const[]) = NULL;
+static int (*real_posix_spawn)(pid_t*, const char*, const posix_spawn_file_actions_t*,
+                               const posix_spawnattr_t*, char *const[], char *const[]) = NULL;
+static int (*real_posix_spawnp)(pid_t*, const char*, const posix_spawn_file_actions_t*,
+                                const posix_spawnattr_t*, char *const[], char *const[]) = NULL;
+#endif
+
+/*
+ * install the fork handlers and look up the exec functions
+ * called from the library constructor, outside any malloc call
+ *
+ * an exec can come before that (another library's constructor): execve
+ * and fexecve then go to the kernel directly, the others are looked up
+ * on first use. the environment is passed unchanged until our path is
+ * known.
+ */
+void process_init(void) {
+    pthread_atfork(fork_prepare, fork_parent, fork_child);
+
+#ifndef PROFILER_LINK_WRAP
+    Dl_info self;
+    if (dladdr((void*)process_init, &self) && self.dli_fname) {
+        if (!realpath(self.dli_fname, g_self_path)) g_self_path[0] = '\0';
+    }
+
+    real_execve = dlsym(RTLD_NEXT, "execve");
+    real_execvpe = dlsym(RTLD_NEXT, "execvpe");
+    real_fexecve = dlsym(RTLD_NEXT, "fexecve");
+    real_posix_spawn = dlsym(RTLD_NEXT, "posix_spawn");
+    real_posix_spawnp = dlsym(RTLD_NEXT, "posix_spawnp");
+#endif
+}
+
+#ifndef PROFILER_LINK_WRAP
+/*
+ * environment rewriting for exec
+ *
+ * runs in vfork() children and right before exec, so no malloc: the new
+ * array and the LD_PRELOAD string live on the caller's stack.
+ */
+
+// room for the PROFILER_* settings we may add
+#define ENV_EXTRA 32
+
+// enough for "LD_PRELOAD=" + our path + ":" + the original value
+#define PRELOAD_MAX (2 * PATH_MAX)
+
+extern char **environ;
+
+static size_t env_count(char *const envp[]) {
+    size_t n = 0;
+    while (envp && envp[n]) n++;
+    return n;
+}
+
+// length of "NAME=" in entry, or 0
+static size_t env_name_len(const char *entry) {
+    const char *eq = strchr(entry, '=');
+    return eq ? (size_t)(eq - entry) + 1 : 0;
+}
+
+static int env_has(char *const envp[], const char *entry) {
+    size_t len = env_name_len(entry);
+    for (size_t i = 0; envp && envp[i]; i++) {
+        if (strncmp(envp[i], entry, len) == 0) return 1;
+    }
+    return 0;
+}
+
+/*
+ * copy envp into out (env_count(envp) + ENV_EXTRA + 1 slots) with our
+ * LD_PRELOAD entry and any missing PROFILER_* settings added
+ * returns envp itself if nothing had to change
+ */
+static char *const *profiled_env(char *const envp[], char **out, char *preload) {
+    if (!g_self_path[0]) return envp;
+
+    size_t n = 0;
+    int changed = 0;
+    int preload_seen = 0;
+
+    for (size_t i = 0; envp && envp[i]; i++) {
+        const char *entry = envp[i];
+        if (strncmp(entry, "LD_PRELOAD=", 11) == 0) {
+            preload_seen = 1;
+            if (!strstr(entry + 11, g_self_path)) {
+                // ours first, so we win against the other preloads
+                size_t self_len = strlen(g_self_path);
+                size_t rest_len = strlen(entry + 11);
+                if (11 + self_len + 1 + rest_len + 1 <= PRELOAD_MAX) {
+                    memcpy(preload, "LD_PRELOAD=", 11);
+                    memcpy(preload + 11, g_self_path, self_len);
+                    preload[11 + self_len] = ':';
+                    memcpy(preload + 12 + self_len, entry + 11, rest_len + 1);
+                    entry = preload;
+                    changed = 1;
+                }
+            }
+        }
+        out[n++] = (char*)entry;
+    }
+
+    if (!preload_seen) {
+        memcpy(preload, "LD_PRELOAD=", 11);
+        memcpy(preload + 11, g_self_path, strlen(g_self_path) + 1);
+        out[n++] = preload;
+        changed = 1;
+    }
+
+    // our configuration follows us unless the caller set its own
+    size_t added = 0;
+    for (char **env = environ; env && *env && added < ENV_EXTRA - 1; env++) {
+        if (strncmp(*env, "PROFILER_", 9) == 0 && !env_has(envp, *env)) {
+            out[n++] = *env;
+            added++;
+            changed = 1;
+        }
+    }
+
+    out[n] = NULL;
+    return changed ? out : envp;
+}
+
+int execve(const char *path, char *const argv[], char *const envp[]) {
+    char *env[env_count(envp) + ENV_EXTRA + 1];
+    char preload[PRELOAD_MAX];
+    char *const *profiled = profiled_env(envp, env, preload);
+    if (!real_execve) return (int)syscall(SYS_execve, path, argv, profiled);
+    return real_execve(path, argv, profiled);
+}
+
+int execvpe(const char *file, char *const argv[], char *const envp[]) {
+    char *env[env_count(envp) + ENV_EXTRA + 1];
+    char preload[PRELOAD_MAX];
+    if (!real_execvpe) real_execvpe = dlsym(RTLD_NEXT, "execvpe");
+    if (!real_execvpe) {
+        errno = ENOSYS;
+        return -1;
+    }
+    return real_execvpe(file, argv, profiled_env(envp, env, preload));
+}
+
+int fexecve(int fd, char *const argv[], char *const envp[]) {
+    char *env[env_count(envp) + ENV_EXTRA + 1];
+    char preload[PRELOAD_MAX];
+    char *const *profiled = profiled_env(envp, env, preload);
+    if (!real_fexecve) return (int)syscall(SYS_execveat, fd, "", argv, profiled, AT_EMPTY_PATH);
+    return real_fexecve(fd, argv, profiled);
+}
+
+/*
+ * execle(path, arg0, ..., NULL, envp): libc implements it with an
+ * internal execve we cannot see, so collect the arguments and use ours
+ */
+int execle(const char *path, const char *arg, ...) {
+    va_list ap;
+    size_t argc = 1;
+    va_start(ap, arg);
+    while (va_arg(ap, const char*)) argc++;
+    va_end(ap);
+
+    const char *argv[argc + 1];
+    argv[0] = arg;
+    va_start(ap, arg);
+    for (size_t i = 1; i <= argc; i++) {
+        argv[i] = va_arg(ap, const char*);     // argv[argc] is the NULL
+    }
+    char *const *envp = va_arg(ap, char *const*);
+    va_end(ap);
+
+    return execve(path, (char *const*)argv, envp);
+}
+
+int posix_spawn(pid_t *pid, const char *path, const posix_spawn_file_actions_t *file_actions,
+                const posix_spawnattr_t *attrp, char *const argv[], char *const envp[]) {
+    char *env[env_count(envp) + ENV_EXTRA + 1];
+    char preload[PRELOAD_MAX];
+    if (!real_posix_spawn) real_posix_spawn = dlsym(RTLD_NEXT, "posix_spawn");
+    if (!real_posix_spawn) return ENOSYS;
+    return real_posix_spawn(pid, path, file_actions, attrp, argv, profiled_env(envp, env, preload));
+}
+
+int posix_spawnp(pid_t *pid, const char *file, const posix_spawn_file_actions_t *file_actions,
+                 const posix_spawnattr_t *attrp, char *const argv[], char *const envp[]) {
+    char *env[env_count(envp) + ENV_EXTRA + 1];
+    char preload[PRELOAD_MAX];
+    if (!real_posix_spawnp) real_posix_spawnp = dlsym(RTLD_NEXT, "posix_spawnp");
+    if (!real_posix_spawnp) return ENOSYS;
+    return real_posix_spawnp(pid, file, file_actions, attrp, argv, profiled_env(envp, env, preload));
+}
+#endif
@@ -9,47 +9,294 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include "../include/profiler_internal.h"
 
 /*
  * Async-Safe Output Utilities :used by all profiler modules to output JSON without using malloc/printf 
  */
 
+// where events go: stderr, or the file named by PROFILER_OUTPUT
+// -1 in a forked child until its own file is opened
+static int g_output_fd = STDERR_FILENO;
+static char g_output_pattern[PATH_MAX];
+static int g_output_per_process = 0;
+
+// the output descriptor, if it is a FIFO read by a live symbolizer
+static int g_output_pipe = -1;
+
+// the output descriptor, if it is a connection to profilerd
+static int g_output_socket = -1;
+
+// PROFILER_OUTPUT=unix:<path> names a socket to connect to
+#define UNIX_PREFIX "unix:"
+
+static int format_dec(char *buf, size_t val);
+
+/*
+ * expand a file name pattern (PROFILER_OUTPUT, PROFILER_TRACE): %p is
+ * the process id, %% a literal %
+ * returns 1 if the pattern depends on the pid
+ */
+int output_expand_path(const char *pattern, char *path, size_t len) {
+    int per_process = 0;
+    size_t n = 0;
+    for (const char *p = pattern; *p && n + 32 < len; p++) {
+        if (p[0] == '%' && p[1] == 'p') {
+            n += format_dec(path + n, (size_t)getpid());
+            per_process = 1;
+            p++;
+        } else if (p[0] == '%' && p[1] == '%') {
+            path[n++] = '%';
+            p++;
+        } else {
+            path[n++] = *p;
+        }
+    }
+    path[n] = '\0';
+    return per_process;
+}
+
+/*
+ * connect to the collector listening on a Unix socket (tools/profilerd)
+ * every process has a connection of its own, a forked child makes its
+ * own on its first event, so the collector can tell processes apart
+ */
+static int connect_output(const char *path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    size_t len = strlen(path);
+
+    int fd = -1;
+    if (len < sizeof(addr.sun_path)) {
+        memcpy(addr.sun_path, path, len);
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    }
+    if (fd >= 0 && connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        fd = -1;
+    }
+    if (fd < 0) {
+        static const char msg[] = "[PROFILER ERROR] cannot connect to PROFILER_OUTPUT, using stderr\n";
+        write(STDERR_FILENO, msg, sizeof(msg) - 1);
+        return STDERR_FILENO;
+    }
+    __atomic_store_n(&g_output_socket, fd, __ATOMIC_RELEASE);
+    return fd;
+}
+
+/*
+ * open the output file, or connect to a unix: socket
+ * returns the descriptor, or stderr on failure
+ *
+ * a per-process file (%p) is started fresh. a shared one is appended
+ * to, so a forked or exec()ed process never truncates its parent's
+ * report; every event is a single write(), so lines never interleave.
+ *
+ * a FIFO needs its reader to be there already: opening it does not wait
+ * for one (a process exec()ed after the symbolizer is gone would hang),
+ * but writes to it do, see pipe_write().
+ */
+static int open_output(void) {
+    char path[PATH_MAX];
+    g_output_per_process = output_expand_path(g_output_pattern, path, sizeof(path));
+    if (strncmp(path, UNIX_PREFIX, strlen(UNIX_PREFIX)) == 0) {
+        g_output_per_process = 1;
+        return connect_output(path + strlen(UNIX_PREFIX));
+    }
+    int flags = O_WRONLY | O_CREAT | O_CLOEXEC | O_NONBLOCK | (g_output_per_process ? O_TRUNC : O_APPEND);
+
+    int fd = open(path, flags, 0644);
+    if (fd < 0) {
+        static const char msg[] = "[PROFILER ERROR] cannot open PROFILER_OUTPUT, using stderr\n";
+        static const char no_reader[] = "[PROFILER ERROR] PROFILER_OUTPUT has no reader, using stderr\n";
+        if (errno == ENXIO) write(STDERR_FILENO, no_reader, sizeof(no_reader) - 1);
+        else write(STDERR_FILENO, msg, sizeof(msg) - 1);
+        return STDERR_FILENO;
+    }
+    fcntl(fd, F_SETFL, flags & ~(O_NONBLOCK | O_CREAT | O_TRUNC | O_CLOEXEC));
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode)) {
+        __atomic_store_n(&g_output_pipe, fd, __ATOMIC_RELEASE);
+    }
+    return fd;
+}
+
+void output_init(void) {
+    const char *pattern = getenv("PROFILER_OUTPUT");
+    if (!pattern || !*pattern || strlen(pattern) >= sizeof(g_output_pattern)) return;
+
+    memcpy(g_output_pattern, pattern, strlen(pattern) + 1);
+    g_output_fd = open_output();
+}
+
 /*
- * write a string to stderr
+ * a forked child gets its own file when the name has %p in it,
+ * otherwise it keeps writing to the inherited descriptor.
+ * the file is created on the first write, so the many children that
+ * only _exit() leave no empty files behind.
+ */
+void output_after_fork(void) {
+    if (!g_output_per_process) return;
+    if (g_output_fd != STDERR_FILENO) close(g_output_fd);
+    g_output_fd = -1;
+    g_output_pipe = -1;
+    g_output_socket = -1;
+}
+
+// returns 0 with errno set if not all of data could be written
+static int write_all(int fd, const char *data, size_t len) {
+    while (len) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return 0;
+        data += n;
+        len -= (size_t)n;
+    }
+    return 1;
+}
+
+// the reader of fd went away, carry on with stderr
+static void output_lost(int fd) {
+    // the descriptor is left open: other threads may still hold it
+    int expected = fd;
+    if (__atomic_compare_exchange_n(&g_output_fd, &expected, STDERR_FILENO, 0,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        static const char msg[] = "[PROFILER ERROR] PROFILER_OUTPUT has no reader, using stderr\n";
+        write(STDERR_FILENO, msg, sizeof(msg) - 1);
+    }
+}
+
+/*
+ * write to a FIFO (PROFILER_OUTPUT=<fifo>, see tools/run_profiler.sh --stream)
+ *
+ * the write blocks while the pipe is full, so a symbolizer that falls
+ * behind slows the program down instead of losing events. one that is
+ * gone would raise SIGPIPE and kill the program: the signal is blocked
+ * around the write, and the rest of the report goes to stderr.
+ */
+static void pipe_write(int fd, const char *data, size_t len) {
+    sigset_t pipe_set, old_set, pending;
+    sigemptyset(&pipe_set);
+    sigaddset(&pipe_set, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipe_set, &old_set);
+    sigpending(&pending);
+    int was_pending = sigismember(&pending, SIGPIPE);
+
+    if (!write_all(fd, data, len) && errno == EPIPE) {
+        // take back the SIGPIPE we raised, not one that was already there
+        if (!was_pending) {
+            static const struct timespec no_wait = { 0, 0 };
+            sigtimedwait(&pipe_set, NULL, &no_wait);
+        }
+        output_lost(fd);
+    }
+    pthread_sigmask(SIG_SETMASK, &old_set, NULL);
+}
+
+/*
+ * send to profilerd: like a FIFO, a collector that falls behind holds
+ * the program back, and one that is gone sends the rest to stderr
+ */
+static void socket_write(int fd, const char *data, size_t len) {
+    while (len) {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            output_lost(fd);
+            return;
+        }
+        data += n;
+        len -= (size_t)n;
+    }
+}
+
+static void output_write(const void *data, size_t len) {
+    int fd = __atomic_load_n(&g_output_fd, __ATOMIC_ACQUIRE);
+    if (fd < 0) {
+        // two threads may race to open it, the loser closes its copy
+        int expected = -1;
+        fd = open_output();
+        if (!__atomic_compare_exchange_n(&g_output_fd, &expected, fd, 0,
+                                         __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            if (fd != STDERR_FILENO) close(fd);
+            fd = expected;
+        }
+    }
+    if (fd == __atomic_load_n(&g_output_pipe, __ATOMIC_ACQUIRE)) {
+        pipe_write(fd, data, len);
+    } else if (fd == __atomic_load_n(&g_output_socket, __ATOMIC_ACQUIRE)) {
+        socket_write(fd, data, len);
+    } else {
+        write_all(fd, data, len);
+    }
+}
+
+/*
+ * write a string to the output
  * async-safe, no malloc
  */
 void write_str(const char *str) {
-    write(STDERR_FILENO, str, strlen(str));
+    output_write(str, strlen(str));
 }
 
 /*
- * write an unsigned integer as hex string
- * async-safe, no malloc
+ * format an unsigned integer into buf (no terminator)
+ * returns the number of characters written
  */
-void write_hex(unsigned long val) {
-    char buf[32];
-    int i = 0;
-    
-    if (val == 0) {
-        write(STDERR_FILENO, "0x0", 3);
-        return;
-    }
+static int format_hex(char *buf, unsigned long val) {
+    char tmp[32];
+    int i = 0, n = 0;
     
     // convert to hex (reverse order)
-    while (val > 0 && i < 30) {
+    do {
         int digit = val % 16;
-        buf[i++] = (digit < 10) ? ('0' + digit) : ('a' + digit - 10);
+        tmp[i++] = (digit < 10) ? ('0' + digit) : ('a' + digit - 10);
         val /= 16;
+    } while (val > 0 && i < 30);
+    
+    buf[n++] = '0';
+    buf[n++] = 'x';
+    while (i > 0) {
+        buf[n++] = tmp[--i];
     }
+    return n;
+}
+
+static int format_dec(char *buf, size_t val) {
+    char tmp[32];
+    int i = 0, n = 0;
     
-    // write "0x" prefix
-    write(STDERR_FILENO, "0x", 2);
+    // convert to decimal (reverse order)
+    do {
+        tmp[i++] = '0' + (val % 10);
+        val /= 10;
+    } while (val > 0 && i < 30);
     
-    // write digits in correct order
     while (i > 0) {
-        write(STDERR_FILENO, &buf[--i], 1);
+        buf[n++] = tmp[--i];
     }
+    return n;
+}
+
+/*
+ * write an unsigned integer as hex string
+ * async-safe, no malloc
+ */
+void write_hex(unsigned long val) {
+    char buf[32];
+    output_write(buf, format_hex(buf, val));
 }
 
 /*
@@ -58,34 +305,160 @@ void write_hex(unsigned long val) {
  */
 void write_dec(size_t val) {
     char buf[32];
-    int i = 0;
-    
-    if (val == 0) {
-        write(STDERR_FILENO, "0", 1);
-        return;
+    output_write(buf, format_dec(buf, val));
+}
+
+/*
+ * Line Buffer Utilities: build a whole JSON event, then write() it once
+ */
+
+void buf_flush(out_buf_t *buf) {
+    if (buf->len > 0) {
+        output_write(buf->data, buf->len);
+        buf->len = 0;
     }
-    
-    // convert to decimal (reverse order)
-    while (val > 0 && i < 30) {
-        buf[i++] = '0' + (val % 10);
-        val /= 10;
+}
+
+static void buf_append(out_buf_t *buf, const char *data, size_t len) {
+    // flush early rather than truncate an oversized event
+    if (buf->len + len > OUT_BUF_SIZE) {
+        buf_flush(buf);
+        if (len > OUT_BUF_SIZE) {
+            output_write(data, len);
+            return;
+        }
     }
+    memcpy(buf->data + buf->len, data, len);
+    buf->len += len;
+}
+
+void buf_str(out_buf_t *buf, const char *str) {
+    buf_append(buf, str, strlen(str));
+}
+
+void buf_hex(out_buf_t *buf, unsigned long val) {
+    char tmp[32];
+    buf_append(buf, tmp, format_hex(tmp, val));
+}
+
+void buf_dec(out_buf_t *buf, size_t val) {
+    char tmp[32];
+    buf_append(buf, tmp, format_dec(tmp, val));
+}
+
+/*
+ * append the top REPORT_FRAMES frames of a stack trace as JSON objects
+ * 
+ * Format: {"addr":"0x123","bin":"libprofiler.so"},{"addr":"0x456","bin":"test_program"}
+ * dladdr() maps each address to the binary that contains it (no malloc)
+ */
+void buf_frames(out_buf_t *buf, void **trace, int depth, unsigned int epoch) {
+    int frames_to_show = (depth < REPORT_FRAMES) ? depth : REPORT_FRAMES;
     
-    // write digits in correct order
-    while (i > 0) {
-        write(STDERR_FILENO, &buf[--i], 1);
+    for (int i = 0; i < frames_to_show; i++) {
+        if (i > 0) buf_str(buf, ",");
+        
+        // module and offset, from the table the frame was recorded against
+        if (modules_buf_frame(buf, trace[i], epoch)) continue;
+        
+        // default is unknown
+        Dl_info dl_info;
+        const char *binary_name = "unknown";
+#ifdef PROFILER_LINK_WRAP
+        // dladdr() knows nothing in a static binary, where all code is
+        // in the executable itself
+        binary_name = program_invocation_short_name;
+#endif
+        if (dladdr(trace[i], &dl_info) && dl_info.dli_fname) {
+            // Extract just the filename from the full path
+            const char *slash = strrchr(dl_info.dli_fname, '/');
+            binary_name = slash ? (slash + 1) : dl_info.dli_fname;
+        }
+        
+        buf_str(buf, "{\"addr\":\"");
+        buf_hex(buf, (unsigned long)trace[i]);
+        buf_str(buf, "\",\"bin\":\"");
+        buf_str(buf, binary_name);
+        buf_str(buf, "\"}");
     }
 }
 
+/*
+ * Memory Accounting: live/peak bytes, updated with atomics from any thread
+ */
+
+static size_t g_live[STAT_CATEGORIES];
+static size_t g_peak[STAT_CATEGORIES];
+static size_t g_live_total;
+static size_t g_peak_total;
+
+// raise *peak to at least value (lock-free max)
+static void update_peak(size_t *peak, size_t value) {
+    size_t seen = __atomic_load_n(peak, __ATOMIC_RELAXED);
+    while (value > seen &&
+           !__atomic_compare_exchange_n(peak, &seen, value, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        // seen was refreshed by the failed exchange, retry
+    }
+}
+
+void stats_account(stat_category_t category, long delta) {
+    size_t live = __atomic_add_fetch(&g_live[category], (size_t)delta, __ATOMIC_RELAXED);
+    size_t total = __atomic_add_fetch(&g_live_total, (size_t)delta, __ATOMIC_RELAXED);
+    if (delta > 0) {
+        update_peak(&g_peak[category], live);
+        update_peak(&g_peak_total, total);
+    }
+}
+
+size_t stats_live_bytes(stat_category_t category) {
+    return __atomic_load_n(&g_live[category], __ATOMIC_RELAXED);
+}
+
+size_t stats_peak_bytes(stat_category_t category) {
+    return __atomic_load_n(&g_peak[category], __ATOMIC_RELAXED);
+}
+
+size_t stats_peak_total_bytes(void) {
+    return __atomic_load_n(&g_peak_total, __ATOMIC_RELAXED);
+}
+
+// start counting from zero, on activation after a dormant period
+void stats_reset(void) {
+    for (int i = 0; i < STAT_CATEGORIES; i++) {
+        __atomic_store_n(&g_live[i], 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&g_peak[i], 0, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&g_live_total, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&g_peak_total, 0, __ATOMIC_RELAXED);
+}
+
 /*
  * Library Lifecycle Management
  */
 
+// set once libc is far enough into startup for the unwinder, see capture_stack()
+int profiler_stacks_ready = 0;
+
 // Library constructor - runs when .so is loaded
+// initializes eagerly, so interposers normally find the profiler ready.
+// allocations made before this runs (by earlier constructors) still
+// trigger init lazily from the interposer.
 __attribute__((constructor))
 static void profiler_lib_init(void) {
-    // Currently initialization happens on first malloc call
-    // This could be extended to read config, setup signal handlers, etc.
+    profiler_init();
+    profiler_stacks_ready = 1;
+    
+    // the unwinder sets up its caches with malloc() on first use; get
+    // that done here, where the allocations are known to be its own
+    void *trace[MAX_STACK_FRAMES];
+    in_profiler = PROFILER_OWN_CALLS;
+    capture_stack(trace);
+    in_profiler = 0;
+    modules_init();
+    process_init();
+    activation_start_watcher();
+    sites_init();
 }
 
 // Library destructor - runs when .so is unloaded  
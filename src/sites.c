@@ -0,0 +1,277 @@
+/*
+ * sites - live allocations by call site, written periodically
+ *
+ * the exit report comes too late for a service that runs for weeks.
+ * with PROFILER_REPORT_INTERVAL=<seconds> a thread groups the live
+ * allocations by stack every so often and writes the heaviest sites:
+ *
+ *   {"type":"sites","pid":1234,"seq":3,"sites":2,"live_allocs":5120,"live_bytes":1048576}
+ *   {"type":"site","count":5000,"bytes":1024000,"frames":[...]}
+ *   {"type":"site","count":120,"bytes":24576,"frames":[...]}
+ *
+ * each "sites" event replaces the previous snapshot of that process, and
+ * is followed by its "sites" lines. PROFILER_REPORT_TOP sets how many
+ * sites are written (default 20). meant for tools/profilerd, which merges
+ * the snapshots of every process on a host, but it is plain JSON Lines
+ * like the rest of the output.
+ *
+ * sites are keyed by the frames the report shows (REPORT_FRAMES). the
+ * table is fixed in size: once it is full, allocations from new sites
+ * only count in the totals. the registry is locked while it is walked,
+ * so the walk only counts; the events are written after it is unlocked.
+ *
+ * a forked child starts a reporter of its own, so every worker of a
+ * pre-fork server is covered. it is started on the child's first tracked
+ * allocation: the fork handler itself may only make async-signal-safe
+ * calls. the reporter also writes corruption summaries that are due (see
+ * corruption.c).
+ *
+ * the reporter waits on a condition variable, and the exit report stops
+ * and joins it first: no pass walks the registry while it is torn down,
+ * and no site line follows the summary.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "../include/profiler_internal.h"
+
+// distinct sites per snapshot, a power of two
+#define SITES_MAX 4096
+
+#define DEFAULT_TOP 20
+
+typedef struct {
+    uint64_t hash;              // 0 for a free slot
+    size_t count;
+    size_t bytes;
+    unsigned int epoch;         // modules_epoch of the first allocation seen
+    int depth;
+    void *frames[REPORT_FRAMES];
+} site_t;
+
+typedef struct {
+    site_t *sites;
+    size_t live_allocs;
+    size_t live_bytes;
+} snapshot_t;
+
+static unsigned int g_interval = 0;
+static size_t g_top = DEFAULT_TOP;
+static site_t *g_sites = NULL;
+static size_t g_seq = 0;
+
+// reporter thread, woken early by sites_stop()
+static pthread_t g_reporter;
+static int g_reporter_running = 0;
+static int g_stop = 0;
+static pthread_mutex_t g_wait_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_wake;
+
+// set in a forked child, the reporter starts on its first allocation
+int sites_start_pending = 0;
+
+static unsigned long env_count(const char *name, unsigned long fallback) {
+    const char *value = getenv(name);
+    if (!value || !*value) return fallback;
+
+    char *end;
+    unsigned long parsed = strtoul(value, &end, 10);
+    return *end == '\0' ? parsed : fallback;
+}
+
+static uint64_t hash_frames(void **frames, int depth) {
+    uint64_t h = 1469598103934665603ull;
+    for (int i = 0; i < depth; i++) {
+        h = (h ^ (uint64_t)(uintptr_t)frames[i]) * 1099511628211ull;
+    }
+    return h ? h : 1;
+}
+
+// called for every live allocation, with the registry locked
+static void count_allocation(const allocation_info_t *info, void *arg) {
+    snapshot_t *snap = arg;
+    snap->live_allocs++;
+    snap->live_bytes += info->size;
+    if (!info->stack_trace || info->stack_depth <= 0) return;
+
+    int depth = info->stack_depth < REPORT_FRAMES ? info->stack_depth : REPORT_FRAMES;
+    uint64_t h = hash_frames(info->stack_trace, depth);
+    for (size_t probe = 0; probe < SITES_MAX; probe++) {
+        site_t *s = &snap->sites[(h + probe) & (SITES_MAX - 1)];
+        if (s->hash == 0) {
+            s->hash = h;
+            s->epoch = info->modules_epoch;
+            s->depth = depth;
+            memcpy(s->frames, info->stack_trace, depth * sizeof(void*));
+        } else if (s->hash != h || s->depth != depth ||
+                   memcmp(s->frames, info->stack_trace, depth * sizeof(void*)) != 0) {
+            continue;
+        }
+        s->count++;
+        s->bytes += info->size;
+        return;
+    }
+}
+
+static void write_site(const site_t *s) {
+    out_buf_t buf;
+    buf.len = 0;
+    buf_str(&buf, "{\"type\":\"site\",\"count\":");
+    buf_dec(&buf, s->count);
+    buf_str(&buf, ",\"bytes\":");
+    buf_dec(&buf, s->bytes);
+    buf_str(&buf, ",\"frames\":[");
+    buf_frames(&buf, (void**)s->frames, s->depth, s->epoch);
+    buf_str(&buf, "]}\n");
+    buf_flush(&buf);
+}
+
+/*
+ * one snapshot: count, then write the top sites, heaviest first
+ */
+static void report_sites(void) {
+    snapshot_t snap = { g_sites, 0, 0 };
+    memset(g_sites, 0, SITES_MAX * sizeof(site_t));
+
+    in_profiler = 1;
+    hash_table_for_each_live(count_allocation, &snap);
+    profiler_leave();
+
+    size_t used = 0;
+    for (size_t i = 0; i < SITES_MAX; i++) {
+        if (g_sites[i].hash) used++;
+    }
+    size_t shown = used < g_top ? used : g_top;
+
+    out_buf_t buf;
+    buf.len = 0;
+    buf_str(&buf, "{\"type\":\"sites\",\"pid\":");
+    buf_dec(&buf, (size_t)getpid());
+    buf_str(&buf, ",\"seq\":");
+    buf_dec(&buf, ++g_seq);
+    buf_str(&buf, ",\"sites\":");
+    buf_dec(&buf, shown);
+    buf_str(&buf, ",\"live_allocs\":");
+    buf_dec(&buf, snap.live_allocs);
+    buf_str(&buf, ",\"live_bytes\":");
+    buf_dec(&buf, snap.live_bytes);
+    buf_str(&buf, "}\n");
+    buf_flush(&buf);
+
+    // selection of the heaviest: top is small next to the table
+    for (size_t n = 0; n < shown; n++) {
+        site_t *best = NULL;
+        for (size_t i = 0; i < SITES_MAX; i++) {
+            site_t *s = &g_sites[i];
+            if (s->hash && (!best || s->bytes > best->bytes)) best = s;
+        }
+        write_site(best);
+        best->hash = 0;
+    }
+}
+
+// sleep one interval; returns 0 once sites_stop() asks us to exit
+static int wait_interval(void) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += g_interval;
+
+    pthread_mutex_lock(&g_wait_mutex);
+    while (!g_stop) {
+        if (pthread_cond_timedwait(&g_wake, &g_wait_mutex, &deadline) == ETIMEDOUT) break;
+    }
+    int keep_going = !g_stop;
+    pthread_mutex_unlock(&g_wait_mutex);
+    return keep_going;
+}
+
+static void *sites_reporter(void *arg) {
+    (void)arg;
+
+    while (wait_interval()) {
+        if (!profiler_dormant) report_sites();
+        corruption_flush_due();
+    }
+    return NULL;
+}
+
+static void start_reporter(void) {
+    if (!g_interval || !g_sites) return;
+
+    // the thread's stack and TLS are the profiler's own, not the program's
+    in_profiler = PROFILER_OWN_CALLS;
+    pthread_condattr_t cond_attr;
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&g_wake, &cond_attr);
+    pthread_condattr_destroy(&cond_attr);
+
+    g_stop = 0;
+    int failed = pthread_create(&g_reporter, NULL, sites_reporter, NULL);
+    in_profiler = 0;
+    if (failed) {
+        write_str("[PROFILER ERROR] failed to start the site reporter\n");
+    } else {
+        g_reporter_running = 1;
+    }
+}
+
+// first tracked allocation of a forked child, see sites_fork_child()
+void sites_start_deferred(void) {
+    if (__atomic_exchange_n(&sites_start_pending, 0, __ATOMIC_ACQ_REL)) {
+        start_reporter();
+    }
+}
+
+/*
+ * stop and join the reporter, called before the exit report
+ * a pass already running is finished first
+ */
+void sites_stop(void) {
+    __atomic_store_n(&sites_start_pending, 0, __ATOMIC_RELEASE);
+    if (!g_reporter_running) return;
+
+    pthread_mutex_lock(&g_wait_mutex);
+    g_stop = 1;
+    pthread_cond_signal(&g_wake);
+    pthread_mutex_unlock(&g_wait_mutex);
+
+    pthread_join(g_reporter, NULL);
+    g_reporter_running = 0;
+}
+
+/*
+ * read the configuration and start the reporter thread, called from
+ * the library constructor
+ */
+void sites_init(void) {
+    g_interval = (unsigned int)env_count("PROFILER_REPORT_INTERVAL", 0);
+    g_top = env_count("PROFILER_REPORT_TOP", DEFAULT_TOP);
+    if (!g_interval) return;
+
+    void *mem = (void*)syscall(SYS_mmap, NULL, SITES_MAX * sizeof(site_t), PROT_READ | PROT_WRITE,
+                               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    g_sites = mem == MAP_FAILED ? NULL : mem;
+    start_reporter();
+}
+
+/*
+ * the reporter is a thread of the parent, the child needs its own
+ * only plain stores here: this runs inside fork(), so the thread is
+ * created later, by sites_start_deferred()
+ */
+void sites_fork_child(void) {
+    static const pthread_mutex_t unlocked = PTHREAD_MUTEX_INITIALIZER;
+
+    g_seq = 0;
+    g_reporter_running = 0;
+    g_wait_mutex = unlocked;
+    if (g_interval && g_sites) sites_start_pending = 1;
+}
@@ -0,0 +1,138 @@
+/*
+ * stack capture - variant chosen once at load time
+ *
+ * every tracked allocation records a stack. whether a full backtrace is
+ * wanted is fixed for the life of the process (PROFILER_STACK_TRACES), so
+ * instead of testing a flag on every malloc the variant is picked by a
+ * GNU IFUNC resolver when the library is relocated.
+ *
+ * why not IFUNC the exported malloc() itself:
+ * a preloaded library is relocated after libc, and libc binds its own
+ * references to malloc/free first. glibc then calls the resolver on our
+ * unrelocated object and prints "Relink ... for IFUNC symbol" warnings.
+ * profiler_capture_stack() is hidden, so it is only bound by our own
+ * relocations, after everything it needs.
+ *
+ * resolver constraints:
+ * - libc is relocated but not initialized: getenv() sees no environment
+ *   yet in a dynamic process, so we read /proc/self/environ instead
+ * - in a static binary IFUNCs are applied before TLS exists, and libc's
+ *   string functions are IFUNCs themselves; environ is already set there,
+ *   and we scan it by hand without calling into libc
+ */
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <unistd.h>
+#include <execinfo.h>
+#include "../include/profiler_internal.h"
+
+extern char **environ;
+
+/*
+ * full variant: the whole stack, minus this function's own frame
+ */
+static int capture_full(void **trace, void *caller) {
+    (void)caller;
+
+    void *frames[MAX_STACK_FRAMES + 1];
+    int depth = backtrace(frames, MAX_STACK_FRAMES + 1);
+    if (depth <= 1) return 0;
+
+    for (int i = 1; i < depth; i++) {
+        trace[i - 1] = frames[i];
+    }
+    return depth - 1;
+}
+
+#ifdef PROFILER_LINK_WRAP
+/*
+ * link-time build: move the caller's frame to the front of trace
+ * the frames before it are ours (the __wrap_ function, and for
+ * corruption reports the reporting path). if the caller is not found
+ * the stack is left as captured.
+ */
+int profiler_drop_own_frames(void **trace, int depth, void *caller) {
+    for (int i = 0; i < depth; i++) {
+        if (trace[i] != caller) continue;
+        for (int j = i; j < depth; j++) {
+            trace[j - i] = trace[j];
+        }
+        return depth - i;
+    }
+    return depth;
+}
+#endif
+
+/*
+ * caller-only variant: no unwinding at all
+ *
+ * frames are never printed in this mode, frame 1 still feeds the libc
+ * filter and the corruption dedup key
+ */
+static int capture_caller(void **trace, void *caller) {
+    trace[0] = NULL;
+    trace[1] = caller;
+    return 2;
+}
+
+/*
+ * does entry ("NAME=value") match the env string exactly?
+ * hand rolled, see resolver constraints above
+ */
+static int env_entry_equals(const char *env, const char *entry) {
+    while (*env && *env == *entry) {
+        env++;
+        entry++;
+    }
+    return *env == *entry;
+}
+
+/*
+ * is "NAME=value" set in the environment?
+ */
+static int environ_has(const char *entry) {
+    if (environ) {
+        for (char **env = environ; *env; env++) {
+            if (env_entry_equals(*env, entry)) return 1;
+        }
+        return 0;
+    }
+
+    // dynamic process: entries are NUL separated in /proc/self/environ
+    int fd = open("/proc/self/environ", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return 0;
+
+    char buf[256];
+    size_t matched = 0;     // bytes of entry matched in the current string
+    int alive = 1;          // current string still matches so far
+    int found = 0;
+    ssize_t n;
+
+    while (!found && (n = read(fd, buf, sizeof(buf))) > 0) {
+        for (ssize_t i = 0; i < n; i++) {
+            if (buf[i] == '\0') {
+                if (alive && entry[matched] == '\0') {
+                    found = 1;
+                    break;
+                }
+                matched = 0;
+                alive = 1;
+            } else if (alive) {
+                if (entry[matched] == buf[i]) {
+                    matched++;
+                } else {
+                    alive = 0;
+                }
+            }
+        }
+    }
+    close(fd);
+    return found;
+}
+
+static int (*resolve_capture_stack(void))(void **, void *) {
+    return environ_has("PROFILER_STACK_TRACES=0") ? capture_caller : capture_full;
+}
+
+int profiler_capture_stack(void **trace, void *caller) __attribute__((ifunc("resolve_capture_stack")));
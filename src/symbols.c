@@ -0,0 +1,305 @@
+/*
+ * symbols - function names for the exit report, resolved in-process
+ *
+ * with PROFILER_SYMBOLIZE=1 every frame of the exit report gets a "fn"
+ * field, "name+0x1a", next to its module and offset. it is meant for a
+ * quick look at a report without tools/resolve_symbols.py or
+ * tools/profiler-symbolize, which remain the way to get files and lines.
+ *
+ * a module's file is mapped the first time one of its frames is written,
+ * and its function symbols (.symtab, or .dynsym if it is stripped) are
+ * copied into a table sorted by address. a frame is looked up there once:
+ * the report of a thousand leaks from one call site repeats the same
+ * frames, so each (module, offset) is kept with its name in a cache.
+ * C++ names are demangled (demangle.c) when they are cached.
+ *
+ * everything lives in memory mapped straight from the kernel, and no
+ * libc call here allocates: this runs from the destructor, with malloc
+ * still interposed. a module whose file cannot be read (deleted, or not
+ * an ELF file) gets no names.
+ */
+
+#define _GNU_SOURCE
+#include <elf.h>
+#include <fcntl.h>
+#include <link.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include "../include/profiler_internal.h"
+
+// modules are numbered from 1, as in modules.c
+#define SYMBOLS_MAX_MODULES 512
+
+// distinct frames remembered, a power of two
+#define FRAME_CACHE_SIZE 16384
+
+// demangled names, escaped for JSON
+#define NAMES_ARENA_SIZE (4 * 1024 * 1024)
+
+// longest demangled name we keep, longer ones stay mangled
+#define DEMANGLED_MAX 1024
+
+typedef struct {
+    uintptr_t addr;             // link-time address
+    uintptr_t size;
+    const char *name;           // in the mapped string table
+} symbol_t;
+
+typedef struct {
+    int loaded;                 // tried: symbols is set if it worked
+    symbol_t *symbols;
+    size_t symbol_count;
+} symbol_table_t;
+
+typedef struct {
+    unsigned int module_id;     // 0 for a free slot
+    uintptr_t offset;
+    const char *name;           // NULL if the frame has no symbol
+    uintptr_t delta;            // offset - symbol address
+} frame_entry_t;
+
+int symbolize_frames = 0;  // exported configuration
+
+static symbol_table_t g_tables[SYMBOLS_MAX_MODULES];
+static frame_entry_t *g_frames;
+static char *g_names;
+static size_t g_names_used;
+
+static pthread_mutex_t symbols_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// memory of our own, not seen by the mmap interposer
+static void *map_anonymous(size_t len) {
+    void *mem = (void*)syscall(SYS_mmap, NULL, len, PROT_READ | PROT_WRITE,
+                               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return mem == MAP_FAILED ? NULL : mem;
+}
+
+static void *map_file(const char *path, size_t *size) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return NULL;
+
+    void *mem = MAP_FAILED;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(ElfW(Ehdr))) {
+        mem = (void*)syscall(SYS_mmap, NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        *size = (size_t)st.st_size;
+    }
+    close(fd);
+    return mem == MAP_FAILED ? NULL : mem;
+}
+
+/*
+ * heapsort by address: qsort() may allocate for its buffer
+ */
+static void sift_down(symbol_t *s, size_t root, size_t count) {
+    for (;;) {
+        size_t child = 2 * root + 1;
+        if (child >= count) return;
+        if (child + 1 < count && s[child + 1].addr > s[child].addr) child++;
+        if (s[root].addr >= s[child].addr) return;
+        symbol_t tmp = s[root];
+        s[root] = s[child];
+        s[child] = tmp;
+        root = child;
+    }
+}
+
+static void sort_symbols(symbol_t *s, size_t count) {
+    for (size_t i = count / 2; i-- > 0; ) {
+        sift_down(s, i, count);
+    }
+    for (size_t end = count; end-- > 1; ) {
+        symbol_t tmp = s[0];
+        s[0] = s[end];
+        s[end] = tmp;
+        sift_down(s, 0, end);
+    }
+}
+
+/*
+ * the symbol table section of a mapped ELF file, .symtab first
+ * returns NULL if there is none or the headers do not fit the file
+ */
+static const ElfW(Shdr) *find_symtab(const unsigned char *map, size_t size,
+                                     const ElfW(Shdr) **strtab) {
+    const ElfW(Ehdr) *ehdr = (const ElfW(Ehdr)*)map;
+    if (memcmp(ehdr->e_ident, ELFMAG, SELFMAG) != 0 ||
+        ehdr->e_ident[EI_CLASS] != (sizeof(void*) == 8 ? ELFCLASS64 : ELFCLASS32) ||
+        ehdr->e_shentsize != sizeof(ElfW(Shdr)) ||
+        ehdr->e_shoff > size || ehdr->e_shnum > (size - ehdr->e_shoff) / sizeof(ElfW(Shdr))) {
+        return NULL;
+    }
+
+    const ElfW(Shdr) *sections = (const ElfW(Shdr)*)(map + ehdr->e_shoff);
+    static const ElfW(Word) types[] = { SHT_SYMTAB, SHT_DYNSYM };
+    for (size_t t = 0; t < sizeof(types) / sizeof(types[0]); t++) {
+        for (size_t i = 0; i < ehdr->e_shnum; i++) {
+            const ElfW(Shdr) *sh = &sections[i];
+            if (sh->sh_type != types[t] || sh->sh_link >= ehdr->e_shnum) continue;
+            const ElfW(Shdr) *str = &sections[sh->sh_link];
+            if (sh->sh_offset > size || sh->sh_size > size - sh->sh_offset ||
+                str->sh_offset > size || str->sh_size > size - str->sh_offset ||
+                str->sh_size == 0 || map[str->sh_offset + str->sh_size - 1] != '\0') {
+                continue;
+            }
+            *strtab = str;
+            return sh;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * build the table of module id from its file, once
+ * the file stays mapped, the names point into it
+ */
+static symbol_table_t *load_table(unsigned int id, const char *path) {
+    symbol_table_t *t = &g_tables[id - 1];
+    if (t->loaded) return t;
+    t->loaded = 1;
+
+    size_t size;
+    const unsigned char *map = map_file(path, &size);
+    if (!map) return t;
+
+    const ElfW(Shdr) *strtab;
+    const ElfW(Shdr) *symtab = find_symtab(map, size, &strtab);
+    if (!symtab) {
+        syscall(SYS_munmap, map, size);
+        return t;
+    }
+
+    const ElfW(Sym) *syms = (const ElfW(Sym)*)(map + symtab->sh_offset);
+    size_t sym_count = symtab->sh_size / sizeof(ElfW(Sym));
+    const char *names = (const char*)(map + strtab->sh_offset);
+
+    size_t count = 0;
+    for (size_t i = 0; i < sym_count; i++) {
+        if (ELF64_ST_TYPE(syms[i].st_info) == STT_FUNC) count++;
+    }
+    symbol_t *table = count ? map_anonymous(count * sizeof(symbol_t)) : NULL;
+    if (!table) {
+        syscall(SYS_munmap, map, size);
+        return t;
+    }
+
+    count = 0;
+    for (size_t i = 0; i < sym_count; i++) {
+        const ElfW(Sym) *sym = &syms[i];
+        if (ELF64_ST_TYPE(sym->st_info) != STT_FUNC || sym->st_shndx == SHN_UNDEF ||
+            sym->st_value == 0 || sym->st_name >= strtab->sh_size) {
+            continue;
+        }
+        table[count].addr = sym->st_value;
+        table[count].size = sym->st_size;
+        table[count].name = names + sym->st_name;
+        count++;
+    }
+    sort_symbols(table, count);
+
+    t->symbols = table;
+    t->symbol_count = count;
+    return t;
+}
+
+/*
+ * the function offset is in: the last symbol at or before it. a symbol
+ * without a size (hand-written assembly) covers up to the next one.
+ */
+static const symbol_t *find_symbol(const symbol_table_t *t, uintptr_t offset) {
+    size_t lo = 0, hi = t->symbol_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (t->symbols[mid].addr <= offset) lo = mid + 1;
+        else hi = mid;
+    }
+    if (lo == 0) return NULL;
+
+    // aliases share an address: take the one that is sized, if any
+    const symbol_t *s = &t->symbols[lo - 1];
+    for (size_t i = lo - 1; i > 0 && t->symbols[i - 1].addr == s->addr && !s->size; i--) {
+        s = &t->symbols[i - 1];
+    }
+    if (s->size && offset >= s->addr + s->size) return NULL;
+    return s;
+}
+
+/*
+ * demangle name and copy it to the arena, escaped for a JSON string
+ * returns NULL once the arena is full
+ */
+static const char *store_name(const char *name) {
+    if (!g_names) g_names = map_anonymous(NAMES_ARENA_SIZE);
+    if (!g_names) return NULL;
+
+    char demangled[DEMANGLED_MAX];
+    const char *s = demangle_symbol(name, demangled, sizeof(demangled)) ? demangled : name;
+
+    char *start = g_names + g_names_used;
+    size_t n = g_names_used;
+    for (; *s; s++) {
+        if (n + 3 > NAMES_ARENA_SIZE) return NULL;
+        unsigned char c = (unsigned char)*s;
+        if (c < 0x20) continue;
+        if (c == '"' || c == '\\') g_names[n++] = '\\';
+        g_names[n++] = (char)c;
+    }
+    g_names[n++] = '\0';
+    g_names_used = n;
+    return start;
+}
+
+static size_t frame_hash(unsigned int id, uintptr_t offset) {
+    uint64_t h = ((uint64_t)offset << 9) ^ id;
+    h *= 0x9e3779b97f4a7c15ull;
+    return (size_t)(h >> 32) & (FRAME_CACHE_SIZE - 1);
+}
+
+/*
+ * the function at offset in module id, loaded from path
+ * returns its name, escaped for JSON, with *delta the distance from its
+ * start; NULL if it has none
+ */
+const char *symbols_lookup(unsigned int id, const char *path, uintptr_t offset, uintptr_t *delta) {
+    if (id == 0 || id > SYMBOLS_MAX_MODULES) return NULL;
+
+    pthread_mutex_lock(&symbols_mutex);
+    if (!g_frames) g_frames = map_anonymous(FRAME_CACHE_SIZE * sizeof(frame_entry_t));
+
+    // a full cache still answers, it just stops remembering
+    frame_entry_t *slot = NULL;
+    if (g_frames) {
+        size_t i = frame_hash(id, offset);
+        for (size_t probe = 0; probe < FRAME_CACHE_SIZE; probe++) {
+            frame_entry_t *e = &g_frames[(i + probe) & (FRAME_CACHE_SIZE - 1)];
+            if (e->module_id == id && e->offset == offset) {
+                *delta = e->delta;
+                pthread_mutex_unlock(&symbols_mutex);
+                return e->name;
+            }
+            if (e->module_id == 0) {
+                slot = e;
+                break;
+            }
+        }
+    }
+
+    const char *name = NULL;
+    const symbol_t *s = find_symbol(load_table(id, path), offset);
+    if (s) {
+        name = store_name(s->name);
+        *delta = offset - s->addr;
+    }
+    if (slot) {
+        slot->module_id = id;
+        slot->offset = offset;
+        slot->name = name;
+        slot->delta = name ? *delta : 0;
+    }
+    pthread_mutex_unlock(&symbols_mutex);
+    return name;
+}
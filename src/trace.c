@@ -0,0 +1,427 @@
+/*
+ * trace - every allocator call, recorded to a binary file
+ *
+ * with PROFILER_TRACE=<path> (%p for the process id, as in
+ * PROFILER_OUTPUT) each tracked malloc, calloc, realloc, aligned
+ * allocation, new and free is written to path with its size, address,
+ * thread, time and stack. the format is in include/profiler_trace.h;
+ * tools/profiler-trace reads it.
+ *
+ * each thread appends its events to a buffer of its own, with no lock,
+ * and writes the buffer out as one chunk when it is full, when the thread
+ * exits, and at exit. times and addresses are stored as deltas from the
+ * previous event in varints, so most events take 6 to 10 bytes.
+ *
+ * stacks are recorded once: a table shared by all threads maps the hash
+ * of a stack to a small id, claimed with a compare-and-swap. the thread
+ * that claims an id writes the frames, the events only carry the id.
+ * once the table is full, new stacks are recorded as id 0.
+ *
+ * buffers are mapped straight from the kernel and never unmapped; the
+ * buffer of a thread that exited is reused by the next new thread. what
+ * a process has buffered is lost if it ends without running destructors
+ * (_exit, a fatal signal, exec).
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include "../include/profiler_internal.h"
+#include "../include/profiler_trace.h"
+
+// per thread, header included
+#define TRACE_BUFFER_SIZE (1024 * 1024)
+
+// distinct stacks per process, a power of two
+#define TRACE_STACKS_MAX (1 << 18)
+
+// room for a stack definition and the event using it
+#define TRACE_EVENT_MAX (3 * TRACE_VARINT_MAX + (MAX_STACK_FRAMES + 6) * TRACE_VARINT_MAX)
+
+// states of trace_buffer_t.busy
+enum { BUFFER_IDLE = 0, BUFFER_WRITING, BUFFER_CLOSED };
+
+typedef struct trace_buffer {
+    struct trace_buffer *next;  // every buffer ever mapped
+    int owned;                  // held by a live thread
+    int busy;                   // BUFFER_*, closed once flushed at exit
+    pid_t tid;
+    uint64_t last_time;         // of the chunk's last event
+    uintptr_t last_addr;
+    uint64_t base_time;         // of the chunk's first event
+    size_t len;
+    unsigned char data[];
+} trace_buffer_t;
+
+#define TRACE_DATA_SIZE (TRACE_BUFFER_SIZE - sizeof(trace_buffer_t))
+
+typedef struct {
+    uint64_t hash;              // 0 for a free slot
+    uint32_t id;                // 0 until the claiming thread sets it
+} stack_slot_t;
+
+int trace_enabled = 0;  // exported configuration
+
+// -1 in a forked child until its first chunk
+static int g_trace_fd = -1;
+static char g_trace_pattern[PATH_MAX];
+static int g_trace_per_process = 0;
+static int g_chunks_written = 0;
+static trace_buffer_t *g_buffers = NULL;
+static stack_slot_t *g_stacks = NULL;
+static uint32_t g_next_stack = 0;
+static pthread_key_t g_thread_key;
+
+static PROFILER_TLS trace_buffer_t *t_buffer = NULL;
+
+static void *map_anonymous(size_t len) {
+    void *mem = (void*)syscall(SYS_mmap, NULL, len, PROT_READ | PROT_WRITE,
+                               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return mem == MAP_FAILED ? NULL : mem;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void trace_failed(void) {
+    if (__atomic_exchange_n(&trace_enabled, 0, __ATOMIC_ACQ_REL)) {
+        write_str("[PROFILER ERROR] cannot write PROFILER_TRACE, tracing stopped\n");
+    }
+}
+
+/*
+ * open the trace file, with the magic if it is new
+ * a per-process file is started fresh, a shared one appended to: every
+ * chunk is a single write, and carries its pid
+ */
+static int open_trace(void) {
+    char path[PATH_MAX];
+    g_trace_per_process = output_expand_path(g_trace_pattern, path, sizeof(path));
+    int flags = O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC | (g_trace_per_process ? O_TRUNC : 0);
+
+    int fd = open(path, flags, 0644);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        write_str("[PROFILER ERROR] cannot open PROFILER_TRACE, not tracing\n");
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    if (st.st_size == 0 && write(fd, TRACE_MAGIC, TRACE_MAGIC_SIZE) != TRACE_MAGIC_SIZE) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/*
+ * the trace descriptor, opened now in a forked child with a file of its
+ * own: the many children that only _exit() leave no empty files behind
+ */
+static int trace_fd(void) {
+    int fd = __atomic_load_n(&g_trace_fd, __ATOMIC_ACQUIRE);
+    if (fd >= 0) return fd;
+
+    // two threads may race to open it, the loser closes its copy
+    int expected = -1;
+    fd = open_trace();
+    if (fd < 0) return -1;
+    if (!__atomic_compare_exchange_n(&g_trace_fd, &expected, fd, 0,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        close(fd);
+        fd = expected;
+    }
+    return fd;
+}
+
+// write out the buffer as a chunk and start a new one
+static void flush_buffer(trace_buffer_t *buf) {
+    if (buf->len == 0) return;
+
+    unsigned char header[1 + 4 * TRACE_VARINT_MAX];
+    size_t n = 0;
+    header[n++] = TRACE_RECORD_CHUNK;
+    n += trace_put_varint(header + n, (uint64_t)getpid());
+    n += trace_put_varint(header + n, (uint64_t)buf->tid);
+    n += trace_put_varint(header + n, buf->base_time);
+    n += trace_put_varint(header + n, buf->len);
+
+    struct iovec iov[2] = { { header, n }, { buf->data, buf->len } };
+    int fd = trace_fd();
+    ssize_t written = -1;
+    while (fd >= 0 && (written = writev(fd, iov, 2)) < 0 && errno == EINTR) {
+    }
+    if (written != (ssize_t)(n + buf->len)) trace_failed();
+    g_chunks_written = 1;
+
+    buf->len = 0;
+    buf->last_addr = 0;
+}
+
+// a thread exits: write what it buffered, hand the buffer on
+static void thread_exit(void *arg) {
+    trace_buffer_t *buf = arg;
+    int idle = BUFFER_IDLE;
+    if (__atomic_compare_exchange_n(&buf->busy, &idle, BUFFER_WRITING, 0,
+                                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        flush_buffer(buf);
+        __atomic_store_n(&buf->busy, BUFFER_IDLE, __ATOMIC_RELEASE);
+    }
+    t_buffer = NULL;
+    __atomic_store_n(&buf->owned, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * the calling thread's buffer, taken from an exited thread or mapped
+ * returns NULL if there is no memory for one
+ */
+static trace_buffer_t *thread_buffer(void) {
+    if (t_buffer) return t_buffer;
+
+    trace_buffer_t *buf;
+    for (buf = __atomic_load_n(&g_buffers, __ATOMIC_ACQUIRE); buf; buf = buf->next) {
+        int free_slot = 0;
+        if (__atomic_compare_exchange_n(&buf->owned, &free_slot, 1, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+    if (!buf) {
+        buf = map_anonymous(TRACE_BUFFER_SIZE);
+        if (!buf) return NULL;
+        buf->owned = 1;
+        buf->next = __atomic_load_n(&g_buffers, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&g_buffers, &buf->next, buf, 0,
+                                            __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+        }
+    }
+    buf->tid = (pid_t)syscall(SYS_gettid);
+    buf->len = 0;
+    buf->last_addr = 0;
+    t_buffer = buf;
+
+    // the key's storage may be allocated on first use: that is ours
+    int saved = in_profiler;
+    in_profiler = PROFILER_OWN_CALLS;
+    pthread_setspecific(g_thread_key, buf);
+    in_profiler = saved;
+    return buf;
+}
+
+static uint64_t hash_stack(void **trace, int depth) {
+    uint64_t h = 1469598103934665603ull;
+    for (int i = 0; i < depth; i++) {
+        h = (h ^ (uint64_t)(uintptr_t)trace[i]) * 1099511628211ull;
+    }
+    return h ? h : 1;
+}
+
+/*
+ * the id of a stack, claimed if it is new
+ * *is_new is set for the thread that must write its frames
+ */
+static uint32_t stack_id(void **trace, int depth, int *is_new) {
+    *is_new = 0;
+    if (depth <= 0 || !g_stacks) return 0;
+
+    uint64_t h = hash_stack(trace, depth);
+    for (size_t probe = 0; probe < TRACE_STACKS_MAX; probe++) {
+        stack_slot_t *slot = &g_stacks[(h + probe) & (TRACE_STACKS_MAX - 1)];
+        uint64_t seen = __atomic_load_n(&slot->hash, __ATOMIC_ACQUIRE);
+        if (seen == 0) {
+            if (__atomic_compare_exchange_n(&slot->hash, &seen, h, 0,
+                                            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                uint32_t id = __atomic_add_fetch(&g_next_stack, 1, __ATOMIC_RELAXED);
+                __atomic_store_n(&slot->id, id, __ATOMIC_RELEASE);
+                *is_new = 1;
+                return id;
+            }
+            // lost the slot to another thread, it may be claiming this stack
+        }
+        if (seen != h) continue;
+
+        // claimed a moment ago: its id follows
+        uint32_t id;
+        while ((id = __atomic_load_n(&slot->id, __ATOMIC_ACQUIRE)) == 0) {
+        }
+        return id;
+    }
+    return 0;
+}
+
+/*
+ * the thread's buffer, made ready for one more event
+ * returns NULL if tracing stopped; trace_end() must follow otherwise
+ */
+static trace_buffer_t *trace_begin(void) {
+    trace_buffer_t *buf = thread_buffer();
+    if (!buf) return NULL;
+
+    int idle = BUFFER_IDLE;
+    if (!__atomic_compare_exchange_n(&buf->busy, &idle, BUFFER_WRITING, 0,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        return NULL;
+    }
+    if (TRACE_DATA_SIZE - buf->len < TRACE_EVENT_MAX) flush_buffer(buf);
+    if (buf->len == 0) {
+        buf->base_time = now_ns();
+        buf->last_time = buf->base_time;
+    }
+    return buf;
+}
+
+static void trace_end(trace_buffer_t *buf) {
+    __atomic_store_n(&buf->busy, BUFFER_IDLE, __ATOMIC_RELEASE);
+}
+
+static inline void put(trace_buffer_t *buf, uint64_t value) {
+    buf->len += trace_put_varint(buf->data + buf->len, value);
+}
+
+// the op byte and time delta every timed event starts with
+static void put_event(trace_buffer_t *buf, unsigned int op) {
+    uint64_t now = now_ns();
+    buf->data[buf->len++] = (unsigned char)op;
+    put(buf, now - buf->last_time);
+    buf->last_time = now;
+}
+
+static void put_addr(trace_buffer_t *buf, const void *addr) {
+    put(buf, trace_zigzag((int64_t)((uintptr_t)addr - buf->last_addr)));
+    buf->last_addr = (uintptr_t)addr;
+}
+
+static void put_stack(trace_buffer_t *buf, uint32_t id, void **trace, int depth) {
+    buf->data[buf->len++] = TRACE_STACK;
+    put(buf, id);
+    put(buf, (uint64_t)depth);
+    uintptr_t last = 0;
+    for (int i = 0; i < depth; i++) {
+        put(buf, trace_zigzag((int64_t)((uintptr_t)trace[i] - last)));
+        last = (uintptr_t)trace[i];
+    }
+}
+
+/*
+ * record an allocation, called with in_profiler set
+ * old_ptr is the block realloc() was called with, for TRACE_REALLOC
+ */
+void trace_alloc(trace_op_t op, void *ptr, void *old_ptr, size_t size, size_t alignment,
+                 void **trace, int depth) {
+    trace_buffer_t *buf = trace_begin();
+    if (!buf) return;
+
+    int is_new;
+    uint32_t id = stack_id(trace, depth, &is_new);
+    if (is_new) put_stack(buf, id, trace, depth);
+
+    put_event(buf, op | (alignment ? TRACE_FLAG_ALIGNED : 0));
+    put(buf, size);
+    if (alignment) put(buf, alignment);
+    put_addr(buf, ptr);
+    if (op == TRACE_REALLOC) {
+        put(buf, trace_zigzag((int64_t)((uintptr_t)old_ptr - (uintptr_t)ptr)));
+    }
+    put(buf, id);
+    trace_end(buf);
+}
+
+// record a free, called with in_profiler set
+void trace_free(void *ptr) {
+    trace_buffer_t *buf = trace_begin();
+    if (!buf) return;
+
+    put_event(buf, TRACE_FREE);
+    put_addr(buf, ptr);
+    trace_end(buf);
+}
+
+/*
+ * read PROFILER_TRACE and open the file, called from profiler_init()
+ */
+void trace_init(void) {
+    const char *pattern = getenv("PROFILER_TRACE");
+    if (!pattern || !*pattern || strlen(pattern) >= sizeof(g_trace_pattern)) return;
+    memcpy(g_trace_pattern, pattern, strlen(pattern) + 1);
+
+    g_stacks = map_anonymous(TRACE_STACKS_MAX * sizeof(stack_slot_t));
+    if (!g_stacks || pthread_key_create(&g_thread_key, thread_exit) != 0) return;
+
+    g_trace_fd = open_trace();
+    trace_enabled = g_trace_fd >= 0;
+}
+
+/*
+ * fork() support, see process.c
+ * what the parent buffered is the parent's to write. the child starts
+ * its own stack ids, and its own file if the name has %p in it.
+ */
+void trace_fork_child(void) {
+    if (!trace_enabled) return;
+
+    for (trace_buffer_t *buf = g_buffers; buf; buf = buf->next) {
+        buf->len = 0;
+        buf->last_addr = 0;
+        buf->busy = BUFFER_IDLE;
+        if (buf != t_buffer) buf->owned = 0;
+    }
+    if (t_buffer) t_buffer->tid = (pid_t)syscall(SYS_gettid);
+
+    if (g_stacks) syscall(SYS_munmap, g_stacks, TRACE_STACKS_MAX * sizeof(stack_slot_t));
+    g_stacks = map_anonymous(TRACE_STACKS_MAX * sizeof(stack_slot_t));
+    g_next_stack = 0;
+
+    g_chunks_written = 0;
+    if (g_trace_per_process) {
+        close(g_trace_fd);
+        g_trace_fd = -1;
+    }
+}
+
+// the process's mappings, to place the frames in their modules offline
+static void write_maps(void) {
+    int fd = open("/proc/self/maps", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return;
+
+    unsigned char header[1 + 2 * TRACE_VARINT_MAX];
+    char data[4096];
+    ssize_t len;
+    while ((len = read(fd, data, sizeof(data))) > 0) {
+        size_t n = 0;
+        header[n++] = TRACE_RECORD_MAPS;
+        n += trace_put_varint(header + n, (uint64_t)getpid());
+        n += trace_put_varint(header + n, (uint64_t)len);
+        struct iovec iov[2] = { { header, n }, { data, (size_t)len } };
+        if (writev(trace_fd(), iov, 2) != (ssize_t)(n + (size_t)len)) break;
+    }
+    close(fd);
+}
+
+/*
+ * write every buffer and the mappings, called from the destructor
+ * a thread still allocating has its buffer closed under it, and the
+ * rest of its calls go unrecorded
+ */
+void trace_finish(void) {
+    if (!__atomic_exchange_n(&trace_enabled, 0, __ATOMIC_ACQ_REL)) return;
+
+    for (trace_buffer_t *buf = __atomic_load_n(&g_buffers, __ATOMIC_ACQUIRE); buf; buf = buf->next) {
+        int idle = BUFFER_IDLE;
+        if (__atomic_compare_exchange_n(&buf->busy, &idle, BUFFER_CLOSED, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            flush_buffer(buf);
+        }
+    }
+    if (g_chunks_written) write_maps();
+}
@@ -0,0 +1,38 @@
+/* Test: Aligned Allocations - Expected: 2 leaks, 0 errors */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <malloc.h>
+
+int main(void) {
+    void *p1 = NULL;
+    if (posix_memalign(&p1, 64, 1000) == 0) {
+        free(p1);  // OK: must not be reported as invalid-free
+    }
+    
+    void *p2 = aligned_alloc(128, 1024);
+    free(p2);  // OK
+    
+    void *p3 = memalign(256, 300);
+    free(p3);  // OK
+    
+    void *p4 = valloc(100);
+    free(p4);  // OK
+    
+    void *p5 = pvalloc(100);
+    free(p5);  // OK
+    
+    int *arr = reallocarray(NULL, 10, sizeof(int));
+    arr = reallocarray(arr, 20, sizeof(int));
+    printf("usable size: %s\n", malloc_usable_size(arr) >= 20 * sizeof(int) ? "ok" : "too small");
+    free(arr);  // OK
+    
+    void *leak1 = aligned_alloc(64, 512);  // Leak (aligned)
+    void *leak2 = NULL;
+    if (posix_memalign(&leak2, 4096, 2048) != 0) return 1;  // Leak (aligned)
+    (void)leak1;
+    
+    printf("Test: Aligned Allocations\n");
+    printf("Expected: 2 leaks (512 + 2048 bytes, both aligned), 0 free errors\n");
+    return 0;
+}
@@ -0,0 +1,51 @@
+/* Test: Attach to a running process - Expected: 1 leak (2048 bytes), 1 free error */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+
+// run WITHOUT LD_PRELOAD: the profiler is attached while we wait below
+int main(void) {
+    // blocks from before the attach: never reported, freeing them is fine
+    char *before = malloc(100);
+    char *never_freed = malloc(300);
+    char *big_before = malloc(256 * 1024);
+
+    // Yama may only let ancestors ptrace us, the attacher is our child
+    prctl(PR_SET_PTRACER, PR_SET_PTRACER_ANY, 0, 0, 0);
+
+    char pid[32];
+    snprintf(pid, sizeof(pid), "%d", (int)getpid());
+
+    pid_t child = fork();
+    if (child == 0) {
+        execl("./tools/profiler-attach", "profiler-attach", pid, (char*)NULL);
+        _exit(127);
+    }
+
+    // the attach happens while we are blocked in this wait
+    int status;
+    waitpid(child, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0 ||
+        !dlsym(RTLD_DEFAULT, "profiler_is_active")) {
+        printf("attach failed\n");
+        return 1;
+    }
+
+    free(before);
+    free(big_before);
+
+    void *leak = malloc(2048);
+
+    int not_heap;
+    free(&not_heap);
+
+    printf("Test: Attach to Running Process\n");
+    printf("Expected: 1 leak (2048 bytes), 1 free error\n");
+    (void)never_freed;
+    (void)leak;
+    return 0;
+}
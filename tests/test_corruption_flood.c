@@ -0,0 +1,17 @@
+/* Test: Corruption Flood - Expected: 1 error site, 1000000 occurrences */
+#include <stdlib.h>
+#include <stdio.h>
+
+int main(void) {
+    void *ptr = malloc(64);
+    free(ptr);
+    
+    // same double-free site hit over and over
+    for (int i = 0; i < 1000000; i++) {
+        free(ptr);  // ERROR: double-free (deduplicated)
+    }
+    
+    printf("Test: Corruption Flood\n");
+    printf("Expected: 1 corruption site reported once, summarized with 1000000 occurrences\n");
+    return 0;
+}
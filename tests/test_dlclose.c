@@ -0,0 +1,41 @@
+/* Test: Leaks from an Unloaded Plugin - Expected: 2 leaks (64 bytes), 1 of them (40 bytes) from an unloaded module, no free errors */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <dlfcn.h>
+
+#define PLUGIN "./tests/libdlclose_plugin.so"
+
+typedef void *(*plugin_alloc_fn)(size_t);
+
+static void *load(plugin_alloc_fn *alloc) {
+    void *handle = dlopen(PLUGIN, RTLD_NOW);
+    if (!handle) {
+        printf("dlopen failed: %s\n", dlerror());
+        exit(1);
+    }
+    *alloc = (plugin_alloc_fn)dlsym(handle, "plugin_alloc");
+    return handle;
+}
+
+int main(void) {
+    plugin_alloc_fn plugin_alloc;
+
+    // first instance: allocates, then goes away
+    void *handle = load(&plugin_alloc);
+    void *orphan = plugin_alloc(40);     // Leak: nobody left to free it
+    void *block = plugin_alloc(100);
+    dlclose(handle);
+
+    free(block);  // OK: outlives the plugin, freed by the program
+
+    // second instance, usually at the same address as the first
+    handle = load(&plugin_alloc);
+    void *leak = plugin_alloc(24);       // Leak: plugin still loaded
+
+    printf("Test: Leaks from an Unloaded Plugin\n");
+    printf("Expected: 2 leaks (64 bytes), 1 of them (40 bytes) from an unloaded module, no free errors\n");
+    (void)orphan;
+    (void)leak;
+    return 0;
+}
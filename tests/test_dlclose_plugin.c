@@ -0,0 +1,6 @@
+/* plugin for test_dlclose: built as tests/libdlclose_plugin.so */
+#include <stdlib.h>
+
+__attribute__((noinline)) void *plugin_alloc(size_t size) {
+    return malloc(size);
+}
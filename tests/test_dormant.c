@@ -0,0 +1,50 @@
+/* Test: Dormant mode with runtime activation - Expected: 1 leak (2048 bytes), 3 free errors */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <signal.h>
+#include <dlfcn.h>
+
+// run with PROFILER_DORMANT=1 PROFILER_SIGNAL=SIGUSR2
+int main(void) {
+    int (*activate)(void) = (int (*)(void))dlsym(RTLD_DEFAULT, "profiler_activate");
+    int (*deactivate)(void) = (int (*)(void))dlsym(RTLD_DEFAULT, "profiler_deactivate");
+    if (!activate || !deactivate) {
+        printf("profiler not loaded\n");
+        return 1;
+    }
+
+    // dormant: neither is ever reported
+    char *before = malloc(100);
+    char *never_freed = malloc(300);
+    char *big_before = malloc(256 * 1024);  // mmap()ed by libc
+
+    activate();
+
+    free(before);           // allocated before activation, not an error
+    free(big_before);
+    free(before);           // but freeing it again is
+
+    // off and on again; the signal toggles tracking
+    deactivate();
+    char *while_dormant = malloc(64);
+    raise(SIGUSR2);
+    free(while_dormant);
+
+    // only what happens from the last activation on is reported
+    void *leak = malloc(2048);
+
+    int not_heap;
+    free(&not_heap);        // still an invalid free
+
+    // a block of this period freed twice, inside the heap the snapshot covers
+    char *twice = malloc(32);
+    free(twice);
+    free(twice);
+
+    printf("Test: Dormant Mode\n");
+    printf("Expected: 1 leak (2048 bytes), 3 free errors\n");
+    (void)never_freed;
+    (void)leak;
+    return 0;
+}
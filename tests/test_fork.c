@@ -0,0 +1,80 @@
+/* Test: fork() and exec() - Expected: 3 reports, 1 leak each (32, 64, 512 bytes), no free errors */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/wait.h>
+
+#define FORKS 50
+
+static volatile int g_stop = 0;
+
+// keeps the profiler's locks busy while the main thread forks
+static void *churn(void *arg) {
+    (void)arg;
+    while (!g_stop) {
+        free(malloc(64));
+    }
+    return NULL;
+}
+
+static void wait_for(pid_t pid) {
+    int status;
+    waitpid(pid, &status, 0);
+}
+
+int main(int argc, char **argv) {
+    // exec()ed with an empty environment: only here if LD_PRELOAD followed
+    if (argc > 1 && strcmp(argv[1], "exec-child") == 0) {
+        void *leak = malloc(32);
+        (void)leak;
+        return 0;
+    }
+
+    setvbuf(stdout, NULL, _IONBF, 0);
+    char *inherited = malloc(100);
+
+    // a child must never hang on a lock held by a thread that is gone
+    pthread_t thread;
+    pthread_create(&thread, NULL, churn, NULL);
+    for (int i = 0; i < FORKS; i++) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            free(malloc(16));
+            _exit(0);   // no report from these
+        }
+        wait_for(pid);
+    }
+    g_stop = 1;
+    pthread_join(thread, NULL);
+
+    // a worker: frees what it inherited, leaks its own block
+    pid_t worker = fork();
+    if (worker == 0) {
+        free(inherited);
+        void *leak = malloc(64);
+        (void)leak;
+        exit(0);
+    }
+    wait_for(worker);
+
+    // exec with an environment that has no LD_PRELOAD
+    pid_t exec_child = fork();
+    if (exec_child == 0) {
+        char *child_argv[] = { argv[0], "exec-child", NULL };
+        char *empty_env[] = { NULL };
+        execve(argv[0], child_argv, empty_env);
+        _exit(127);
+    }
+    wait_for(exec_child);
+
+    free(inherited);
+    void *leak = malloc(512);
+
+    printf("Test: fork() and exec()\n");
+    printf("Expected: 3 reports, 1 leak each (32, 64, 512 bytes), no free errors\n");
+    (void)leak;
+    return 0;
+}
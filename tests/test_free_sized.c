@@ -0,0 +1,38 @@
+/* Test: C23 Sized Free - Expected: 0 leaks, 4 errors */
+#include <stdlib.h>
+#include <stdio.h>
+
+// C23 functions, weak so the test also links against older libcs
+extern void free_sized(void *ptr, size_t size) __attribute__((weak));
+extern void free_aligned_sized(void *ptr, size_t alignment, size_t size) __attribute__((weak));
+
+int main(void) {
+    if (!free_sized || !free_aligned_sized) {
+        printf("free_sized not available (run with the profiler preloaded)\n");
+        return 0;
+    }
+    
+    void *p1 = malloc(100);
+    free_sized(p1, 100);  // OK
+    
+    void *p2 = calloc(10, 8);
+    free_sized(p2, 80);  // OK
+    
+    void *p3 = aligned_alloc(64, 256);
+    free_aligned_sized(p3, 64, 256);  // OK
+    
+    void *p4 = malloc(100);
+    free_sized(p4, 50);  // ERROR: wrong size
+    
+    void *p5 = aligned_alloc(64, 256);
+    free_aligned_sized(p5, 32, 256);  // ERROR: wrong alignment
+    
+    void *p6 = aligned_alloc(64, 256);
+    free_sized(p6, 256);  // ERROR: aligned block needs free_aligned_sized
+    
+    free_sized(p1, 100);  // ERROR: double-free
+    
+    printf("Test: C23 Sized Free\n");
+    printf("Expected: 0 leaks, 4 corruption errors (3 sized-free mismatches, 1 double-free)\n");
+    return 0;
+}
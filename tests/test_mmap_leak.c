@@ -0,0 +1,36 @@
+/* Test: Anonymous Mappings - Expected: 2 unreleased mappings */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define MAP_ANON_RW(len) mmap(NULL, (len), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)
+
+int main(void) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    
+    // split by a partial unmap, then trim the head: 8 pages left
+    char *split = MAP_ANON_RW(16 * page);
+    munmap(split + 4 * page, 4 * page);
+    munmap(split, 4 * page);  // Leak: pages 8..15 (8 pages)
+    
+    // half of it given back with MADV_DONTNEED, mapping stays
+    char *big = MAP_ANON_RW(1 << 20);  // Leak: 1 MiB, 512 KiB released
+    big[0] = 1;
+    madvise(big, 1 << 19, MADV_DONTNEED);
+    madvise(big, 1 << 19, MADV_DONTNEED);       // OK: already released, not counted twice
+    madvise(big + page, 4 * page, MADV_DONTNEED);
+    
+    // grown with mremap, then unmapped in full
+    char *grown = MAP_ANON_RW(4 * page);
+    grown = mremap(grown, 4 * page, 8 * page, MREMAP_MAYMOVE);
+    munmap(grown, 8 * page);  // OK
+    
+    // unmapped in full
+    char *temp = MAP_ANON_RW(page);
+    munmap(temp, page);  // OK
+    
+    printf("Test: Anonymous Mappings\n");
+    printf("Expected: 2 unreleased mappings (8 pages + 1 MiB with 512 KiB released)\n");
+    return 0;
+}
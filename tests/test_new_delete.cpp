@@ -0,0 +1,50 @@
+/* Test: C++ new/delete - Expected: 3 leaks, 5 errors */
+#include <cstdlib>
+#include <cstdio>
+#include <new>
+#include <string>
+
+struct alignas(64) CacheLine {
+    char data[64];
+};
+
+int main() {
+    int *one = new int(42);
+    delete one;  // OK
+    
+    int *many = new int[100];
+    delete[] many;  // OK
+    
+    CacheLine *line = new CacheLine();
+    delete line;  // OK: aligned new + aligned sized delete
+    
+    int *maybe = new (std::nothrow) int[10];
+    delete[] maybe;  // OK
+    
+    void *raw = ::operator new(100);
+    ::operator delete(raw, 100);  // OK: sized delete, matching size
+    
+    int *from_malloc = static_cast<int*>(malloc(sizeof(int)));
+    delete from_malloc;  // ERROR: malloc / operator delete
+    
+    int *from_new = new int(7);
+    free(from_new);  // ERROR: operator new / free
+    
+    int *from_new_array = new int[10];
+    delete from_new_array;  // ERROR: operator new[] / operator delete
+    
+    void *sized = ::operator new(64);
+    ::operator delete(sized, 32);  // ERROR: sized delete with wrong size
+    
+    void *aligned = ::operator new(64, std::align_val_t(64));
+    ::operator delete(aligned, std::align_val_t(32));  // ERROR: aligned delete with wrong alignment
+    
+    new double[4];  // Leak (new[])
+    
+    // Leak: the string object, and its buffer allocated inside libstdc++
+    new std::string(100, 'x');
+    
+    printf("Test: C++ new/delete\n");
+    printf("Expected: 3 leaks (32 bytes new[], 32 + 101 bytes std::string), 5 corruption errors\n");
+    return 0;
+}
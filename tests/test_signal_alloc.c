@@ -0,0 +1,87 @@
+/* Test: Allocation in Signal Handlers - Expected: 1 leak (48 bytes), 1 unreleased mapping (1 page), no free errors */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#define MAP_ANON_RW(len) mmap(NULL, (len), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)
+
+// handler runs each signal must see before the test stops
+#define RUNS 500
+
+static size_t page;
+static pthread_t main_thread;
+static volatile int g_done = 0;
+static volatile int g_heap_runs = 0;
+static volatile int g_map_runs = 0;
+
+static void *g_prev = NULL;
+static void *g_leak = NULL;
+static void *g_leaked_map = NULL;
+
+// SIGUSR1: heap traffic, across invocations too (freeing the previous block)
+static void heap_handler(int sig) {
+    (void)sig;
+    void *p = malloc(24);
+    free(g_prev);
+    g_prev = p;
+    if (!g_leak) g_leak = malloc(48);  // Leak: 48 bytes, from a handler
+    g_heap_runs++;
+}
+
+// SIGUSR2: may interrupt the SIGUSR1 handler; mappings only, libc's
+// malloc is not re-entrant itself
+static void map_handler(int sig) {
+    (void)sig;
+    munmap(MAP_ANON_RW(page), page);
+    if (!g_leaked_map) g_leaked_map = MAP_ANON_RW(page);  // Leak: 1 page
+    g_map_runs++;
+}
+
+static void *sender(void *arg) {
+    (void)arg;
+    while (g_heap_runs < RUNS || g_map_runs < RUNS) {
+        pthread_kill(main_thread, SIGUSR1);
+        pthread_kill(main_thread, SIGUSR2);
+        usleep(10);
+    }
+    g_done = 1;
+    return NULL;
+}
+
+int main(void) {
+    setvbuf(stdout, NULL, _IONBF, 0);
+    page = (size_t)sysconf(_SC_PAGESIZE);
+    main_thread = pthread_self();
+
+    // no SA_NODEFER, but SIGUSR2 is left unblocked inside the SIGUSR1 handler
+    struct sigaction sa = {0};
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    sa.sa_handler = heap_handler;
+    sigaction(SIGUSR1, &sa, NULL);
+    sa.sa_handler = map_handler;
+    sigaction(SIGUSR2, &sa, NULL);
+
+    pthread_t thread;
+    pthread_create(&thread, NULL, sender, NULL);
+
+    // keep the profiler busy (and its locks taken) while signals arrive;
+    // the mapping path never calls libc's malloc, so the handlers can
+    while (!g_done) {
+        char *region = MAP_ANON_RW(4 * page);
+        region = mremap(region, 4 * page, 8 * page, MREMAP_MAYMOVE);
+        madvise(region, page, MADV_DONTNEED);
+        munmap(region, 8 * page);
+    }
+    pthread_join(thread, NULL);
+
+    free(g_prev);
+
+    printf("Test: Allocation in Signal Handlers\n");
+    printf("Expected: 1 leak (48 bytes), 1 unreleased mapping (1 page), no free errors\n");
+    return 0;
+}
@@ -0,0 +1,30 @@
+/* Test: Link-time interposition in a static binary - Expected: 2 leaks (1024 + 256 bytes), 1 free error */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+int main(void) {
+    // in a static binary the profiler cannot tell libc's own allocations
+    // from ours, so keep stdio from allocating its buffer
+    setvbuf(stdout, NULL, _IONBF, 0);
+
+    // make test checks that each report starts here, not in the profiler
+
+    void *leak1 = malloc(1024);
+    char *leak2 = calloc(64, 4);
+
+    void *grown = malloc(32);
+    grown = realloc(grown, 4096);
+    memset(grown, 0, 4096);
+    free(grown);
+
+    void *twice = malloc(128);
+    free(twice);
+    free(twice);
+
+    printf("Test: Static Link-Time Interposition\n");
+    printf("Expected: 2 leaks (1024 + 256 bytes), 1 free error\n");
+    (void)leak1;
+    (void)leak2;
+    return 0;
+}
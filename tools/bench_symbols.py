@@ -0,0 +1,122 @@
+#!/usr/bin/env python3
+"""
+bench_symbols.py
+Symbolization throughput, in frames per second.
+
+Usage:
+    ./bench_symbols.py <binary> [frames]
+
+Builds a synthetic report of <frames> frames (default 100000) spread over
+the .text section of <binary>, as a large leak report would, and times:
+    native    - profiler-symbolize printing the whole report, including
+                building the module's tables (skipped if it is not built)
+    cached    - the same, with the tables from its cache (by build-id)
+    batched   - resolve_symbols.py as it runs on a report: every unique
+                address once, one addr2line process per module
+    per-frame - one addr2line process per frame, as before; timed on a
+                sample and extrapolated
+"""
+
+import os
+import random
+import subprocess
+import sys
+import tempfile
+import time
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+import resolve_symbols
+
+# frames timed the old way, it takes a few ms each
+PER_FRAME_SAMPLE = 200
+
+# frames per synthetic leak
+STACK_DEPTH = 8
+
+SYMBOLIZER = os.path.join(os.path.dirname(os.path.abspath(__file__)), 'profiler-symbolize')
+
+
+def text_section(binary):
+    """Returns (address, size) of the .text section."""
+    out = subprocess.run(['readelf', '-SW', binary], capture_output=True, text=True, check=True).stdout
+    for line in out.splitlines():
+        fields = line.replace('[ ', '[').split()
+        if len(fields) > 5 and fields[1] == '.text':
+            return int(fields[3], 16), int(fields[5], 16)
+    raise SystemExit(f"no .text section in {binary}")
+
+
+def synthetic_report(binary, frames, path=None):
+    """Module event plus leaks whose frames are random .text offsets."""
+    start, size = text_section(binary)
+    rng = random.Random(1)
+    lines = [f'{{"type":"module","id":1,"path":"{path or binary}","base":"0x0","build_id":""}}']
+    for leak in range(frames // STACK_DEPTH):
+        stack = ','.join(
+            f'{{"addr":"0x0","bin":"{os.path.basename(binary)}","mod":1,"off":"{hex(start + rng.randrange(size))}"}}'
+            for _ in range(STACK_DEPTH))
+        lines.append(f'{{"type":"leak","addr":"{hex(0x1000 + leak * 16)}","size":16,"frames":[{stack}]}}')
+    return lines
+
+
+def time_native(binary, frames):
+    """Seconds profiler-symbolize takes on the report, without and with its
+    cache, or None if it is not built."""
+    if not os.access(SYMBOLIZER, os.X_OK):
+        return None
+    with tempfile.TemporaryDirectory() as tmp:
+        env = dict(os.environ, PROFILER_SYMBOL_CACHE=os.path.join(tmp, 'cache'))
+        # under another name, or the profiler's own frames are not resolved
+        target = os.path.join(tmp, 'bench-target.so')
+        os.symlink(binary, target)
+        report = os.path.join(tmp, 'report.json')
+        with open(report, 'w') as f:
+            f.write('\n'.join(synthetic_report(binary, frames, target)) + '\n')
+        times = []
+        for _ in range(2):
+            start = time.monotonic()
+            subprocess.run([SYMBOLIZER, report, target], stdout=subprocess.DEVNULL, env=env, check=True)
+            times.append(time.monotonic() - start)
+        return times
+
+
+def main():
+    if len(sys.argv) < 2:
+        print("Usage: bench_symbols.py <binary> [frames]", file=sys.stderr)
+        sys.exit(1)
+
+    binary = os.path.abspath(sys.argv[1])
+    frames = int(sys.argv[2]) if len(sys.argv) > 2 else 100000
+    frames -= frames % STACK_DEPTH
+    report = synthetic_report(binary, frames)
+
+    # parse, deduplicate, resolve: what resolve_symbols.py does before printing
+    # (not prefetch_symbols() itself, which skips the profiler's own library)
+    start = time.monotonic()
+    events = [resolve_symbols.parse_line(line) for line in report]
+    offsets = {frame['off'] for obj in events[1:] for frame in obj['frames']}
+    resolve_symbols.resolve_all({binary: offsets})
+    batched = time.monotonic() - start
+    resolved = sum(1 for location in resolve_symbols.SYMBOL_CACHE.values() if location)
+
+    sample = sorted(offsets)[:PER_FRAME_SAMPLE]
+    start = time.monotonic()
+    for offset in sample:
+        subprocess.run(['addr2line', '-e', binary, '-f', '-C', '-s', '-a', offset],
+                       capture_output=True, text=True)
+    per_frame = (time.monotonic() - start) / len(sample)
+
+    native = time_native(binary, frames)
+
+    print(f"binary:    {binary}")
+    print(f"frames:    {frames} ({len(offsets)} unique, {resolved} resolved to a line)")
+    if native is not None:
+        print(f"native:    {native[0]:.2f} s, {frames / native[0]:,.0f} frames/s")
+        print(f"cached:    {native[1]:.2f} s, {frames / native[1]:,.0f} frames/s")
+    print(f"batched:   {batched:.2f} s, {frames / batched:,.0f} frames/s")
+    print(f"per-frame: {per_frame * frames:.2f} s (estimated from {len(sample)} frames), "
+          f"{1 / per_frame:,.0f} frames/s")
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,320 @@
+/*
+ * profiler-attach - load the profiler into a running process
+ *
+ * usage: profiler-attach <pid> [path/to/libprofiler.so]
+ *
+ * restarting a service under LD_PRELOAD loses the state being debugged.
+ * this tool stops the target with ptrace, makes its main thread call
+ *   dlopen(libprofiler.so, RTLD_NOW | RTLD_GLOBAL)
+ *   dlsym(handle, "profiler_attach")
+ *   profiler_attach()
+ * and lets it go. profiler_attach() patches the target's GOTs and starts
+ * tracking (see src/attach.c). the report is written to the target's
+ * stderr when it exits, as with LD_PRELOAD.
+ *
+ * how a remote call works (x86_64 only):
+ * registers are saved, rip is pointed at the function, arguments go in
+ * rdi/rsi, and the return address pushed on the target's stack is 0. the
+ * call ends in a SIGSEGV at address 0, which we catch, read rax from, and
+ * suppress. then the saved registers are put back.
+ *
+ * the addresses of dlopen/dlsym in the target are ours, moved by the
+ * difference of the libc load addresses: both processes must use the
+ * same libc (glibc 2.34 or later, where dlopen lives in libc).
+ *
+ * safe point:
+ * dlopen() takes loader and malloc locks. a thread stopped in user code
+ * may be holding one, so we only inject at a system call boundary: a
+ * thread blocked in a syscall is used as is, otherwise we let it run to
+ * its next syscall. a target that makes none within a few seconds is
+ * left alone.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <sys/ptrace.h>
+#include <sys/wait.h>
+#include <sys/user.h>
+
+// wait for the target to reach a syscall for this long
+#define SAFE_POINT_TIMEOUT 3
+
+// the x86_64 ABI lets leaf functions use 128 bytes below rsp
+#define RED_ZONE 128
+
+static pid_t g_pid;
+
+/*
+ * load address and path of the libc mapped in a process
+ * maps: "/proc/<pid>/maps" or "/proc/self/maps"
+ */
+static int find_libc(const char *maps, unsigned long *base, char *path, size_t path_len) {
+    FILE *f = fopen(maps, "r");
+    if (!f) return 0;
+
+    char line[512];
+    int found = 0;
+    while (!found && fgets(line, sizeof(line), f)) {
+        unsigned long start, offset;
+        char file[PATH_MAX];
+        if (sscanf(line, "%lx-%*x %*s %lx %*s %*s %4095s", &start, &offset, file) != 3) continue;
+
+        const char *name = strrchr(file, '/');
+        name = name ? name + 1 : file;
+        if (offset == 0 && (strncmp(name, "libc.so", 7) == 0 || strncmp(name, "libc-", 5) == 0)) {
+            *base = start;
+            snprintf(path, path_len, "%s", file);
+            found = 1;
+        }
+    }
+    fclose(f);
+    return found;
+}
+
+/*
+ * copy between our memory and the stopped target's
+ */
+static int write_remote(unsigned long addr, const void *data, size_t len) {
+    char mem[64];
+    snprintf(mem, sizeof(mem), "/proc/%d/mem", g_pid);
+    int fd = open(mem, O_RDWR);
+    if (fd < 0) return 0;
+    ssize_t n = pwrite(fd, data, len, (off_t)addr);
+    close(fd);
+    return n == (ssize_t)len;
+}
+
+static int read_remote(unsigned long addr, void *data, size_t len) {
+    char mem[64];
+    snprintf(mem, sizeof(mem), "/proc/%d/mem", g_pid);
+    int fd = open(mem, O_RDONLY);
+    if (fd < 0) return 0;
+    ssize_t n = pread(fd, data, len, (off_t)addr);
+    close(fd);
+    return n == (ssize_t)len;
+}
+
+/*
+ * run fn(arg0, arg1) in the target on its own stack, below stack_top
+ * returns 0 and sets *result, or -1 if the target did not come back
+ */
+static int remote_call(const struct user_regs_struct *saved, unsigned long stack_top,
+                       unsigned long fn, unsigned long arg0, unsigned long arg1,
+                       unsigned long *result) {
+    struct user_regs_struct regs = *saved;
+    unsigned long return_address = 0;
+
+    regs.rsp = (stack_top & ~0xfUL) - sizeof(return_address);
+    if (!write_remote(regs.rsp, &return_address, sizeof(return_address))) return -1;
+
+    regs.rip = fn;
+    regs.rdi = arg0;
+    regs.rsi = arg1;
+    regs.rax = 0;
+    regs.orig_rax = -1;     // not in a syscall: no restart handling
+    if (ptrace(PTRACE_SETREGS, g_pid, NULL, &regs) != 0) return -1;
+
+    int sig = 0;
+    for (;;) {
+        int status;
+        if (ptrace(PTRACE_CONT, g_pid, NULL, (void*)(long)sig) != 0) return -1;
+        if (waitpid(g_pid, &status, __WALL) != g_pid) return -1;
+        if (!WIFSTOPPED(status)) return -1;     // exited or killed
+
+        sig = WSTOPSIG(status);
+        if (sig == SIGSEGV) {
+            if (ptrace(PTRACE_GETREGS, g_pid, NULL, &regs) != 0) return -1;
+            if (regs.rip != 0) {
+                fprintf(stderr, "profiler-attach: target crashed in the injected call\n");
+                return -1;
+            }
+            *result = regs.rax;
+            return 0;
+        }
+        // group stops carry no signal to deliver, anything else is passed on
+        if (status >> 16 == PTRACE_EVENT_STOP || sig == SIGTRAP) sig = 0;
+    }
+}
+
+static void on_alarm(int sig) {
+    (void)sig;      // only interrupts waitpid()
+}
+
+/*
+ * stop the target at a syscall boundary
+ * *at_entry is set if it stopped on the way into a syscall, which has
+ * to be executed again after we are done
+ */
+static int stop_at_safe_point(struct user_regs_struct *regs, int *at_entry) {
+    int status;
+    *at_entry = 0;
+
+    if (ptrace(PTRACE_SEIZE, g_pid, NULL, (void*)PTRACE_O_TRACESYSGOOD) != 0) {
+        perror("profiler-attach: ptrace(PTRACE_SEIZE)");
+        return 0;
+    }
+    if (ptrace(PTRACE_INTERRUPT, g_pid, NULL, NULL) != 0) return 0;
+    if (waitpid(g_pid, &status, __WALL) != g_pid) return 0;
+    if (ptrace(PTRACE_GETREGS, g_pid, NULL, regs) != 0) return 0;
+
+    // already blocked in a syscall: the kernel restarts it on resume
+    if ((long)regs->orig_rax >= 0) return 1;
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_alarm;
+    sigaction(SIGALRM, &sa, NULL);
+    alarm(SAFE_POINT_TIMEOUT);
+
+    int sig = 0;
+    for (;;) {
+        if (ptrace(PTRACE_SYSCALL, g_pid, NULL, (void*)(long)sig) != 0) break;
+        if (waitpid(g_pid, &status, __WALL) != g_pid) {
+            if (errno != EINTR) break;
+            fprintf(stderr, "profiler-attach: target makes no system calls, giving up\n");
+            ptrace(PTRACE_INTERRUPT, g_pid, NULL, NULL);
+            waitpid(g_pid, &status, __WALL);
+            break;
+        }
+        if (!WIFSTOPPED(status)) break;
+
+        sig = WSTOPSIG(status);
+        if (sig == (SIGTRAP | 0x80)) {
+            alarm(0);
+            if (ptrace(PTRACE_GETREGS, g_pid, NULL, regs) != 0) return 0;
+            *at_entry = 1;
+            return 1;
+        }
+        if (status >> 16 == PTRACE_EVENT_STOP || sig == SIGTRAP) sig = 0;
+    }
+    alarm(0);
+    return 0;
+}
+
+static int inject(const char *library) {
+    // where dlopen and dlsym are in the target
+    unsigned long our_libc, their_libc;
+    char our_path[PATH_MAX], their_path[PATH_MAX], maps[64];
+    snprintf(maps, sizeof(maps), "/proc/%d/maps", g_pid);
+    if (!find_libc("/proc/self/maps", &our_libc, our_path, sizeof(our_path)) ||
+        !find_libc(maps, &their_libc, their_path, sizeof(their_path))) {
+        fprintf(stderr, "profiler-attach: cannot find libc in pid %d\n", g_pid);
+        return 0;
+    }
+    if (strcmp(our_path, their_path) != 0) {
+        fprintf(stderr, "profiler-attach: target uses %s, we use %s\n", their_path, our_path);
+        return 0;
+    }
+
+    Dl_info info;
+    if (!dladdr((void*)dlopen, &info) || (unsigned long)info.dli_fbase != our_libc) {
+        fprintf(stderr, "profiler-attach: dlopen is not in libc (glibc 2.34 or later needed)\n");
+        return 0;
+    }
+    unsigned long remote_dlopen = (unsigned long)dlopen - our_libc + their_libc;
+    unsigned long remote_dlsym = (unsigned long)dlsym - our_libc + their_libc;
+    unsigned long remote_dlerror = (unsigned long)dlerror - our_libc + their_libc;
+
+    struct user_regs_struct saved;
+    int at_entry;
+    if (!stop_at_safe_point(&saved, &at_entry)) {
+        ptrace(PTRACE_DETACH, g_pid, NULL, NULL);
+        return 0;
+    }
+
+    // strings go on the target's stack, below the red zone
+    static const char entry_name[] = "profiler_attach";
+    size_t library_len = strlen(library) + 1;
+    unsigned long library_addr = (saved.rsp - RED_ZONE - library_len) & ~0xfUL;
+    unsigned long name_addr = (library_addr - sizeof(entry_name)) & ~0xfUL;
+    unsigned long stack_top = name_addr - RED_ZONE;
+
+    int ok = 0;
+    unsigned long handle = 0, entry = 0, ret = 0;
+    if (!write_remote(library_addr, library, library_len) ||
+        !write_remote(name_addr, entry_name, sizeof(entry_name))) {
+        fprintf(stderr, "profiler-attach: cannot write to pid %d\n", g_pid);
+    } else if (remote_call(&saved, stack_top, remote_dlopen, library_addr,
+                           RTLD_NOW | RTLD_GLOBAL, &handle) != 0) {
+        fprintf(stderr, "profiler-attach: dlopen call failed\n");
+    } else if (!handle) {
+        unsigned long message = 0;
+        char text[256] = "unknown error";
+        if (remote_call(&saved, stack_top, remote_dlerror, 0, 0, &message) == 0 && message) {
+            read_remote(message, text, sizeof(text) - 1);
+            text[sizeof(text) - 1] = '\0';
+        }
+        fprintf(stderr, "profiler-attach: dlopen failed in target: %s\n", text);
+    } else if (remote_call(&saved, stack_top, remote_dlsym, handle, name_addr, &entry) != 0 || !entry) {
+        fprintf(stderr, "profiler-attach: %s has no profiler_attach()\n", library);
+    } else if (remote_call(&saved, stack_top, entry, 0, 0, &ret) != 0 || (int)ret != 0) {
+        fprintf(stderr, "profiler-attach: profiler_attach() failed in target\n");
+    } else {
+        ok = 1;
+    }
+
+    // put the thread back where it was; a syscall we stopped in front of runs again
+    if (at_entry) {
+        saved.rip -= 2;     // length of the syscall instruction
+        saved.rax = saved.orig_rax;
+    }
+    ptrace(PTRACE_SETREGS, g_pid, NULL, &saved);
+    ptrace(PTRACE_DETACH, g_pid, NULL, NULL);
+    return ok;
+}
+
+/*
+ * default library: libprofiler.so in the directory above this tool
+ */
+static void default_library(char *path, size_t len) {
+    char exe[PATH_MAX - 32];
+    ssize_t n = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+    if (n <= 0) {
+        snprintf(path, len, "libprofiler.so");
+        return;
+    }
+    exe[n] = '\0';
+    char *slash = strrchr(exe, '/');
+    if (slash) *slash = '\0';
+    snprintf(path, len, "%s/../libprofiler.so", exe);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2 || argc > 3) {
+        fprintf(stderr, "usage: %s <pid> [path/to/libprofiler.so]\n", argv[0]);
+        return 2;
+    }
+
+    char *end;
+    long pid = strtol(argv[1], &end, 10);
+    if (*end != '\0' || pid <= 0) {
+        fprintf(stderr, "profiler-attach: bad pid '%s'\n", argv[1]);
+        return 2;
+    }
+    g_pid = (pid_t)pid;
+
+    char library[PATH_MAX], resolved[PATH_MAX];
+    if (argc == 3) {
+        snprintf(library, sizeof(library), "%s", argv[2]);
+    } else {
+        default_library(library, sizeof(library));
+    }
+    // the target has its own working directory
+    if (!realpath(library, resolved)) {
+        fprintf(stderr, "profiler-attach: %s: %s\n", library, strerror(errno));
+        return 1;
+    }
+
+    if (!inject(resolved)) return 1;
+
+    printf("profiler-attach: tracking pid %d\n", g_pid);
+    return 0;
+}
@@ -0,0 +1,580 @@
+/*
+ * profilerd - collects the events of every profiled process on a host
+ *
+ * usage: profilerd <socket>              run the collector
+ *        profilerd -t [-n N] <socket>    print the top sites of a running one
+ *
+ * processes started with PROFILER_OUTPUT=unix:<socket> connect here,
+ * one connection per process (forked children make their own), and send
+ * the events they would otherwise write to stderr. with
+ * PROFILER_REPORT_INTERVAL set they also send a snapshot of their live
+ * allocations by site every so often (see src/sites.c).
+ *
+ * the collector keeps the latest snapshot of every connected process, and
+ * the leaks of every process that has exited, merged by site. a site is a
+ * stack of (module, offset) frames, with modules told apart by GNU
+ * build-id: the same code shared by 200 workers is one site, and each
+ * module is symbolized once for the whole host, not once per process.
+ *
+ * -t asks the collector for the host-wide view: the N heaviest sites
+ * (default 20), live bytes of the running processes plus what exited
+ * processes leaked, symbolized with the tables of profiler-symbolize
+ * (elf.c, dwarf.c, and its on-disk cache).
+ *
+ * the protocol is the profiler's JSON Lines; a query is one more line,
+ * {"type":"query","top":20}, answered with text before the collector
+ * closes the connection.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "symbolize/symbolize.h"
+
+// frames kept per site, as many as the profiler reports
+#define SITE_FRAMES 7
+
+#define DEFAULT_TOP 20
+
+// longest event line a client may send; past it the client is dropped
+#define MAX_LINE (1024 * 1024)
+
+// System libraries left out of the view (as profiler-symbolize)
+static const char *const SYSTEM_LIBRARIES[] = {
+    "libc.so", "libc-", "libpthread.so", "libpthread-", "ld-linux",
+    "libdl.so", "libm.so", "libprofiler.so",
+};
+
+/*
+ * a module file, once for the host: keyed by build-id, or by path for
+ * modules without one. frames of an unknown module (a bare address)
+ * get a file with no path, keyed by its name.
+ */
+typedef struct file {
+    char *key;
+    char *path;                 // NULL if it cannot be symbolized
+    const char *name;           // base name
+    int system;
+    module_t *module;           // opened on the first query that needs it
+    struct file *next;
+} file_t;
+
+typedef struct {
+    file_t *file;
+    uint64_t offset;
+} frame_t;
+
+typedef struct {
+    frame_t frames[SITE_FRAMES];
+    int depth;
+    size_t count, bytes;
+    size_t procs;               // processes it was seen in
+    const void *last_proc;      // while merging: the last one counted
+} site_t;
+
+// a set of sites, open addressing by frames
+typedef struct {
+    site_t *slots;
+    size_t capacity, count;
+} site_table_t;
+
+// one connection: a profiled process, or a query
+typedef struct {
+    int fd;
+    char *buf;
+    size_t len, size;
+    int query;
+    size_t top;
+
+    file_t **modules;           // by the module id of its events
+    size_t module_slots;
+    site_table_t live;          // its latest snapshot
+    site_table_t leaks;         // leak events, until its summary
+    int exited;
+} client_t;
+
+static file_t *g_files = NULL;
+static client_t **g_clients = NULL;
+static size_t g_client_count = 0;
+
+// what processes that have exited leaked, merged
+static site_table_t g_exited;
+static size_t g_exited_count = 0;
+
+static json_event_t g_event;
+
+static const char *base_name(const char *path) {
+    const char *slash = strrchr(path, '/');
+    return slash ? slash + 1 : path;
+}
+
+static int is_system_library(const char *name) {
+    for (size_t i = 0; i < sizeof(SYSTEM_LIBRARIES) / sizeof(SYSTEM_LIBRARIES[0]); i++) {
+        if (strstr(name, SYSTEM_LIBRARIES[i])) return 1;
+    }
+    return 0;
+}
+
+static file_t *get_file(const char *key, const char *path, const char *name) {
+    for (file_t *f = g_files; f; f = f->next) {
+        if (strcmp(f->key, key) == 0) return f;
+    }
+    file_t *f = calloc(1, sizeof(file_t));
+    if (!f) return NULL;
+    f->key = strdup(key);
+    f->path = path ? strdup(path) : NULL;
+    f->name = f->path ? base_name(f->path) : f->key;
+    f->system = is_system_library(name);
+    f->next = g_files;
+    g_files = f;
+    return f;
+}
+
+/*
+ * site tables
+ */
+
+static uint64_t hash_site(const site_t *s) {
+    uint64_t h = 1469598103934665603ull;
+    for (int i = 0; i < s->depth; i++) {
+        h = (h ^ (uint64_t)(uintptr_t)s->frames[i].file) * 1099511628211ull;
+        h = (h ^ s->frames[i].offset) * 1099511628211ull;
+    }
+    return h;
+}
+
+static int same_site(const site_t *a, const site_t *b) {
+    return a->depth == b->depth && memcmp(a->frames, b->frames, a->depth * sizeof(frame_t)) == 0;
+}
+
+static int table_grow(site_table_t *t) {
+    size_t capacity = t->capacity ? t->capacity * 2 : 256;
+    site_t *slots = calloc(capacity, sizeof(site_t));
+    if (!slots) return 0;
+    for (size_t i = 0; i < t->capacity; i++) {
+        if (!t->slots[i].depth) continue;
+        size_t j = hash_site(&t->slots[i]) & (capacity - 1);
+        while (slots[j].depth) j = (j + 1) & (capacity - 1);
+        slots[j] = t->slots[i];
+    }
+    free(t->slots);
+    t->slots = slots;
+    t->capacity = capacity;
+    return 1;
+}
+
+// the entry of t for the frames of s, added empty if new; NULL if out of memory
+static site_t *table_get(site_table_t *t, const site_t *s) {
+    if ((t->count + 1) * 2 > t->capacity && !table_grow(t)) return NULL;
+    size_t i = hash_site(s) & (t->capacity - 1);
+    while (t->slots[i].depth) {
+        if (same_site(&t->slots[i], s)) return &t->slots[i];
+        i = (i + 1) & (t->capacity - 1);
+    }
+    site_t *e = &t->slots[i];
+    memcpy(e->frames, s->frames, sizeof(e->frames));
+    e->depth = s->depth;
+    t->count++;
+    return e;
+}
+
+static void table_add(site_table_t *t, const site_t *s, const void *proc) {
+    site_t *e = table_get(t, s);
+    if (!e) return;
+    e->count += s->count;
+    e->bytes += s->bytes;
+    if (!proc) {
+        e->procs += s->procs;
+    } else if (e->last_proc != proc) {
+        e->last_proc = proc;
+        e->procs++;
+    }
+}
+
+static void table_clear(site_table_t *t) {
+    free(t->slots);
+    memset(t, 0, sizeof(*t));
+}
+
+/*
+ * events of a process
+ */
+
+static void define_module(client_t *c, const json_event_t *e) {
+    long id = json_int(e, "id");
+    if (id <= 0 || id > 65536) return;
+    if ((size_t)id >= c->module_slots) {
+        size_t slots = c->module_slots ? c->module_slots : 64;
+        while (slots <= (size_t)id) slots *= 2;
+        file_t **modules = realloc(c->modules, slots * sizeof(file_t*));
+        if (!modules) return;
+        memset(modules + c->module_slots, 0, (slots - c->module_slots) * sizeof(file_t*));
+        c->modules = modules;
+        c->module_slots = slots;
+    }
+
+    const char *path = json_str(e, "path", "");
+    const char *build_id = json_str(e, "build_id", "");
+    char key[4096];
+    snprintf(key, sizeof(key), "%s%s", *build_id ? "id:" : "path:", *build_id ? build_id : path);
+    c->modules[id] = get_file(key, path, base_name(path));
+}
+
+// the stack of an event with frames, as a site with no weight
+static void event_site(const client_t *c, const json_event_t *e, site_t *s) {
+    memset(s, 0, sizeof(*s));
+    for (size_t i = 0; i < e->frame_count && s->depth < SITE_FRAMES; i++) {
+        const json_frame_t *f = &e->frames[i];
+        file_t *file = NULL;
+        const char *where = NULL;
+        if (f->has_mod && f->mod > 0 && (size_t)f->mod < c->module_slots) {
+            file = c->modules[f->mod];
+            where = f->off;
+        }
+        if (!file) {
+            // no module: only the binary's name and the bare address
+            char key[512];
+            snprintf(key, sizeof(key), "bin:%s", f->bin ? f->bin : "unknown");
+            file = get_file(key, NULL, f->bin ? f->bin : "unknown");
+            where = f->addr;
+        }
+        if (!file) continue;
+        s->frames[s->depth].file = file;
+        s->frames[s->depth].offset = where ? strtoull(where, NULL, 16) : 0;
+        s->depth++;
+    }
+}
+
+// a process is done: its leaks join the exited processes', its snapshot goes
+static void process_exited(client_t *c) {
+    if (c->exited) return;
+    c->exited = 1;
+    for (size_t i = 0; i < c->leaks.capacity; i++) {
+        if (c->leaks.slots[i].depth) table_add(&g_exited, &c->leaks.slots[i], c);
+    }
+    table_clear(&c->leaks);
+    table_clear(&c->live);
+    g_exited_count++;
+}
+
+static void send_view(client_t *c);
+
+static void handle_event(client_t *c, const json_event_t *e) {
+    const char *type = json_str(e, "type", "");
+    site_t s;
+
+    if (strcmp(type, "module") == 0 || strcmp(type, "unloaded_module") == 0) {
+        define_module(c, e);
+    } else if (strcmp(type, "sites") == 0) {
+        table_clear(&c->live);
+    } else if (strcmp(type, "site") == 0) {
+        event_site(c, e, &s);
+        s.count = (size_t)json_int(e, "count");
+        s.bytes = (size_t)json_int(e, "bytes");
+        if (s.depth) table_add(&c->live, &s, c);
+    } else if (strcmp(type, "leak") == 0) {
+        event_site(c, e, &s);
+        s.count = 1;
+        s.bytes = (size_t)json_int(e, "size");
+        if (s.depth) table_add(&c->leaks, &s, c);
+    } else if (strcmp(type, "summary") == 0) {
+        process_exited(c);
+    } else if (strcmp(type, "query") == 0) {
+        long long top = json_int(e, "top");
+        c->query = 1;
+        c->top = top > 0 ? (size_t)top : DEFAULT_TOP;
+        send_view(c);
+    }
+}
+
+/*
+ * the host-wide view
+ */
+
+// "at: file; line: N in function", or <module+offset>
+static void format_frame(FILE *out, const frame_t *f) {
+    file_t *file = f->file;
+    if (file->path && !file->module) file->module = module_open(file->path);
+
+    location_t loc[1];
+    if (file->module && file->module->usable && dwarf_lookup(file->module, f->offset, loc, 1) > 0) {
+        if (loc[0].file) {
+            fprintf(out, "at: %s; line: %u", loc[0].file, loc[0].line);
+            if (loc[0].function) fprintf(out, " in %s", loc[0].function);
+            return;
+        }
+        if (loc[0].function) {
+            fprintf(out, "in %s (%s)", loc[0].function, file->name);
+            return;
+        }
+    }
+    fprintf(out, "<%s+0x%llx>", file->name, (unsigned long long)f->offset);
+}
+
+static int by_bytes(const void *a, const void *b) {
+    const site_t *x = *(const site_t *const*)a, *y = *(const site_t *const*)b;
+    return x->bytes < y->bytes ? 1 : x->bytes > y->bytes ? -1 : 0;
+}
+
+static void write_view(FILE *out, size_t top) {
+    site_table_t all = { 0 };
+    size_t running = 0, live_bytes = 0;
+    for (size_t i = 0; i < g_client_count; i++) {
+        client_t *c = g_clients[i];
+        if (c->query || c->exited) continue;
+        running++;
+        for (size_t j = 0; j < c->live.capacity; j++) {
+            if (!c->live.slots[j].depth) continue;
+            table_add(&all, &c->live.slots[j], c);
+            live_bytes += c->live.slots[j].bytes;
+        }
+    }
+    for (size_t j = 0; j < g_exited.capacity; j++) {
+        if (g_exited.slots[j].depth) table_add(&all, &g_exited.slots[j], NULL);
+    }
+
+    fprintf(out, "profilerd: %zu process(es) running, %zu exited\n", running, g_exited_count);
+    fprintf(out, "live in running processes: %zu bytes\n\n", live_bytes);
+
+    site_t **sorted = all.count ? malloc(all.count * sizeof(site_t*)) : NULL;
+    size_t n = 0;
+    for (size_t j = 0; sorted && j < all.capacity; j++) {
+        if (all.slots[j].depth) sorted[n++] = &all.slots[j];
+    }
+    qsort(sorted, n, sizeof(site_t*), by_bytes);
+
+    if (n) fprintf(out, "========== TOP SITES ==========\n\n");
+    for (size_t i = 0; i < n && i < top; i++) {
+        const site_t *s = sorted[i];
+        fprintf(out, "[SITE] %zu bytes in %zu allocation(s), %zu process(es)\n", s->bytes, s->count, s->procs);
+        for (int d = 0; d < s->depth; d++) {
+            if (s->frames[d].file->system) continue;
+            fputs("  ", out);
+            format_frame(out, &s->frames[d]);
+            fputc('\n', out);
+        }
+        fputc('\n', out);
+    }
+    free(sorted);
+    table_clear(&all);
+}
+
+static void send_view(client_t *c) {
+    char *text = NULL;
+    size_t size = 0;
+    FILE *out = open_memstream(&text, &size);
+    if (!out) return;
+    write_view(out, c->top);
+    fclose(out);
+
+    // a query is small and rare: write it out before going on
+    for (size_t done = 0; done < size; ) {
+        ssize_t n = send(c->fd, text + done, size - done, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        done += (size_t)n;
+    }
+    free(text);
+}
+
+/*
+ * connections
+ */
+
+static void add_client(int fd) {
+    client_t **clients = realloc(g_clients, (g_client_count + 1) * sizeof(client_t*));
+    client_t *c = calloc(1, sizeof(client_t));
+    if (!clients || !c) {
+        if (clients) g_clients = clients;
+        free(c);
+        close(fd);
+        return;
+    }
+    g_clients = clients;
+    c->fd = fd;
+    g_clients[g_client_count++] = c;
+}
+
+static void remove_client(size_t i) {
+    client_t *c = g_clients[i];
+    // a process that went away without a summary (killed, _exit()) is
+    // simply gone: its snapshot no longer counts, it never reported leaks
+    close(c->fd);
+    table_clear(&c->live);
+    table_clear(&c->leaks);
+    free(c->modules);
+    free(c->buf);
+    free(c);
+    g_clients[i] = g_clients[--g_client_count];
+}
+
+// read what is there, handle every whole line; returns 0 once the peer is done
+static int read_client(client_t *c) {
+    if (c->size - c->len < 4096) {
+        size_t size = c->size ? c->size * 2 : 65536;
+        char *buf = realloc(c->buf, size);
+        if (!buf) return 0;
+        c->buf = buf;
+        c->size = size;
+    }
+    ssize_t n = read(c->fd, c->buf + c->len, c->size - c->len - 1);
+    if (n < 0 && (errno == EINTR || errno == EAGAIN)) return 1;
+    if (n <= 0) return 0;
+    c->len += (size_t)n;
+
+    char *line = c->buf;
+    char *end;
+    while ((end = memchr(line, '\n', c->len - (size_t)(line - c->buf)))) {
+        *end = '\0';
+        if (json_parse_event(line, &g_event)) handle_event(c, &g_event);
+        line = end + 1;
+        if (c->query) return 0;
+    }
+    c->len -= (size_t)(line - c->buf);
+    memmove(c->buf, line, c->len);
+    if (c->len >= MAX_LINE) {
+        fprintf(stderr, "profilerd: dropping a client, line longer than %d bytes\n", MAX_LINE);
+        return 0;
+    }
+    return 1;
+}
+
+static int listen_on(const char *path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "profilerd: socket path too long: %s\n", path);
+        return -1;
+    }
+    memcpy(addr.sun_path, path, strlen(path));
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+    // replace a stale socket from an earlier run, never any other file
+    struct stat st;
+    if (lstat(path, &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) {
+            fprintf(stderr, "profilerd: %s exists and is not a socket\n", path);
+            close(fd);
+            return -1;
+        }
+        unlink(path);
+    }
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, 256) != 0) {
+        perror(path);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static volatile sig_atomic_t g_stop = 0;
+
+static void on_signal(int sig) {
+    (void)sig;
+    g_stop = 1;
+}
+
+static int run_collector(const char *path) {
+    int listener = listen_on(path);
+    if (listener < 0) return 1;
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    struct pollfd *fds = NULL;
+    while (!g_stop) {
+        struct pollfd *grown = realloc(fds, (g_client_count + 1) * sizeof(struct pollfd));
+        if (!grown) break;
+        fds = grown;
+        fds[0].fd = listener;
+        fds[0].events = POLLIN;
+        for (size_t i = 0; i < g_client_count; i++) {
+            fds[i + 1].fd = g_clients[i]->fd;
+            fds[i + 1].events = POLLIN;
+        }
+        size_t polled = g_client_count;
+        if (poll(fds, polled + 1, -1) < 0) {
+            if (errno == EINTR) continue;
+            perror("poll");
+            break;
+        }
+
+        // backwards: remove_client() moves the last client into the hole
+        for (size_t i = polled; i-- > 0; ) {
+            if (fds[i + 1].revents && !read_client(g_clients[i])) remove_client(i);
+        }
+        if (fds[0].revents & POLLIN) {
+            int fd = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+            if (fd >= 0) add_client(fd);
+        }
+    }
+
+    free(fds);
+    close(listener);
+    unlink(path);
+    return 0;
+}
+
+static int run_query(const char *path, size_t top) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        perror(path);
+        return 1;
+    }
+    dprintf(fd, "{\"type\":\"query\",\"top\":%zu}\n", top);
+
+    char buf[65536];
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0) {
+        fwrite(buf, 1, (size_t)n, stdout);
+    }
+    close(fd);
+    return 0;
+}
+
+static void usage(void) {
+    fprintf(stderr, "Usage: profilerd <socket>              collect events from profiled processes\n");
+    fprintf(stderr, "   or: profilerd -t [-n N] <socket>    print the top N sites (default %d)\n", DEFAULT_TOP);
+}
+
+int main(int argc, char **argv) {
+    int query = 0;
+    size_t top = DEFAULT_TOP;
+    int opt;
+    while ((opt = getopt(argc, argv, "tn:h")) != -1) {
+        switch (opt) {
+        case 't': query = 1; break;
+        case 'n': top = strtoul(optarg, NULL, 10); break;
+        default:
+            usage();
+            return 1;
+        }
+    }
+    if (argc - optind < 1) {
+        usage();
+        return 1;
+    }
+    return query ? run_query(argv[optind], top) : run_collector(argv[optind]);
+}
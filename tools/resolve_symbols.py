@@ -18,6 +18,8 @@ import sys
 import json
 import subprocess
 import os
+import threading
+from concurrent.futures import ThreadPoolExecutor
 from pathlib import Path
 
 # Check if full stack mode is enabled
@@ -36,6 +38,14 @@ SYSTEM_LIBRARIES = {
 }
 
 
+# modules by id, from "module" events: {3: "/path/to/libfoo.so"}
+# a module is described before the first frame that refers to it
+MODULES = {}
+
+# ids of the modules dlclose()d before the frame was recorded
+UNLOADED_MODULES = set()
+
+
 def is_system_library(binary_path):
     """
     Check if a binary is a system library that should be filtered.
@@ -49,61 +59,113 @@ def is_system_library(binary_path):
     return False
 
 
-def resolve_address_with_addr2line(binary_path, address):
+# addresses sent to one addr2line process per round trip
+BATCH_SIZE = 4096
+
+# resolved locations: {(binary_path, address): "file.c:12" or None}
+SYMBOL_CACHE = {}
+
+
+class Symbolizer:
     """
-    Use addr2line to resolve address to filename:line.
-    
-    Args:
-        binary_path: Path to the binary
-        address: Hex address string (e.g., "0x4011ea")
+    One long-lived addr2line process for one binary.
     
-    Returns: "filename:line" or None if resolution fails
+    Addresses are written to its stdin in batches and the answers read
+    back in order, instead of starting a process per frame.
     """
-    try:
-        # Run addr2line
-        result = subprocess.run(
-            ['addr2line', '-e', binary_path, '-f', '-C', '-s', '-a', address],
-            capture_output=True,
-            text=True,
-            timeout=2
+    
+    def __init__(self, binary_path):
+        self.process = subprocess.Popen(
+            ['addr2line', '-e', binary_path, '-f', '-C', '-s', '-a'],
+            stdin=subprocess.PIPE,
+            stdout=subprocess.PIPE,
+            stderr=subprocess.DEVNULL,
+            text=True
         )
+    
+    def resolve(self, addresses):
+        """
+        Returns one "filename:line" or None per address, in order.
+        """
+        # feed from another thread: a large batch fills both pipes
+        def feed():
+            try:
+                self.process.stdin.write(''.join(f"{address}\n" for address in addresses))
+                self.process.stdin.flush()
+            except OSError:
+                pass
         
-        if result.returncode == 0:
-            lines = result.stdout.strip().split('\n')
-            # addr2line output format:
-            # 0x4011ea
-            # main
-            # test_simple_leak.c:18
-            if len(lines) >= 3:
-                location = lines[2]  # filename:line
-                # Check if location is valid (not "??:0" or "??:?")
-                if location and not location.startswith('??'):
-                    return location
+        writer = threading.Thread(target=feed)
+        writer.start()
         
-    except (subprocess.TimeoutExpired, FileNotFoundError, Exception):
-        pass
+        # addr2line output format, three lines per address:
+        # 0x4011ea
+        # main
+        # test_simple_leak.c:18
+        locations = []
+        for _ in addresses:
+            lines = [self.process.stdout.readline() for _ in range(3)]
+            location = lines[2].strip()
+            # Check if location is valid (not "??:0" or "??:?")
+            locations.append(location if location and not location.startswith('??') else None)
+        writer.join()
+        return locations
+    
+    def close(self):
+        self.process.stdin.close()
+        self.process.wait()
+
+
+def resolve_binary(binary_path, addresses):
+    """Resolve addresses of one binary, BATCH_SIZE at a time, into SYMBOL_CACHE."""
+    if not Path(binary_path).exists():
+        for address in addresses:
+            SYMBOL_CACHE[(binary_path, address)] = None
+        return
     
-    return None
+    symbolizer = Symbolizer(binary_path)
+    try:
+        for i in range(0, len(addresses), BATCH_SIZE):
+            batch = addresses[i:i + BATCH_SIZE]
+            for address, location in zip(batch, symbolizer.resolve(batch)):
+                SYMBOL_CACHE[(binary_path, address)] = location
+    finally:
+        symbolizer.close()
 
 
-def get_binary_for_address(address, target_binary):
+def resolve_all(requests):
     """
-    Determine which binary contains this address.
+    Resolve {binary_path: set of addresses} into SYMBOL_CACHE.
     
-    Strategy: Try to resolve with the target binary. If it fails, assume it's a system library.
+    Each unique (binary, address) is resolved once; binaries are handled
+    in parallel, one addr2line process each.
+    """
+    pending = {}
+    for binary_path, addresses in requests.items():
+        todo = sorted(a for a in addresses if (binary_path, a) not in SYMBOL_CACHE)
+        if todo:
+            pending[binary_path] = todo
+    if not pending:
+        return
     
-    Returns: (binary_path, is_system_library, is_target_binary)
+    with ThreadPoolExecutor(max_workers=min(len(pending), os.cpu_count() or 1)) as pool:
+        for future in [pool.submit(resolve_binary, path, todo) for path, todo in pending.items()]:
+            future.result()
+
+
+def resolve_address_with_addr2line(binary_path, address):
     """
-    # First, try to resolve with the target binary
-    resolved = resolve_address_with_addr2line(target_binary, address)
+    Resolve address in binary_path to "filename:line".
     
-    if resolved and not resolved.startswith('??'):
-        # Successfully resolved - it's in the target binary
-        return (target_binary, False, True)
-    else:
-        # Failed to resolve - assume it's a system library
-        # We don't know which specific library, but mark it as system
-        return ("unknown_library.so", True, False)
+    Looked up in SYMBOL_CACHE, which process_profiler_output() fills for
+    the whole report up front; a miss is resolved on its own.
+    
+    Returns: "filename:line" or None if resolution fails
+    """
+    key = (binary_path, address)
+    if key not in SYMBOL_CACHE:
+        resolve_all({binary_path: {address}})
+    return SYMBOL_CACHE[key]
 
 
 def format_resolved_location(filename, line_num, is_system):
@@ -142,7 +204,26 @@ def process_event_with_frames(event_obj, target_binary):
     # Print event-specific header
     if event_type == 'leak':
         size = event_obj.get('size', 0)
-        print(f"[LEAK] {addr}: {size} bytes")
+        details = []
+        if event_obj.get('kind'):
+            details.append(f"operator {event_obj['kind']}")
+        if event_obj.get('align'):
+            details.append(f"aligned to {event_obj['align']}")
+        if event_obj.get('unloaded'):
+            details.append("allocated by an unloaded module")
+        suffix = f" ({', '.join(details)})" if details else ""
+        print(f"[LEAK] {addr}: {size} bytes{suffix}")
+    elif event_type == 'mmap_leak':
+        size = event_obj.get('size', 0)
+        released = event_obj.get('released', 0)
+        suffix = f" ({released} bytes released with MADV_DONTNEED)" if released else ""
+        print(f"[MMAP] {addr}: {size} bytes{suffix}")
+    elif event_type == 'corruption_summary':
+        # Deduplicated site: {"type":"corruption_summary","error":"...","count":N,"suppressed":M,...}
+        error = event_obj.get('error', 'Unknown')
+        count = event_obj.get('count', 0)
+        suppressed = event_obj.get('suppressed', 0)
+        print(f"[CORRUPTION] {error} at {addr}: {count} occurrence(s), {suppressed} not shown individually")
     else:
         # All other types are errors/corruption
         print(f"[CORRUPTION] {event_type} at {addr}")
@@ -160,6 +241,11 @@ def process_event_with_frames(event_obj, target_binary):
             frame_addr = frame
             binary_name = "unknown"
         
+        # module-relative frame: resolve its offset in the module's file
+        if isinstance(frame, dict) and 'mod' in frame and frame['mod'] in MODULES:
+            print_module_frame(frame, target_name)
+            continue
+        
         # Determine if this is user code or system library
         is_user_code = (binary_name == target_name)
         is_system = is_system_library(binary_name)
@@ -197,6 +283,41 @@ def process_event_with_frames(event_obj, target_binary):
     print()
 
 
+def print_module_frame(frame, target_name):
+    """
+    Print a frame given as {"addr":...,"bin":...,"mod":3,"off":"0x1139"}.
+    
+    The offset is relative to the module's load base, which is what
+    addr2line expects for PIE executables and shared libraries alike.
+    """
+    module_id = frame['mod']
+    path = MODULES[module_id]
+    binary_name = Path(path).name
+    is_system = is_system_library(binary_name)
+    
+    # In default mode, skip system library frames
+    if not FULL_STACK_MODE and is_system:
+        return
+    
+    resolved = None
+    if not is_system:
+        resolved = resolve_address_with_addr2line(path, frame['off'])
+    
+    if resolved and ':' in resolved:
+        filename, line_num = resolved.rsplit(':', 1)
+        label = "[USR] " if FULL_STACK_MODE else ""
+        suffix = f" ({binary_name}, unloaded)" if module_id in UNLOADED_MODULES else ""
+        print(f"  {label}at: {filename}; line: {line_num}{suffix}")
+    elif FULL_STACK_MODE:
+        if is_system:
+            print(f"  [SYS] <{binary_name}+{frame['off']}>")
+        elif binary_name == target_name:
+            # Unresolved frame in user binary = C runtime startup
+            print(f"  [CRT] <{binary_name}+{frame['off']}>")
+        else:
+            print(f"  [???] <{binary_name}+{frame['off']}>")
+
+
 # Legacy aliases for backward compatibility (can be removed later)
 def process_leak_json(leak_obj, target_binary):
     """Legacy function - redirects to unified handler."""
@@ -208,14 +329,69 @@ def process_corruption_json(corruption_obj, target_binary):
     return process_event_with_frames(corruption_obj, target_binary)
 
 
+def parse_line(line):
+    """Returns the JSON event on line, or None for plain text."""
+    try:
+        obj = json.loads(line)
+    except json.JSONDecodeError:
+        return None
+    return obj if isinstance(obj, dict) else None
+
+
+def prefetch_symbols(events, target_binary):
+    """
+    Resolve every frame the report will print, in one go.
+    
+    Walks the events the way process_profiler_output() will, module
+    events included (ids are per process, and processes can share one
+    output), and hands the unique addresses to resolve_all().
+    """
+    target_name = Path(target_binary).name
+    modules = {}
+    requests = {}
+    
+    for _, obj in events:
+        if obj is None:
+            continue
+        obj_type = obj.get('type', '')
+        if obj_type in ('module', 'unloaded_module'):
+            modules[obj.get('id')] = obj.get('path', '')
+            continue
+        
+        for frame in obj.get('frames', []):
+            if not isinstance(frame, dict):
+                continue
+            if 'mod' in frame and frame['mod'] in modules:
+                path = modules[frame['mod']]
+                if not is_system_library(path):
+                    requests.setdefault(path, set()).add(frame.get('off', '?'))
+            elif frame.get('bin') == target_name:
+                requests.setdefault(target_binary, set()).add(frame.get('addr', '?'))
+    
+    resolve_all(requests)
+
+
 def process_profiler_output(input_stream, target_binary):
     """
     Process the profiler output line by line.
     Handles both JSON events and plain text.
+    
+    The whole report is read first, so that its frames can be symbolized
+    together (see prefetch_symbols()).
     """
+    events = []
+    for line in input_stream:
+        line = line.strip()
+        # Skip empty lines
+        if line:
+            events.append((line, parse_line(line)))
+    
+    prefetch_symbols(events, target_binary)
+    
     # Track corruption events
     corruption_count = 0
     corruption_header_printed = False
+    unloaded_header_printed = False
     
     # Print mode indicator at the start
     if FULL_STACK_MODE:
@@ -225,68 +401,119 @@ def process_profiler_output(input_stream, target_binary):
         print("=" * 60)
         print()
     
-    for line in input_stream:
-        line = line.strip()
-        
-        # Skip empty lines
-        if not line:
+    for line, obj in events:
+        if obj is None:
+            # Not JSON - print as-is (handles non-JSON stderr output)
+            print(line)
             continue
         
-        # Try to parse as JSON
-        try:
-            obj = json.loads(line)
-            obj_type = obj.get('type', '')
-            
-            # Check if this is a corruption event (has frames but is not a leak)
-            if 'frames' in obj and obj_type != 'leak':
-                # Print header on first corruption
-                if not corruption_header_printed:
-                    print()
-                    print("========== DOUBLE/INVALID FREE ERRORS ==========")
-                    print()
-                    corruption_header_printed = True
-                
-                # Process and count corruption
-                process_event_with_frames(obj, target_binary)
-                corruption_count += 1
-            
-            # Check if this event has frames (leak events)
-            elif 'frames' in obj:
-                # Unified handler for all events with stack traces
-                process_event_with_frames(obj, target_binary)
-            
-            elif obj_type == 'header':
-                # Header: {"type":"header","leaks_count":2,"total_bytes":1536}
-                count = obj.get('leaks_count', 0)
-                total = obj.get('total_bytes', 0)
+        obj_type = obj.get('type', '')
+        
+        # Check if this is a corruption event (has frames but is not a leak)
+        if 'frames' in obj and obj_type not in ('leak', 'mmap_leak'):
+            # Print header on first corruption
+            if not corruption_header_printed:
                 print()
-                print("========== MEMORY LEAKS ==========")
-                print(f"Found {count} leak(s), {total} bytes total")
+                print("========== DOUBLE/INVALID FREE ERRORS ==========")
                 print()
+                corruption_header_printed = True
             
-            elif obj_type == 'summary':
-                # Summary: {"type":"summary","real_leaks":2,"real_bytes":1536,"libc_leaks":1,"libc_bytes":1024}
-                real_leaks = obj.get('real_leaks', 0)
-                real_bytes = obj.get('real_bytes', 0)
-                libc_leaks = obj.get('libc_leaks', 0)
-                libc_bytes = obj.get('libc_bytes', 0)
-                
-                print("Summary:")
-                print(f"  Real leaks: {real_leaks} allocation(s), {real_bytes} bytes")
-                if libc_leaks > 0:
-                    print(f"  Libc infrastructure: {libc_leaks} allocation(s), {libc_bytes} bytes (ignored)")
-                print(f"  Free errors: {corruption_count}")
-                print("==================================")
+            # Process and count corruption
+            # (a summary stands for every occurrence not printed before it)
+            process_event_with_frames(obj, target_binary)
+            if obj_type == 'corruption_summary':
+                corruption_count += obj.get('new', 0)
+            else:
+                corruption_count += 1
+        
+        # Check if this event has frames (leak events)
+        elif 'frames' in obj:
+            # Unified handler for all events with stack traces
+            process_event_with_frames(obj, target_binary)
+        
+        elif obj_type == 'mmap_header':
+            # Mapping header: {"type":"mmap_header","mappings_count":2,"total_bytes":1081344}
+            count = obj.get('mappings_count', 0)
+            total = obj.get('total_bytes', 0)
+            print()
+            print("========== UNRELEASED MAPPINGS ==========")
+            print(f"Found {count} mapping(s), {total} bytes total")
+            print()
+        
+        elif obj_type == 'module':
+            # {"type":"module","id":3,"path":"...","base":"0x...","build_id":"...","unloaded":true}
+            MODULES[obj.get('id')] = obj.get('path', '')
+            if obj.get('unloaded'):
+                UNLOADED_MODULES.add(obj.get('id'))
+        
+        elif obj_type == 'unloaded_module':
+            # {"type":"unloaded_module","id":3,"path":"...","base":"0x...","build_id":"...","leaks":1,"bytes":40}
+            path = obj.get('path', '')
+            MODULES[obj.get('id')] = path
+            UNLOADED_MODULES.add(obj.get('id'))
+            build_id = obj.get('build_id', '')
+            if not unloaded_header_printed:
                 print()
+                print("========== LEAKS FROM UNLOADED MODULES ==========")
+                unloaded_header_printed = True
+            print(f"{path} (build-id {build_id or 'none'}, was loaded at {obj.get('base', '?')}): "
+                  f"{obj.get('leaks', 0)} leak(s), {obj.get('bytes', 0)} bytes")
+        
+        elif obj_type == 'header':
+            # Header: {"type":"header","leaks_count":2,"total_bytes":1536}
+            count = obj.get('leaks_count', 0)
+            total = obj.get('total_bytes', 0)
+            print()
+            print("========== MEMORY LEAKS ==========")
+            print(f"Found {count} leak(s), {total} bytes total")
+            print()
+        
+        elif obj_type == 'summary':
+            # Summary: {"type":"summary","real_leaks":2,"real_bytes":1536,"libc_leaks":1,"libc_bytes":1024}
+            real_leaks = obj.get('real_leaks', 0)
+            real_bytes = obj.get('real_bytes', 0)
+            libc_leaks = obj.get('libc_leaks', 0)
+            libc_bytes = obj.get('libc_bytes', 0)
+            aligned_leaks = obj.get('aligned_leaks', 0)
+            aligned_bytes = obj.get('aligned_bytes', 0)
             
+            # several processes (fork, exec) can share one output
+            pid = obj.get('pid')
+            print(f"Summary (pid {pid}):" if pid is not None else "Summary:")
+            print(f"  Real leaks: {real_leaks} allocation(s), {real_bytes} bytes")
+            if aligned_leaks > 0:
+                print(f"    of which aligned: {aligned_leaks} allocation(s), {aligned_bytes} bytes")
+            unloaded_leaks = obj.get('unloaded_leaks', 0)
+            if unloaded_leaks > 0:
+                print(f"    of which from unloaded modules: {unloaded_leaks} allocation(s), "
+                      f"{obj.get('unloaded_bytes', 0)} bytes")
+            if libc_leaks > 0:
+                print(f"  Libc infrastructure: {libc_leaks} allocation(s), {libc_bytes} bytes (ignored)")
+            mmap_leaks = obj.get('mmap_leaks', 0)
+            if mmap_leaks > 0:
+                print(f"  Unreleased mappings: {mmap_leaks} mapping(s), {obj.get('mmap_bytes', 0)} bytes")
+            if 'peak_total_bytes' in obj:
+                print(f"  Peak memory: {obj['peak_total_bytes']} bytes "
+                      f"(heap {obj.get('peak_heap_bytes', 0)}, mapped {obj.get('peak_mapped_bytes', 0)})")
+            print(f"  Free errors: {corruption_count}")
+            print("==================================")
+            print()
+            corruption_count = 0
+            corruption_header_printed = False
+            unloaded_header_printed = False
+        
+        elif obj_type == 'profiler_state':
+            # Dormant mode switch: {"type":"profiler_state","state":"active","generation":1}
+            state = obj.get('state', '')
+            if state == 'active':
+                print(f"[PROFILER] tracking active (generation {obj.get('generation', 0)})")
             else:
-                # Any other type is treated as a corruption event
-                # Format: {"type":"Double-Free or Invalid-Free","addr":"0x...","frames":[...]}
-                process_corruption_json(obj, target_binary)
+                print("[PROFILER] tracking dormant")
         
-        except json.JSONDecodeError:
-            # Not JSON - print as-is (handles non-JSON stderr output)
-            print(line)
+        else:
+            # Any other type is treated as a corruption event
+            # Format: {"type":"Double-Free or Invalid-Free","addr":"0x...","frames":[...]}
+            process_corruption_json(obj, target_binary)
 
 
 def main():
@@ -2,17 +2,35 @@
 #
 # run_profiler.sh - Wrapper script for running profiler with symbol resolution
 #
-# Usage: ./tools/run_profiler.sh <test_binary>
+# Usage: ./tools/run_profiler.sh [--no-preload] [--stream] <test_binary>
+#
+# --no-preload runs the binary without LD_PRELOAD, for programs that get
+# the profiler some other way (linked in, or loaded by profiler-attach)
+#
+# --stream symbolizes while the program runs: events go through a FIFO
+# (PROFILER_OUTPUT) to profiler-symbolize, which prints each one as soon
+# as it is resolved. the program's own stderr is left alone. meant for
+# services, which otherwise report nothing until they exit.
 #
 # This script:
 # 1. Runs the test binary with profiler enabled
-# 2. Captures JSON output to temporary file
+# 2. Captures JSON output to temporary file (or a FIFO with --stream)
 # 3. Runs symbol resolution on the JSON
 # 4. Cleans up temporary file
 #
 
 set -e  # Exit on error
 
+PRELOAD=1
+STREAM=0
+while [ $# -gt 0 ]; do
+    case "$1" in
+        --no-preload) PRELOAD=0; shift ;;
+        --stream) STREAM=1; shift ;;
+        *) break ;;
+    esac
+done
+
 if [ $# -lt 1 ]; then
     echo "Usage: $0 <test_binary>"
     echo "Example: $0 ./tests/test_simple_leak"
@@ -46,13 +64,51 @@ if [ -z "$PROFILER_FULL_STACK" ]; then
     export PROFILER_FULL_STACK=0
 fi
 
+run_binary() {
+    if [ "$PRELOAD" = "1" ]; then
+        LD_PRELOAD="$PROJECT_DIR/libprofiler.so" "$TEST_BINARY"
+    else
+        "$TEST_BINARY"
+    fi
+}
+
+# Stream through a FIFO: needs the native symbolizer, the Python one reads
+# the whole report first
+if [ "$STREAM" = "1" ] && [ -x "$SCRIPT_DIR/profiler-symbolize" ]; then
+    FIFO_DIR="$(mktemp -d /tmp/profiler_stream_XXXXXX)"
+    FIFO="$FIFO_DIR/events"
+    mkfifo "$FIFO"
+    trap 'rm -rf "$FIFO_DIR"' EXIT
+
+    "$SCRIPT_DIR/profiler-symbolize" "$FIFO" "$TEST_BINARY" &
+    SYMBOLIZER_PID=$!
+
+    # hold a write end open, so the symbolizer sees the end of the stream
+    # only once the program and everything it forked or exec()ed is done
+    exec 3>"$FIFO"
+    STATUS=0
+    PROFILER_OUTPUT="$FIFO" run_binary 3>&- || STATUS=$?
+    exec 3>&-
+    wait "$SYMBOLIZER_PID"
+    exit "$STATUS"
+fi
+
 # Run the profiler and capture JSON output
-LD_PRELOAD="$PROJECT_DIR/libprofiler.so" "$TEST_BINARY" 2>"$TEMP_JSON"
+if [ "$PRELOAD" = "1" ]; then
+    LD_PRELOAD="$PROJECT_DIR/libprofiler.so" "$TEST_BINARY" 2>"$TEMP_JSON"
+else
+    "$TEST_BINARY" 2>"$TEMP_JSON"
+fi
 
 echo ""
 
-# Run symbol resolution
-python3 "$SCRIPT_DIR/resolve_symbols.py" "$TEMP_JSON" "$TEST_BINARY"
+# Run symbol resolution: the native symbolizer, or the Python one if it
+# was not built
+if [ -x "$SCRIPT_DIR/profiler-symbolize" ]; then
+    "$SCRIPT_DIR/profiler-symbolize" "$TEMP_JSON" "$TEST_BINARY"
+else
+    python3 "$SCRIPT_DIR/resolve_symbols.py" "$TEMP_JSON" "$TEST_BINARY"
+fi
 
 # Clean up
 rm -f "$TEMP_JSON"
@@ -0,0 +1,221 @@
+/*
+ * symbol cache - the tables of a module on disk, by GNU build-id
+ *
+ * reports of many runs of the same binaries symbolize the same modules
+ * over and over. the tables dwarf.c builds hold no pointers, so they are
+ * written out as they are, one file per build-id:
+ *
+ *   <dir>/<build-id in hex>.psym
+ *
+ *   cache_header_t, then the symbols, rows, funcs, inlines and the string
+ *   pool, each at an 8-byte aligned offset given in the header
+ *
+ * a later run maps the file and uses the tables in place, without reading
+ * any DWARF. a rebuilt module has a new build-id, so it gets a new file
+ * and the old one is simply never looked at again. modules without a
+ * build-id are not cached.
+ *
+ * the directory is $PROFILER_SYMBOL_CACHE, or $XDG_CACHE_HOME/profiler-symbolize,
+ * or ~/.cache/profiler-symbolize. PROFILER_SYMBOL_CACHE=0 turns it off.
+ *
+ * a file is trusted only as far as its header: the tables must fit in the
+ * file, string ids and inline slices are checked when they are used.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "symbolize.h"
+
+#define CACHE_MAGIC "PSYMTAB"
+
+// bump when the tables or the way they are built change
+#define CACHE_VERSION 1
+
+_Static_assert(sizeof(elf_symbol_t) == 24 && sizeof(line_row_t) == 24 &&
+               sizeof(func_range_t) == 32 && sizeof(inline_range_t) == 32,
+               "table layout changed, bump CACHE_VERSION");
+
+typedef struct {
+    uint64_t offset;
+    uint64_t count;             // entries, or bytes for the pool
+} cache_table_t;
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t build_id_size;
+    unsigned char build_id[MAX_BUILD_ID];
+    // a stripped copy shares the build-id of the file it was stripped from
+    uint64_t module_size;
+    cache_table_t symbols, rows, funcs, inlines, pool;
+} cache_header_t;
+
+/*
+ * the cache file of m, in path
+ * returns 0 if m has no build-id or the cache is turned off
+ */
+static int cache_path(const module_t *m, char *path, size_t size) {
+    if (!m->build_id_size) return 0;
+
+    char hex[2 * MAX_BUILD_ID + 1];
+    for (size_t i = 0; i < m->build_id_size; i++) {
+        snprintf(hex + 2 * i, 3, "%02x", m->build_id[i]);
+    }
+
+    int len;
+    const char *dir = getenv("PROFILER_SYMBOL_CACHE");
+    const char *xdg = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    if (dir && *dir) {
+        if (strcmp(dir, "0") == 0) return 0;
+        len = snprintf(path, size, "%s/%s.psym", dir, hex);
+    } else if (xdg && *xdg) {
+        len = snprintf(path, size, "%s/profiler-symbolize/%s.psym", xdg, hex);
+    } else if (home && *home) {
+        len = snprintf(path, size, "%s/.cache/profiler-symbolize/%s.psym", home, hex);
+    } else {
+        return 0;
+    }
+    return len > 0 && (size_t)len < size;
+}
+
+// the table fits in the file, at an aligned offset
+static int table_fits(const cache_table_t *t, size_t entry_size, size_t file_size) {
+    return t->offset % 8 == 0 && t->offset <= file_size &&
+           t->count <= (file_size - t->offset) / entry_size;
+}
+
+/*
+ * use the cached tables of m, if there are any
+ * returns 1 if m's tables are now those of the cache file
+ */
+int cache_load(module_t *m) {
+    char path[PATH_MAX];
+    if (!cache_path(m, path, sizeof(path))) return 0;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return 0;
+    struct stat st;
+    void *map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(cache_header_t)) {
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (map == MAP_FAILED) return 0;
+
+    const unsigned char *data = map;
+    size_t size = st.st_size;
+    const cache_header_t *h = map;
+    if (memcmp(h->magic, CACHE_MAGIC, sizeof(h->magic)) != 0 || h->version != CACHE_VERSION ||
+        h->build_id_size != m->build_id_size || memcmp(h->build_id, m->build_id, m->build_id_size) != 0 ||
+        h->module_size != m->map_size ||
+        !table_fits(&h->symbols, sizeof(elf_symbol_t), size) ||
+        !table_fits(&h->rows, sizeof(line_row_t), size) ||
+        !table_fits(&h->funcs, sizeof(func_range_t), size) ||
+        !table_fits(&h->inlines, sizeof(inline_range_t), size) ||
+        !table_fits(&h->pool, 1, size) || h->pool.count > UINT32_MAX ||
+        (h->pool.count && data[h->pool.offset + h->pool.count - 1] != '\0')) {
+        // another version's, or damaged: it is rewritten after this run
+        munmap(map, size);
+        return 0;
+    }
+
+    m->symbols = (elf_symbol_t*)(data + h->symbols.offset);
+    m->symbol_count = h->symbols.count;
+    m->rows = (line_row_t*)(data + h->rows.offset);
+    m->row_count = h->rows.count;
+    m->funcs = (func_range_t*)(data + h->funcs.offset);
+    m->func_count = h->funcs.count;
+    m->inlines = (inline_range_t*)(data + h->inlines.offset);
+    m->inline_count = h->inlines.count;
+    m->pool = (char*)(data + h->pool.offset);
+    m->pool_size = h->pool.count;
+    m->cache_map = data;
+    m->cache_size = size;
+    return 1;
+}
+
+static int write_all(int fd, const void *data, size_t size) {
+    const char *p = data;
+    while (size) {
+        ssize_t n = write(fd, p, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return 0;
+        p += n;
+        size -= (size_t)n;
+    }
+    return 1;
+}
+
+// mkdir -p of the directory path is in
+static void make_parents(const char *path) {
+    char dir[PATH_MAX];
+    snprintf(dir, sizeof(dir), "%s", path);
+    for (char *p = dir + 1; *p; p++) {
+        if (*p != '/') continue;
+        *p = '\0';
+        mkdir(dir, 0755);
+        *p = '/';
+    }
+}
+
+/*
+ * write the tables of m to the cache
+ * failures are silent: the cache only saves time. the file is written
+ * under a temporary name and renamed, so a reader never sees half of it.
+ */
+void cache_store(const module_t *m) {
+    char path[PATH_MAX], temp[PATH_MAX + 32];
+    if (m->cache_map || !cache_path(m, path, sizeof(path))) return;
+    make_parents(path);
+
+    snprintf(temp, sizeof(temp), "%s.%d.tmp", path, (int)getpid());
+    int fd = open(temp, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd < 0) return;
+
+    cache_header_t h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, CACHE_MAGIC, sizeof(h.magic));
+    h.version = CACHE_VERSION;
+    h.build_id_size = (uint32_t)m->build_id_size;
+    memcpy(h.build_id, m->build_id, m->build_id_size);
+    h.module_size = m->map_size;
+
+    const struct { cache_table_t *table; const void *data; size_t count, entry_size; } tables[] = {
+        { &h.symbols, m->symbols, m->symbol_count, sizeof(elf_symbol_t) },
+        { &h.rows, m->rows, m->row_count, sizeof(line_row_t) },
+        { &h.funcs, m->funcs, m->func_count, sizeof(func_range_t) },
+        { &h.inlines, m->inlines, m->inline_count, sizeof(inline_range_t) },
+        { &h.pool, m->pool, m->pool_size, 1 },
+    };
+    const size_t table_count = sizeof(tables) / sizeof(tables[0]);
+
+    uint64_t offset = sizeof(h);
+    for (size_t i = 0; i < table_count; i++) {
+        offset = (offset + 7) & ~(uint64_t)7;
+        tables[i].table->offset = offset;
+        tables[i].table->count = tables[i].data ? tables[i].count : 0;
+        offset += tables[i].table->count * tables[i].entry_size;
+    }
+
+    static const char padding[8];
+    int ok = write_all(fd, &h, sizeof(h));
+    uint64_t written = sizeof(h);
+    for (size_t i = 0; i < table_count && ok; i++) {
+        ok = write_all(fd, padding, tables[i].table->offset - written);
+        size_t bytes = tables[i].table->count * tables[i].entry_size;
+        if (ok && bytes) ok = write_all(fd, tables[i].data, bytes);
+        written = tables[i].table->offset + bytes;
+    }
+
+    if (close(fd) != 0) ok = 0;
+    if (!ok || rename(temp, path) != 0) unlink(temp);
+}
@@ -0,0 +1,1326 @@
+/*
+ * DWARF side of the symbolizer - address tables from .debug_line/.debug_info
+ *
+ * each module is parsed once, into three sorted tables (see symbolize.h):
+ * - line rows, from every line-number program (DWARF 2 to 5). rows of a
+ *   sequence stay in program order, sequences are sorted by address. as
+ *   addr2line does, the last row at an address wins.
+ * - concrete functions (DW_TAG_subprogram with code), one entry per range
+ * - inlined calls (DW_TAG_inlined_subroutine) of each function, as a slice
+ *   in DIE order, so the calls containing an address come out outermost
+ *   first
+ * a lookup is two binary searches and a scan of one function's inlined
+ * calls, with no allocation.
+ *
+ * function names come from DW_AT_linkage_name (demangled) or DW_AT_name,
+ * following DW_AT_abstract_origin and DW_AT_specification. units are
+ * walked independently; type units, split DWARF and .debug_types are
+ * skipped, they hold no code.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include "symbolize.h"
+
+// the DWARF constants used here
+#define DW_TAG_inlined_subroutine   0x1d
+#define DW_TAG_subprogram           0x2e
+
+#define DW_AT_name                  0x03
+#define DW_AT_stmt_list             0x10
+#define DW_AT_low_pc                0x11
+#define DW_AT_high_pc               0x12
+#define DW_AT_abstract_origin       0x31
+#define DW_AT_specification         0x47
+#define DW_AT_ranges                0x55
+#define DW_AT_call_file             0x58
+#define DW_AT_call_line             0x59
+#define DW_AT_linkage_name          0x6e
+#define DW_AT_str_offsets_base      0x72
+#define DW_AT_addr_base             0x73
+#define DW_AT_rnglists_base         0x74
+#define DW_AT_MIPS_linkage_name     0x2007
+
+#define DW_UT_compile               0x01
+#define DW_UT_type                  0x02
+#define DW_UT_partial               0x03
+#define DW_UT_skeleton              0x04
+#define DW_UT_split_compile         0x05
+#define DW_UT_split_type            0x06
+
+#define DW_LNCT_path                0x1
+
+#define DW_LNS_copy                 0x01
+#define DW_LNS_advance_pc           0x02
+#define DW_LNS_advance_line         0x03
+#define DW_LNS_set_file             0x04
+#define DW_LNS_const_add_pc         0x08
+#define DW_LNS_fixed_advance_pc     0x09
+
+#define DW_LNE_end_sequence         0x01
+#define DW_LNE_set_address          0x02
+#define DW_LNE_define_file          0x03
+#define DW_LNE_set_discriminator    0x04
+
+#define DW_RLE_end_of_list          0x00
+#define DW_RLE_base_addressx        0x01
+#define DW_RLE_startx_endx          0x02
+#define DW_RLE_startx_length        0x03
+#define DW_RLE_offset_pair          0x04
+#define DW_RLE_base_address         0x05
+#define DW_RLE_start_end            0x06
+#define DW_RLE_start_length         0x07
+
+// nesting of DIEs we follow; deeper units are dropped
+#define MAX_DIE_DEPTH 256
+
+// DW_AT_abstract_origin/specification chains we follow for a name
+#define MAX_NAME_HOPS 8
+
+extern char *__cxa_demangle(const char *name, char *buf, size_t *len, int *status);
+
+/*
+ * C++ demangling, through the C++ runtime
+ * returns a malloc()ed name, or NULL if name is not mangled
+ */
+char *demangle(const char *name) {
+    int status = 0;
+    char *plain = __cxa_demangle(name, NULL, NULL, &status);
+    return status == 0 ? plain : NULL;
+}
+
+/*
+ * bounds-checked reading of a section
+ * a read past the end sets error and returns 0, and so does every
+ * read after it: parsers check error once per record.
+ */
+typedef struct {
+    const unsigned char *p;
+    const unsigned char *end;
+    int error;
+} reader_t;
+
+static void reader_init(reader_t *r, const section_t *s, uint64_t offset) {
+    r->error = offset > s->size;
+    r->p = s->data + (r->error ? s->size : offset);
+    r->end = s->data + s->size;
+}
+
+static int need(reader_t *r, uint64_t n) {
+    if ((uint64_t)(r->end - r->p) < n) {
+        r->error = 1;
+        r->p = r->end;
+        return 0;
+    }
+    return 1;
+}
+
+static uint64_t read_u(reader_t *r, int n) {
+    if (!need(r, n)) return 0;
+    uint64_t v = 0;
+    for (int i = 0; i < n; i++) {
+        v |= (uint64_t)r->p[i] << (8 * i);
+    }
+    r->p += n;
+    return v;
+}
+
+static uint64_t read_uleb(reader_t *r) {
+    uint64_t v = 0;
+    int shift = 0;
+    for (;;) {
+        if (!need(r, 1)) return 0;
+        unsigned char b = *r->p++;
+        if (shift < 64) v |= (uint64_t)(b & 0x7f) << shift;
+        shift += 7;
+        if (!(b & 0x80)) return v;
+    }
+}
+
+static int64_t read_sleb(reader_t *r) {
+    int64_t v = 0;
+    int shift = 0;
+    unsigned char b;
+    do {
+        if (!need(r, 1)) return 0;
+        b = *r->p++;
+        if (shift < 64) v |= (int64_t)(b & 0x7f) << shift;
+        shift += 7;
+    } while (b & 0x80);
+    if (shift < 64 && (b & 0x40)) v |= -((int64_t)1 << shift);
+    return v;
+}
+
+static const char *read_cstr(reader_t *r) {
+    const unsigned char *nul = memchr(r->p, 0, r->end - r->p);
+    if (!nul) {
+        r->error = 1;
+        r->p = r->end;
+        return NULL;
+    }
+    const char *s = (const char*)r->p;
+    r->p = nul + 1;
+    return s;
+}
+
+static void skip(reader_t *r, uint64_t n) {
+    if (need(r, n)) r->p += n;
+}
+
+// initial length: 32-bit, or 0xffffffff and 64-bit
+static uint64_t read_unit_length(reader_t *r, int *offset_size) {
+    uint64_t len = read_u(r, 4);
+    *offset_size = 4;
+    if (len == 0xffffffff) {
+        len = read_u(r, 8);
+        *offset_size = 8;
+    }
+    return len;
+}
+
+static const char *section_str(const section_t *s, uint64_t offset) {
+    if (offset >= s->size) return NULL;
+    const char *str = (const char*)s->data + offset;
+    return memchr(str, 0, s->size - offset) ? str : NULL;
+}
+
+static const char *base_name(const char *path) {
+    if (!path) return NULL;
+    const char *slash = strrchr(path, '/');
+    return slash ? slash + 1 : path;
+}
+
+static int grow(void **array, size_t *capacity, size_t needed, size_t size) {
+    if (needed <= *capacity) return 1;
+    size_t n = *capacity ? *capacity * 2 : 64;
+    while (n < needed) n *= 2;
+    void *p = realloc(*array, n * size);
+    if (!p) return 0;
+    *array = p;
+    *capacity = n;
+    return 1;
+}
+
+#define GROW(array, count, capacity) \
+    grow((void**)&(array), &(capacity), (count) + 1, sizeof(*(array)))
+
+/*
+ * attribute values
+ */
+enum {
+    VAL_NONE,       // absent, or a form we skip
+    VAL_UINT,
+    VAL_STR,
+    VAL_STRX,       // index into .debug_str_offsets
+    VAL_ADDR,
+    VAL_ADDRX,      // index into .debug_addr
+    VAL_REF,        // offset of a DIE in .debug_info
+    VAL_RNGLISTX,   // index into the unit's range list offsets
+};
+
+typedef struct {
+    int kind;
+    uint64_t u;
+    const char *str;
+} value_t;
+
+typedef struct {
+    uint64_t name;
+    uint64_t form;
+    int64_t implicit_const;
+} abbrev_attr_t;
+
+typedef struct {
+    uint64_t code;
+    uint64_t tag;
+    int children;
+    size_t first_attr;
+    size_t attr_count;
+} abbrev_t;
+
+typedef struct {
+    uint64_t offset;
+    abbrev_t *list;
+    size_t count, capacity;
+    abbrev_attr_t *attrs;
+    size_t attr_count, attr_capacity;
+} abbrev_table_t;
+
+typedef struct {
+    uint64_t offset;            // of the unit header in .debug_info
+    uint64_t end;
+    uint64_t first_die;
+    int version, offset_size, addr_size;
+    int unit_type;
+    uint64_t abbrev_offset;
+    abbrev_table_t *abbrevs;
+    uint64_t str_offsets_base, addr_base, rnglists_base;
+    uint64_t base_address;      // DW_AT_low_pc of the unit DIE
+    uint64_t stmt_list;
+    int has_stmt_list;
+} unit_t;
+
+// the attributes of a DIE we use
+typedef struct {
+    uint64_t offset;
+    uint64_t tag;
+    int children;
+    value_t name, linkage_name, low_pc, high_pc, ranges;
+    value_t abstract_origin, specification, call_file, call_line;
+    value_t stmt_list, str_offsets_base, addr_base, rnglists_base;
+} die_t;
+
+typedef struct {
+    uint64_t offset;            // of the program in .debug_line
+    string_id_t *files;         // base names
+    size_t count;
+    int first_index;            // 0 for DWARF 5, 1 before
+} file_table_t;
+
+typedef struct {
+    uint64_t low;
+    size_t first_row, row_count;
+} sequence_t;
+
+typedef struct {
+    uint64_t *keys;             // DIE offsets, 0 = free
+    string_id_t *values;
+    size_t capacity, count;
+} name_map_t;
+
+typedef struct {
+    module_t *m;
+
+    line_row_t *rows;
+    size_t row_count, row_capacity;
+    sequence_t *sequences;
+    size_t sequence_count, sequence_capacity;
+    size_t func_capacity, inline_capacity;
+
+    unit_t *units;
+    size_t unit_count, unit_capacity;
+    abbrev_table_t **abbrevs;
+    size_t abbrev_count, abbrev_capacity;
+    file_table_t *file_tables;
+    size_t file_table_count, file_table_capacity;
+
+    name_map_t names;
+    uint64_t (*ranges)[2];
+    size_t range_count, range_capacity;
+} builder_t;
+
+/*
+ * .debug_abbrev
+ */
+static abbrev_table_t *load_abbrevs(builder_t *b, uint64_t offset) {
+    for (size_t i = 0; i < b->abbrev_count; i++) {
+        if (b->abbrevs[i]->offset == offset) return b->abbrevs[i];
+    }
+    if (!GROW(b->abbrevs, b->abbrev_count, b->abbrev_capacity)) return NULL;
+
+    // units keep a pointer to their table
+    abbrev_table_t *t = calloc(1, sizeof(abbrev_table_t));
+    if (!t) return NULL;
+    b->abbrevs[b->abbrev_count++] = t;
+    t->offset = offset;
+
+    reader_t r;
+    reader_init(&r, &b->m->dwarf.abbrev, offset);
+    for (;;) {
+        uint64_t code = read_uleb(&r);
+        if (code == 0 || r.error) break;
+        if (!GROW(t->list, t->count, t->capacity)) break;
+
+        abbrev_t *a = &t->list[t->count++];
+        a->code = code;
+        a->tag = read_uleb(&r);
+        a->children = (int)read_u(&r, 1);
+        a->first_attr = t->attr_count;
+        for (;;) {
+            uint64_t name = read_uleb(&r);
+            uint64_t form = read_uleb(&r);
+            if ((name == 0 && form == 0) || r.error) break;
+            if (!GROW(t->attrs, t->attr_count, t->attr_capacity)) break;
+
+            abbrev_attr_t *attr = &t->attrs[t->attr_count++];
+            attr->name = name;
+            attr->form = form;
+            attr->implicit_const = form == 0x21 ? read_sleb(&r) : 0;
+        }
+        a->attr_count = t->attr_count - a->first_attr;
+    }
+    return t;
+}
+
+static const abbrev_t *find_abbrev(const abbrev_table_t *t, uint64_t code) {
+    // codes are usually 1, 2, 3...
+    if (code - 1 < t->count && t->list[code - 1].code == code) return &t->list[code - 1];
+    for (size_t i = 0; i < t->count; i++) {
+        if (t->list[i].code == code) return &t->list[i];
+    }
+    return NULL;
+}
+
+/*
+ * read one attribute value of the given form
+ * forms we have no use for are skipped; an unknown form sets r->error,
+ * since the rest of the unit cannot be decoded without its size.
+ */
+static void read_form(reader_t *r, const module_t *m, const unit_t *u, uint64_t form,
+                      int64_t implicit_const, value_t *v) {
+    v->kind = VAL_NONE;
+    v->str = NULL;
+    v->u = 0;
+
+    switch (form) {
+    case 0x01:  // addr
+        v->kind = VAL_ADDR;
+        v->u = read_u(r, u->addr_size);
+        break;
+    case 0x0b:  // data1
+    case 0x0c:  // flag
+        v->kind = VAL_UINT;
+        v->u = read_u(r, 1);
+        break;
+    case 0x05:  // data2
+        v->kind = VAL_UINT;
+        v->u = read_u(r, 2);
+        break;
+    case 0x06:  // data4
+        v->kind = VAL_UINT;
+        v->u = read_u(r, 4);
+        break;
+    case 0x07:  // data8
+        v->kind = VAL_UINT;
+        v->u = read_u(r, 8);
+        break;
+    case 0x0d:  // sdata
+        v->kind = VAL_UINT;
+        v->u = (uint64_t)read_sleb(r);
+        break;
+    case 0x0f:  // udata
+    case 0x22:  // loclistx
+        v->kind = VAL_UINT;
+        v->u = read_uleb(r);
+        break;
+    case 0x17:  // sec_offset
+        v->kind = VAL_UINT;
+        v->u = read_u(r, u->offset_size);
+        break;
+    case 0x21:  // implicit_const
+        v->kind = VAL_UINT;
+        v->u = (uint64_t)implicit_const;
+        break;
+    case 0x19:  // flag_present
+        v->kind = VAL_UINT;
+        v->u = 1;
+        break;
+    case 0x08:  // string
+        v->str = read_cstr(r);
+        v->kind = v->str ? VAL_STR : VAL_NONE;
+        break;
+    case 0x0e:  // strp
+        v->str = section_str(&m->dwarf.str, read_u(r, u->offset_size));
+        v->kind = v->str ? VAL_STR : VAL_NONE;
+        break;
+    case 0x1f:  // line_strp
+        v->str = section_str(&m->dwarf.line_str, read_u(r, u->offset_size));
+        v->kind = v->str ? VAL_STR : VAL_NONE;
+        break;
+    case 0x1a:  // strx
+    case 0x1f02:    // GNU_str_index
+        v->kind = VAL_STRX;
+        v->u = read_uleb(r);
+        break;
+    case 0x25: case 0x26: case 0x27: case 0x28:     // strx1..4
+        v->kind = VAL_STRX;
+        v->u = read_u(r, (int)(form - 0x24));
+        break;
+    case 0x1b:  // addrx
+    case 0x1f01:    // GNU_addr_index
+        v->kind = VAL_ADDRX;
+        v->u = read_uleb(r);
+        break;
+    case 0x29: case 0x2a: case 0x2b: case 0x2c:     // addrx1..4
+        v->kind = VAL_ADDRX;
+        v->u = read_u(r, (int)(form - 0x28));
+        break;
+    case 0x11:  // ref1
+        v->kind = VAL_REF;
+        v->u = u->offset + read_u(r, 1);
+        break;
+    case 0x12:  // ref2
+        v->kind = VAL_REF;
+        v->u = u->offset + read_u(r, 2);
+        break;
+    case 0x13:  // ref4
+        v->kind = VAL_REF;
+        v->u = u->offset + read_u(r, 4);
+        break;
+    case 0x14:  // ref8
+        v->kind = VAL_REF;
+        v->u = u->offset + read_u(r, 8);
+        break;
+    case 0x15:  // ref_udata
+        v->kind = VAL_REF;
+        v->u = u->offset + read_uleb(r);
+        break;
+    case 0x10:  // ref_addr
+        v->kind = VAL_REF;
+        v->u = read_u(r, u->version <= 2 ? u->addr_size : u->offset_size);
+        break;
+    case 0x23:  // rnglistx
+        v->kind = VAL_RNGLISTX;
+        v->u = read_uleb(r);
+        break;
+    case 0x0a:  // block1
+        skip(r, read_u(r, 1));
+        break;
+    case 0x03:  // block2
+        skip(r, read_u(r, 2));
+        break;
+    case 0x04:  // block4
+        skip(r, read_u(r, 4));
+        break;
+    case 0x09:  // block
+    case 0x18:  // exprloc
+        skip(r, read_uleb(r));
+        break;
+    case 0x1e:  // data16
+        skip(r, 16);
+        break;
+    case 0x20:  // ref_sig8
+    case 0x24:  // ref_sup8
+        skip(r, 8);
+        break;
+    case 0x1c:  // ref_sup4
+        skip(r, 4);
+        break;
+    case 0x1d:  // strp_sup
+    case 0x1f20:    // GNU_ref_alt
+    case 0x1f21:    // GNU_strp_alt
+        skip(r, u->offset_size);
+        break;
+    case 0x16:  // indirect
+        read_form(r, m, u, read_uleb(r), implicit_const, v);
+        break;
+    default:
+        r->error = 1;
+        break;
+    }
+}
+
+static const char *value_str(const module_t *m, const unit_t *u, const value_t *v) {
+    if (v->kind == VAL_STR) return v->str;
+    if (v->kind != VAL_STRX) return NULL;
+
+    reader_t r;
+    reader_init(&r, &m->dwarf.str_offsets, u->str_offsets_base + v->u * u->offset_size);
+    uint64_t offset = read_u(&r, u->offset_size);
+    return r.error ? NULL : section_str(&m->dwarf.str, offset);
+}
+
+static int value_addr(const module_t *m, const unit_t *u, const value_t *v, uint64_t *addr) {
+    if (v->kind == VAL_ADDR) {
+        *addr = v->u;
+        return 1;
+    }
+    if (v->kind != VAL_ADDRX) return 0;
+
+    reader_t r;
+    reader_init(&r, &m->dwarf.addr, u->addr_base + v->u * u->addr_size);
+    *addr = read_u(&r, u->addr_size);
+    return !r.error;
+}
+
+/*
+ * read the DIE at r
+ * returns 1 for a DIE, 0 for a null entry (end of siblings), -1 on error
+ */
+static int read_die(reader_t *r, const module_t *m, const unit_t *u, die_t *d) {
+    memset(d, 0, sizeof(*d));
+    d->offset = (uint64_t)(r->p - m->dwarf.info.data);
+
+    uint64_t code = read_uleb(r);
+    if (r->error) return -1;
+    if (code == 0) return 0;
+
+    const abbrev_t *a = find_abbrev(u->abbrevs, code);
+    if (!a) return -1;
+    d->tag = a->tag;
+    d->children = a->children;
+
+    for (size_t i = 0; i < a->attr_count; i++) {
+        const abbrev_attr_t *attr = &u->abbrevs->attrs[a->first_attr + i];
+        value_t v;
+        read_form(r, m, u, attr->form, attr->implicit_const, &v);
+        if (r->error) return -1;
+
+        switch (attr->name) {
+        case DW_AT_name: d->name = v; break;
+        case DW_AT_linkage_name:
+        case DW_AT_MIPS_linkage_name: d->linkage_name = v; break;
+        case DW_AT_low_pc: d->low_pc = v; break;
+        case DW_AT_high_pc: d->high_pc = v; break;
+        case DW_AT_ranges: d->ranges = v; break;
+        case DW_AT_abstract_origin: d->abstract_origin = v; break;
+        case DW_AT_specification: d->specification = v; break;
+        case DW_AT_call_file: d->call_file = v; break;
+        case DW_AT_call_line: d->call_line = v; break;
+        case DW_AT_stmt_list: d->stmt_list = v; break;
+        case DW_AT_str_offsets_base: d->str_offsets_base = v; break;
+        case DW_AT_addr_base: d->addr_base = v; break;
+        case DW_AT_rnglists_base: d->rnglists_base = v; break;
+        }
+    }
+    return 1;
+}
+
+/*
+ * address ranges of a DIE, into b->ranges
+ */
+static void add_range(builder_t *b, uint64_t low, uint64_t high) {
+    if (high <= low || !GROW(b->ranges, b->range_count, b->range_capacity)) return;
+    b->ranges[b->range_count][0] = low;
+    b->ranges[b->range_count][1] = high;
+    b->range_count++;
+}
+
+static void read_rnglist(builder_t *b, const unit_t *u, uint64_t offset) {
+    const module_t *m = b->m;
+    reader_t r;
+    reader_init(&r, &m->dwarf.rnglists, offset);
+
+    uint64_t base = u->base_address;
+    value_t x = { VAL_ADDRX, 0, NULL };
+    uint64_t start, end;
+    while (!r.error) {
+        switch (read_u(&r, 1)) {
+        case DW_RLE_end_of_list:
+            return;
+        case DW_RLE_base_addressx:
+            x.u = read_uleb(&r);
+            value_addr(m, u, &x, &base);
+            break;
+        case DW_RLE_startx_endx:
+            x.u = read_uleb(&r);
+            if (!value_addr(m, u, &x, &start)) return;
+            x.u = read_uleb(&r);
+            if (!value_addr(m, u, &x, &end)) return;
+            add_range(b, start, end);
+            break;
+        case DW_RLE_startx_length:
+            x.u = read_uleb(&r);
+            if (!value_addr(m, u, &x, &start)) return;
+            add_range(b, start, start + read_uleb(&r));
+            break;
+        case DW_RLE_offset_pair:
+            start = read_uleb(&r);
+            end = read_uleb(&r);
+            add_range(b, base + start, base + end);
+            break;
+        case DW_RLE_base_address:
+            base = read_u(&r, u->addr_size);
+            break;
+        case DW_RLE_start_end:
+            start = read_u(&r, u->addr_size);
+            end = read_u(&r, u->addr_size);
+            add_range(b, start, end);
+            break;
+        case DW_RLE_start_length:
+            start = read_u(&r, u->addr_size);
+            add_range(b, start, start + read_uleb(&r));
+            break;
+        default:
+            return;
+        }
+    }
+}
+
+// DWARF 2-4: pairs of addresses, a pair with an all-ones start sets the base
+static void read_ranges(builder_t *b, const unit_t *u, uint64_t offset) {
+    reader_t r;
+    reader_init(&r, &b->m->dwarf.ranges, offset);
+
+    uint64_t base = u->base_address;
+    uint64_t all_ones = u->addr_size == 8 ? UINT64_MAX : 0xffffffffu;
+    while (!r.error) {
+        uint64_t start = read_u(&r, u->addr_size);
+        uint64_t end = read_u(&r, u->addr_size);
+        if (r.error || (start == 0 && end == 0)) return;
+        if (start == all_ones) {
+            base = end;
+        } else {
+            add_range(b, base + start, base + end);
+        }
+    }
+}
+
+static void die_ranges(builder_t *b, const unit_t *u, const die_t *d) {
+    b->range_count = 0;
+
+    uint64_t low, high;
+    if (value_addr(b->m, u, &d->low_pc, &low) && d->high_pc.kind != VAL_NONE) {
+        // DWARF 4+: a constant high_pc is the length
+        if (d->high_pc.kind == VAL_UINT) {
+            high = low + d->high_pc.u;
+        } else if (!value_addr(b->m, u, &d->high_pc, &high)) {
+            return;
+        }
+        add_range(b, low, high);
+        return;
+    }
+
+    if (d->ranges.kind == VAL_RNGLISTX) {
+        reader_t r;
+        reader_init(&r, &b->m->dwarf.rnglists, u->rnglists_base + d->ranges.u * u->offset_size);
+        uint64_t offset = read_u(&r, u->offset_size);
+        if (!r.error) read_rnglist(b, u, u->rnglists_base + offset);
+    } else if (d->ranges.kind == VAL_UINT) {
+        if (u->version >= 5) read_rnglist(b, u, d->ranges.u);
+        else read_ranges(b, u, d->ranges.u);
+    }
+}
+
+/*
+ * function names
+ */
+static string_id_t name_map_get(const name_map_t *map, uint64_t key) {
+    if (!map->capacity) return 0;
+    for (size_t i = key & (map->capacity - 1); map->keys[i]; i = (i + 1) & (map->capacity - 1)) {
+        if (map->keys[i] == key) return map->values[i];
+    }
+    return 0;
+}
+
+static void name_map_put(name_map_t *map, uint64_t key, string_id_t value) {
+    if ((map->count + 1) * 2 > map->capacity) {
+        size_t capacity = map->capacity ? map->capacity * 2 : 1024;
+        uint64_t *keys = calloc(capacity, sizeof(uint64_t));
+        string_id_t *values = calloc(capacity, sizeof(string_id_t));
+        if (!keys || !values) {
+            free(keys);
+            free(values);
+            return;
+        }
+        for (size_t i = 0; i < map->capacity; i++) {
+            if (!map->keys[i]) continue;
+            size_t j = map->keys[i] & (capacity - 1);
+            while (keys[j]) j = (j + 1) & (capacity - 1);
+            keys[j] = map->keys[i];
+            values[j] = map->values[i];
+        }
+        free(map->keys);
+        free(map->values);
+        map->keys = keys;
+        map->values = values;
+        map->capacity = capacity;
+    }
+
+    size_t i = key & (map->capacity - 1);
+    while (map->keys[i] && map->keys[i] != key) i = (i + 1) & (map->capacity - 1);
+    if (!map->keys[i]) map->count++;
+    map->keys[i] = key;
+    map->values[i] = value;
+}
+
+static const unit_t *unit_at(const builder_t *b, uint64_t offset) {
+    size_t lo = 0, hi = b->unit_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (b->units[mid].offset <= offset) lo = mid + 1;
+        else hi = mid;
+    }
+    if (lo == 0) return NULL;
+    const unit_t *u = &b->units[lo - 1];
+    return offset < u->end && u->abbrevs ? u : NULL;
+}
+
+static string_id_t die_name(builder_t *b, const unit_t *u, const die_t *d, int hops);
+
+// name of the DIE a reference points at, remembered per DIE
+static string_id_t ref_name(builder_t *b, const value_t *ref, int hops) {
+    if (ref->kind != VAL_REF || hops >= MAX_NAME_HOPS) return 0;
+
+    string_id_t name = name_map_get(&b->names, ref->u);
+    if (name) return name;
+
+    const unit_t *u = unit_at(b, ref->u);
+    if (!u) return 0;
+
+    reader_t r;
+    reader_init(&r, &b->m->dwarf.info, ref->u);
+    r.end = b->m->dwarf.info.data + u->end;
+    die_t d;
+    if (read_die(&r, b->m, u, &d) != 1) return 0;
+
+    name = die_name(b, u, &d, hops + 1);
+    if (name) name_map_put(&b->names, ref->u, name);
+    return name;
+}
+
+static string_id_t die_name(builder_t *b, const unit_t *u, const die_t *d, int hops) {
+    const char *linkage = value_str(b->m, u, &d->linkage_name);
+    if (linkage) {
+        char *plain = demangle(linkage);
+        string_id_t id = module_intern(b->m, plain ? plain : linkage);
+        free(plain);
+        return id;
+    }
+
+    const char *name = value_str(b->m, u, &d->name);
+    if (name) return module_intern(b->m, name);
+
+    string_id_t id = ref_name(b, &d->abstract_origin, hops);
+    return id ? id : ref_name(b, &d->specification, hops);
+}
+
+/*
+ * .debug_line
+ */
+static string_id_t file_name(const file_table_t *files, uint64_t index) {
+    if (!files || index < (uint64_t)files->first_index) return 0;
+    index -= files->first_index;
+    return index < files->count ? files->files[index] : 0;
+}
+
+static void add_file(module_t *m, file_table_t *files, size_t *capacity, const char *path) {
+    if (!GROW(files->files, files->count, *capacity)) return;
+    files->files[files->count++] = module_intern(m, base_name(path));
+}
+
+// DWARF 5 directory and file entries: a list of (content type, form)
+static int read_entry_format(reader_t *r, uint64_t formats[][2], int max) {
+    int count = (int)read_u(r, 1);
+    if (count > max) {
+        r->error = 1;
+        return 0;
+    }
+    for (int i = 0; i < count; i++) {
+        formats[i][0] = read_uleb(r);
+        formats[i][1] = read_uleb(r);
+    }
+    return count;
+}
+
+/*
+ * read the entries of a DWARF 5 directory or file list
+ * the path of each entry goes to files, if given
+ */
+static void read_entries(reader_t *r, module_t *m, const unit_t *u,
+                         file_table_t *files, size_t *capacity) {
+    uint64_t formats[16][2];
+    int format_count = read_entry_format(r, formats, 16);
+    uint64_t count = read_uleb(r);
+
+    for (uint64_t i = 0; i < count && !r->error; i++) {
+        const char *path = NULL;
+        for (int f = 0; f < format_count; f++) {
+            value_t v;
+            read_form(r, m, u, formats[f][1], 0, &v);
+            if (formats[f][0] == DW_LNCT_path) path = value_str(m, u, &v);
+        }
+        if (files) add_file(m, files, capacity, path ? path : "");
+    }
+}
+
+static void add_row(builder_t *b, uint64_t addr, string_id_t file, unsigned int line,
+                    unsigned int discriminator, int end_sequence) {
+    if (!GROW(b->rows, b->row_count, b->row_capacity)) return;
+    line_row_t *row = &b->rows[b->row_count++];
+    row->addr = addr;
+    row->file = file;
+    row->line = line;
+    row->discriminator = discriminator;
+    row->end_sequence = end_sequence;
+}
+
+// close the sequence that started at row first
+static void end_sequence(builder_t *b, size_t first) {
+    if (b->row_count <= first) return;
+
+    // code discarded by the linker keeps its rows, at address 0
+    uint64_t low = b->rows[first].addr;
+    if (low == 0 || !GROW(b->sequences, b->sequence_count, b->sequence_capacity)) {
+        b->row_count = first;
+        return;
+    }
+    sequence_t *s = &b->sequences[b->sequence_count++];
+    s->low = low;
+    s->first_row = first;
+    s->row_count = b->row_count - first;
+}
+
+/*
+ * run the line-number program at offset, adding its rows
+ * returns its file table (kept in the builder), or NULL
+ * *next is set to the offset right after the program
+ */
+static const file_table_t *parse_line_program(builder_t *b, uint64_t offset, uint64_t *next) {
+    for (size_t i = 0; i < b->file_table_count; i++) {
+        if (b->file_tables[i].offset == offset) return &b->file_tables[i];
+    }
+
+    module_t *m = b->m;
+    reader_t r;
+    reader_init(&r, &m->dwarf.line, offset);
+
+    // the header's forms are decoded like a unit's
+    unit_t u;
+    memset(&u, 0, sizeof(u));
+    uint64_t length = read_unit_length(&r, &u.offset_size);
+    if (r.error || length > (uint64_t)(r.end - r.p)) return NULL;
+    r.end = r.p + length;
+    *next = (uint64_t)(r.end - m->dwarf.line.data);
+
+    u.version = (int)read_u(&r, 2);
+    u.addr_size = 8;
+    if (u.version < 2 || u.version > 5) return NULL;
+    if (u.version >= 5) {
+        u.addr_size = (int)read_u(&r, 1);
+        read_u(&r, 1);      // segment selector size
+    }
+    uint64_t header_length = read_u(&r, u.offset_size);
+    if (header_length > (uint64_t)(r.end - r.p)) return NULL;
+    const unsigned char *program = r.p + header_length;
+
+    unsigned int min_inst_length = (unsigned int)read_u(&r, 1);
+    if (u.version >= 4) read_u(&r, 1);     // maximum operations per instruction
+    read_u(&r, 1);                          // default_is_stmt
+    int line_base = (int8_t)read_u(&r, 1);
+    unsigned int line_range = (unsigned int)read_u(&r, 1);
+    unsigned int opcode_base = (unsigned int)read_u(&r, 1);
+    const unsigned char *opcode_lengths = r.p;
+    if (opcode_base == 0 || line_range == 0) return NULL;
+    skip(&r, opcode_base - 1);
+
+    if (!GROW(b->file_tables, b->file_table_count, b->file_table_capacity)) return NULL;
+    file_table_t *files = &b->file_tables[b->file_table_count++];
+    memset(files, 0, sizeof(*files));
+    files->offset = offset;
+    size_t capacity = 0;
+
+    if (u.version >= 5) {
+        read_entries(&r, m, &u, NULL, NULL);        // directories
+        read_entries(&r, m, &u, files, &capacity);
+    } else {
+        const char *dir;
+        while ((dir = read_cstr(&r)) && *dir) {
+        }
+        const char *path;
+        while ((path = read_cstr(&r)) && *path) {
+            read_uleb(&r);      // directory index
+            read_uleb(&r);      // modification time
+            read_uleb(&r);      // length
+            add_file(m, files, &capacity, path);
+        }
+        files->first_index = 1;
+    }
+    if (r.error) return files;
+
+    // the state machine
+    r.p = program;
+    uint64_t addr = 0;
+    uint64_t file = 1;
+    int64_t line = 1;
+    unsigned int discriminator = 0;
+    size_t first = b->row_count;
+
+    while (r.p < r.end && !r.error) {
+        unsigned int opcode = (unsigned int)read_u(&r, 1);
+
+        if (opcode >= opcode_base) {
+            unsigned int adjusted = opcode - opcode_base;
+            addr += min_inst_length * (adjusted / line_range);
+            line += line_base + (int)(adjusted % line_range);
+            add_row(b, addr, file_name(files, file), (unsigned int)line, discriminator, 0);
+            discriminator = 0;
+            continue;
+        }
+
+        switch (opcode) {
+        case 0: {
+            uint64_t len = read_uleb(&r);
+            if (len == 0 || !need(&r, len)) break;
+            const unsigned char *end = r.p + len;
+            switch (read_u(&r, 1)) {
+            case DW_LNE_end_sequence:
+                add_row(b, addr, 0, (unsigned int)line, 0, 1);
+                end_sequence(b, first);
+                first = b->row_count;
+                addr = 0;
+                file = 1;
+                line = 1;
+                discriminator = 0;
+                break;
+            case DW_LNE_set_address:
+                addr = read_u(&r, (int)(len - 1 < 8 ? len - 1 : 8));
+                break;
+            case DW_LNE_define_file: {
+                const char *path = read_cstr(&r);
+                if (path) add_file(m, files, &capacity, path);
+                break;
+            }
+            case DW_LNE_set_discriminator:
+                discriminator = (unsigned int)read_uleb(&r);
+                break;
+            }
+            r.p = end;
+            break;
+        }
+        case DW_LNS_copy:
+            add_row(b, addr, file_name(files, file), (unsigned int)line, discriminator, 0);
+            discriminator = 0;
+            break;
+        case DW_LNS_advance_pc:
+            addr += min_inst_length * read_uleb(&r);
+            break;
+        case DW_LNS_advance_line:
+            line += read_sleb(&r);
+            break;
+        case DW_LNS_set_file:
+            file = read_uleb(&r);
+            break;
+        case DW_LNS_const_add_pc:
+            addr += min_inst_length * ((255 - opcode_base) / line_range);
+            break;
+        case DW_LNS_fixed_advance_pc:
+            addr += read_u(&r, 2);
+            break;
+        default:
+            // set_column, negate_stmt, set_isa and unknown opcodes: skip the operands
+            for (unsigned int i = 0; i < opcode_lengths[opcode - 1]; i++) {
+                read_uleb(&r);
+            }
+            break;
+        }
+    }
+
+    // a sequence without its end_sequence has no end address
+    b->row_count = first;
+    return files;
+}
+
+/*
+ * .debug_info
+ */
+static void read_units(builder_t *b) {
+    const section_t *info = &b->m->dwarf.info;
+    uint64_t offset = 0;
+
+    while (offset < info->size) {
+        reader_t r;
+        reader_init(&r, info, offset);
+
+        unit_t u;
+        memset(&u, 0, sizeof(u));
+        u.offset = offset;
+        uint64_t length = read_unit_length(&r, &u.offset_size);
+        if (r.error || length > (uint64_t)(r.end - r.p)) return;
+        u.end = (uint64_t)(r.p - info->data) + length;
+
+        u.version = (int)read_u(&r, 2);
+        u.unit_type = DW_UT_compile;
+        if (u.version >= 5) {
+            u.unit_type = (int)read_u(&r, 1);
+            u.addr_size = (int)read_u(&r, 1);
+            u.abbrev_offset = read_u(&r, u.offset_size);
+            if (u.unit_type == DW_UT_skeleton || u.unit_type == DW_UT_split_compile) skip(&r, 8);
+            if (u.unit_type == DW_UT_type || u.unit_type == DW_UT_split_type) skip(&r, 8 + u.offset_size);
+        } else {
+            u.abbrev_offset = read_u(&r, u.offset_size);
+            u.addr_size = (int)read_u(&r, 1);
+        }
+        u.first_die = (uint64_t)(r.p - info->data);
+        offset = u.end;
+
+        if (r.error || u.version < 2 || u.version > 5 || (u.addr_size != 4 && u.addr_size != 8)) continue;
+        if (u.unit_type != DW_UT_compile && u.unit_type != DW_UT_partial) continue;
+        if (!GROW(b->units, b->unit_count, b->unit_capacity)) return;
+        b->units[b->unit_count++] = u;
+    }
+}
+
+// the unit DIE: bases for the forms of the other DIEs
+static int read_unit_die(builder_t *b, unit_t *u) {
+    u->abbrevs = load_abbrevs(b, u->abbrev_offset);
+    if (!u->abbrevs) return 0;
+
+    reader_t r;
+    reader_init(&r, &b->m->dwarf.info, u->first_die);
+    r.end = b->m->dwarf.info.data + u->end;
+    die_t d;
+    if (read_die(&r, b->m, u, &d) != 1) {
+        u->abbrevs = NULL;
+        return 0;
+    }
+
+    if (d.str_offsets_base.kind == VAL_UINT) u->str_offsets_base = d.str_offsets_base.u;
+    if (d.addr_base.kind == VAL_UINT) u->addr_base = d.addr_base.u;
+    if (d.rnglists_base.kind == VAL_UINT) u->rnglists_base = d.rnglists_base.u;
+    value_addr(b->m, u, &d.low_pc, &u->base_address);
+    if (d.stmt_list.kind == VAL_UINT) {
+        u->stmt_list = d.stmt_list.u;
+        u->has_stmt_list = 1;
+    }
+    return 1;
+}
+
+typedef struct {
+    int function;               // a DW_TAG_subprogram with code
+    int in_function;
+    unsigned int inline_depth;
+    size_t first_func, func_count;
+    size_t first_inline;
+} scope_t;
+
+static void close_function(builder_t *b, const scope_t *s) {
+    module_t *m = b->m;
+    for (size_t i = s->first_func; i < s->first_func + s->func_count; i++) {
+        m->funcs[i].first_inline = (uint32_t)s->first_inline;
+        m->funcs[i].inline_count = (uint32_t)(m->inline_count - s->first_inline);
+    }
+}
+
+static void walk_unit(builder_t *b, const unit_t *u, const file_table_t *files) {
+    module_t *m = b->m;
+    reader_t r;
+    reader_init(&r, &m->dwarf.info, u->first_die);
+    r.end = m->dwarf.info.data + u->end;
+
+    scope_t stack[MAX_DIE_DEPTH];
+    int depth = 0;
+
+    while (r.p < r.end) {
+        die_t d;
+        int rc = read_die(&r, m, u, &d);
+        if (rc < 0) return;
+        if (rc == 0) {
+            // padding after the unit DIE's children ends up here too
+            if (depth == 0) continue;
+            depth--;
+            if (stack[depth].function) close_function(b, &stack[depth]);
+            continue;
+        }
+
+        scope_t s;
+        memset(&s, 0, sizeof(s));
+        if (depth > 0) {
+            s.in_function = stack[depth - 1].in_function;
+            s.inline_depth = stack[depth - 1].inline_depth;
+        }
+
+        if (d.tag == DW_TAG_subprogram) {
+            die_ranges(b, u, &d);
+            if (b->range_count) {
+                string_id_t name = die_name(b, u, &d, 0);
+                s.function = 1;
+                s.in_function = 1;
+                s.inline_depth = 0;
+                s.first_func = m->func_count;
+                s.first_inline = m->inline_count;
+                for (size_t i = 0; i < b->range_count; i++) {
+                    if (!GROW(m->funcs, m->func_count, b->func_capacity)) break;
+                    func_range_t *f = &m->funcs[m->func_count++];
+                    f->low = b->ranges[i][0];
+                    f->high = b->ranges[i][1];
+                    f->name = name;
+                    f->reserved = 0;
+                    s.func_count++;
+                }
+            }
+        } else if (d.tag == DW_TAG_inlined_subroutine && s.in_function) {
+            die_ranges(b, u, &d);
+            string_id_t name = die_name(b, u, &d, 0);
+            s.inline_depth++;
+            for (size_t i = 0; i < b->range_count; i++) {
+                if (!GROW(m->inlines, m->inline_count, b->inline_capacity)) break;
+                inline_range_t *in = &m->inlines[m->inline_count++];
+                in->low = b->ranges[i][0];
+                in->high = b->ranges[i][1];
+                in->name = name;
+                in->call_file = d.call_file.kind == VAL_UINT ? file_name(files, d.call_file.u) : 0;
+                in->call_line = d.call_line.kind == VAL_UINT ? (unsigned int)d.call_line.u : 0;
+                in->depth = s.inline_depth;
+            }
+        }
+
+        if (d.children) {
+            if (depth == MAX_DIE_DEPTH) return;
+            stack[depth++] = s;
+        } else if (s.function) {
+            close_function(b, &s);
+        }
+    }
+
+    // a truncated unit: close what is open
+    while (depth > 0) {
+        depth--;
+        if (stack[depth].function) close_function(b, &stack[depth]);
+    }
+}
+
+static int sequence_cmp(const void *a, const void *b) {
+    const sequence_t *x = a, *y = b;
+    if (x->low != y->low) return x->low < y->low ? -1 : 1;
+    return x->first_row < y->first_row ? -1 : x->first_row > y->first_row;
+}
+
+static int func_cmp(const void *a, const void *b) {
+    const func_range_t *x = a, *y = b;
+    if (x->low != y->low) return x->low < y->low ? -1 : 1;
+    return 0;
+}
+
+// the module's rows, sequence after sequence in address order
+static void finish_rows(builder_t *b) {
+    module_t *m = b->m;
+    qsort(b->sequences, b->sequence_count, sizeof(sequence_t), sequence_cmp);
+
+    m->rows = malloc((b->row_count ? b->row_count : 1) * sizeof(line_row_t));
+    if (!m->rows) return;
+    for (size_t i = 0; i < b->sequence_count; i++) {
+        const sequence_t *s = &b->sequences[i];
+        memcpy(&m->rows[m->row_count], &b->rows[s->first_row], s->row_count * sizeof(line_row_t));
+        m->row_count += s->row_count;
+    }
+}
+
+void dwarf_load(module_t *m) {
+    builder_t b;
+    memset(&b, 0, sizeof(b));
+    b.m = m;
+
+    if (m->dwarf.info.size) {
+        // names can refer to DIEs of any unit, read them all first
+        read_units(&b);
+        for (size_t i = 0; i < b.unit_count; i++) {
+            read_unit_die(&b, &b.units[i]);
+        }
+        for (size_t i = 0; i < b.unit_count; i++) {
+            const unit_t *u = &b.units[i];
+            if (!u->abbrevs) continue;
+
+            const file_table_t *files = NULL;
+            uint64_t next;
+            if (u->has_stmt_list) files = parse_line_program(&b, u->stmt_list, &next);
+            walk_unit(&b, u, files);
+        }
+    } else {
+        // line tables without units: run every program in turn
+        uint64_t offset = 0;
+        while (offset < m->dwarf.line.size) {
+            uint64_t next = m->dwarf.line.size;
+            parse_line_program(&b, offset, &next);
+            if (next <= offset) break;
+            offset = next;
+        }
+    }
+
+    finish_rows(&b);
+    qsort(m->funcs, m->func_count, sizeof(func_range_t), func_cmp);
+
+    for (size_t i = 0; i < b.abbrev_count; i++) {
+        free(b.abbrevs[i]->list);
+        free(b.abbrevs[i]->attrs);
+        free(b.abbrevs[i]);
+    }
+    for (size_t i = 0; i < b.file_table_count; i++) {
+        free(b.file_tables[i].files);
+    }
+    free(b.abbrevs);
+    free(b.file_tables);
+    free(b.units);
+    free(b.rows);
+    free(b.sequences);
+    free(b.ranges);
+    free(b.names.keys);
+    free(b.names.values);
+}
+
+/*
+ * lookup
+ */
+static const line_row_t *find_row(const module_t *m, uint64_t addr) {
+    size_t lo = 0, hi = m->row_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (m->rows[mid].addr <= addr) lo = mid + 1;
+        else hi = mid;
+    }
+    if (lo == 0) return NULL;
+
+    // past the end of its sequence, or before the start of the next
+    const line_row_t *row = &m->rows[lo - 1];
+    return row->end_sequence ? NULL : row;
+}
+
+static const func_range_t *find_func(const module_t *m, uint64_t addr) {
+    size_t lo = 0, hi = m->func_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (m->funcs[mid].low <= addr) lo = mid + 1;
+        else hi = mid;
+    }
+
+    // a nested function can start inside its parent: look back a little
+    for (size_t i = lo, n = 0; i > 0 && n < 4; i--, n++) {
+        const func_range_t *f = &m->funcs[i - 1];
+        if (addr < f->high) return f;
+    }
+    return NULL;
+}
+
+/*
+ * resolve addr into at most max levels, innermost first: the line of
+ * the code at addr, then for each call inlined there the line it was
+ * called from, out to the concrete function
+ * returns the number of levels, 0 if nothing is known about addr
+ */
+int dwarf_lookup(const module_t *m, uint64_t addr, location_t *out, int max) {
+    if (max <= 0) return 0;
+
+    const line_row_t *row = find_row(m, addr);
+    const func_range_t *func = find_func(m, addr);
+
+    const char *function = NULL;
+    const char *symbol_file = NULL;
+    const inline_range_t *chain[MAX_INLINE_DEPTH];
+    int chain_length = 0;
+    if (func) {
+        function = module_string(m, func->name);
+        // (a slice out of the table can only come from a damaged cache file)
+        size_t first = func->first_inline, count = func->inline_count;
+        if (first > m->inline_count || count > m->inline_count - first) count = 0;
+        for (size_t i = first; i < first + count; i++) {
+            const inline_range_t *in = &m->inlines[i];
+            if (addr >= in->low && addr < in->high && chain_length < MAX_INLINE_DEPTH) {
+                chain[chain_length++] = in;
+            }
+        }
+    } else {
+        const elf_symbol_t *sym = module_symbol(m, addr);
+        if (sym) {
+            function = module_string(m, sym->name);
+            symbol_file = module_string(m, sym->file);
+        }
+    }
+    if (!row && !function) return 0;
+
+    // chain runs outermost first
+    // (without a line, the symbol's file with an unknown line, as addr2line)
+    out[0].file = row ? module_string(m, row->file) : symbol_file;
+    out[0].line = row ? row->line : 0;
+    out[0].discriminator = row ? row->discriminator : 0;
+    out[0].function = chain_length ? module_string(m, chain[chain_length - 1]->name) : function;
+
+    int count = 1;
+    for (int i = chain_length - 1; i >= 0 && count < max; i--, count++) {
+        out[count].file = module_string(m, chain[i]->call_file);
+        out[count].line = chain[i]->call_line;
+        out[count].discriminator = 0;
+        out[count].function = i > 0 ? module_string(m, chain[i - 1]->name) : function;
+    }
+    return count;
+}
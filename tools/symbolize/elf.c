@@ -0,0 +1,309 @@
+/*
+ * ELF side of the symbolizer - map a module, find its sections
+ *
+ * the whole file is mapped read-only and the DWARF sections are read in
+ * place. the strings the tables need (names, file names) are copied into
+ * the module's string pool, once each.
+ *
+ * only ELF64 little-endian files are handled (x86_64, like the profiler).
+ * compressed debug sections (SHF_COMPRESSED) are treated as absent.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <elf.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "symbolize.h"
+
+static int symbol_cmp(const void *a, const void *b) {
+    const elf_symbol_t *x = a, *y = b;
+    if (x->addr != y->addr) return x->addr < y->addr ? -1 : 1;
+    // bigger first, so the entry kept for an address covers the most
+    if (x->size != y->size) return x->size > y->size ? -1 : 1;
+    return 0;
+}
+
+static int in_file(const module_t *m, uint64_t offset, uint64_t size) {
+    return offset <= m->map_size && size <= m->map_size - offset;
+}
+
+static void load_symbols(module_t *m, const Elf64_Shdr *symtab, const Elf64_Shdr *strtab) {
+    if (!in_file(m, symtab->sh_offset, symtab->sh_size) ||
+        !in_file(m, strtab->sh_offset, strtab->sh_size) ||
+        symtab->sh_entsize != sizeof(Elf64_Sym)) {
+        return;
+    }
+
+    const Elf64_Sym *syms = (const Elf64_Sym*)(m->map + symtab->sh_offset);
+    const char *names = (const char*)(m->map + strtab->sh_offset);
+    size_t count = symtab->sh_size / sizeof(Elf64_Sym);
+
+    m->symbols = malloc(count * sizeof(elf_symbol_t));
+    if (!m->symbols) return;
+
+    /*
+     * the file a function comes from, as addr2line guesses it without
+     * line information: the last STT_FILE symbol before it. globals come
+     * after every file's locals, so once an STT_FILE followed a function,
+     * only locals get one.
+     */
+    string_id_t file = 0;
+    int file_after_function = 0, function_seen = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        int type = ELF64_ST_TYPE(syms[i].st_info);
+        if (type == STT_FILE && syms[i].st_name < strtab->sh_size) {
+            file = module_intern(m, names + syms[i].st_name);
+            if (function_seen) file_after_function = 1;
+            continue;
+        }
+        if (type != STT_FUNC && type != STT_GNU_IFUNC) continue;
+        function_seen = 1;
+        if (syms[i].st_shndx == SHN_UNDEF || syms[i].st_value == 0) continue;
+        if (syms[i].st_name >= strtab->sh_size) continue;
+
+        elf_symbol_t *s = &m->symbols[m->symbol_count++];
+        s->addr = syms[i].st_value;
+        s->size = syms[i].st_size;
+        s->file = 0;
+        if (ELF64_ST_BIND(syms[i].st_info) == STB_LOCAL || !file_after_function) s->file = file;
+
+        const char *name = names + syms[i].st_name;
+        char *plain = strncmp(name, "_Z", 2) == 0 ? demangle(name) : NULL;
+        s->name = module_intern(m, plain ? plain : name);
+        free(plain);
+    }
+    qsort(m->symbols, m->symbol_count, sizeof(elf_symbol_t), symbol_cmp);
+
+    // aliases share an address, keep one
+    size_t kept = 0;
+    for (size_t i = 0; i < m->symbol_count; i++) {
+        if (kept && m->symbols[kept - 1].addr == m->symbols[i].addr) continue;
+        m->symbols[kept++] = m->symbols[i];
+    }
+    m->symbol_count = kept;
+}
+
+// the NT_GNU_BUILD_ID note of an SHT_NOTE section, if it has one
+static void read_build_id(module_t *m, const Elf64_Shdr *sh) {
+    const unsigned char *p = m->map + sh->sh_offset;
+    const unsigned char *end = p + sh->sh_size;
+
+    while ((size_t)(end - p) >= sizeof(Elf64_Nhdr)) {
+        const Elf64_Nhdr *note = (const Elf64_Nhdr*)p;
+        size_t name_size = (note->n_namesz + 3) & ~(size_t)3;
+        size_t desc_size = (note->n_descsz + 3) & ~(size_t)3;
+        p += sizeof(Elf64_Nhdr);
+        if ((size_t)(end - p) < name_size || (size_t)(end - p) - name_size < desc_size) return;
+
+        if (note->n_type == NT_GNU_BUILD_ID && note->n_namesz == 4 && memcmp(p, "GNU", 4) == 0 &&
+            note->n_descsz > 0 && note->n_descsz <= MAX_BUILD_ID) {
+            memcpy(m->build_id, p + name_size, note->n_descsz);
+            m->build_id_size = note->n_descsz;
+            return;
+        }
+        p += name_size + desc_size;
+    }
+}
+
+/*
+ * find the DWARF sections and the build-id
+ * returns the symbol table to load, .symtab or else .dynsym, or NULL
+ */
+static const Elf64_Shdr *find_sections(module_t *m) {
+    const Elf64_Ehdr *ehdr = (const Elf64_Ehdr*)m->map;
+    if (ehdr->e_shentsize != sizeof(Elf64_Shdr) ||
+        !in_file(m, ehdr->e_shoff, (uint64_t)ehdr->e_shnum * sizeof(Elf64_Shdr))) {
+        return NULL;
+    }
+
+    const Elf64_Shdr *shdrs = (const Elf64_Shdr*)(m->map + ehdr->e_shoff);
+    size_t count = ehdr->e_shnum;
+    if (ehdr->e_shstrndx >= count) return NULL;
+
+    const Elf64_Shdr *names_hdr = &shdrs[ehdr->e_shstrndx];
+    if (!in_file(m, names_hdr->sh_offset, names_hdr->sh_size)) return NULL;
+    const char *names = (const char*)(m->map + names_hdr->sh_offset);
+
+    const struct { const char *name; section_t *section; } wanted[] = {
+        { ".debug_info", &m->dwarf.info },
+        { ".debug_abbrev", &m->dwarf.abbrev },
+        { ".debug_line", &m->dwarf.line },
+        { ".debug_str", &m->dwarf.str },
+        { ".debug_line_str", &m->dwarf.line_str },
+        { ".debug_str_offsets", &m->dwarf.str_offsets },
+        { ".debug_addr", &m->dwarf.addr },
+        { ".debug_rnglists", &m->dwarf.rnglists },
+        { ".debug_ranges", &m->dwarf.ranges },
+    };
+
+    const Elf64_Shdr *symtab = NULL, *dynsym = NULL;
+    for (size_t i = 0; i < count; i++) {
+        const Elf64_Shdr *sh = &shdrs[i];
+        if (sh->sh_type == SHT_SYMTAB) symtab = sh;
+        if (sh->sh_type == SHT_DYNSYM) dynsym = sh;
+        if (sh->sh_name >= names_hdr->sh_size || sh->sh_type == SHT_NOBITS) continue;
+        if ((sh->sh_flags & SHF_COMPRESSED) || !in_file(m, sh->sh_offset, sh->sh_size)) continue;
+        if (sh->sh_type == SHT_NOTE && !m->build_id_size) read_build_id(m, sh);
+
+        for (size_t w = 0; w < sizeof(wanted) / sizeof(wanted[0]); w++) {
+            if (strcmp(names + sh->sh_name, wanted[w].name) == 0) {
+                wanted[w].section->data = m->map + sh->sh_offset;
+                wanted[w].section->size = sh->sh_size;
+            }
+        }
+    }
+
+    // a stripped module still has its exported functions
+    const Elf64_Shdr *syms = symtab ? symtab : dynsym;
+    return syms && syms->sh_link < count ? syms : NULL;
+}
+
+/*
+ * map path and build its tables, or load them from the cache
+ * never returns NULL for a valid path argument: a module that cannot be
+ * read is returned with usable = 0, so it is only tried once.
+ */
+module_t *module_open(const char *path) {
+    module_t *m = calloc(1, sizeof(module_t));
+    if (!m) return NULL;
+    m->path = strdup(path);
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return m;
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(Elf64_Ehdr)) {
+        void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            m->map = map;
+            m->map_size = st.st_size;
+        }
+    }
+    close(fd);
+    if (!m->map) return m;
+
+    const Elf64_Ehdr *ehdr = (const Elf64_Ehdr*)m->map;
+    if (memcmp(ehdr->e_ident, ELFMAG, SELFMAG) != 0 ||
+        ehdr->e_ident[EI_CLASS] != ELFCLASS64 || ehdr->e_ident[EI_DATA] != ELFDATA2LSB) {
+        fprintf(stderr, "profiler-symbolize: %s: not an ELF64 little-endian file\n", path);
+        return m;
+    }
+
+    const Elf64_Shdr *syms = find_sections(m);
+    m->usable = 1;
+    if (cache_load(m)) return m;
+
+    if (syms) {
+        const Elf64_Shdr *shdrs = (const Elf64_Shdr*)(m->map + ehdr->e_shoff);
+        load_symbols(m, syms, &shdrs[syms->sh_link]);
+    }
+    dwarf_load(m);
+
+    // the pool is complete, its index is not needed any more
+    free(m->pool_index);
+    m->pool_index = NULL;
+    m->pool_index_capacity = m->pool_index_count = 0;
+
+    cache_store(m);
+    return m;
+}
+
+static uint32_t string_hash(const char *s, size_t len) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ (unsigned char)s[i]) * 16777619u;
+    }
+    return h;
+}
+
+static int pool_index_grow(module_t *m) {
+    size_t capacity = m->pool_index_capacity ? m->pool_index_capacity * 2 : 1024;
+    string_id_t *index = calloc(capacity, sizeof(string_id_t));
+    if (!index) return 0;
+
+    for (size_t i = 0; i < m->pool_index_capacity; i++) {
+        string_id_t id = m->pool_index[i];
+        if (!id) continue;
+        const char *s = m->pool + id;
+        size_t j = string_hash(s, strlen(s)) & (capacity - 1);
+        while (index[j]) j = (j + 1) & (capacity - 1);
+        index[j] = id;
+    }
+    free(m->pool_index);
+    m->pool_index = index;
+    m->pool_index_capacity = capacity;
+    return 1;
+}
+
+/*
+ * the id of s in the module's string pool, added if it is not there yet
+ * returns 0 for NULL, or if the pool cannot grow
+ */
+string_id_t module_intern(module_t *m, const char *s) {
+    if (!s) return 0;
+    size_t len = strlen(s);
+
+    if ((m->pool_index_count + 1) * 2 > m->pool_index_capacity && !pool_index_grow(m)) return 0;
+    size_t i = string_hash(s, len) & (m->pool_index_capacity - 1);
+    for (; m->pool_index[i]; i = (i + 1) & (m->pool_index_capacity - 1)) {
+        if (strcmp(m->pool + m->pool_index[i], s) == 0) return m->pool_index[i];
+    }
+
+    // offset 0 stands for no string, the pool starts with an unused NUL
+    size_t needed = (m->pool_size ? m->pool_size : 1) + len + 1;
+    if (needed > UINT32_MAX) return 0;
+    if (needed > m->pool_capacity) {
+        size_t capacity = m->pool_capacity ? m->pool_capacity * 2 : 4096;
+        while (capacity < needed) capacity *= 2;
+        char *pool = realloc(m->pool, capacity);
+        if (!pool) return 0;
+        m->pool = pool;
+        m->pool_capacity = capacity;
+    }
+    if (!m->pool_size) m->pool[m->pool_size++] = '\0';
+
+    string_id_t id = (string_id_t)m->pool_size;
+    memcpy(m->pool + id, s, len + 1);
+    m->pool_size += len + 1;
+    m->pool_index[i] = id;
+    m->pool_index_count++;
+    return id;
+}
+
+void module_close(module_t *m) {
+    if (!m) return;
+    if (m->map) munmap((void*)m->map, m->map_size);
+    if (m->cache_map) {
+        munmap((void*)m->cache_map, m->cache_size);
+    } else {
+        free(m->symbols);
+        free(m->rows);
+        free(m->funcs);
+        free(m->inlines);
+        free(m->pool);
+    }
+    free(m->pool_index);
+    free(m->path);
+    free(m);
+}
+
+/*
+ * the function symbol nearest below addr, or NULL
+ * sizes are not checked: like addr2line, the padding after a function and
+ * symbols without a size (hand-written assembly) belong to the one before.
+ */
+const elf_symbol_t *module_symbol(const module_t *m, uint64_t addr) {
+    size_t lo = 0, hi = m->symbol_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (m->symbols[mid].addr <= addr) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo ? &m->symbols[lo - 1] : NULL;
+}
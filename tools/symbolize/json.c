@@ -0,0 +1,393 @@
+/*
+ * JSON side of the symbolizer - one profiler event per line
+ *
+ * events are flat objects plus a "frames" array of flat objects, so this
+ * is not a general parser: top-level scalars become fields, frames are
+ * decoded into json_frame_t, and any other nested value is skipped.
+ * strings are unescaped in place, in a copy of the line; a line that is
+ * not a JSON object is left untouched for the caller to print.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include "symbolize.h"
+
+typedef struct {
+    char *p;
+    json_event_t *event;
+} parser_t;
+
+static void skip_ws(parser_t *ps) {
+    while (*ps->p == ' ' || *ps->p == '\t' || *ps->p == '\r' || *ps->p == '\n') ps->p++;
+}
+
+static int hex_digit(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+static int read_hex4(const char *s, unsigned int *out) {
+    unsigned int v = 0;
+    for (int i = 0; i < 4; i++) {
+        int d = hex_digit(s[i]);
+        if (d < 0) return 0;
+        v = v * 16 + (unsigned int)d;
+    }
+    *out = v;
+    return 1;
+}
+
+static char *put_utf8(char *dst, unsigned int c) {
+    if (c < 0x80) {
+        *dst++ = (char)c;
+    } else if (c < 0x800) {
+        *dst++ = (char)(0xc0 | (c >> 6));
+        *dst++ = (char)(0x80 | (c & 0x3f));
+    } else if (c < 0x10000) {
+        *dst++ = (char)(0xe0 | (c >> 12));
+        *dst++ = (char)(0x80 | ((c >> 6) & 0x3f));
+        *dst++ = (char)(0x80 | (c & 0x3f));
+    } else {
+        *dst++ = (char)(0xf0 | (c >> 18));
+        *dst++ = (char)(0x80 | ((c >> 12) & 0x3f));
+        *dst++ = (char)(0x80 | ((c >> 6) & 0x3f));
+        *dst++ = (char)(0x80 | (c & 0x3f));
+    }
+    return dst;
+}
+
+/*
+ * string at ps->p, unescaped in place and NUL-terminated
+ * the decoded string is never longer than its source
+ */
+static char *parse_string(parser_t *ps) {
+    if (*ps->p != '"') return NULL;
+    char *src = ps->p + 1;
+    char *start = src, *dst = src;
+
+    for (;;) {
+        char c = *src++;
+        if (c == '\0' || (unsigned char)c < 0x20) return NULL;
+        if (c == '"') break;
+        if (c != '\\') {
+            *dst++ = c;
+            continue;
+        }
+
+        unsigned int code;
+        switch (*src++) {
+        case '"': *dst++ = '"'; break;
+        case '\\': *dst++ = '\\'; break;
+        case '/': *dst++ = '/'; break;
+        case 'b': *dst++ = '\b'; break;
+        case 'f': *dst++ = '\f'; break;
+        case 'n': *dst++ = '\n'; break;
+        case 'r': *dst++ = '\r'; break;
+        case 't': *dst++ = '\t'; break;
+        case 'u':
+            if (!read_hex4(src, &code)) return NULL;
+            src += 4;
+            if (code >= 0xd800 && code < 0xdc00 && src[0] == '\\' && src[1] == 'u') {
+                unsigned int low;
+                if (read_hex4(src + 2, &low) && low >= 0xdc00 && low < 0xe000) {
+                    code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+                    src += 6;
+                }
+            }
+            dst = put_utf8(dst, code);
+            break;
+        default:
+            return NULL;
+        }
+    }
+
+    *dst = '\0';
+    ps->p = src;
+    return start;
+}
+
+// numbers are kept as written, copied out so the delimiter survives
+static const char *parse_number(parser_t *ps) {
+    char *start = ps->p;
+    if (*ps->p == '-') ps->p++;
+    if (*ps->p < '0' || *ps->p > '9') return NULL;
+    while ((*ps->p >= '0' && *ps->p <= '9') || *ps->p == '.' || *ps->p == 'e' ||
+           *ps->p == 'E' || *ps->p == '+' || *ps->p == '-') {
+        ps->p++;
+    }
+
+    json_event_t *e = ps->event;
+    size_t len = (size_t)(ps->p - start);
+    if (e->scratch_used + len + 1 > sizeof(e->scratch)) return NULL;
+    char *copy = e->scratch + e->scratch_used;
+    memcpy(copy, start, len);
+    copy[len] = '\0';
+    e->scratch_used += len + 1;
+    return copy;
+}
+
+static int parse_literal(parser_t *ps, const char *word) {
+    size_t len = strlen(word);
+    if (strncmp(ps->p, word, len) != 0) return 0;
+    ps->p += len;
+    return 1;
+}
+
+/*
+ * a scalar value, or any value skipped (JSON_OTHER)
+ * returns 0 on a syntax error
+ */
+static int parse_value(parser_t *ps, json_type_t *type, const char **value);
+
+static int skip_container(parser_t *ps, char open, char close) {
+    ps->p++;
+    skip_ws(ps);
+    if (*ps->p == close) {
+        ps->p++;
+        return 1;
+    }
+    for (;;) {
+        json_type_t type;
+        const char *value;
+        if (open == '{') {
+            if (!parse_string(ps)) return 0;
+            skip_ws(ps);
+            if (*ps->p++ != ':') return 0;
+            skip_ws(ps);
+        }
+        if (!parse_value(ps, &type, &value)) return 0;
+        skip_ws(ps);
+        if (*ps->p == ',') {
+            ps->p++;
+            skip_ws(ps);
+            continue;
+        }
+        if (*ps->p == close) {
+            ps->p++;
+            return 1;
+        }
+        return 0;
+    }
+}
+
+static int parse_value(parser_t *ps, json_type_t *type, const char **value) {
+    *value = NULL;
+    switch (*ps->p) {
+    case '"':
+        *type = JSON_STRING;
+        *value = parse_string(ps);
+        return *value != NULL;
+    case '{':
+        *type = JSON_OTHER;
+        return skip_container(ps, '{', '}');
+    case '[':
+        *type = JSON_OTHER;
+        return skip_container(ps, '[', ']');
+    case 't':
+        *type = JSON_TRUE;
+        *value = "true";
+        return parse_literal(ps, "true");
+    case 'f':
+        *type = JSON_FALSE;
+        *value = "false";
+        return parse_literal(ps, "false");
+    case 'n':
+        *type = JSON_NULL;
+        *value = "null";
+        return parse_literal(ps, "null");
+    default:
+        *type = JSON_NUMBER;
+        *value = parse_number(ps);
+        return *value != NULL;
+    }
+}
+
+static json_frame_t *new_frame(json_event_t *e) {
+    if (e->frame_count == e->frame_capacity) {
+        size_t capacity = e->frame_capacity ? e->frame_capacity * 2 : 32;
+        json_frame_t *frames = realloc(e->frames, capacity * sizeof(json_frame_t));
+        if (!frames) return NULL;
+        e->frames = frames;
+        e->frame_capacity = capacity;
+    }
+    json_frame_t *f = &e->frames[e->frame_count++];
+    memset(f, 0, sizeof(*f));
+    return f;
+}
+
+// {"addr":"0x...","bin":"libfoo.so","mod":3,"off":"0x1139"}
+static int parse_frame(parser_t *ps, json_frame_t *f) {
+    ps->p++;
+    skip_ws(ps);
+    if (*ps->p == '}') {
+        ps->p++;
+        return 1;
+    }
+    for (;;) {
+        const char *key = parse_string(ps);
+        if (!key) return 0;
+        skip_ws(ps);
+        if (*ps->p++ != ':') return 0;
+        skip_ws(ps);
+
+        json_type_t type;
+        const char *value;
+        if (!parse_value(ps, &type, &value)) return 0;
+        if (type == JSON_STRING && strcmp(key, "addr") == 0) f->addr = value;
+        else if (type == JSON_STRING && strcmp(key, "bin") == 0) f->bin = value;
+        else if (type == JSON_STRING && strcmp(key, "off") == 0) f->off = value;
+        else if (type == JSON_NUMBER && strcmp(key, "mod") == 0) {
+            f->mod = strtol(value, NULL, 10);
+            f->has_mod = 1;
+        }
+
+        skip_ws(ps);
+        if (*ps->p == ',') {
+            ps->p++;
+            skip_ws(ps);
+            continue;
+        }
+        if (*ps->p == '}') {
+            ps->p++;
+            return 1;
+        }
+        return 0;
+    }
+}
+
+static int parse_frames(parser_t *ps) {
+    json_event_t *e = ps->event;
+    e->has_frames = 1;
+    e->frame_count = 0;
+
+    ps->p++;
+    skip_ws(ps);
+    if (*ps->p == ']') {
+        ps->p++;
+        return 1;
+    }
+    for (;;) {
+        if (*ps->p == '{') {
+            json_frame_t *f = new_frame(e);
+            if (!f || !parse_frame(ps, f)) return 0;
+        } else if (*ps->p == '"') {
+            // a bare address, from before frames were objects
+            json_frame_t *f = new_frame(e);
+            if (!f || !(f->addr = parse_string(ps))) return 0;
+        } else {
+            json_type_t type;
+            const char *value;
+            if (!parse_value(ps, &type, &value)) return 0;
+        }
+
+        skip_ws(ps);
+        if (*ps->p == ',') {
+            ps->p++;
+            skip_ws(ps);
+            continue;
+        }
+        if (*ps->p == ']') {
+            ps->p++;
+            return 1;
+        }
+        return 0;
+    }
+}
+
+/*
+ * parse line into event
+ * returns 1 if line holds a JSON object, 0 otherwise (line is unchanged)
+ */
+int json_parse_event(const char *line, json_event_t *e) {
+    size_t len = strlen(line);
+    if (len + 1 > e->buffer_size) {
+        char *buffer = realloc(e->buffer, len + 1);
+        if (!buffer) return 0;
+        e->buffer = buffer;
+        e->buffer_size = len + 1;
+    }
+    memcpy(e->buffer, line, len + 1);
+
+    e->field_count = 0;
+    e->has_frames = 0;
+    e->frame_count = 0;
+    e->scratch_used = 0;
+
+    parser_t ps = { e->buffer, e };
+    skip_ws(&ps);
+    if (*ps.p != '{') return 0;
+    ps.p++;
+    skip_ws(&ps);
+
+    if (*ps.p == '}') {
+        ps.p++;
+    } else {
+        for (;;) {
+            const char *key = parse_string(&ps);
+            if (!key) return 0;
+            skip_ws(&ps);
+            if (*ps.p++ != ':') return 0;
+            skip_ws(&ps);
+
+            if (strcmp(key, "frames") == 0 && *ps.p == '[') {
+                if (!parse_frames(&ps)) return 0;
+            } else {
+                json_type_t type;
+                const char *value;
+                if (!parse_value(&ps, &type, &value)) return 0;
+                if (e->field_count < EVENT_MAX_FIELDS) {
+                    json_field_t *field = &e->fields[e->field_count++];
+                    field->key = key;
+                    field->type = type;
+                    field->value = value;
+                }
+            }
+
+            skip_ws(&ps);
+            if (*ps.p == ',') {
+                ps.p++;
+                skip_ws(&ps);
+                continue;
+            }
+            if (*ps.p++ != '}') return 0;
+            break;
+        }
+    }
+
+    skip_ws(&ps);
+    return *ps.p == '\0';
+}
+
+const json_field_t *json_get(const json_event_t *e, const char *key) {
+    // the last one wins, as in most parsers
+    for (size_t i = e->field_count; i > 0; i--) {
+        if (strcmp(e->fields[i - 1].key, key) == 0) return &e->fields[i - 1];
+    }
+    return NULL;
+}
+
+const char *json_str(const json_event_t *e, const char *key, const char *fallback) {
+    const json_field_t *f = json_get(e, key);
+    return f && f->value && f->type != JSON_NULL ? f->value : fallback;
+}
+
+// the value of key is set and not false, 0, "" or null
+int json_truthy(const json_event_t *e, const char *key) {
+    const json_field_t *f = json_get(e, key);
+    if (!f) return 0;
+    switch (f->type) {
+    case JSON_STRING: return f->value[0] != '\0';
+    case JSON_NUMBER: return strtod(f->value, NULL) != 0;
+    case JSON_TRUE: return 1;
+    case JSON_OTHER: return 1;
+    default: return 0;
+    }
+}
+
+long long json_int(const json_event_t *e, const char *key) {
+    const json_field_t *f = json_get(e, key);
+    return f && f->type == JSON_NUMBER ? strtoll(f->value, NULL, 10) : 0;
+}
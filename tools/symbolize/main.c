@@ -0,0 +1,538 @@
+/*
+ * profiler-symbolize - native replacement for tools/resolve_symbols.py
+ *
+ * usage: profiler-symbolize [-f] [-i] <profiler_output|-> <binary>
+ *
+ *   -f  name the function of each resolved frame
+ *   -i  expand inlined calls: one line per level, innermost first
+ *
+ * prints the same report as resolve_symbols.py, PROFILER_FULL_STACK
+ * included, for the same input: JSON Lines from the profiler, frames as
+ * module id and offset (or bare addresses in the target binary, from
+ * older reports). the ELF file of a module is mapped and its tables are
+ * built once, on its first frame (see elf.c and dwarf.c), or taken from
+ * the cache of an earlier run (cache.c); after that a
+ * new frame costs a few binary searches and a repeated one a hash lookup,
+ * so output is symbolized as it is read, which also works on a live stream.
+ *
+ * reading a FIFO or a pipe (tools/run_profiler.sh --stream), each event is
+ * printed as soon as it is resolved. the profiler blocks while the pipe is
+ * full, so a slow symbolizer holds the program back instead of losing events.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "symbolize.h"
+
+// System libraries to filter out in default mode (as resolve_symbols.py)
+static const char *const SYSTEM_LIBRARIES[] = {
+    "libc.so",
+    "libc-",           // libc-2.31.so, etc.
+    "libpthread.so",
+    "libpthread-",
+    "ld-linux",        // dynamic linker
+    "libdl.so",
+    "libm.so",
+    "libprofiler.so",  // our own profiler
+};
+
+// module ids above this are ignored; the profiler numbers them from 1
+#define MAX_MODULE_ID 65536
+
+static int g_full_stack = 0;
+static int g_functions = 0;
+static int g_inlines = 0;
+static int g_live = 0;          // input is a stream: flush after every event
+
+// every ELF file opened so far, by path
+static module_t **g_files = NULL;
+static size_t g_file_count = 0;
+static size_t g_file_capacity = 0;
+
+// modules of the report, by id, from "module" and "unloaded_module" events
+typedef struct {
+    char *path;
+    const char *name;           // base name of path
+    int system;                 // a system library, resolved in full-stack mode only
+    module_t *file;             // opened on its first frame
+    int unloaded;               // once set, stays set (as in resolve_symbols.py)
+} report_module_t;
+
+static report_module_t *g_modules = NULL;
+static size_t g_module_slots = 0;
+
+static int is_system_library(const char *name) {
+    for (size_t i = 0; i < sizeof(SYSTEM_LIBRARIES) / sizeof(SYSTEM_LIBRARIES[0]); i++) {
+        if (strstr(name, SYSTEM_LIBRARIES[i])) return 1;
+    }
+    return 0;
+}
+
+static const char *base_name(const char *path) {
+    const char *slash = strrchr(path, '/');
+    return slash ? slash + 1 : path;
+}
+
+static module_t *open_file(const char *path) {
+    for (size_t i = 0; i < g_file_count; i++) {
+        if (strcmp(g_files[i]->path, path) == 0) return g_files[i];
+    }
+    if (g_file_count == g_file_capacity) {
+        size_t capacity = g_file_capacity ? g_file_capacity * 2 : 16;
+        module_t **files = realloc(g_files, capacity * sizeof(module_t*));
+        if (!files) return NULL;
+        g_files = files;
+        g_file_capacity = capacity;
+    }
+    module_t *m = module_open(path);
+    if (m) g_files[g_file_count++] = m;
+    return m;
+}
+
+static report_module_t *report_module(long id, int create) {
+    if (id < 0 || id >= MAX_MODULE_ID) return NULL;
+    if ((size_t)id >= g_module_slots) {
+        if (!create) return NULL;
+        size_t slots = g_module_slots ? g_module_slots : 64;
+        while (slots <= (size_t)id) slots *= 2;
+        report_module_t *modules = realloc(g_modules, slots * sizeof(report_module_t));
+        if (!modules) return NULL;
+        memset(modules + g_module_slots, 0, (slots - g_module_slots) * sizeof(report_module_t));
+        g_modules = modules;
+        g_module_slots = slots;
+    }
+    report_module_t *rm = &g_modules[id];
+    return create || rm->path ? rm : NULL;
+}
+
+static void define_module(const json_event_t *e, int unloaded) {
+    const json_field_t *id = json_get(e, "id");
+    if (!id || id->type != JSON_NUMBER) return;
+    report_module_t *rm = report_module(strtol(id->value, NULL, 10), 1);
+    if (!rm) return;
+
+    const char *path = json_str(e, "path", "");
+    if (!rm->path || strcmp(rm->path, path) != 0) {
+        free(rm->path);
+        rm->path = strdup(path);
+        rm->name = rm->path ? base_name(rm->path) : "";
+        rm->system = is_system_library(rm->name);
+        rm->file = NULL;
+    }
+    if (unloaded) rm->unloaded = 1;
+}
+
+// the lines printed for a resolved frame, malloc()ed
+
+static char *format_locations(const location_t *loc, int count) {
+    char *text = NULL;
+    size_t size = 0;
+    FILE *out = open_memstream(&text, &size);
+    if (!out) return NULL;
+
+    int levels = g_inlines ? count : 1;
+    for (int i = 0; i < levels; i++) {
+        fprintf(out, "  %sat: %s; line: ", g_full_stack ? "[USR] " : "", loc[i].file ? loc[i].file : "??");
+        if (loc[i].line) fprintf(out, "%u", loc[i].line);
+        else fputs("?", out);
+        if (loc[i].discriminator) fprintf(out, " (discriminator %u)", loc[i].discriminator);
+        if (g_functions && loc[i].function) fprintf(out, " in %s", loc[i].function);
+        if (i < levels - 1) fputs(" (inlined)", out);
+        fputc('\n', out);
+    }
+    fclose(out);
+    return text;
+}
+
+/*
+ * resolved frames, by file and address
+ * a big report repeats the same few thousand stacks, so each unique frame
+ * is looked up and formatted once; "" for an address that does not resolve
+ */
+typedef struct {
+    const module_t *file;
+    uint64_t addr;
+    char *text;
+} frame_entry_t;
+
+static frame_entry_t *g_frames = NULL;
+static size_t g_frame_slots = 0;
+static size_t g_frame_count = 0;
+
+static size_t frame_slot(const module_t *file, uint64_t addr) {
+    uint64_t h = (addr ^ (uint64_t)(uintptr_t)file) * 0x9e3779b97f4a7c15ULL;
+    return (size_t)(h >> 32) & (g_frame_slots - 1);
+}
+
+static int grow_frames(void) {
+    size_t slots = g_frame_slots ? g_frame_slots * 2 : 4096;
+    frame_entry_t *old = g_frames;
+    size_t old_slots = g_frame_slots;
+
+    g_frames = calloc(slots, sizeof(frame_entry_t));
+    if (!g_frames) {
+        g_frames = old;
+        return 0;
+    }
+    g_frame_slots = slots;
+    for (size_t i = 0; i < old_slots; i++) {
+        if (!old[i].text) continue;
+        size_t j = frame_slot(old[i].file, old[i].addr);
+        while (g_frames[j].text) j = (j + 1) & (slots - 1);
+        g_frames[j] = old[i];
+    }
+    free(old);
+    return 1;
+}
+
+/*
+ * the text of a frame in file, from the cache or resolved now
+ * returns NULL if the address does not resolve (or on allocation failure)
+ */
+static const char *resolve_text(module_t *file, const char *addr) {
+    if (!file || !file->usable || !addr) return NULL;
+    uint64_t address = strtoull(addr, NULL, 16);
+
+    if (g_frame_count * 2 >= g_frame_slots && !grow_frames()) return NULL;
+    size_t i = frame_slot(file, address);
+    while (g_frames[i].text) {
+        if (g_frames[i].file == file && g_frames[i].addr == address) {
+            return g_frames[i].text[0] ? g_frames[i].text : NULL;
+        }
+        i = (i + 1) & (g_frame_slots - 1);
+    }
+
+    location_t loc[MAX_INLINE_DEPTH];
+    int count = dwarf_lookup(file, address, loc, MAX_INLINE_DEPTH);
+    char *text = count > 0 && loc[0].file ? format_locations(loc, count) : strdup("");
+    if (!text) return NULL;
+
+    g_frames[i].file = file;
+    g_frames[i].addr = address;
+    g_frames[i].text = text;
+    g_frame_count++;
+    return text[0] ? text : NULL;
+}
+
+// text with suffix at the end of every line
+static void print_text(const char *text, const char *suffix) {
+    if (!suffix) {
+        fputs(text, stdout);
+        return;
+    }
+    for (const char *end; (end = strchr(text, '\n')); text = end + 1) {
+        fwrite(text, 1, (size_t)(end - text), stdout);
+        printf("%s\n", suffix);
+    }
+}
+
+/*
+ * a frame given as {"addr":...,"bin":...,"mod":3,"off":"0x1139"}
+ * the offset is relative to the module's load base, which is what the
+ * tables of a PIE executable or shared library are keyed by
+ */
+static void print_module_frame(const json_frame_t *f, report_module_t *rm, const char *target_name) {
+    const char *binary_name = rm->name;
+    int is_system = rm->system;
+    const char *off = f->off ? f->off : "?";
+
+    // In default mode, skip system library frames
+    if (!g_full_stack && is_system) return;
+
+    const char *text = NULL;
+    if (!is_system) {
+        if (!rm->file) rm->file = open_file(rm->path);
+        text = resolve_text(rm->file, f->off);
+    }
+
+    if (text && rm->unloaded) {
+        char suffix[512];
+        snprintf(suffix, sizeof(suffix), " (%s, unloaded)", binary_name);
+        print_text(text, suffix);
+    } else if (text) {
+        print_text(text, NULL);
+    } else if (g_full_stack) {
+        if (is_system) {
+            printf("  [SYS] <%s+%s>\n", binary_name, off);
+        } else if (strcmp(binary_name, target_name) == 0) {
+            // Unresolved frame in user binary = C runtime startup
+            printf("  [CRT] <%s+%s>\n", binary_name, off);
+        } else {
+            printf("  [???] <%s+%s>\n", binary_name, off);
+        }
+    }
+}
+
+static void print_event_with_frames(const json_event_t *e, const char *target_binary,
+                                    const char *target_name) {
+    const char *type = json_str(e, "type", "Unknown");
+    const char *addr = json_str(e, "addr", "?");
+
+    // Print event-specific header
+    if (strcmp(type, "leak") == 0) {
+        char details[512] = "";
+        size_t len = 0;
+        if (json_truthy(e, "kind")) {
+            len += snprintf(details + len, sizeof(details) - len, "%soperator %s",
+                            len ? ", " : "", json_str(e, "kind", ""));
+        }
+        if (json_truthy(e, "align") && len < sizeof(details)) {
+            len += snprintf(details + len, sizeof(details) - len, "%saligned to %s",
+                            len ? ", " : "", json_str(e, "align", ""));
+        }
+        if (json_truthy(e, "unloaded") && len < sizeof(details)) {
+            len += snprintf(details + len, sizeof(details) - len, "%sallocated by an unloaded module",
+                            len ? ", " : "");
+        }
+        if (len) printf("[LEAK] %s: %s bytes (%s)\n", addr, json_str(e, "size", "0"), details);
+        else printf("[LEAK] %s: %s bytes\n", addr, json_str(e, "size", "0"));
+    } else if (strcmp(type, "mmap_leak") == 0) {
+        if (json_truthy(e, "released")) {
+            printf("[MMAP] %s: %s bytes (%s bytes released with MADV_DONTNEED)\n",
+                   addr, json_str(e, "size", "0"), json_str(e, "released", "0"));
+        } else {
+            printf("[MMAP] %s: %s bytes\n", addr, json_str(e, "size", "0"));
+        }
+    } else if (strcmp(type, "corruption_summary") == 0) {
+        printf("[CORRUPTION] %s at %s: %s occurrence(s), %s not shown individually\n",
+               json_str(e, "error", "Unknown"), addr, json_str(e, "count", "0"),
+               json_str(e, "suppressed", "0"));
+    } else {
+        // All other types are errors/corruption
+        printf("[CORRUPTION] %s at %s\n", type, addr);
+    }
+
+    for (size_t i = 0; i < e->frame_count; i++) {
+        const json_frame_t *f = &e->frames[i];
+
+        // module-relative frame: resolve its offset in the module's file
+        report_module_t *rm = f->has_mod ? report_module(f->mod, 0) : NULL;
+        if (rm) {
+            print_module_frame(f, rm, target_name);
+            continue;
+        }
+
+        const char *frame_addr = f->addr ? f->addr : "?";
+        const char *binary_name = f->bin ? f->bin : "unknown";
+        int is_user_code = strcmp(binary_name, target_name) == 0;
+        int is_system = is_system_library(binary_name);
+
+        // In default mode, skip system library frames
+        if (!g_full_stack && is_system) continue;
+
+        // bare address in the target binary
+        if (is_user_code) {
+            const char *text = resolve_text(open_file(target_binary), frame_addr);
+            if (text) {
+                print_text(text, NULL);
+                continue;
+            }
+        }
+
+        // Unresolved or system library frame
+        if (g_full_stack) {
+            if (is_system) {
+                printf("  [SYS] <%s+%s>\n", binary_name, frame_addr);
+            } else if (is_user_code) {
+                // Unresolved frame in user binary = C runtime startup
+                printf("  [CRT] <%s+%s>\n", binary_name, frame_addr);
+            } else {
+                printf("  [???] <%s+%s>\n", binary_name, frame_addr);
+            }
+        }
+    }
+
+    // Print empty line after stack
+    printf("\n");
+}
+
+static void print_summary(const json_event_t *e, long long corruption_count) {
+    // several processes (fork, exec) can share one output
+    const json_field_t *pid = json_get(e, "pid");
+    if (pid && pid->type != JSON_NULL) printf("Summary (pid %s):\n", pid->value ? pid->value : "?");
+    else printf("Summary:\n");
+
+    printf("  Real leaks: %s allocation(s), %s bytes\n",
+           json_str(e, "real_leaks", "0"), json_str(e, "real_bytes", "0"));
+    if (json_int(e, "aligned_leaks") > 0) {
+        printf("    of which aligned: %s allocation(s), %s bytes\n",
+               json_str(e, "aligned_leaks", "0"), json_str(e, "aligned_bytes", "0"));
+    }
+    if (json_int(e, "unloaded_leaks") > 0) {
+        printf("    of which from unloaded modules: %s allocation(s), %s bytes\n",
+               json_str(e, "unloaded_leaks", "0"), json_str(e, "unloaded_bytes", "0"));
+    }
+    if (json_int(e, "libc_leaks") > 0) {
+        printf("  Libc infrastructure: %s allocation(s), %s bytes (ignored)\n",
+               json_str(e, "libc_leaks", "0"), json_str(e, "libc_bytes", "0"));
+    }
+    if (json_int(e, "mmap_leaks") > 0) {
+        printf("  Unreleased mappings: %s mapping(s), %s bytes\n",
+               json_str(e, "mmap_leaks", "0"), json_str(e, "mmap_bytes", "0"));
+    }
+    if (json_get(e, "peak_total_bytes")) {
+        printf("  Peak memory: %s bytes (heap %s, mapped %s)\n",
+               json_str(e, "peak_total_bytes", "0"), json_str(e, "peak_heap_bytes", "0"),
+               json_str(e, "peak_mapped_bytes", "0"));
+    }
+    printf("  Free errors: %lld\n", corruption_count);
+    printf("==================================\n\n");
+}
+
+// Python's str.strip()
+static char *strip(char *line) {
+    while (*line == ' ' || (*line >= '\t' && *line <= '\r')) line++;
+    size_t len = strlen(line);
+    while (len && (line[len - 1] == ' ' || (line[len - 1] >= '\t' && line[len - 1] <= '\r'))) len--;
+    line[len] = '\0';
+    return line;
+}
+
+static void process_profiler_output(FILE *input, const char *target_binary) {
+    const char *target_name = base_name(target_binary);
+    long long corruption_count = 0;
+    int corruption_header_printed = 0;
+    int unloaded_header_printed = 0;
+
+    // Print mode indicator at the start
+    if (g_full_stack) {
+        printf("============================================================\n");
+        printf("PROFILER MODE: FULL SYSTEM STACK DUMP\n");
+        printf("(All frames including system libraries will be shown)\n");
+        printf("============================================================\n\n");
+    }
+
+    static json_event_t e;
+    char *raw = NULL;
+    size_t raw_size = 0;
+    while (getline(&raw, &raw_size, input) >= 0) {
+        char *line = strip(raw);
+
+        // Skip empty lines
+        if (!*line) continue;
+
+        if (!json_parse_event(line, &e)) {
+            // Not JSON - print as-is (handles non-JSON stderr output)
+            printf("%s\n", line);
+            if (g_live) fflush(stdout);
+            continue;
+        }
+
+        const char *type = json_str(&e, "type", "");
+
+        if (e.has_frames && strcmp(type, "leak") != 0 && strcmp(type, "mmap_leak") != 0) {
+            // corruption event: header on the first one
+            if (!corruption_header_printed) {
+                printf("\n========== DOUBLE/INVALID FREE ERRORS ==========\n\n");
+                corruption_header_printed = 1;
+            }
+            // (a summary stands for every occurrence not printed before it)
+            print_event_with_frames(&e, target_binary, target_name);
+            if (strcmp(type, "corruption_summary") == 0) corruption_count += json_int(&e, "new");
+            else corruption_count++;
+
+        } else if (e.has_frames) {
+            print_event_with_frames(&e, target_binary, target_name);
+
+        } else if (strcmp(type, "mmap_header") == 0) {
+            printf("\n========== UNRELEASED MAPPINGS ==========\n");
+            printf("Found %s mapping(s), %s bytes total\n\n",
+                   json_str(&e, "mappings_count", "0"), json_str(&e, "total_bytes", "0"));
+
+        } else if (strcmp(type, "module") == 0) {
+            define_module(&e, json_truthy(&e, "unloaded"));
+
+        } else if (strcmp(type, "unloaded_module") == 0) {
+            define_module(&e, 1);
+            if (!unloaded_header_printed) {
+                printf("\n========== LEAKS FROM UNLOADED MODULES ==========\n");
+                unloaded_header_printed = 1;
+            }
+            const char *build_id = json_str(&e, "build_id", "");
+            printf("%s (build-id %s, was loaded at %s): %s leak(s), %s bytes\n",
+                   json_str(&e, "path", ""), *build_id ? build_id : "none", json_str(&e, "base", "?"),
+                   json_str(&e, "leaks", "0"), json_str(&e, "bytes", "0"));
+
+        } else if (strcmp(type, "header") == 0) {
+            printf("\n========== MEMORY LEAKS ==========\n");
+            printf("Found %s leak(s), %s bytes total\n\n",
+                   json_str(&e, "leaks_count", "0"), json_str(&e, "total_bytes", "0"));
+
+        } else if (strcmp(type, "summary") == 0) {
+            print_summary(&e, corruption_count);
+            corruption_count = 0;
+            corruption_header_printed = 0;
+            unloaded_header_printed = 0;
+
+        } else if (strcmp(type, "profiler_state") == 0) {
+            // Dormant mode switch: {"type":"profiler_state","state":"active","generation":1}
+            if (strcmp(json_str(&e, "state", ""), "active") == 0) {
+                printf("[PROFILER] tracking active (generation %s)\n", json_str(&e, "generation", "0"));
+            } else {
+                printf("[PROFILER] tracking dormant\n");
+            }
+
+        } else {
+            // Any other type is treated as a corruption event
+            print_event_with_frames(&e, target_binary, target_name);
+        }
+        if (g_live) fflush(stdout);
+    }
+    free(raw);
+}
+
+static void usage(void) {
+    fprintf(stderr, "Usage: profiler-symbolize [-f] [-i] <profiler_output.txt> <binary_path>\n");
+    fprintf(stderr, "   or: profiler-symbolize [-f] [-i] - <binary_path>  (read from stdin)\n");
+}
+
+int main(int argc, char **argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "fih")) != -1) {
+        switch (opt) {
+        case 'f': g_functions = 1; break;
+        case 'i': g_inlines = 1; break;
+        default:
+            usage();
+            return 1;
+        }
+    }
+    if (argc - optind < 2) {
+        usage();
+        return 1;
+    }
+
+    const char *output_file = argv[optind];
+    const char *binary_path = argv[optind + 1];
+
+    if (access(binary_path, F_OK) != 0) {
+        fprintf(stderr, "Error: Binary not found: %s\n", binary_path);
+        return 1;
+    }
+
+    const char *full = getenv("PROFILER_FULL_STACK");
+    g_full_stack = full && strcmp(full, "1") == 0;
+
+    FILE *input = stdin;
+    if (strcmp(output_file, "-") != 0) {
+        input = fopen(output_file, "r");
+        if (!input) {
+            perror(output_file);
+            return 1;
+        }
+    }
+    struct stat st;
+    g_live = fstat(fileno(input), &st) == 0 && !S_ISREG(st.st_mode);
+
+    process_profiler_output(input, binary_path);
+
+    if (input != stdin) fclose(input);
+    for (size_t i = 0; i < g_file_count; i++) {
+        module_close(g_files[i]);
+    }
+    return 0;
+}
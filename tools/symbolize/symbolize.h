@@ -0,0 +1,180 @@
+/*
+ * profiler-symbolize - shared declarations
+ *
+ * elf.c    maps a module, finds its sections and function symbols
+ * dwarf.c  builds the address tables from .debug_line and .debug_info
+ * cache.c  keeps the tables of a module on disk, by build-id
+ * json.c   parses one profiler event
+ * main.c   prints a report, the way tools/resolve_symbols.py does
+ *
+ * tools/profilerd.c uses the same tables and parser.
+ */
+
+#ifndef PROFILER_SYMBOLIZE_H
+#define PROFILER_SYMBOLIZE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * address tables of one module
+ * every table is sorted by address and searched with a binary search.
+ * addresses are link-time: a frame's "off" (its distance from the load
+ * base) is looked up as is.
+ *
+ * the tables hold no pointers: strings are offsets into the module's
+ * string pool (0 for none), so they can be written to the cache and
+ * used from its mapping as they are (see cache.c).
+ */
+typedef uint32_t string_id_t;
+
+// one row of the line-number program; rows of a sequence are contiguous
+// and each sequence ends with an end_sequence row at its end address
+typedef struct {
+    uint64_t addr;
+    string_id_t file;           // base name
+    uint32_t line;
+    uint32_t discriminator;
+    uint32_t end_sequence;
+} line_row_t;
+
+// a concrete function, one entry per address range
+typedef struct {
+    uint64_t low, high;
+    string_id_t name;
+    uint32_t first_inline;      // its inlined calls, in module->inlines
+    uint32_t inline_count;
+    uint32_t reserved;
+} func_range_t;
+
+// a call inlined into a function, in DIE order: parents before children
+typedef struct {
+    uint64_t low, high;
+    string_id_t name;           // the inlined function
+    string_id_t call_file;      // where it was inlined into its parent
+    uint32_t call_line;
+    uint32_t depth;             // 1 for calls inlined into the function itself
+} inline_range_t;
+
+// STT_FUNC from .symtab, or .dynsym for stripped modules
+typedef struct {
+    uint64_t addr, size;
+    string_id_t name;
+    string_id_t file;           // from the STT_FILE symbol before it, or 0
+} elf_symbol_t;
+
+typedef struct {
+    const unsigned char *data;
+    size_t size;
+} section_t;
+
+typedef struct {
+    section_t info, abbrev, line, str, line_str, str_offsets, addr, rnglists, ranges;
+} dwarf_sections_t;
+
+#define MAX_BUILD_ID 64
+
+typedef struct module {
+    char *path;
+    const unsigned char *map;
+    size_t map_size;
+    int usable;                 // mapped and parsed; 0 if the file is unreadable
+
+    unsigned char build_id[MAX_BUILD_ID];
+    size_t build_id_size;       // 0 if the module has no NT_GNU_BUILD_ID note
+    dwarf_sections_t dwarf;
+
+    // malloc()ed while built, in cache_map once loaded from the cache
+    elf_symbol_t *symbols;
+    size_t symbol_count;
+    line_row_t *rows;
+    size_t row_count;
+    func_range_t *funcs;
+    size_t func_count;
+    inline_range_t *inlines;
+    size_t inline_count;
+
+    // string pool: NUL-terminated strings, the first one at offset 1
+    char *pool;
+    size_t pool_size;
+    size_t pool_capacity;
+    string_id_t *pool_index;    // hash of the pool while it is built
+    size_t pool_index_capacity;
+    size_t pool_index_count;
+
+    const unsigned char *cache_map;
+    size_t cache_size;
+} module_t;
+
+// the string id refers to, NULL for 0 or an id out of the pool
+static inline const char *module_string(const module_t *m, string_id_t id) {
+    return id && id < m->pool_size ? m->pool + id : NULL;
+}
+
+// one level of a resolved frame, innermost first
+typedef struct {
+    const char *file;           // NULL if the address has no line information
+    unsigned int line;
+    unsigned int discriminator;
+    const char *function;       // NULL if unknown
+} location_t;
+
+// how many inline levels a frame can expand to
+#define MAX_INLINE_DEPTH 32
+
+// elf.c
+module_t *module_open(const char *path);
+void module_close(module_t *m);
+const elf_symbol_t *module_symbol(const module_t *m, uint64_t addr);
+string_id_t module_intern(module_t *m, const char *s);
+
+// cache.c
+int cache_load(module_t *m);
+void cache_store(const module_t *m);
+
+// dwarf.c
+void dwarf_load(module_t *m);
+int dwarf_lookup(const module_t *m, uint64_t addr, location_t *out, int max);
+char *demangle(const char *name);
+
+// json.c
+typedef enum { JSON_STRING, JSON_NUMBER, JSON_TRUE, JSON_FALSE, JSON_NULL, JSON_OTHER } json_type_t;
+
+typedef struct {
+    const char *key;
+    json_type_t type;
+    const char *value;          // strings unescaped, numbers as written
+} json_field_t;
+
+typedef struct {
+    const char *addr;           // NULL if absent
+    const char *bin;
+    const char *off;
+    long mod;
+    int has_mod;
+} json_frame_t;
+
+#define EVENT_MAX_FIELDS 64
+
+// reused from line to line; zero-initialize before the first one
+typedef struct {
+    json_field_t fields[EVENT_MAX_FIELDS];
+    size_t field_count;
+    int has_frames;
+    json_frame_t *frames;
+    size_t frame_count;
+    size_t frame_capacity;
+
+    char *buffer;               // the line, strings unescaped in place
+    size_t buffer_size;
+    char scratch[1024];         // numbers
+    size_t scratch_used;
+} json_event_t;
+
+int json_parse_event(const char *line, json_event_t *event);
+const json_field_t *json_get(const json_event_t *event, const char *key);
+const char *json_str(const json_event_t *event, const char *key, const char *fallback);
+int json_truthy(const json_event_t *event, const char *key);
+long long json_int(const json_event_t *event, const char *key);
+
+#endif
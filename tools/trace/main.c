@@ -0,0 +1,230 @@
+/*
+ * profiler-trace - reads the traces written with PROFILER_TRACE
+ *
+ * usage: profiler-trace dump <trace>
+ *        profiler-trace stats [-n N] <trace>
+ *        profiler-trace simulate [-n N] [-l usec] <trace>
+ *
+ *   dump      one line per event, in file order: time since the first
+ *             event, pid/tid, call, size, address, stack id
+ *   stats     calls and bytes per kind of call, threads, the rate the
+ *             trace was written at, and the N stacks (default 10) that
+ *             allocated most often, frames as file+offset
+ *   simulate  the peak footprint, fragmentation and allocator calls of
+ *             size classes, per-site runs, slab pools for the N busiest
+ *             sites and bump arenas for sites whose blocks are freed
+ *             within usec (default 1000) by their own thread (simulate.c)
+ *
+ * frames are placed with the maps each process wrote at exit, in the
+ * same file+offset form tools/profiler-symbolize reads.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "trace.h"
+
+#define DEFAULT_TOP 10
+#define DEFAULT_LIFETIME_US 1000
+
+static void usage(void) {
+    fprintf(stderr, "usage: profiler-trace dump <trace>\n"
+                    "       profiler-trace stats [-n N] <trace>\n"
+                    "       profiler-trace simulate [-n N] [-l usec] <trace>\n");
+}
+
+static uint64_t g_first_time = UINT64_MAX;
+
+static int find_first(const trace_event_t *e, void *arg) {
+    (void)arg;
+    if (e->time < g_first_time) g_first_time = e->time;
+    return 0;
+}
+
+static int dump_event(const trace_event_t *e, void *arg) {
+    (void)arg;
+    printf("%14.6f %u/%u %-7s", (double)(e->time - g_first_time) / 1e9, e->pid, e->tid,
+           trace_op_name(e->op));
+    if (e->op != TRACE_FREE) printf(" %llu", (unsigned long long)e->size);
+    if (e->alignment) printf(" align %llu", (unsigned long long)e->alignment);
+    printf(" 0x%llx", (unsigned long long)e->addr);
+    if (e->op == TRACE_REALLOC) printf(" from 0x%llx", (unsigned long long)e->old_addr);
+    if (e->stack) printf(" stack %u", e->stack);
+    printf("\n");
+    return 0;
+}
+
+static const char *base_name(const char *path) {
+    const char *slash = strrchr(path, '/');
+    return slash ? slash + 1 : path;
+}
+
+typedef struct {
+    const trace_file_t *file;
+    uint64_t calls[TRACE_OPS];
+    uint64_t bytes[TRACE_OPS];
+    uint64_t events;
+    uint64_t first, last;
+    uint64_t *stack_calls;      // by index in file->stacks
+    uint64_t *stack_bytes;
+    uint64_t no_stack;
+    uint64_t *threads;          // pid << 32 | tid, seen so far
+    size_t thread_count, thread_capacity;
+} stats_t;
+
+static void count_thread(stats_t *s, uint32_t pid, uint32_t tid) {
+    uint64_t key = (uint64_t)pid << 32 | tid;
+    for (size_t i = s->thread_count; i-- > 0; ) {
+        if (s->threads[i] == key) return;
+    }
+    if (s->thread_count == s->thread_capacity) {
+        s->thread_capacity = s->thread_capacity ? s->thread_capacity * 2 : 16;
+        s->threads = realloc(s->threads, s->thread_capacity * sizeof(uint64_t));
+        if (!s->threads) {
+            fprintf(stderr, "Error: out of memory\n");
+            exit(1);
+        }
+    }
+    s->threads[s->thread_count++] = key;
+}
+
+static int count_event(const trace_event_t *e, void *arg) {
+    stats_t *s = arg;
+    s->events++;
+    s->calls[e->op]++;
+    s->bytes[e->op] += e->size;
+    if (e->time < s->first) s->first = e->time;
+    if (e->time > s->last) s->last = e->time;
+    count_thread(s, e->pid, e->tid);
+    if (e->op == TRACE_FREE) return 0;
+
+    const trace_stack_t *stack = e->stack ? trace_stack(s->file, e->pid, e->stack) : NULL;
+    if (!stack) {
+        s->no_stack++;
+        return 0;
+    }
+    size_t i = (size_t)(stack - s->file->stacks);
+    s->stack_calls[i]++;
+    s->stack_bytes[i] += e->size;
+    return 0;
+}
+
+static void print_stack(const trace_file_t *t, const trace_stack_t *stack) {
+    // frame 0 is the profiler's interposer
+    for (uint32_t i = 1; i < stack->depth; i++) {
+        uint64_t offset;
+        const char *path = trace_locate(t, stack->pid, stack->frames[i], &offset);
+        if (path && *path) {
+            printf("      %s+0x%llx\n", base_name(path), (unsigned long long)offset);
+        } else {
+            printf("      0x%llx\n", (unsigned long long)stack->frames[i]);
+        }
+    }
+}
+
+static int run_stats(const trace_file_t *t, size_t top) {
+    stats_t s = { .file = t, .first = UINT64_MAX };
+    s.stack_calls = calloc(t->stack_count + 1, sizeof(uint64_t));
+    s.stack_bytes = calloc(t->stack_count + 1, sizeof(uint64_t));
+    if (!s.stack_calls || !s.stack_bytes) {
+        fprintf(stderr, "Error: out of memory\n");
+        return 1;
+    }
+    trace_read(t, count_event, &s);
+
+    size_t processes = 0;
+    for (size_t i = 0; i < s.thread_count; i++) {
+        int seen = 0;
+        for (size_t j = 0; j < i && !seen; j++) {
+            seen = (s.threads[j] >> 32) == (s.threads[i] >> 32);
+        }
+        processes += !seen;
+    }
+    double seconds = s.events ? (double)(s.last - s.first) / 1e9 : 0;
+
+    printf("%llu events from %zu process(es), %zu thread(s), over %.3f s\n",
+           (unsigned long long)s.events, processes, s.thread_count, seconds);
+    printf("%zu bytes, %.1f bytes per event", t->size,
+           s.events ? (double)t->size / (double)s.events : 0.0);
+    if (seconds > 0) printf(", %.1f KiB/s", (double)t->size / 1024.0 / seconds);
+    printf("\n%zu distinct stacks\n\n", t->stack_count);
+
+    printf("%-8s %14s %16s\n", "call", "count", "bytes");
+    for (int op = TRACE_MALLOC; op < TRACE_STACK; op++) {
+        if (!s.calls[op]) continue;
+        printf("%-8s %14llu", trace_op_name((trace_op_t)op), (unsigned long long)s.calls[op]);
+        if (op != TRACE_FREE) printf(" %16llu", (unsigned long long)s.bytes[op]);
+        printf("\n");
+    }
+
+    size_t shown = top < t->stack_count ? top : t->stack_count;
+    if (shown) printf("\nTop %zu stacks by allocations:\n", shown);
+    for (size_t n = 0; n < shown; n++) {
+        size_t best = t->stack_count;
+        for (size_t i = 0; i < t->stack_count; i++) {
+            if (s.stack_calls[i] && (best == t->stack_count || s.stack_calls[i] > s.stack_calls[best])) {
+                best = i;
+            }
+        }
+        if (best == t->stack_count) break;
+
+        printf("  [%zu] %llu allocation(s), %llu bytes, pid %u\n", n + 1,
+               (unsigned long long)s.stack_calls[best], (unsigned long long)s.stack_bytes[best],
+               t->stacks[best].pid);
+        print_stack(t, &t->stacks[best]);
+        s.stack_calls[best] = 0;
+    }
+    if (s.no_stack) printf("\n%llu allocation(s) without a stack\n", (unsigned long long)s.no_stack);
+
+    free(s.threads);
+    free(s.stack_calls);
+    free(s.stack_bytes);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        usage();
+        return 1;
+    }
+    const char *command = argv[1];
+    argc--;
+    argv++;
+
+    size_t top = DEFAULT_TOP;
+    uint64_t lifetime_us = DEFAULT_LIFETIME_US;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:l:h")) != -1) {
+        switch (opt) {
+        case 'n': top = strtoul(optarg, NULL, 10); break;
+        case 'l': lifetime_us = strtoull(optarg, NULL, 10); break;
+        default:
+            usage();
+            return 1;
+        }
+    }
+    if (argc - optind < 1) {
+        usage();
+        return 1;
+    }
+
+    trace_file_t t;
+    if (!trace_open(&t, argv[optind])) return 1;
+
+    int ret = 0;
+    if (strcmp(command, "dump") == 0) {
+        trace_read(&t, find_first, NULL);
+        trace_read(&t, dump_event, NULL);
+    } else if (strcmp(command, "stats") == 0) {
+        ret = run_stats(&t, top);
+    } else if (strcmp(command, "simulate") == 0) {
+        ret = trace_simulate(&t, top, lifetime_us * 1000);
+    } else {
+        usage();
+        ret = 1;
+    }
+    trace_close(&t);
+    return ret;
+}
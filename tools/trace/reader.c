@@ -0,0 +1,293 @@
+/*
+ * reader - decodes a trace file
+ *
+ * the file is mapped and read twice: trace_open() collects the stacks
+ * and the maps records, which may come after the events that need them,
+ * then every trace_read() walks the events.
+ */
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "trace.h"
+
+typedef struct {
+    uint32_t pid;
+    const unsigned char *data;
+    size_t len;
+} maps_piece_t;
+
+// what the first pass keeps, grown as it goes
+typedef struct {
+    trace_file_t *t;
+    size_t stack_capacity;
+    size_t frame_count, frame_capacity;
+    maps_piece_t *pieces;
+    size_t piece_count, piece_capacity;
+} collect_t;
+
+static void *grow(void *array, size_t *capacity, size_t count, size_t item) {
+    if (count < *capacity) return array;
+    *capacity = *capacity ? *capacity * 2 : 64;
+    void *bigger = realloc(array, *capacity * item);
+    if (!bigger) {
+        fprintf(stderr, "Error: out of memory\n");
+        exit(1);
+    }
+    return bigger;
+}
+
+/*
+ * decode the events of one chunk, stacks to collect (first pass) or
+ * events to fn (second pass)
+ * returns -1 if the chunk is malformed, else what fn returned
+ */
+static int read_chunk(const unsigned char *p, const unsigned char *end, uint32_t pid, uint32_t tid,
+                      uint64_t time, collect_t *collect,
+                      int (*fn)(const trace_event_t *event, void *arg), void *arg) {
+    uint64_t addr = 0;
+    while (p < end) {
+        unsigned int byte = *p++;
+        trace_op_t op = (trace_op_t)(byte & TRACE_OP_MASK);
+        uint64_t v;
+
+        if (op == TRACE_STACK) {
+            uint64_t id, depth, frame = 0;
+            if (!trace_get_varint(&p, end, &id) || !trace_get_varint(&p, end, &depth) ||
+                depth > (uint64_t)(end - p)) {
+                return -1;
+            }
+            if (collect) {
+                trace_file_t *t = collect->t;
+                t->stacks = grow(t->stacks, &collect->stack_capacity, t->stack_count, sizeof(trace_stack_t));
+                collect->t->frames = grow(t->frames, &collect->frame_capacity,
+                                          collect->frame_count + depth, sizeof(uint64_t));
+                // frames are placed once every stack is in, the array still moves
+                t->stacks[t->stack_count++] = (trace_stack_t){
+                    pid, (uint32_t)id, (uint32_t)depth, (const uint64_t*)(uintptr_t)collect->frame_count,
+                };
+            }
+            for (uint64_t i = 0; i < depth; i++) {
+                if (!trace_get_varint(&p, end, &v)) return -1;
+                frame += (uint64_t)trace_unzigzag(v);
+                if (collect) collect->t->frames[collect->frame_count++] = frame;
+            }
+            continue;
+        }
+        if (op == 0 || op >= TRACE_OPS) return -1;
+
+        trace_event_t e = { .op = op, .pid = pid, .tid = tid };
+        if (!trace_get_varint(&p, end, &v)) return -1;
+        time += v;
+        e.time = time;
+
+        if (op != TRACE_FREE) {
+            if (!trace_get_varint(&p, end, &e.size)) return -1;
+            if ((byte & TRACE_FLAG_ALIGNED) && !trace_get_varint(&p, end, &e.alignment)) return -1;
+        }
+        if (!trace_get_varint(&p, end, &v)) return -1;
+        addr += (uint64_t)trace_unzigzag(v);
+        e.addr = addr;
+        if (op == TRACE_REALLOC) {
+            if (!trace_get_varint(&p, end, &v)) return -1;
+            e.old_addr = addr + (uint64_t)trace_unzigzag(v);
+        }
+        if (op != TRACE_FREE) {
+            if (!trace_get_varint(&p, end, &v)) return -1;
+            e.stack = (uint32_t)v;
+        }
+
+        if (fn) {
+            int stop = fn(&e, arg);
+            if (stop) return stop;
+        }
+    }
+    return 0;
+}
+
+/*
+ * walk the records; returns -1 at the first malformed one, else what
+ * fn returned
+ */
+static int walk(const trace_file_t *t, collect_t *collect,
+                int (*fn)(const trace_event_t *event, void *arg), void *arg) {
+    const unsigned char *p = t->map + TRACE_MAGIC_SIZE;
+    const unsigned char *end = t->map + t->size;
+
+    while (p < end) {
+        unsigned char type = *p++;
+        uint64_t pid, tid, time, len;
+        if (type == TRACE_RECORD_CHUNK) {
+            if (!trace_get_varint(&p, end, &pid) || !trace_get_varint(&p, end, &tid) ||
+                !trace_get_varint(&p, end, &time) || !trace_get_varint(&p, end, &len) ||
+                len > (uint64_t)(end - p)) {
+                return -1;
+            }
+            int ret = read_chunk(p, p + len, (uint32_t)pid, (uint32_t)tid, time, collect, fn, arg);
+            if (ret) return ret;
+        } else if (type == TRACE_RECORD_MAPS) {
+            if (!trace_get_varint(&p, end, &pid) || !trace_get_varint(&p, end, &len) ||
+                len > (uint64_t)(end - p)) {
+                return -1;
+            }
+            if (collect) {
+                collect->pieces = grow(collect->pieces, &collect->piece_capacity,
+                                       collect->piece_count, sizeof(maps_piece_t));
+                collect->pieces[collect->piece_count++] = (maps_piece_t){ (uint32_t)pid, p, len };
+            }
+        } else {
+            return -1;
+        }
+        p += len;
+    }
+    return 0;
+}
+
+static int compare_stacks(const void *a, const void *b) {
+    const trace_stack_t *x = a, *y = b;
+    if (x->pid != y->pid) return x->pid < y->pid ? -1 : 1;
+    return x->id < y->id ? -1 : x->id > y->id;
+}
+
+static int compare_mappings(const void *a, const void *b) {
+    const trace_mapping_t *x = a, *y = b;
+    return x->start < y->start ? -1 : x->start > y->start;
+}
+
+static int compare_processes(const void *a, const void *b) {
+    const trace_process_t *x = a, *y = b;
+    return x->pid < y->pid ? -1 : x->pid > y->pid;
+}
+
+/*
+ * parse the joined maps text of a process
+ * "start-end perms offset dev inode path", one mapping per line
+ */
+static void parse_maps(trace_process_t *proc) {
+    size_t capacity = 0;
+    char *save;
+    for (char *line = strtok_r(proc->text, "\n", &save); line; line = strtok_r(NULL, "\n", &save)) {
+        unsigned long long start, end, offset;
+        int path_at = 0;
+        if (sscanf(line, "%llx-%llx %*s %llx %*s %*s %n", &start, &end, &offset, &path_at) < 3) continue;
+
+        proc->mappings = grow(proc->mappings, &capacity, proc->count, sizeof(trace_mapping_t));
+        proc->mappings[proc->count++] = (trace_mapping_t){
+            start, end, start - offset, path_at ? line + path_at : "",
+        };
+    }
+    qsort(proc->mappings, proc->count, sizeof(trace_mapping_t), compare_mappings);
+}
+
+// one process per pid that wrote maps, its pieces joined in file order
+static void collect_processes(trace_file_t *t, collect_t *c) {
+    size_t capacity = 0;
+    for (size_t i = 0; i < c->piece_count; i++) {
+        trace_process_t *proc = NULL;
+        for (size_t j = 0; j < t->process_count; j++) {
+            if (t->processes[j].pid == c->pieces[i].pid) proc = &t->processes[j];
+        }
+        if (!proc) {
+            t->processes = grow(t->processes, &capacity, t->process_count, sizeof(trace_process_t));
+            proc = &t->processes[t->process_count++];
+            *proc = (trace_process_t){ .pid = c->pieces[i].pid };
+        }
+
+        size_t len = proc->text ? strlen(proc->text) : 0;
+        char *text = realloc(proc->text, len + c->pieces[i].len + 1);
+        if (!text) {
+            fprintf(stderr, "Error: out of memory\n");
+            exit(1);
+        }
+        memcpy(text + len, c->pieces[i].data, c->pieces[i].len);
+        text[len + c->pieces[i].len] = '\0';
+        proc->text = text;
+    }
+    for (size_t i = 0; i < t->process_count; i++) {
+        parse_maps(&t->processes[i]);
+    }
+    qsort(t->processes, t->process_count, sizeof(trace_process_t), compare_processes);
+}
+
+int trace_open(trace_file_t *t, const char *path) {
+    memset(t, 0, sizeof(*t));
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        perror(path);
+        return 0;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < TRACE_MAGIC_SIZE) {
+        fprintf(stderr, "Error: %s is not a trace\n", path);
+        close(fd);
+        return 0;
+    }
+    t->size = (size_t)st.st_size;
+    void *map = mmap(NULL, t->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED || memcmp(map, TRACE_MAGIC, TRACE_MAGIC_SIZE) != 0) {
+        fprintf(stderr, "Error: %s is not a trace\n", path);
+        if (map != MAP_FAILED) munmap(map, t->size);
+        return 0;
+    }
+    t->map = map;
+
+    collect_t c = { .t = t };
+    if (walk(t, &c, NULL, NULL) < 0) {
+        t->truncated = 1;
+        fprintf(stderr, "Warning: %s is cut short or damaged, reading what comes before\n", path);
+    }
+    for (size_t i = 0; i < t->stack_count; i++) {
+        t->stacks[i].frames = t->frames + (uintptr_t)t->stacks[i].frames;
+    }
+    qsort(t->stacks, t->stack_count, sizeof(trace_stack_t), compare_stacks);
+    collect_processes(t, &c);
+    free(c.pieces);
+    return 1;
+}
+
+void trace_close(trace_file_t *t) {
+    for (size_t i = 0; i < t->process_count; i++) {
+        free(t->processes[i].mappings);
+        free(t->processes[i].text);
+    }
+    free(t->processes);
+    free(t->stacks);
+    free(t->frames);
+    if (t->map) munmap((void*)t->map, t->size);
+    memset(t, 0, sizeof(*t));
+}
+
+int trace_read(const trace_file_t *t, int (*fn)(const trace_event_t *event, void *arg), void *arg) {
+    int ret = walk(t, NULL, fn, arg);
+    return ret < 0 ? 0 : ret;
+}
+
+const trace_stack_t *trace_stack(const trace_file_t *t, uint32_t pid, uint32_t id) {
+    trace_stack_t key = { .pid = pid, .id = id };
+    return bsearch(&key, t->stacks, t->stack_count, sizeof(trace_stack_t), compare_stacks);
+}
+
+const char *trace_locate(const trace_file_t *t, uint32_t pid, uint64_t addr, uint64_t *offset) {
+    trace_process_t key = { .pid = pid };
+    const trace_process_t *proc = bsearch(&key, t->processes, t->process_count,
+                                          sizeof(trace_process_t), compare_processes);
+    if (!proc) return NULL;
+
+    size_t lo = 0, hi = proc->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (proc->mappings[mid].start <= addr) lo = mid + 1;
+        else hi = mid;
+    }
+    if (lo == 0 || addr >= proc->mappings[lo - 1].end) return NULL;
+
+    const trace_mapping_t *m = &proc->mappings[lo - 1];
+    *offset = addr - m->base;
+    return m->path;
+}
@@ -0,0 +1,627 @@
+/*
+ * simulate - what-if allocators over a trace
+ *
+ * the calls of the trace, in time order, go through models of a few
+ * allocator designs, each of which keeps its own footprint:
+ *
+ *   exact         the bytes asked for and live, the least anything can use
+ *   size-classes  one heap: small sizes rounded up to a class, served from
+ *                 16 KiB runs of that class, a run returned once empty;
+ *                 large ones rounded to pages
+ *   per-site      the same, with runs of their own for each stack
+ *   slabs         the N stacks that allocate most get pools of their own,
+ *                 one per size class, in slabs of 64 slots that are kept
+ *                 once empty; the rest go to the size classes
+ *   bump-arenas   stacks whose blocks are nearly all (99%) freed by the
+ *                 thread that made them within the lifetime given are
+ *                 bump-allocated from 64 KiB chunks of that thread, a chunk
+ *                 dropped (or reused) once all its blocks are freed; the
+ *                 rest go to the size classes
+ *
+ * the trace records no request tags, so bump-arenas takes "freed soon by
+ * its own thread" as what request scoped means. for each model it
+ * reports the peak footprint, the fragmentation at that peak (the part
+ * of it not asked for) and the calls that reach the allocator underneath
+ * against those in the trace; a pool or arena serves its blocks without
+ * one and only calls for its slabs and chunks.
+ *
+ * blocks are told apart by pid and address; frees of blocks allocated
+ * before the trace started are calls in every model and change nothing
+ * else.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "trace.h"
+
+#define PAGE_SIZE 4096
+#define SMALL_MAX 16384         // larger blocks are page-rounded
+#define RUN_BYTES 16384         // a run of a class up to RUN_CLASS_MAX
+#define RUN_CLASS_MAX 2048      // above, runs hold RUN_MIN_SLOTS
+#define RUN_MIN_SLOTS 8
+#define POOL_SLOTS 64           // per slab, and the fewest allocations a pooled site made
+#define ARENA_BYTES 65536       // a bump chunk
+#define ARENA_MAX (ARENA_BYTES / 4)
+#define SCOPED_PERCENT 99       // of a site's blocks, for an arena
+
+typedef enum { MODEL_EXACT, MODEL_SIZE_CLASSES, MODEL_PER_SITE, MODEL_SLABS, MODEL_BUMP,
+               MODEL_COUNT } model_t;
+
+static const char *const MODEL_NAMES[MODEL_COUNT] = {
+    "exact", "size-classes", "per-site", "slabs", "bump-arenas",
+};
+
+// where a block was placed
+enum { PLACE_EXACT, PLACE_SMALL, PLACE_LARGE, PLACE_POOL, PLACE_ARENA };
+
+typedef struct {
+    trace_op_t op;
+    uint32_t pid, tid;
+    uint32_t site;              // index in sites, allocations only
+    uint64_t time;
+    uint64_t addr, old_addr;
+    uint64_t size;
+    size_t seq;                 // file order, for equal times
+} sim_event_t;
+
+typedef struct {
+    uint32_t pid, stack;
+    uint64_t allocs;
+    uint64_t max_size;
+    uint64_t scoped_blocks;     // freed soon, by the thread that made them
+    int pooled, scoped;
+} site_t;
+
+typedef struct {
+    uint64_t key;               // pid << 48 ^ addr, 0 for a free slot
+    uint64_t size;              // asked for
+    uint64_t footprint;         // PLACE_EXACT and PLACE_LARGE
+    uint64_t time;
+    uint32_t tid, site;
+    uint32_t holder;            // the run, slab or chunk
+    uint8_t place;
+} block_t;
+
+// open addressing with backward shift deletion, keys never 0
+typedef struct {
+    block_t *slots;
+    size_t capacity, used;
+} blocks_t;
+
+// u64 -> u32, for sites, bins and arenas; keys never 0
+typedef struct {
+    uint64_t *keys;
+    uint32_t *values;
+    size_t capacity, used;
+} index_t;
+
+// a run of a size class, or a slab of a pool
+typedef struct {
+    uint32_t bin;
+    uint32_t live, slots;
+    uint64_t bytes;             // 0 once returned
+} run_t;
+
+typedef struct {
+    uint64_t slot;              // the size it serves
+    int keep;                   // pools keep empty slabs
+    uint32_t *open;             // runs that may have a free slot
+    size_t open_count, open_capacity;
+} bin_t;
+
+typedef struct {
+    uint32_t arena;
+    uint32_t live;
+    uint64_t used;              // bytes bumped so far
+} chunk_t;
+
+typedef struct {
+    model_t model;
+    site_t *sites;
+    blocks_t blocks;
+    index_t bin_index, arena_index;
+    bin_t *bins;
+    size_t bin_count, bin_capacity;
+    run_t *runs;
+    size_t run_count, run_capacity;
+    uint32_t *free_runs;
+    size_t free_run_count, free_run_capacity;
+    chunk_t *chunks;
+    size_t chunk_count, chunk_capacity;
+    uint32_t *arenas;           // current chunk of each, UINT32_MAX for none
+    size_t arena_count, arena_capacity;
+
+    uint64_t live;              // bytes asked for
+    uint64_t footprint;
+    uint64_t peak, live_at_peak;
+    uint64_t calls;
+} sim_t;
+
+static void out_of_memory(void) {
+    fprintf(stderr, "Error: out of memory\n");
+    exit(1);
+}
+
+static void *grow(void *array, size_t *capacity, size_t count, size_t item) {
+    if (count < *capacity) return array;
+    *capacity = *capacity ? *capacity * 2 : 64;
+    void *bigger = realloc(array, *capacity * item);
+    if (!bigger) out_of_memory();
+    return bigger;
+}
+
+static size_t hash_slot(uint64_t key, size_t capacity) {
+    return (size_t)((key * 0x9e3779b97f4a7c15ull) >> 20) & (capacity - 1);
+}
+
+static uint32_t *index_find(index_t *m, uint64_t key, int add) {
+    if (add && (m->used + 1) * 2 > m->capacity) {
+        index_t bigger = { .capacity = m->capacity ? m->capacity * 2 : 256 };
+        bigger.keys = calloc(bigger.capacity, sizeof(uint64_t));
+        bigger.values = calloc(bigger.capacity, sizeof(uint32_t));
+        if (!bigger.keys || !bigger.values) out_of_memory();
+        for (size_t i = 0; i < m->capacity; i++) {
+            if (m->keys[i]) *index_find(&bigger, m->keys[i], 1) = m->values[i];
+        }
+        free(m->keys);
+        free(m->values);
+        *m = bigger;
+    }
+    if (!m->capacity) return NULL;
+    size_t i = hash_slot(key, m->capacity);
+    while (m->keys[i] && m->keys[i] != key) i = (i + 1) & (m->capacity - 1);
+    if (!m->keys[i]) {
+        if (!add) return NULL;
+        m->keys[i] = key;
+        m->values[i] = 0;
+        m->used++;
+    }
+    return &m->values[i];
+}
+
+static block_t *block_find(blocks_t *b, uint64_t key) {
+    if (!b->capacity) return NULL;
+    size_t i = hash_slot(key, b->capacity);
+    while (b->slots[i].key) {
+        if (b->slots[i].key == key) return &b->slots[i];
+        i = (i + 1) & (b->capacity - 1);
+    }
+    return NULL;
+}
+
+static block_t *block_add(blocks_t *b, uint64_t key) {
+    if ((b->used + 1) * 2 > b->capacity) {
+        blocks_t bigger = { .capacity = b->capacity ? b->capacity * 2 : 4096 };
+        bigger.slots = calloc(bigger.capacity, sizeof(block_t));
+        if (!bigger.slots) out_of_memory();
+        for (size_t i = 0; i < b->capacity; i++) {
+            if (b->slots[i].key) *block_add(&bigger, b->slots[i].key) = b->slots[i];
+        }
+        free(b->slots);
+        *b = bigger;
+    }
+    size_t i = hash_slot(key, b->capacity);
+    while (b->slots[i].key) i = (i + 1) & (b->capacity - 1);
+    b->slots[i] = (block_t){ .key = key };
+    b->used++;
+    return &b->slots[i];
+}
+
+static void block_remove(blocks_t *b, block_t *block) {
+    size_t i = (size_t)(block - b->slots);
+    size_t j = i;
+    b->slots[i].key = 0;
+    b->used--;
+    // pull back the blocks whose probe ran through the emptied slot
+    for (;;) {
+        j = (j + 1) & (b->capacity - 1);
+        if (!b->slots[j].key) return;
+        size_t home = hash_slot(b->slots[j].key, b->capacity);
+        if (((j - home) & (b->capacity - 1)) < ((j - i) & (b->capacity - 1))) continue;
+        b->slots[i] = b->slots[j];
+        b->slots[j].key = 0;
+        i = j;
+    }
+}
+
+static uint64_t block_key(uint32_t pid, uint64_t addr) {
+    return (uint64_t)pid << 48 ^ addr;
+}
+
+/*
+ * the class of a small size: multiples of 16 up to 128, then four
+ * classes for every doubling
+ */
+static uint64_t size_class(uint64_t size) {
+    if (size <= 16) return 16;
+    if (size <= 128) return (size + 15) & ~(uint64_t)15;
+    uint64_t power = 128;
+    while (power * 2 < size) power *= 2;
+    uint64_t step = power / 4;
+    return (size + step - 1) / step * step;
+}
+
+static uint64_t round_pages(uint64_t size) {
+    return (size + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE;
+}
+
+static void note_footprint(sim_t *s) {
+    if (s->footprint > s->peak) {
+        s->peak = s->footprint;
+        s->live_at_peak = s->live;
+    }
+}
+
+static uint32_t bin_of(sim_t *s, uint64_t key, uint64_t slot, int keep) {
+    uint32_t *at = index_find(&s->bin_index, key, 1);
+    if (!*at) {
+        s->bins = grow(s->bins, &s->bin_capacity, s->bin_count, sizeof(bin_t));
+        s->bins[s->bin_count++] = (bin_t){ .slot = slot, .keep = keep };
+        *at = (uint32_t)s->bin_count;
+    }
+    return *at - 1;
+}
+
+static void open_run(sim_t *s, uint32_t bin, uint32_t run) {
+    bin_t *b = &s->bins[bin];
+    b->open = grow(b->open, &b->open_capacity, b->open_count, sizeof(uint32_t));
+    b->open[b->open_count++] = run;
+}
+
+// a slot of bin; a new run (one call) when none is open
+static uint32_t run_alloc(sim_t *s, uint32_t bin) {
+    bin_t *b = &s->bins[bin];
+    while (b->open_count) {
+        run_t *r = &s->runs[b->open[b->open_count - 1]];
+        // entries of runs since filled, returned or given to another bin
+        if (r->bytes && r->bin == bin && r->live < r->slots) break;
+        b->open_count--;
+    }
+
+    uint32_t run;
+    if (b->open_count) {
+        run = b->open[b->open_count - 1];
+    } else {
+        if (s->free_run_count) {
+            run = s->free_runs[--s->free_run_count];
+        } else {
+            s->runs = grow(s->runs, &s->run_capacity, s->run_count, sizeof(run_t));
+            run = (uint32_t)s->run_count++;
+        }
+        uint64_t bytes;
+        if (b->keep) bytes = round_pages(b->slot * POOL_SLOTS);
+        else if (b->slot <= RUN_CLASS_MAX) bytes = RUN_BYTES;
+        else bytes = round_pages(b->slot * RUN_MIN_SLOTS);
+        s->runs[run] = (run_t){ .bin = bin, .slots = (uint32_t)(bytes / b->slot), .bytes = bytes };
+        s->footprint += bytes;
+        // a pool takes its slabs from the allocator underneath
+        if (b->keep) s->calls++;
+        open_run(s, bin, run);
+    }
+
+    run_t *r = &s->runs[run];
+    if (++r->live == r->slots) s->bins[bin].open_count--;
+    return run;
+}
+
+static void run_free(sim_t *s, uint32_t run) {
+    run_t *r = &s->runs[run];
+    if (r->live-- == r->slots) open_run(s, r->bin, run);
+    if (r->live || s->bins[r->bin].keep) return;
+
+    s->footprint -= r->bytes;
+    r->bytes = 0;
+    s->free_runs = grow(s->free_runs, &s->free_run_capacity, s->free_run_count, sizeof(uint32_t));
+    s->free_runs[s->free_run_count++] = run;
+}
+
+static void chunk_drop(sim_t *s) {
+    s->footprint -= ARENA_BYTES;
+    s->calls++;
+}
+
+static uint32_t arena_alloc(sim_t *s, uint32_t pid, uint32_t tid, uint64_t size) {
+    uint32_t *at = index_find(&s->arena_index, (uint64_t)pid << 32 | tid, 1);
+    if (!*at) {
+        s->arenas = grow(s->arenas, &s->arena_capacity, s->arena_count, sizeof(uint32_t));
+        s->arenas[s->arena_count++] = UINT32_MAX;
+        *at = (uint32_t)s->arena_count;
+    }
+    uint32_t arena = *at - 1;
+    uint32_t chunk = s->arenas[arena];
+    size = (size + 15) & ~(uint64_t)15;
+
+    if (chunk == UINT32_MAX || s->chunks[chunk].used + size > ARENA_BYTES) {
+        if (chunk != UINT32_MAX && !s->chunks[chunk].live) chunk_drop(s);
+        s->chunks = grow(s->chunks, &s->chunk_capacity, s->chunk_count, sizeof(chunk_t));
+        chunk = (uint32_t)s->chunk_count++;
+        s->chunks[chunk] = (chunk_t){ .arena = arena };
+        s->arenas[arena] = chunk;
+        s->footprint += ARENA_BYTES;
+        s->calls++;
+    }
+    s->chunks[chunk].used += size;
+    s->chunks[chunk].live++;
+    return chunk;
+}
+
+static void arena_free(sim_t *s, uint32_t chunk) {
+    chunk_t *c = &s->chunks[chunk];
+    if (--c->live) return;
+    // the chunk still being bumped starts over, the others go
+    if (s->arenas[c->arena] == chunk) c->used = 0;
+    else chunk_drop(s);
+}
+
+// place a block as the model would; returns 1 if that took an allocator call
+static int place(sim_t *s, block_t *b, uint32_t pid) {
+    const site_t *site = &s->sites[b->site];
+    s->live += b->size;
+
+    if (s->model == MODEL_EXACT) {
+        b->place = PLACE_EXACT;
+        b->footprint = b->size;
+        s->footprint += b->size;
+        return 1;
+    }
+    if (s->model == MODEL_SLABS && site->pooled) {
+        uint64_t class = size_class(b->size);
+        b->place = PLACE_POOL;
+        b->holder = run_alloc(s, bin_of(s, 1ull << 63 | (uint64_t)b->site << 20 | class, class, 1));
+        return 0;
+    }
+    if (s->model == MODEL_BUMP && site->scoped && b->size <= ARENA_MAX) {
+        b->place = PLACE_ARENA;
+        b->holder = arena_alloc(s, pid, b->tid, b->size);
+        return 0;
+    }
+    if (b->size > SMALL_MAX) {
+        b->place = PLACE_LARGE;
+        b->footprint = round_pages(b->size);
+        s->footprint += b->footprint;
+        return 1;
+    }
+
+    uint64_t class = size_class(b->size);
+    uint64_t owner = s->model == MODEL_PER_SITE ? (uint64_t)b->site + 1 : 0;
+    b->place = PLACE_SMALL;
+    b->holder = run_alloc(s, bin_of(s, owner << 20 | class, class, 0));
+    return 1;
+}
+
+// take a block out; returns 1 if that took an allocator call
+static int unplace(sim_t *s, const block_t *b) {
+    s->live -= b->size;
+    switch (b->place) {
+    case PLACE_POOL:  run_free(s, b->holder); return 0;
+    case PLACE_ARENA: arena_free(s, b->holder); return 0;
+    case PLACE_SMALL: run_free(s, b->holder); return 1;
+    default:
+        s->footprint -= b->footprint;
+        return 1;
+    }
+}
+
+// the block at addr, gone from the table; NULL if the trace never made it
+static int take_block(sim_t *s, uint32_t pid, uint64_t addr, block_t *out) {
+    block_t *b = addr ? block_find(&s->blocks, block_key(pid, addr)) : NULL;
+    if (!b) return 0;
+    *out = *b;
+    block_remove(&s->blocks, b);
+    return 1;
+}
+
+static block_t *add_block(sim_t *s, const sim_event_t *e) {
+    uint64_t key = block_key(e->pid, e->addr);
+    block_t *b = block_find(&s->blocks, key);
+    if (b) {
+        // a free the trace lost to a race: the old block goes here
+        s->calls += (uint64_t)unplace(s, b);
+        block_remove(&s->blocks, b);
+    }
+    b = block_add(&s->blocks, key);
+    b->size = e->size;
+    b->time = e->time;
+    b->tid = e->tid;
+    b->site = e->site;
+    return b;
+}
+
+static void simulate(sim_t *s, const sim_event_t *events, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        const sim_event_t *e = &events[i];
+        block_t old;
+        int calls = 0;
+
+        if (e->op == TRACE_FREE) {
+            s->calls += take_block(s, e->pid, e->addr, &old) ? (uint64_t)unplace(s, &old) : 1;
+            continue;
+        }
+        if (e->op == TRACE_REALLOC && take_block(s, e->pid, e->old_addr, &old)) {
+            calls += unplace(s, &old);
+        }
+        if (e->addr) {
+            // realloc() of a pooled or arena block to another is still one call
+            calls += place(s, add_block(s, e), e->pid);
+        } else {
+            calls = 1;
+        }
+        s->calls += calls ? 1 : 0;
+        note_footprint(s);
+    }
+}
+
+static void sim_free(sim_t *s) {
+    for (size_t i = 0; i < s->bin_count; i++) {
+        free(s->bins[i].open);
+    }
+    free(s->bins);
+    free(s->runs);
+    free(s->free_runs);
+    free(s->chunks);
+    free(s->arenas);
+    free(s->blocks.slots);
+    free(s->bin_index.keys);
+    free(s->bin_index.values);
+    free(s->arena_index.keys);
+    free(s->arena_index.values);
+}
+
+typedef struct {
+    sim_event_t *events;
+    size_t count, capacity;
+    site_t *sites;
+    size_t site_count, site_capacity;
+    index_t site_index;
+} collect_t;
+
+static int collect_event(const trace_event_t *e, void *arg) {
+    collect_t *c = arg;
+    c->events = grow(c->events, &c->capacity, c->count, sizeof(sim_event_t));
+    sim_event_t *ev = &c->events[c->count];
+    *ev = (sim_event_t){
+        .op = e->op, .pid = e->pid, .tid = e->tid, .time = e->time, .addr = e->addr,
+        .old_addr = e->old_addr, .size = e->size, .seq = c->count,
+    };
+    c->count++;
+    if (e->op == TRACE_FREE) return 0;
+
+    // one site per stack of a process, +1 as keys are never 0
+    uint32_t *at = index_find(&c->site_index, ((uint64_t)e->pid << 32 | e->stack) + 1, 1);
+    if (!*at) {
+        c->sites = grow(c->sites, &c->site_capacity, c->site_count, sizeof(site_t));
+        c->sites[c->site_count++] = (site_t){ .pid = e->pid, .stack = e->stack };
+        *at = (uint32_t)c->site_count;
+    }
+    ev->site = *at - 1;
+    site_t *site = &c->sites[ev->site];
+    site->allocs++;
+    if (e->size > site->max_size) site->max_size = e->size;
+    return 0;
+}
+
+static int compare_events(const void *a, const void *b) {
+    const sim_event_t *x = a, *y = b;
+    if (x->time != y->time) return x->time < y->time ? -1 : 1;
+    return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+// the sites whose blocks nearly all went back soon, on their own thread
+static void find_scoped(site_t *sites, size_t site_count, const sim_event_t *events, size_t count,
+                        uint64_t lifetime) {
+    blocks_t blocks = { 0 };
+    for (size_t i = 0; i < count; i++) {
+        const sim_event_t *e = &events[i];
+        uint64_t from = e->op == TRACE_FREE ? e->addr : e->op == TRACE_REALLOC ? e->old_addr : 0;
+        block_t *b = from ? block_find(&blocks, block_key(e->pid, from)) : NULL;
+        if (b) {
+            if (b->tid == e->tid && e->time - b->time <= lifetime) sites[b->site].scoped_blocks++;
+            block_remove(&blocks, b);
+        }
+        if (e->op == TRACE_FREE || !e->addr) continue;
+
+        if ((b = block_find(&blocks, block_key(e->pid, e->addr)))) block_remove(&blocks, b);
+        b = block_add(&blocks, block_key(e->pid, e->addr));
+        b->time = e->time;
+        b->tid = e->tid;
+        b->site = e->site;
+    }
+    for (size_t i = 0; i < site_count; i++) {
+        sites[i].scoped = sites[i].allocs &&
+                          sites[i].scoped_blocks * 100 >= sites[i].allocs * SCOPED_PERCENT;
+    }
+    free(blocks.slots);
+}
+
+// the top sites by allocations that a pool can hold; returns how many
+static size_t pick_pools(site_t *sites, size_t site_count, size_t top) {
+    size_t picked = 0;
+    while (picked < top) {
+        site_t *best = NULL;
+        for (size_t i = 0; i < site_count; i++) {
+            site_t *s = &sites[i];
+            if (s->pooled || !s->stack || s->max_size > SMALL_MAX || s->allocs < POOL_SLOTS) continue;
+            if (!best || s->allocs > best->allocs) best = s;
+        }
+        if (!best) break;
+        best->pooled = 1;
+        picked++;
+    }
+    return picked;
+}
+
+// the first frame past the interposer, as file+offset
+static void print_site(const trace_file_t *t, const site_t *site) {
+    const trace_stack_t *stack = trace_stack(t, site->pid, site->stack);
+    if (!stack || stack->depth < 2) {
+        printf("stack %u", site->stack);
+        return;
+    }
+    uint64_t offset;
+    const char *path = trace_locate(t, site->pid, stack->frames[1], &offset);
+    if (path && *path) {
+        const char *slash = strrchr(path, '/');
+        printf("%s+0x%llx", slash ? slash + 1 : path, (unsigned long long)offset);
+    } else {
+        printf("0x%llx", (unsigned long long)stack->frames[1]);
+    }
+}
+
+int trace_simulate(const trace_file_t *t, size_t top, uint64_t lifetime) {
+    collect_t c = { 0 };
+    trace_read(t, collect_event, &c);
+    if (!c.count) {
+        fprintf(stderr, "Error: the trace has no events\n");
+        return 1;
+    }
+    qsort(c.events, c.count, sizeof(sim_event_t), compare_events);
+    find_scoped(c.sites, c.site_count, c.events, c.count, lifetime);
+    size_t pooled = pick_pools(c.sites, c.site_count, top);
+
+    size_t scoped = 0;
+    uint64_t scoped_allocs = 0;
+    for (size_t i = 0; i < c.site_count; i++) {
+        if (!c.sites[i].scoped) continue;
+        scoped++;
+        scoped_allocs += c.sites[i].allocs;
+    }
+
+    printf("%zu events, %zu allocation sites\n", c.count, c.site_count);
+    printf("slabs: pools for the top %zu site(s)\n", pooled);
+    printf("bump-arenas: %zu site(s), %llu allocation(s), %d%% freed by their own thread within %.3f ms\n\n",
+           scoped, (unsigned long long)scoped_allocs, SCOPED_PERCENT, (double)lifetime / 1e6);
+
+    printf("%-13s %14s %9s %14s %12s %12s\n", "model", "peak KiB", "x exact", "fragmentation",
+           "calls", "saved");
+    uint64_t exact_peak = 0;
+    for (int m = 0; m < MODEL_COUNT; m++) {
+        sim_t s = { .model = (model_t)m, .sites = c.sites };
+        simulate(&s, c.events, c.count);
+        if (m == MODEL_EXACT) exact_peak = s.peak;
+
+        double fragmentation = s.peak ? 1.0 - (double)s.live_at_peak / (double)s.peak : 0;
+        printf("%-13s %14.1f %9.2f %13.1f%% %12llu %11.1f%%\n", MODEL_NAMES[m], (double)s.peak / 1024.0,
+               exact_peak ? (double)s.peak / (double)exact_peak : 0, fragmentation * 100,
+               (unsigned long long)s.calls,
+               100.0 * (1.0 - (double)s.calls / (double)c.count));
+        sim_free(&s);
+    }
+
+    if (pooled) printf("\nPooled sites:\n");
+    for (size_t i = 0, n = 0; i < c.site_count; i++) {
+        const site_t *site = &c.sites[i];
+        if (!site->pooled) continue;
+        printf("  [%zu] %llu allocation(s), up to %llu bytes, pid %u, ", ++n,
+               (unsigned long long)site->allocs, (unsigned long long)site->max_size, site->pid);
+        print_site(t, site);
+        printf("%s\n", site->scoped ? ", request scoped" : "");
+    }
+
+    free(c.events);
+    free(c.sites);
+    free(c.site_index.keys);
+    free(c.site_index.values);
+    return 0;
+}
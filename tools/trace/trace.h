@@ -0,0 +1,99 @@
+/*
+ * profiler-trace - shared declarations
+ *
+ * reader.c    maps a trace file, decodes its events and stacks
+ * simulate.c  what-if allocators over a trace
+ * main.c      the commands: dump, stats, simulate
+ *
+ * bench/bench_replay.c builds reader.c in too.
+ * the format is in include/profiler_trace.h.
+ */
+
+#ifndef PROFILER_TRACE_TOOL_H
+#define PROFILER_TRACE_TOOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "../../include/profiler_trace.h"
+
+// one allocator call, decoded
+typedef struct {
+    trace_op_t op;
+    uint32_t pid;
+    uint32_t tid;
+    uint64_t time;              // ns, CLOCK_MONOTONIC
+    uint64_t addr;
+    uint64_t old_addr;          // TRACE_REALLOC, 0 for realloc(NULL, n)
+    uint64_t size;              // 0 for TRACE_FREE
+    uint64_t alignment;         // 0 if none was asked for
+    uint32_t stack;             // 0 for none
+} trace_event_t;
+
+typedef struct {
+    uint32_t pid;
+    uint32_t id;
+    uint32_t depth;
+    const uint64_t *frames;     // in trace_file_t.frames
+} trace_stack_t;
+
+// a mapping of one process, from its maps records
+typedef struct {
+    uint64_t start, end;
+    uint64_t base;              // load address of the file it maps
+    const char *path;           // "" for anonymous memory
+} trace_mapping_t;
+
+typedef struct {
+    uint32_t pid;
+    trace_mapping_t *mappings;  // sorted by start
+    size_t count;
+    char *text;                 // the maps records, joined
+} trace_process_t;
+
+typedef struct {
+    const unsigned char *map;
+    size_t size;
+    int truncated;              // stopped at a record cut short
+
+    trace_stack_t *stacks;      // sorted by pid, then id
+    size_t stack_count;
+    uint64_t *frames;
+    trace_process_t *processes; // those that wrote maps, sorted by pid
+    size_t process_count;
+} trace_file_t;
+
+// returns 0 with a message on stderr if path is not a readable trace
+int trace_open(trace_file_t *t, const char *path);
+void trace_close(trace_file_t *t);
+
+/*
+ * call fn for every event, in file order (see profiler_trace.h)
+ * stops early, returning fn's value, when fn returns nonzero
+ */
+int trace_read(const trace_file_t *t, int (*fn)(const trace_event_t *event, void *arg), void *arg);
+
+// NULL if the trace does not define it
+const trace_stack_t *trace_stack(const trace_file_t *t, uint32_t pid, uint32_t id);
+
+/*
+ * where a frame of process pid is: the file it maps, and the offset
+ * from that file's load address. returns NULL if pid wrote no maps or
+ * addr is in none of them
+ */
+const char *trace_locate(const trace_file_t *t, uint32_t pid, uint64_t addr, uint64_t *offset);
+
+/*
+ * replay the trace through models of allocator designs and print the
+ * footprint and calls of each (simulate.c); pools go to the top sites,
+ * arenas to sites whose blocks are freed within lifetime ns
+ */
+int trace_simulate(const trace_file_t *t, size_t top, uint64_t lifetime);
+
+static inline const char *trace_op_name(trace_op_t op) {
+    static const char *const names[TRACE_OPS] = {
+        "?", "malloc", "calloc", "realloc", "free", "aligned", "new", "new[]", "stack",
+    };
+    return op < TRACE_OPS ? names[op] : "?";
+}
+
+#endif // PROFILER_TRACE_TOOL_H